@@ -0,0 +1,182 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef _ALLOCCOUNTER_H
+#define _ALLOCCOUNTER_H
+
+/*
+ * Heap accounting for the benchmarks only (Linux with glibc).
+ *
+ * Including this header interposes malloc, calloc, realloc, free and the
+ * aligned allocators process wide; operator new and delete end up there
+ * too.  Every call is passed on to glibc and charged, with the usable size
+ * of the block, to the tag of the calling thread (SetThreadTag, 0 for
+ * threads that never set one).  A block freed by a thread with another tag
+ * than the one that allocated it is credited to the freeing thread, so a
+ * tag's live bytes are only meaningful when each tag allocates and frees
+ * its own memory, as an ARDP handle does when all calls on it are made
+ * under its tag.
+ */
+
+#include <qcc/platform.h>
+
+#include <string.h>
+
+#if defined(__linux__) && defined(__GLIBC__)
+#include <errno.h>
+#include <malloc.h>
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+#define ALLOC_COUNTER_ENABLED 1
+#endif
+
+class AllocCounter {
+
+  public:
+    static const int MAX_TAGS = 8;
+
+    struct Snapshot {
+        int64_t liveBytes[MAX_TAGS];
+        int64_t liveBlocks[MAX_TAGS];
+        uint64_t allocs[MAX_TAGS];
+
+        Snapshot() {
+            memset(this, 0, sizeof(*this));
+        }
+    };
+
+    /** Whether the allocator is actually being counted on this platform */
+    static bool Enabled() {
+#ifdef ALLOC_COUNTER_ENABLED
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /** Charge what the calling thread allocates and frees from now on to tag */
+    static void SetThreadTag(int tag) {
+        s_tag = (tag >= 0 && tag < MAX_TAGS) ? tag : 0;
+    }
+
+    static int GetThreadTag() {
+        return s_tag;
+    }
+
+    static Snapshot Take() {
+        Snapshot s;
+        for (int i = 0; i < MAX_TAGS; ++i) {
+            s.liveBytes[i] = __sync_add_and_fetch(&s_liveBytes[i], 0);
+            s.liveBlocks[i] = __sync_add_and_fetch(&s_liveBlocks[i], 0);
+            s.allocs[i] = __sync_add_and_fetch(&s_allocs[i], 0);
+        }
+        return s;
+    }
+
+    static void Charge(void* ptr) {
+#ifdef ALLOC_COUNTER_ENABLED
+        if (ptr) {
+            __sync_add_and_fetch(&s_liveBytes[s_tag], (int64_t)malloc_usable_size(ptr));
+            __sync_add_and_fetch(&s_liveBlocks[s_tag], 1);
+            __sync_add_and_fetch(&s_allocs[s_tag], 1);
+        }
+#endif
+    }
+
+    static void Credit(void* ptr) {
+#ifdef ALLOC_COUNTER_ENABLED
+        if (ptr) {
+            __sync_sub_and_fetch(&s_liveBytes[s_tag], (int64_t)malloc_usable_size(ptr));
+            __sync_sub_and_fetch(&s_liveBlocks[s_tag], 1);
+        }
+#endif
+    }
+
+  private:
+    static __thread int s_tag;
+    static int64_t s_liveBytes[MAX_TAGS];
+    static int64_t s_liveBlocks[MAX_TAGS];
+    static uint64_t s_allocs[MAX_TAGS];
+};
+
+/* The tools are single translation units, so defining these here is fine */
+__thread int AllocCounter::s_tag = 0;
+int64_t AllocCounter::s_liveBytes[AllocCounter::MAX_TAGS];
+int64_t AllocCounter::s_liveBlocks[AllocCounter::MAX_TAGS];
+uint64_t AllocCounter::s_allocs[AllocCounter::MAX_TAGS];
+
+#ifdef ALLOC_COUNTER_ENABLED
+extern "C" void* malloc(size_t size)
+{
+    void* ptr = __libc_malloc(size);
+    AllocCounter::Charge(ptr);
+    return ptr;
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+    void* ptr = __libc_calloc(count, size);
+    AllocCounter::Charge(ptr);
+    return ptr;
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+    /* The old block may be freed by glibc, so take it off before */
+    AllocCounter::Credit(ptr);
+    void* newPtr = __libc_realloc(ptr, size);
+    AllocCounter::Charge(newPtr ? newPtr : (size ? ptr : NULL));
+    return newPtr;
+}
+
+extern "C" void free(void* ptr)
+{
+    AllocCounter::Credit(ptr);
+    __libc_free(ptr);
+}
+
+extern "C" void* memalign(size_t alignment, size_t size)
+{
+    void* ptr = __libc_memalign(alignment, size);
+    AllocCounter::Charge(ptr);
+    return ptr;
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void* p = memalign(alignment, size);
+    if (p == NULL) {
+        return ENOMEM;
+    }
+    *ptr = p;
+    return 0;
+}
+#endif
+
+#endif
@@ -0,0 +1,424 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef _ARDPLINKEMULATOR_H
+#define _ARDPLINKEMULATOR_H
+
+/*
+ * In-process emulation of a bad link between two ARDP endpoints on loopback.
+ *
+ * The ARDP test hooks let a tool look at and rewrite every datagram, but a
+ * hook runs inside the sendto/recvfrom call and can neither withhold a
+ * datagram nor hand it over later, which is what loss, delay and reordering
+ * need.  So the emulator is a UDP relay instead: endpoint A connects to the
+ * relay port, and every datagram is queued per direction with its release
+ * time and forwarded by the relay thread.  Because it sees every datagram it
+ * also parses the ARDP header and counts data segments and retransmissions.
+ *
+ * Impairments are applied in this order: blackhole, random loss,
+ * Gilbert-Elliott burst loss, token bucket (with a drop-tail queue), fixed
+ * delay plus uniform jitter, reordering.  Jitter larger than the packet
+ * spacing reorders packets too, as with netem.
+ */
+
+#include <qcc/platform.h>
+#include <qcc/Event.h>
+#include <qcc/IPAddress.h>
+#include <qcc/Mutex.h>
+#include <qcc/Socket.h>
+#include <qcc/SocketTypes.h>
+#include <qcc/Thread.h>
+
+#include <alljoyn/Status.h>
+
+#include <stdio.h>
+#include <map>
+#include <queue>
+#include <vector>
+
+#include "ArdpSegmentHeader.h"
+#include "LatencyHistogram.h"
+#include "XorShiftRng.h"
+
+/** What happens to the datagrams travelling in one direction */
+struct LinkImpairment {
+    double lossRate;             /**< Independent random loss, 0.0 to 1.0 */
+
+    /*
+     * Gilbert-Elliott two state burst loss; disabled while geGoodToBad is 0.
+     * The mean burst length is 1 / geBadToGood packets.
+     */
+    double geGoodToBad;          /**< Per packet probability of entering the bad state */
+    double geBadToGood;          /**< Per packet probability of leaving the bad state */
+    double geLossGood;           /**< Loss probability in the good state */
+    double geLossBad;            /**< Loss probability in the bad state */
+
+    uint32_t delayUs;            /**< Fixed one way delay */
+    uint32_t jitterUs;           /**< Uniform extra delay, 0 to jitterUs */
+
+    double reorderRate;          /**< Probability that a datagram is held back */
+    uint32_t reorderDelayUs;     /**< How long a held back datagram waits */
+
+    uint32_t rateKbps;           /**< Token bucket rate in kbit/s, 0 is unlimited */
+    uint32_t bucketBytes;        /**< Token bucket depth, the largest burst sent at line rate */
+    uint32_t queueBytes;         /**< Datagrams waiting for tokens beyond this are dropped */
+
+    bool blackhole;              /**< Drop everything */
+
+    LinkImpairment() :
+        lossRate(0.0), geGoodToBad(0.0), geBadToGood(1.0), geLossGood(0.0), geLossBad(1.0),
+        delayUs(0), jitterUs(0), reorderRate(0.0), reorderDelayUs(0),
+        rateKbps(0), bucketBytes(65536), queueBytes(256 * 1024), blackhole(false) { }
+};
+
+/** Counters for one direction */
+struct LinkStats {
+    uint64_t datagrams;          /**< Offered by the sender */
+    uint64_t bytes;
+    uint64_t dataSegments;       /**< Datagrams carrying message data */
+    uint64_t retransmits;        /**< Data segments whose sequence number was seen before */
+    uint64_t controlSegments;    /**< SYN, ACK/EACK only, NUL and RST */
+    uint64_t droppedRandom;
+    uint64_t droppedBurst;
+    uint64_t droppedQueue;
+    uint64_t droppedBlackhole;
+    uint64_t reordered;
+    uint64_t delivered;
+    uint64_t deliveredBytes;
+    uint64_t maxQueueUs;         /**< Longest wait for tokens */
+
+    LinkStats() :
+        datagrams(0), bytes(0), dataSegments(0), retransmits(0), controlSegments(0),
+        droppedRandom(0), droppedBurst(0), droppedQueue(0), droppedBlackhole(0),
+        reordered(0), delivered(0), deliveredBytes(0), maxQueueUs(0) { }
+
+    uint64_t Dropped() const { return droppedRandom + droppedBurst + droppedQueue + droppedBlackhole; }
+};
+
+class ArdpLinkEmulator : public qcc::Thread {
+
+  public:
+    enum Direction {
+        A_TO_B = 0,
+        B_TO_A = 1
+    };
+
+    ArdpLinkEmulator(uint64_t seed = 1) :
+        qcc::Thread("ArdpLinkEmulator"),
+        m_sockA(qcc::INVALID_SOCKET_FD), m_sockB(qcc::INVALID_SOCKET_FD), m_portA(0), m_portB(0), m_haveA(false),
+        m_order(0), m_stopping(false) {
+        m_dir[A_TO_B].rng.Seed(seed);
+        m_dir[B_TO_A].rng.Seed(seed ^ 0x5DEECE66DULL);
+    }
+
+    virtual ~ArdpLinkEmulator() {
+        Shutdown();
+    }
+
+    /**
+     * Open the relay sockets on loopback and start forwarding.  Endpoint A
+     * sends to GetPortForA(); whatever arrives there goes on to endpoint B at
+     * bAddress:bPort, and B's answers go back to wherever A sent from.
+     */
+    QStatus Init(const char* bAddress, uint16_t bPort) {
+        m_addrB = qcc::IPAddress(bAddress);
+        m_portB = bPort;
+        QStatus status = OpenSocket(m_sockA, m_portA);
+        if (status == ER_OK) {
+            uint16_t unused;
+            status = OpenSocket(m_sockB, unused);
+        }
+        if (status != ER_OK) {
+            return status;
+        }
+        return Start();
+    }
+
+    void Shutdown() {
+        m_stopping = true;
+        Stop();
+        Join();
+        if (m_sockA != qcc::INVALID_SOCKET_FD) {
+            qcc::Close(m_sockA);
+            m_sockA = qcc::INVALID_SOCKET_FD;
+        }
+        if (m_sockB != qcc::INVALID_SOCKET_FD) {
+            qcc::Close(m_sockB);
+            m_sockB = qcc::INVALID_SOCKET_FD;
+        }
+        while (!m_pending.empty()) {
+            delete m_pending.top();
+            m_pending.pop();
+        }
+    }
+
+    uint16_t GetPortForA() const { return m_portA; }
+
+    void SetImpairment(Direction dir, const LinkImpairment& impairment) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        m_dir[dir].impairment = impairment;
+        m_lock.Unlock(MUTEX_CONTEXT);
+    }
+
+    /** Cut (or restore) one direction without touching the other settings */
+    void SetBlackhole(Direction dir, bool blackhole) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        m_dir[dir].impairment.blackhole = blackhole;
+        m_lock.Unlock(MUTEX_CONTEXT);
+    }
+
+    LinkStats GetStats(Direction dir) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        LinkStats stats = m_dir[dir].stats;
+        m_lock.Unlock(MUTEX_CONTEXT);
+        return stats;
+    }
+
+    static void PrintStats(const char* name, const LinkStats& s, FILE* fp = stdout) {
+        fprintf(fp, "%s: datagrams %llu (%llu bytes), data %llu, retransmitted %llu (%.2f%%), control %llu\n", name,
+                (unsigned long long)s.datagrams, (unsigned long long)s.bytes, (unsigned long long)s.dataSegments,
+                (unsigned long long)s.retransmits, s.dataSegments ? 100.0 * s.retransmits / s.dataSegments : 0.0,
+                (unsigned long long)s.controlSegments);
+        fprintf(fp, "%s: dropped random %llu, burst %llu, queue %llu, blackhole %llu; reordered %llu; delivered %llu; max queueing %llu us\n", name,
+                (unsigned long long)s.droppedRandom, (unsigned long long)s.droppedBurst, (unsigned long long)s.droppedQueue,
+                (unsigned long long)s.droppedBlackhole, (unsigned long long)s.reordered, (unsigned long long)s.delivered,
+                (unsigned long long)s.maxQueueUs);
+    }
+
+    void PrintStats(FILE* fp = stdout) {
+        PrintStats("A->B", GetStats(A_TO_B), fp);
+        PrintStats("B->A", GetStats(B_TO_A), fp);
+    }
+
+  protected:
+    qcc::ThreadReturn STDCALL Run(void* arg) {
+        qcc::Event eventA(m_sockA, qcc::Event::IO_READ);
+        qcc::Event eventB(m_sockB, qcc::Event::IO_READ);
+        std::vector<qcc::Event*> checkEvents;
+        std::vector<qcc::Event*> signaledEvents;
+        checkEvents.push_back(&eventA);
+        checkEvents.push_back(&eventB);
+
+        while (!m_stopping) {
+            uint32_t ms = 100;
+            m_lock.Lock(MUTEX_CONTEXT);
+            if (!m_pending.empty()) {
+                uint64_t now = GetTimestampMicros();
+                uint64_t release = m_pending.top()->releaseUs;
+                ms = (release <= now) ? 0 : (uint32_t)((release - now + 999) / 1000);
+            }
+            m_lock.Unlock(MUTEX_CONTEXT);
+
+            if (ms) {
+                signaledEvents.clear();
+                qcc::Event::Wait(checkEvents, signaledEvents, ms);
+            }
+            Drain(m_sockA, A_TO_B);
+            Drain(m_sockB, B_TO_A);
+            ReleaseDue();
+        }
+        return this;
+    }
+
+  private:
+    struct Datagram {
+        uint64_t releaseUs;
+        uint64_t order;          /**< Keeps datagrams with equal release times in arrival order */
+        Direction dir;
+        std::vector<uint8_t> data;
+    };
+
+    struct LaterRelease {
+        bool operator()(const Datagram* a, const Datagram* b) const {
+            return (a->releaseUs != b->releaseUs) ? (a->releaseUs > b->releaseUs) : (a->order > b->order);
+        }
+    };
+
+    struct DirectionState {
+        LinkImpairment impairment;
+        LinkStats stats;
+        XorShiftRng rng;
+        bool geBad;
+        double tokens;
+        uint64_t lastDepartureUs;
+        std::map<uint32_t, uint32_t> highestSeq;  /**< Per (src, dst) ARDP port pair */
+
+        DirectionState() : geBad(false), tokens(0.0), lastDepartureUs(0) { }
+    };
+
+    QStatus OpenSocket(qcc::SocketFd& sock, uint16_t& port) {
+        QStatus status = qcc::Socket(qcc::QCC_AF_INET, qcc::QCC_SOCK_DGRAM, sock);
+        if (status == ER_OK) {
+            status = qcc::SetBlocking(sock, false);
+        }
+        if (status == ER_OK) {
+            status = qcc::Bind(sock, qcc::IPAddress("127.0.0.1"), 0);
+        }
+        if (status == ER_OK) {
+            qcc::IPAddress addr;
+            status = qcc::GetLocalAddress(sock, addr, port);
+        }
+        return status;
+    }
+
+    void Drain(qcc::SocketFd sock, Direction dir) {
+        qcc::IPAddress addr;
+        uint16_t port;
+        size_t received;
+        while (qcc::RecvFrom(sock, addr, port, m_buf, sizeof(m_buf), received) == ER_OK) {
+            m_lock.Lock(MUTEX_CONTEXT);
+            if (dir == A_TO_B) {
+                m_addrA = addr;
+                m_portAPeer = port;
+                m_haveA = true;
+            }
+            Admit(dir, m_buf, received, GetTimestampMicros());
+            m_lock.Unlock(MUTEX_CONTEXT);
+        }
+    }
+
+    /* Decide the fate of one datagram; called with m_lock held */
+    void Admit(Direction dir, const uint8_t* buf, size_t len, uint64_t now) {
+        DirectionState& d = m_dir[dir];
+        LinkImpairment& imp = d.impairment;
+        d.stats.datagrams++;
+        d.stats.bytes += len;
+
+        ArdpSegmentInfo seg;
+        if (ArdpParseSegment(buf, len, seg) && seg.IsData()) {
+            d.stats.dataSegments++;
+            uint32_t key = ((uint32_t)seg.src << 16) | seg.dst;
+            std::map<uint32_t, uint32_t>::iterator it = d.highestSeq.find(key);
+            if (it == d.highestSeq.end()) {
+                d.highestSeq[key] = seg.seq;
+            } else if (ArdpSeqAfter(seg.seq, it->second)) {
+                it->second = seg.seq;
+            } else {
+                d.stats.retransmits++;
+            }
+        } else {
+            d.stats.controlSegments++;
+        }
+
+        if (imp.blackhole) {
+            d.stats.droppedBlackhole++;
+            return;
+        }
+        if (imp.lossRate > 0.0 && d.rng.NextDouble() < imp.lossRate) {
+            d.stats.droppedRandom++;
+            return;
+        }
+        if (imp.geGoodToBad > 0.0) {
+            if (d.geBad) {
+                if (d.rng.NextDouble() < imp.geBadToGood) {
+                    d.geBad = false;
+                }
+            } else if (d.rng.NextDouble() < imp.geGoodToBad) {
+                d.geBad = true;
+            }
+            if (d.rng.NextDouble() < (d.geBad ? imp.geLossBad : imp.geLossGood)) {
+                d.stats.droppedBurst++;
+                return;
+            }
+        }
+
+        /*
+         * Token bucket feeding a FIFO: the datagram leaves once the link has
+         * finished with everything ahead of it and enough tokens have built
+         * up.  The wait is bounded by the queue size.
+         */
+        uint64_t depart = now;
+        if (imp.rateKbps) {
+            double bytesPerUs = imp.rateKbps / 8000.0;
+            uint64_t start = (d.lastDepartureUs > now) ? d.lastDepartureUs : now;
+            double tokens = d.tokens + (start - d.lastDepartureUs) * bytesPerUs;
+            if (d.lastDepartureUs == 0 || tokens > imp.bucketBytes) {
+                tokens = imp.bucketBytes;
+            }
+            depart = start;
+            if (tokens < len) {
+                depart += (uint64_t)((len - tokens) / bytesPerUs + 0.5);
+                tokens = len;
+            }
+            if ((depart - now) * bytesPerUs > imp.queueBytes) {
+                d.stats.droppedQueue++;
+                return;
+            }
+            d.tokens = tokens - len;
+            d.lastDepartureUs = depart;
+            if (depart - now > d.stats.maxQueueUs) {
+                d.stats.maxQueueUs = depart - now;
+            }
+        }
+
+        uint64_t release = depart + imp.delayUs;
+        if (imp.jitterUs) {
+            release += d.rng.Below(imp.jitterUs + 1);
+        }
+        if (imp.reorderRate > 0.0 && d.rng.NextDouble() < imp.reorderRate) {
+            release += imp.reorderDelayUs;
+            d.stats.reordered++;
+        }
+
+        Datagram* dg = new Datagram;
+        dg->releaseUs = release;
+        dg->order = m_order++;
+        dg->dir = dir;
+        dg->data.assign(buf, buf + len);
+        m_pending.push(dg);
+    }
+
+    void ReleaseDue() {
+        uint64_t now = GetTimestampMicros();
+        m_lock.Lock(MUTEX_CONTEXT);
+        while (!m_pending.empty() && m_pending.top()->releaseUs <= now) {
+            Datagram* dg = m_pending.top();
+            m_pending.pop();
+            size_t sent;
+            QStatus status;
+            if (dg->dir == A_TO_B) {
+                status = qcc::SendTo(m_sockB, m_addrB, m_portB, &dg->data[0], dg->data.size(), sent);
+            } else if (m_haveA) {
+                status = qcc::SendTo(m_sockA, m_addrA, m_portAPeer, &dg->data[0], dg->data.size(), sent);
+            } else {
+                status = ER_FAIL;
+            }
+            if (status == ER_OK) {
+                m_dir[dg->dir].stats.delivered++;
+                m_dir[dg->dir].stats.deliveredBytes += dg->data.size();
+            }
+            delete dg;
+        }
+        m_lock.Unlock(MUTEX_CONTEXT);
+    }
+
+    qcc::SocketFd m_sockA;       /**< Faces endpoint A */
+    qcc::SocketFd m_sockB;       /**< Faces endpoint B */
+    uint16_t m_portA;
+    qcc::IPAddress m_addrA;      /**< Where A sends from, learned from its first datagram */
+    uint16_t m_portAPeer;
+    qcc::IPAddress m_addrB;
+    uint16_t m_portB;
+    bool m_haveA;
+
+    qcc::Mutex m_lock;
+    DirectionState m_dir[2];
+    std::priority_queue<Datagram*, std::vector<Datagram*>, LaterRelease> m_pending;
+    uint64_t m_order;
+    volatile bool m_stopping;
+    uint8_t m_buf[65536];
+};
+
+#endif
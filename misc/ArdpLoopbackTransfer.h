@@ -0,0 +1,478 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef _ARDPLOOPBACKTRANSFER_H
+#define _ARDPLOOPBACKTRANSFER_H
+
+/*
+ * A fixed duration bulk transfer between two ArdpTestEndpoints in this
+ * process, optionally through an ArdpLinkEmulator.  Endpoint A connects and
+ * sends as fast as the send window allows, endpoint B releases every
+ * message as soon as it arrives.  Each message starts with the flow id, a
+ * sequence number and the send timestamp so B can check ordering and
+ * measure delivery latency.
+ */
+
+#include <qcc/platform.h>
+#include <qcc/Event.h>
+#include <qcc/Mutex.h>
+#include <qcc/Thread.h>
+
+#include <alljoyn/Status.h>
+
+#include <ArdpProtocol.h>
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#include <map>
+#include <vector>
+
+#include "ArdpLinkEmulator.h"
+#include "ArdpTestEndpoint.h"
+#include "LatencyHistogram.h"
+#include "XorShiftRng.h"
+
+const uint32_t TRANSFER_HEADER_LEN = 16;  /**< flow id, sequence number, send timestamp */
+
+struct ArdpTransferParams {
+    ajn::ArdpGlobalConfig config;
+    uint32_t connections;
+    uint32_t durationMs;
+    uint32_t minPayload;
+    uint32_t maxPayload;
+    uint32_t ttl;
+    uint32_t maxInFlight;        /**< Messages in flight per connection, 0 for segmax */
+    bool useEmulator;            /**< false connects A straight to B */
+    LinkImpairment forward;      /**< A->B, the data path */
+    LinkImpairment reverse;      /**< B->A, the acknowledgement path */
+    uint64_t seed;
+
+    ArdpTransferParams() :
+        connections(1), durationMs(10000), minPayload(1024), maxPayload(1024), ttl(0), maxInFlight(0), useEmulator(true), seed(1) {
+        ArdpTestDefaultConfig(config);
+    }
+};
+
+struct ArdpTransferResult {
+    uint32_t connected;
+    uint32_t connectFailed;
+    uint32_t disconnected;
+    uint64_t messagesSent;
+    uint64_t messagesCompleted;  /**< SendCb with ER_OK */
+    uint64_t messagesDelivered;
+    uint64_t bytesDelivered;
+    uint64_t outOfOrder;         /**< Deliveries whose sequence number was not the expected one */
+    uint64_t fragments;          /**< Sum of rcv->fcnt over the deliveries */
+    uint16_t maxFragments;
+    uint64_t sendErrors;
+    uint32_t stalls;
+    uint64_t stalledUs;
+    double seconds;
+    double cpuSeconds;           /**< User plus system time of the whole process during the measurement */
+    LatencyHistogram latency;
+    LinkStats forward;
+    LinkStats reverse;
+
+    ArdpTransferResult() : latency("send_to_recvcb") {
+        Reset();
+    }
+
+    void Reset() {
+        connected = connectFailed = disconnected = 0;
+        messagesSent = messagesCompleted = messagesDelivered = bytesDelivered = outOfOrder = sendErrors = 0;
+        fragments = 0;
+        maxFragments = 0;
+        stalls = 0;
+        stalledUs = 0;
+        seconds = cpuSeconds = 0.0;
+        latency.Reset();
+        forward = LinkStats();
+        reverse = LinkStats();
+    }
+
+    double GoodputMBps() const {
+        return seconds > 0.0 ? bytesDelivered / seconds / (1024.0 * 1024.0) : 0.0;
+    }
+
+    double CpuUsPerMessage() const {
+        return messagesDelivered ? cpuSeconds * 1e6 / messagesDelivered : 0.0;
+    }
+
+    double FragmentsPerMessage() const {
+        return messagesDelivered ? (double)fragments / messagesDelivered : 0.0;
+    }
+
+    double RetransmitPercent() const {
+        return forward.dataSegments ? 100.0 * forward.retransmits / forward.dataSegments : 0.0;
+    }
+
+    void Print(FILE* fp = stdout) const {
+        fprintf(fp, "connections: %u up, %u failed, %u disconnected\n", connected, connectFailed, disconnected);
+        fprintf(fp, "messages: sent %llu, completed %llu, delivered %llu (%llu bytes), out of order %llu, send errors %llu\n",
+                (unsigned long long)messagesSent, (unsigned long long)messagesCompleted, (unsigned long long)messagesDelivered,
+                (unsigned long long)bytesDelivered, (unsigned long long)outOfOrder, (unsigned long long)sendErrors);
+        fprintf(fp, "goodput: %.3f MB/s over %.2f s, window stalls %u (%.1f ms)\n",
+                GoodputMBps(), seconds, stalls, stalledUs / 1000.0);
+        latency.PrintSummary(fp);
+    }
+};
+
+class ArdpLoopbackTransfer : public ArdpEndpointListener {
+
+  public:
+    ArdpLoopbackTransfer() : m_sender(NULL), m_receiver(NULL), m_result(NULL), m_stopping(false), m_abort(false) { }
+
+    /** Cut a running transfer short, e.g. from a SIGINT handler */
+    void Abort() {
+        m_abort = true;
+    }
+
+    QStatus Run(const ArdpTransferParams& params, ArdpTransferResult& result) {
+        m_params = params;
+        if (m_params.minPayload < TRANSFER_HEADER_LEN) {
+            m_params.minPayload = TRANSFER_HEADER_LEN;
+        }
+        if (m_params.maxPayload < m_params.minPayload) {
+            m_params.maxPayload = m_params.minPayload;
+        }
+        m_result = &result;
+        result.Reset();
+        m_stopping = false;
+
+        ArdpTestEndpoint receiver("transfer-b", this);
+        ArdpTestEndpoint sender("transfer-a", this);
+        ArdpLinkEmulator emulator(m_params.seed);
+        m_receiver = &receiver;
+        m_sender = &sender;
+
+        QStatus status = receiver.Init(m_params.config);
+        uint16_t port = receiver.GetPort();
+        if (status == ER_OK && m_params.useEmulator) {
+            emulator.SetImpairment(ArdpLinkEmulator::A_TO_B, m_params.forward);
+            emulator.SetImpairment(ArdpLinkEmulator::B_TO_A, m_params.reverse);
+            status = emulator.Init("127.0.0.1", port);
+            port = emulator.GetPortForA();
+        }
+        if (status == ER_OK) {
+            status = sender.Init(m_params.config);
+        }
+
+        uint32_t inFlight = m_params.maxInFlight ? m_params.maxInFlight : m_params.config.segmax;
+        for (uint32_t i = 0; (status == ER_OK) && (i < m_params.connections); ++i) {
+            Flow* flow = new Flow(i, m_params.seed + i);
+            for (uint32_t j = 0; j < inFlight; ++j) {
+                uint8_t* buf = (uint8_t*)malloc(m_params.maxPayload);
+                memset(buf, 0xA5, m_params.maxPayload);
+                flow->allBufs.push_back(buf);
+                flow->freeBufs.push_back(buf);
+            }
+            m_flows.push_back(flow);
+            m_expectedSeq.push_back(0);
+
+            sender.GetLock().Lock(MUTEX_CONTEXT);
+            status = sender.Connect("127.0.0.1", port, &flow->conn);
+            if (status == ER_OK) {
+                m_flowMap[flow->conn] = flow;
+            }
+            sender.GetLock().Unlock(MUTEX_CONTEXT);
+        }
+
+        if (status == ER_OK) {
+            WaitForConnections();
+            uint64_t start = GetTimestampMicros();
+            double cpuStart = CpuSeconds();
+            for (size_t i = 0; i < m_flows.size(); ++i) {
+                if (m_flows[i]->connected) {
+                    m_flows[i]->thread = new FlowSender(this, m_flows[i]);
+                    m_flows[i]->thread->Start();
+                }
+            }
+            while (!m_abort && (GetTimestampMicros() - start) < (uint64_t)m_params.durationMs * 1000) {
+                qcc::Sleep(10);
+            }
+            StopSenders();
+
+            /* Snapshot before tearing down so late deliveries do not count */
+            receiver.GetLock().Lock(MUTEX_CONTEXT);
+            sender.GetLock().Lock(MUTEX_CONTEXT);
+            result.seconds = (GetTimestampMicros() - start) / 1000000.0;
+            result.cpuSeconds = CpuSeconds() - cpuStart;
+            for (size_t i = 0; i < m_flows.size(); ++i) {
+                result.messagesSent += m_flows[i]->sent;
+                result.stalls += m_flows[i]->stalls;
+                result.stalledUs += m_flows[i]->stalledUs;
+            }
+            m_result = NULL;
+            sender.GetLock().Unlock(MUTEX_CONTEXT);
+            receiver.GetLock().Unlock(MUTEX_CONTEXT);
+
+            if (m_params.useEmulator) {
+                result.forward = emulator.GetStats(ArdpLinkEmulator::A_TO_B);
+                result.reverse = emulator.GetStats(ArdpLinkEmulator::B_TO_A);
+            }
+        }
+        m_result = NULL;
+
+        sender.Shutdown();
+        receiver.Shutdown();
+        emulator.Shutdown();
+        m_sender = m_receiver = NULL;
+
+        for (size_t i = 0; i < m_flows.size(); ++i) {
+            delete m_flows[i];
+        }
+        m_flows.clear();
+        m_flowMap.clear();
+        m_expectedSeq.clear();
+        return status;
+    }
+
+    /* ArdpEndpointListener, called under the lock of the endpoint in question */
+
+    void Connected(ArdpTestEndpoint& ep, ajn::ArdpConnRecord* conn, bool passive, QStatus status) {
+        if (passive || m_result == NULL) {
+            return;
+        }
+        Flow* flow = Find(conn);
+        if (flow) {
+            if (status == ER_OK) {
+                flow->connected = true;
+                m_result->connected++;
+            } else {
+                flow->failed = true;
+                m_result->connectFailed++;
+            }
+        }
+    }
+
+    void Disconnected(ArdpTestEndpoint& ep, ajn::ArdpConnRecord* conn, QStatus status) {
+        Flow* flow = (&ep == m_sender) ? Find(conn) : NULL;
+        if (flow) {
+            flow->connected = false;
+            flow->conn = NULL;
+            m_flowMap.erase(conn);
+            flow->windowEvent.SetEvent();
+            if (m_result) {
+                m_result->disconnected++;
+            }
+        }
+    }
+
+    void Received(ArdpTestEndpoint& ep, ajn::ArdpConnRecord* conn, ajn::ArdpRcvBuf* rcv, QStatus status) {
+        if (m_result && rcv->datalen >= TRANSFER_HEADER_LEN) {
+            uint32_t flowId, seq;
+            uint64_t timestamp;
+            memcpy(&flowId, rcv->data, sizeof(flowId));
+            memcpy(&seq, rcv->data + 4, sizeof(seq));
+            memcpy(&timestamp, rcv->data + 8, sizeof(timestamp));
+
+            uint64_t len = 0;
+            ajn::ArdpRcvBuf* buf = rcv;
+            for (uint16_t i = 0; i < rcv->fcnt; ++i) {
+                len += buf->datalen;
+                buf = buf->next;
+            }
+
+            m_result->messagesDelivered++;
+            m_result->bytesDelivered += len;
+            m_result->fragments += rcv->fcnt;
+            if (rcv->fcnt > m_result->maxFragments) {
+                m_result->maxFragments = rcv->fcnt;
+            }
+            m_result->latency.Record(GetTimestampMicros() - timestamp);
+            if (flowId < m_expectedSeq.size()) {
+                if (seq != m_expectedSeq[flowId]) {
+                    m_result->outOfOrder++;
+                }
+                m_expectedSeq[flowId] = seq + 1;
+            }
+        }
+        ep.RecvReady(conn, rcv);
+    }
+
+    void Sent(ArdpTestEndpoint& ep, ajn::ArdpConnRecord* conn, uint8_t* buf, uint32_t len, QStatus status) {
+        Flow* flow = Find(conn);
+        if (flow) {
+            flow->freeBufs.push_back(buf);
+            flow->blocked = false;
+            flow->windowEvent.SetEvent();
+        }
+        if (m_result && status == ER_OK) {
+            m_result->messagesCompleted++;
+        }
+    }
+
+    void Window(ArdpTestEndpoint& ep, ajn::ArdpConnRecord* conn, uint16_t window, QStatus status) {
+        Flow* flow = Find(conn);
+        if (flow && window > 0) {
+            flow->blocked = false;
+            flow->windowEvent.SetEvent();
+        }
+    }
+
+  private:
+    struct Flow;
+
+    class FlowSender : public qcc::Thread {
+      public:
+        FlowSender(ArdpLoopbackTransfer* transfer, Flow* flow) : qcc::Thread("FlowSender"), m_transfer(transfer), m_flow(flow) { }
+
+      protected:
+        qcc::ThreadReturn STDCALL Run(void* arg) {
+            m_transfer->SendLoop(m_flow);
+            return this;
+        }
+
+      private:
+        ArdpLoopbackTransfer* m_transfer;
+        Flow* m_flow;
+    };
+
+    struct Flow {
+        uint32_t id;
+        ajn::ArdpConnRecord* conn;
+        bool connected;
+        bool failed;
+        bool blocked;
+        qcc::Event windowEvent;
+        std::vector<uint8_t*> allBufs;
+        std::vector<uint8_t*> freeBufs;   /**< At most maxInFlight messages can be in flight */
+        uint32_t nextSeq;
+        uint64_t sent;
+        uint32_t stalls;
+        uint64_t stalledUs;
+        XorShiftRng rng;
+        FlowSender* thread;
+
+        Flow(uint32_t id, uint64_t seed) :
+            id(id), conn(NULL), connected(false), failed(false), blocked(false), nextSeq(0), sent(0),
+            stalls(0), stalledUs(0), rng(seed), thread(NULL) { }
+
+        ~Flow() {
+            delete thread;
+            for (size_t i = 0; i < allBufs.size(); ++i) {
+                free(allBufs[i]);
+            }
+        }
+    };
+
+    static double CpuSeconds() {
+#ifndef _WIN32
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#else
+        return 0.0;
+#endif
+    }
+
+    Flow* Find(ajn::ArdpConnRecord* conn) {
+        std::map<ajn::ArdpConnRecord*, Flow*>::iterator it = m_flowMap.find(conn);
+        return (it == m_flowMap.end()) ? NULL : it->second;
+    }
+
+    void WaitForConnections() {
+        uint64_t limit = (uint64_t)m_params.config.connectTimeout * (m_params.config.connectRetries + 1);
+        uint64_t start = GetTimestampMicros();
+        while (!m_abort && (GetTimestampMicros() - start) / 1000 < limit) {
+            m_sender->GetLock().Lock(MUTEX_CONTEXT);
+            uint32_t done = m_result->connected + m_result->connectFailed;
+            m_sender->GetLock().Unlock(MUTEX_CONTEXT);
+            if (done >= m_flows.size()) {
+                break;
+            }
+            qcc::Sleep(10);
+        }
+    }
+
+    void StopSenders() {
+        m_stopping = true;
+        for (size_t i = 0; i < m_flows.size(); ++i) {
+            m_flows[i]->windowEvent.SetEvent();
+        }
+        for (size_t i = 0; i < m_flows.size(); ++i) {
+            if (m_flows[i]->thread) {
+                m_flows[i]->thread->Stop();
+                m_flows[i]->thread->Join();
+            }
+        }
+    }
+
+    void SendLoop(Flow* flow) {
+        qcc::Mutex& lock = m_sender->GetLock();
+        while (!m_stopping && !m_abort) {
+            lock.Lock(MUTEX_CONTEXT);
+            if (!flow->connected) {
+                lock.Unlock(MUTEX_CONTEXT);
+                break;
+            }
+            if (flow->blocked || flow->freeBufs.empty()) {
+                flow->windowEvent.ResetEvent();
+                lock.Unlock(MUTEX_CONTEXT);
+                uint64_t begin = GetTimestampMicros();
+                qcc::Event::Wait(flow->windowEvent, 100);
+                flow->stalls++;
+                flow->stalledUs += GetTimestampMicros() - begin;
+                continue;
+            }
+
+            uint8_t* buf = flow->freeBufs.back();
+            flow->freeBufs.pop_back();
+            uint32_t len = m_params.minPayload;
+            if (m_params.maxPayload > m_params.minPayload) {
+                len += flow->rng.Below(m_params.maxPayload - m_params.minPayload + 1);
+            }
+            uint64_t now = GetTimestampMicros();
+            memcpy(buf, &flow->id, sizeof(flow->id));
+            memcpy(buf + 4, &flow->nextSeq, sizeof(flow->nextSeq));
+            memcpy(buf + 8, &now, sizeof(now));
+
+            QStatus status = ajn::ARDP_Send(m_sender->GetHandle(), flow->conn, buf, len, m_params.ttl);
+            bool pause = false;
+            if (status == ER_OK) {
+                flow->nextSeq++;
+                flow->sent++;
+            } else {
+                flow->freeBufs.push_back(buf);
+                if (status == ER_ARDP_BACKPRESSURE) {
+                    flow->blocked = true;
+                } else {
+                    m_result->sendErrors++;
+                    pause = true;
+                }
+            }
+            lock.Unlock(MUTEX_CONTEXT);
+            m_sender->Wake();
+            if (pause) {
+                qcc::Sleep(10);
+            }
+        }
+    }
+
+    ArdpTransferParams m_params;
+    ArdpTestEndpoint* m_sender;
+    ArdpTestEndpoint* m_receiver;
+    ArdpTransferResult* m_result;   /**< NULL outside the measurement */
+    std::vector<Flow*> m_flows;
+    std::map<ajn::ArdpConnRecord*, Flow*> m_flowMap;
+    std::vector<uint32_t> m_expectedSeq;
+    volatile bool m_stopping;
+    volatile bool m_abort;
+};
+
+#endif
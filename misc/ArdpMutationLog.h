@@ -0,0 +1,234 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef _ARDPMUTATIONLOG_H
+#define _ARDPMUTATIONLOG_H
+
+/*
+ * Binary log of the segments ardpfuzz mutated, so a run can be replayed.
+ *
+ * The file starts with the 8 byte magic "ARDPMUT1" and the 64-bit seed of
+ * the run.  Then, for every mutated segment, little endian:
+ *
+ *   u32 index       ordinal of the segment among those the hook saw from
+ *                   this source, counting from 0
+ *   u8  source      TesthookSource
+ *   u8  op          which mutation was picked
+ *   u16 headerLen   header length before and after
+ *   u16 newHeaderLen
+ *   u32 dataLen     data length before and after, NO_DATA if there was
+ *   u32 newDataLen  no data buffer
+ *   u16 count       number of bytes changed, followed by count times
+ *   u16 offset, u8 old, u8 new
+ *
+ * Segments that went out unchanged are not logged.
+ */
+
+#include <qcc/platform.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+struct ByteChange {
+    uint16_t offset;
+    uint8_t from;
+    uint8_t to;
+};
+
+struct MutationRecord {
+    static const uint32_t NO_DATA = 0xFFFFFFFF;
+
+    uint32_t index;
+    uint8_t source;
+    uint8_t op;
+    uint16_t headerLen;
+    uint16_t newHeaderLen;
+    uint32_t dataLen;
+    uint32_t newDataLen;
+    std::vector<ByteChange> changes;
+
+    MutationRecord() : index(0), source(0), op(0), headerLen(0), newHeaderLen(0), dataLen(NO_DATA), newDataLen(NO_DATA) { }
+
+    bool Changed() const {
+        return !changes.empty() || (headerLen != newHeaderLen) || (dataLen != newDataLen);
+    }
+};
+
+class MutationLogWriter {
+
+  public:
+    MutationLogWriter() : m_fp(NULL), m_records(0) { }
+
+    ~MutationLogWriter() {
+        Close();
+    }
+
+    bool Open(const char* path, uint64_t seed) {
+        m_fp = fopen(path, "wb");
+        if (!m_fp) {
+            return false;
+        }
+        fwrite(s_magic, 1, sizeof(s_magic), m_fp);
+        Put64(seed);
+        return true;
+    }
+
+    void Write(const MutationRecord& r) {
+        if (!m_fp) {
+            return;
+        }
+        Put32(r.index);
+        Put8(r.source);
+        Put8(r.op);
+        Put16(r.headerLen);
+        Put16(r.newHeaderLen);
+        Put32(r.dataLen);
+        Put32(r.newDataLen);
+        Put16((uint16_t)r.changes.size());
+        for (size_t i = 0; i < r.changes.size(); ++i) {
+            Put16(r.changes[i].offset);
+            Put8(r.changes[i].from);
+            Put8(r.changes[i].to);
+        }
+        m_records++;
+    }
+
+    /** Push what has been logged so far to the file, so it survives a crash of the peer taking us down */
+    void Flush() {
+        if (m_fp) {
+            fflush(m_fp);
+        }
+    }
+
+    void Close() {
+        if (m_fp) {
+            fclose(m_fp);
+            m_fp = NULL;
+        }
+    }
+
+    uint64_t GetRecords() const { return m_records; }
+
+    static const char s_magic[8];
+
+  private:
+    void Put8(uint8_t v) {
+        fputc(v, m_fp);
+    }
+    void Put16(uint16_t v) {
+        Put8((uint8_t)v);
+        Put8((uint8_t)(v >> 8));
+    }
+    void Put32(uint32_t v) {
+        Put16((uint16_t)v);
+        Put16((uint16_t)(v >> 16));
+    }
+    void Put64(uint64_t v) {
+        Put32((uint32_t)v);
+        Put32((uint32_t)(v >> 32));
+    }
+
+    FILE* m_fp;
+    uint64_t m_records;
+};
+
+/* The tools are single translation units, so defining this here is fine */
+const char MutationLogWriter::s_magic[8] = { 'A', 'R', 'D', 'P', 'M', 'U', 'T', '1' };
+
+/**
+ * Reads a whole log into memory; the records come back in the order they
+ * were written.  A record cut short at the end is dropped.
+ */
+class MutationLogReader {
+
+  public:
+    MutationLogReader() : m_seed(0), m_truncated(false) { }
+
+    bool Load(const char* path) {
+        FILE* fp = fopen(path, "rb");
+        if (!fp) {
+            return false;
+        }
+        char magic[sizeof(MutationLogWriter::s_magic)];
+        bool valid = (fread(magic, 1, sizeof(magic), fp) == sizeof(magic)) &&
+                     (memcmp(magic, MutationLogWriter::s_magic, sizeof(magic)) == 0) && Get64(fp, m_seed);
+        bool ok = valid;
+        while (ok) {
+            MutationRecord r;
+            uint16_t count;
+            int c = fgetc(fp);
+            if (c == EOF) {
+                break;      /* clean end of file */
+            }
+            ungetc(c, fp);
+            ok = Get32(fp, r.index) && Get8(fp, r.source) && Get8(fp, r.op) && Get16(fp, r.headerLen) && Get16(fp, r.newHeaderLen) &&
+                 Get32(fp, r.dataLen) && Get32(fp, r.newDataLen) && Get16(fp, count);
+            for (uint16_t i = 0; ok && i < count; ++i) {
+                ByteChange c;
+                ok = Get16(fp, c.offset) && Get8(fp, c.from) && Get8(fp, c.to);
+                r.changes.push_back(c);
+            }
+            if (ok) {
+                m_records.push_back(r);
+            }
+        }
+        fclose(fp);
+        m_truncated = valid && !ok;
+        return valid;
+    }
+
+    uint64_t GetSeed() const { return m_seed; }
+    /** The last record was cut short, as happens when the writer died mid-record */
+    bool IsTruncated() const { return m_truncated; }
+    const std::vector<MutationRecord>& GetRecords() const { return m_records; }
+
+  private:
+    static bool Get8(FILE* fp, uint8_t& v) {
+        int c = fgetc(fp);
+        v = (uint8_t)c;
+        return c != EOF;
+    }
+    static bool Get16(FILE* fp, uint16_t& v) {
+        uint8_t lo, hi;
+        if (!Get8(fp, lo) || !Get8(fp, hi)) {
+            return false;
+        }
+        v = lo | (hi << 8);
+        return true;
+    }
+    static bool Get32(FILE* fp, uint32_t& v) {
+        uint16_t lo, hi;
+        if (!Get16(fp, lo) || !Get16(fp, hi)) {
+            return false;
+        }
+        v = lo | ((uint32_t)hi << 16);
+        return true;
+    }
+    static bool Get64(FILE* fp, uint64_t& v) {
+        uint32_t lo, hi;
+        if (!Get32(fp, lo) || !Get32(fp, hi)) {
+            return false;
+        }
+        v = lo | ((uint64_t)hi << 32);
+        return true;
+    }
+
+    uint64_t m_seed;
+    bool m_truncated;
+    std::vector<MutationRecord> m_records;
+};
+
+#endif
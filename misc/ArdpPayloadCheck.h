@@ -0,0 +1,208 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef _ARDPPAYLOADCHECK_H
+#define _ARDPPAYLOADCHECK_H
+
+/*
+ * End-to-end integrity checks for the test payloads.  The sender either
+ * fills the body of a message with a pattern derived from a per-message seed
+ * or stamps a CRC32C of it into the header; the receiver checks the body
+ * where it lies, fragment by fragment along the ArdpRcvBuf chain, without
+ * copying it anywhere first.
+ */
+
+#include <qcc/platform.h>
+
+#include <ArdpProtocol.h>
+
+#include <string.h>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+enum PayloadCheckType {
+    PAYLOAD_CHECK_NONE = 0,
+    PAYLOAD_CHECK_PATTERN = 1,   /**< Check word is the pattern seed */
+    PAYLOAD_CHECK_CRC32C = 2     /**< Check word is the CRC32C of the body */
+};
+
+/** Big endian 32-bit word at any alignment, as the payload headers are written */
+static inline uint32_t PayloadGetWord(const uint8_t* buf, uint32_t index)
+{
+    const uint8_t* p = buf + index * 4;
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void PayloadPutWord(uint8_t* buf, uint32_t index, uint32_t value)
+{
+    uint8_t* p = buf + index * 4;
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+/*
+ * CRC32C (Castagnoli).  Uses the SSE4.2 instruction when the build enables
+ * it, slicing-by-8 tables otherwise.
+ */
+class Crc32c {
+
+  public:
+    /** Continue a CRC; start from Begin() and finish with End() */
+    static uint32_t Update(uint32_t crc, const uint8_t* p, size_t len) {
+#if defined(__SSE4_2__)
+        while (len && ((uintptr_t)p & 7)) {
+            crc = _mm_crc32_u8(crc, *p++);
+            --len;
+        }
+#if defined(__x86_64__)
+        while (len >= 8) {
+            uint64_t v;
+            memcpy(&v, p, 8);
+            crc = (uint32_t)_mm_crc32_u64(crc, v);
+            p += 8;
+            len -= 8;
+        }
+#endif
+        while (len--) {
+            crc = _mm_crc32_u8(crc, *p++);
+        }
+        return crc;
+#else
+        const uint32_t (*t)[256] = Tables().t;
+        while (len && ((uintptr_t)p & 3)) {
+            crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+            --len;
+        }
+        while (len >= 8) {
+            uint32_t lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+            uint32_t hi = (uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+            crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+                  t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+            p += 8;
+            len -= 8;
+        }
+        while (len--) {
+            crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+#endif
+    }
+
+    static uint32_t Begin() { return 0xFFFFFFFF; }
+    static uint32_t End(uint32_t crc) { return crc ^ 0xFFFFFFFF; }
+
+    static uint32_t Compute(const uint8_t* p, size_t len) {
+        return End(Update(Begin(), p, len));
+    }
+
+  private:
+    struct Table {
+        uint32_t t[8][256];
+        Table() {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : (c >> 1);
+                }
+                t[0][i] = c;
+            }
+            for (uint32_t i = 0; i < 256; ++i) {
+                for (int s = 1; s < 8; ++s) {
+                    t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+                }
+            }
+        }
+    };
+
+    static const Table& Tables() {
+        static const Table table;
+        return table;
+    }
+};
+
+/*
+ * The byte at message offset k is byte (k % 4) of seed + (k / 4) * golden
+ * ratio, so shifted, swapped or repeated fragments show up as well as
+ * flipped bits.
+ */
+static inline uint8_t PatternByte(uint32_t seed, uint32_t offset)
+{
+    uint32_t v = seed + (offset >> 2) * 0x9E3779B1;
+    return (uint8_t)(v >> ((offset & 3) << 3));
+}
+
+/** Fill buf[from, to) with the pattern; offsets are from the start of the message */
+static inline void FillPattern(uint8_t* buf, uint32_t from, uint32_t to, uint32_t seed)
+{
+    for (uint32_t k = from; k < to; ++k) {
+        buf[k] = PatternByte(seed, k);
+    }
+}
+
+/**
+ * Walk the fcnt fragments of a received message and check everything from
+ * message offset skip onwards.  The fragments are read where they are.
+ *
+ * @param rcv        First fragment, as handed to RecvCb
+ * @param skip       Length of the header that is not covered by the check
+ * @param type       PAYLOAD_CHECK_PATTERN or PAYLOAD_CHECK_CRC32C
+ * @param check      Pattern seed or expected CRC32C
+ * @param length     Returns the total message length
+ * @param badOffset  Returns the offset of the first wrong byte (pattern) or
+ *                   the message length (CRC) on failure
+ *
+ * @return true if the body checks out
+ */
+static inline bool CheckRcvChain(const ajn::ArdpRcvBuf* rcv, uint32_t skip, uint32_t type, uint32_t check,
+                                 uint32_t& length, uint32_t& badOffset)
+{
+    uint32_t crc = Crc32c::Begin();
+    bool ok = true;
+    uint32_t offset = 0;
+    badOffset = 0;
+    uint16_t fcnt = rcv->fcnt;
+    for (uint16_t i = 0; (i < fcnt) && rcv; ++i, rcv = rcv->next) {
+        uint32_t from = (offset < skip) ? skip - offset : 0;
+        if (from < rcv->datalen) {
+            const uint8_t* p = rcv->data + from;
+            uint32_t n = rcv->datalen - from;
+            if (type == PAYLOAD_CHECK_CRC32C) {
+                crc = Crc32c::Update(crc, p, n);
+            } else if (ok && (type == PAYLOAD_CHECK_PATTERN)) {
+                uint32_t base = offset + from;
+                for (uint32_t j = 0; j < n; ++j) {
+                    if (p[j] != PatternByte(check, base + j)) {
+                        ok = false;
+                        badOffset = base + j;
+                        break;
+                    }
+                }
+            }
+        }
+        offset += rcv->datalen;
+    }
+    length = offset;
+    if (type == PAYLOAD_CHECK_CRC32C && Crc32c::End(crc) != check) {
+        ok = false;
+        badOffset = offset;
+    }
+    return ok;
+}
+
+#endif
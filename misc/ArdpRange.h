@@ -0,0 +1,71 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef _ARDPRANGE_H
+#define _ARDPRANGE_H
+
+/*
+ * Value ranges for the sweep tools: a comma separated list (4,8,16),
+ * lo:hi:step (0:100:25) or lo:hi:xN for a geometric series.
+ */
+
+#include <qcc/platform.h>
+#include <qcc/String.h>
+#include <qcc/StringUtil.h>
+
+#include <vector>
+
+/* Expand "4,8,16", "0:100:25" or "100:1600:x2" into the list of values */
+static inline bool ParseRange(const char* arg, std::vector<uint32_t>& values)
+{
+    values.clear();
+    qcc::String s(arg);
+    size_t colon = s.find_first_of(':');
+    if (colon == qcc::String::npos) {
+        size_t pos = 0;
+        while (pos <= s.size()) {
+            size_t comma = s.find_first_of(',', pos);
+            if (comma == qcc::String::npos) {
+                comma = s.size();
+            }
+            uint32_t v = qcc::StringToU32(s.substr(pos, comma - pos), 0, 0xFFFFFFFF);
+            if (v == 0xFFFFFFFF) {
+                return false;
+            }
+            values.push_back(v);
+            pos = comma + 1;
+        }
+        return !values.empty();
+    }
+
+    size_t colon2 = s.find_first_of(':', colon + 1);
+    if (colon2 == qcc::String::npos) {
+        return false;
+    }
+    uint32_t lo = qcc::StringToU32(s.substr(0, colon), 0, 0xFFFFFFFF);
+    uint32_t hi = qcc::StringToU32(s.substr(colon + 1, colon2 - colon - 1), 0, 0xFFFFFFFF);
+    qcc::String stepStr = s.substr(colon2 + 1);
+    bool geometric = (stepStr.size() > 0) && (stepStr[0] == 'x');
+    uint32_t step = qcc::StringToU32(geometric ? stepStr.substr(1) : stepStr, 0, 0);
+    if (lo == 0xFFFFFFFF || hi == 0xFFFFFFFF || lo > hi || step == 0 || (geometric && (step < 2 || lo == 0))) {
+        return false;
+    }
+    for (uint64_t v = lo; v <= hi; v = geometric ? v * step : v + step) {
+        values.push_back((uint32_t)v);
+    }
+    return true;
+}
+
+#endif
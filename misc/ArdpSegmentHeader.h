@@ -0,0 +1,124 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef _ARDPSEGMENTHEADER_H
+#define _ARDPSEGMENTHEADER_H
+
+/*
+ * The ARDP header is private to ArdpProtocol.cc.  These offsets mirror the
+ * fixed part of it as it goes on the wire, so that the test tools can tell
+ * data from control segments and pick out sequence and acknowledgement
+ * numbers.  All multi-byte fields are in network byte order.  If the header
+ * layout in ArdpProtocol.cc changes, this file has to follow.
+ */
+
+#include <qcc/platform.h>
+
+#include <string.h>
+
+const uint32_t ARDP_SEG_FLAGS = 0;    /**< uint8_t:  segment flags (ARDP_SEG_SYN...) */
+const uint32_t ARDP_SEG_HLEN = 1;     /**< uint8_t:  header length in units of 16 bits */
+const uint32_t ARDP_SEG_SRC = 2;      /**< uint16_t: source ARDP port */
+const uint32_t ARDP_SEG_DST = 4;      /**< uint16_t: destination ARDP port */
+const uint32_t ARDP_SEG_DLEN = 6;     /**< uint16_t: length of the data in this segment */
+const uint32_t ARDP_SEG_SEQ = 8;      /**< uint32_t: sequence number */
+const uint32_t ARDP_SEG_ACK = 12;     /**< uint32_t: cumulative acknowledgement */
+const uint32_t ARDP_SEG_TTL = 16;     /**< uint32_t: time to live of the message */
+const uint32_t ARDP_SEG_LCS = 20;     /**< uint32_t: last consumed sequence number */
+const uint32_t ARDP_SEG_ACKNXT = 24;  /**< uint32_t: first unexpired sequence number */
+const uint32_t ARDP_SEG_SOM = 28;     /**< uint32_t: sequence number of the first fragment of the message */
+const uint32_t ARDP_SEG_FCNT = 32;    /**< uint16_t: number of fragments in the message */
+const uint32_t ARDP_SEG_FIXED_LEN = 36;
+
+const uint8_t ARDP_SEG_SYN = 0x01;
+const uint8_t ARDP_SEG_ACK_FLAG = 0x02;
+const uint8_t ARDP_SEG_EACK = 0x04;
+const uint8_t ARDP_SEG_RST = 0x08;
+const uint8_t ARDP_SEG_NUL = 0x10;
+
+static inline uint16_t ArdpSegGet16(const uint8_t* buf, uint32_t offset)
+{
+    return (uint16_t)((buf[offset] << 8) | buf[offset + 1]);
+}
+
+static inline uint32_t ArdpSegGet32(const uint8_t* buf, uint32_t offset)
+{
+    return ((uint32_t)buf[offset] << 24) | ((uint32_t)buf[offset + 1] << 16) | ((uint32_t)buf[offset + 2] << 8) | buf[offset + 3];
+}
+
+static inline void ArdpSegPut32(uint8_t* buf, uint32_t offset, uint32_t value)
+{
+    buf[offset] = (uint8_t)(value >> 24);
+    buf[offset + 1] = (uint8_t)(value >> 16);
+    buf[offset + 2] = (uint8_t)(value >> 8);
+    buf[offset + 3] = (uint8_t)value;
+}
+
+static inline void ArdpSegPut16(uint8_t* buf, uint32_t offset, uint16_t value)
+{
+    buf[offset] = (uint8_t)(value >> 8);
+    buf[offset + 1] = (uint8_t)value;
+}
+
+/** The fields of one segment header that the test tools look at */
+struct ArdpSegmentInfo {
+    uint8_t flags;
+    uint32_t hlen;      /**< header length in bytes */
+    uint16_t src;
+    uint16_t dst;
+    uint16_t dlen;
+    uint32_t seq;
+    uint32_t ack;
+    uint32_t ttl;
+    uint32_t som;
+    uint16_t fcnt;
+
+    bool IsSyn() const { return (flags & ARDP_SEG_SYN) != 0; }
+    bool IsRst() const { return (flags & ARDP_SEG_RST) != 0; }
+    bool IsNul() const { return (flags & ARDP_SEG_NUL) != 0; }
+    bool HasAck() const { return (flags & ARDP_SEG_ACK_FLAG) != 0; }
+    /** A data segment occupies sequence space; everything else is control traffic */
+    bool IsData() const { return !IsSyn() && (dlen > 0); }
+};
+
+/**
+ * Pick the fixed header apart.  Returns false if the buffer is too short to
+ * hold one; no other validation is done.
+ */
+static inline bool ArdpParseSegment(const uint8_t* buf, size_t len, ArdpSegmentInfo& info)
+{
+    if (len < ARDP_SEG_FIXED_LEN) {
+        return false;
+    }
+    info.flags = buf[ARDP_SEG_FLAGS];
+    info.hlen = (uint32_t)buf[ARDP_SEG_HLEN] * 2;
+    info.src = ArdpSegGet16(buf, ARDP_SEG_SRC);
+    info.dst = ArdpSegGet16(buf, ARDP_SEG_DST);
+    info.dlen = ArdpSegGet16(buf, ARDP_SEG_DLEN);
+    info.seq = ArdpSegGet32(buf, ARDP_SEG_SEQ);
+    info.ack = ArdpSegGet32(buf, ARDP_SEG_ACK);
+    info.ttl = ArdpSegGet32(buf, ARDP_SEG_TTL);
+    info.som = ArdpSegGet32(buf, ARDP_SEG_SOM);
+    info.fcnt = ArdpSegGet16(buf, ARDP_SEG_FCNT);
+    return true;
+}
+
+/** Serial number arithmetic on 32-bit sequence numbers: a comes after b */
+static inline bool ArdpSeqAfter(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) > 0;
+}
+
+#endif
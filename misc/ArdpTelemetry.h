@@ -0,0 +1,242 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef _ARDPTELEMETRY_H
+#define _ARDPTELEMETRY_H
+
+/*
+ * RTT and retransmission telemetry for one ARDP handle, fed from the test
+ * hooks: OnSend() with the header of every segment the handle sends,
+ * OnRecv() with every segment it receives.  Connections are told apart by
+ * the port pair in the headers, so the hooks need not know the connection.
+ *
+ * Every data segment is timestamped by sequence number when it first goes
+ * out; sending it again is a retransmission.  A cumulative ACK that covers
+ * a segment sent exactly once gives an RTT sample (Karn's rule).  A segment
+ * that was above the hole when an EACK arrived may have been acknowledged
+ * by that EACK already, so its later cumulative ACK gives no sample either.
+ *
+ * The hooks do not say why a segment is retransmitted.  A retransmission
+ * that follows an EACK reporting the segment still missing is counted as
+ * fast retransmit, any other as a timeout.
+ *
+ * Every interval one CSV row of the counters and RTT percentiles for that
+ * interval, over all connections, goes to the output file.  Not thread
+ * safe; the hooks run under the lock that ARDP_Run is called with.
+ */
+
+#include <qcc/platform.h>
+
+#include <stdio.h>
+#include <map>
+
+#include "ArdpSegmentHeader.h"
+#include "LatencyHistogram.h"
+
+class ArdpTelemetry {
+
+  public:
+    struct Counters {
+        uint64_t dataSegments;      /**< Data segments sent, retransmissions included */
+        uint64_t retransmits;
+        uint64_t fastRetransmits;
+        uint64_t timeoutRetransmits;
+        uint64_t acks;              /**< Segments received carrying an ACK */
+        uint64_t eacks;
+
+        Counters() : dataSegments(0), retransmits(0), fastRetransmits(0), timeoutRetransmits(0), acks(0), eacks(0) { }
+
+        double RetransmitPercent() const {
+            return dataSegments ? 100.0 * retransmits / dataSegments : 0.0;
+        }
+    };
+
+    ArdpTelemetry() :
+        m_fp(NULL), m_intervalUs(1000000), m_start(0), m_intervalStart(0),
+        m_intervalRtt("rtt_interval"), m_rtt("rtt") { }
+
+    ~ArdpTelemetry() {
+        Close();
+    }
+
+    bool Open(const char* path, uint32_t intervalMs) {
+        m_fp = fopen(path, "w");
+        if (!m_fp) {
+            return false;
+        }
+        m_intervalUs = (uint64_t)(intervalMs ? intervalMs : 1000) * 1000;
+        fprintf(m_fp, "time_ms,data_segments,retransmits,retransmit_pct,fast_retransmits,timeout_retransmits,"
+                "acks,eacks,in_flight,rtt_samples,rtt_min_us,rtt_p50_us,rtt_p99_us,rtt_max_us\n");
+        return true;
+    }
+
+    /** Write the interval in progress and close the file */
+    void Close() {
+        if (m_fp) {
+            if (m_start) {
+                WriteRow(GetTimestampMicros());
+            }
+            fclose(m_fp);
+            m_fp = NULL;
+        }
+    }
+
+    bool IsOpen() const { return m_fp != NULL; }
+
+    void OnSend(const uint8_t* header, size_t len) {
+        ArdpSegmentInfo info;
+        if (!m_fp || !ArdpParseSegment(header, len, info) || !info.IsData()) {
+            return;
+        }
+        uint64_t now = Tick();
+        Conn& c = m_conns[Key(info.src, info.dst)];
+        m_interval.dataSegments++;
+        m_total.dataSegments++;
+        std::map<uint32_t, Segment>::iterator it = c.inFlight.find(info.seq);
+        if (it == c.inFlight.end()) {
+            Segment& s = c.inFlight[info.seq];
+            s.firstSent = now;
+            return;
+        }
+        Segment& s = it->second;
+        s.transmissions++;
+        m_interval.retransmits++;
+        m_total.retransmits++;
+        if (s.eacked) {
+            m_interval.fastRetransmits++;
+            m_total.fastRetransmits++;
+        } else {
+            m_interval.timeoutRetransmits++;
+            m_total.timeoutRetransmits++;
+        }
+        s.eacked = false;
+    }
+
+    void OnRecv(const uint8_t* buf, size_t len) {
+        ArdpSegmentInfo info;
+        if (!m_fp || !ArdpParseSegment(buf, len, info) || !info.HasAck()) {
+            return;
+        }
+        uint64_t now = Tick();
+        /* Our segments went out from dst to src of this one */
+        std::map<uint32_t, Conn>::iterator cit = m_conns.find(Key(info.dst, info.src));
+        if (cit == m_conns.end()) {
+            return;
+        }
+        Conn& c = cit->second;
+        m_interval.acks++;
+        m_total.acks++;
+        bool eack = (info.flags & ARDP_SEG_EACK) != 0;
+        if (eack) {
+            m_interval.eacks++;
+            m_total.eacks++;
+        }
+
+        std::map<uint32_t, Segment>::iterator it = c.inFlight.begin();
+        while (it != c.inFlight.end()) {
+            uint32_t seq = it->first;
+            Segment& s = it->second;
+            if (!ArdpSeqAfter(seq, info.ack)) {
+                if (s.transmissions == 1 && !s.ambiguous) {
+                    m_intervalRtt.Record(now - s.firstSent);
+                    m_rtt.Record(now - s.firstSent);
+                }
+                c.inFlight.erase(it++);
+                continue;
+            }
+            if (eack) {
+                if (seq == info.ack + 1) {
+                    /* The hole itself: the peer has later segments but not this one */
+                    s.eacked = true;
+                } else {
+                    s.ambiguous = true;
+                }
+            }
+            ++it;
+        }
+    }
+
+    const Counters& GetTotals() const { return m_total; }
+    const LatencyHistogram& GetRtt() const { return m_rtt; }
+
+    void PrintSummary(FILE* fp = stdout) const {
+        fprintf(fp, "Telemetry: %llu data segments, %llu retransmitted (%.2f%%: %llu after an EACK, %llu on timeout), "
+                "%llu ACKs of which %llu EACKs\n",
+                (unsigned long long)m_total.dataSegments, (unsigned long long)m_total.retransmits, m_total.RetransmitPercent(),
+                (unsigned long long)m_total.fastRetransmits, (unsigned long long)m_total.timeoutRetransmits,
+                (unsigned long long)m_total.acks, (unsigned long long)m_total.eacks);
+        m_rtt.PrintSummary(fp);
+    }
+
+  private:
+    struct Segment {
+        uint64_t firstSent;
+        uint32_t transmissions;
+        bool eacked;        /**< An EACK reported it missing since it was last sent */
+        bool ambiguous;     /**< May have been acknowledged by an EACK, no RTT sample */
+        Segment() : firstSent(0), transmissions(1), eacked(false), ambiguous(false) { }
+    };
+
+    struct Conn {
+        std::map<uint32_t, Segment> inFlight;
+    };
+
+    static uint32_t Key(uint16_t local, uint16_t remote) {
+        return ((uint32_t)local << 16) | remote;
+    }
+
+    /* The current time, closing the interval first if it has run out */
+    uint64_t Tick() {
+        uint64_t now = GetTimestampMicros();
+        if (!m_start) {
+            m_start = m_intervalStart = now;
+        }
+        while (now - m_intervalStart >= m_intervalUs) {
+            WriteRow(m_intervalStart + m_intervalUs);
+            m_intervalStart += m_intervalUs;
+        }
+        return now;
+    }
+
+    void WriteRow(uint64_t end) {
+        size_t inFlight = 0;
+        for (std::map<uint32_t, Conn>::const_iterator it = m_conns.begin(); it != m_conns.end(); ++it) {
+            inFlight += it->second.inFlight.size();
+        }
+        fprintf(m_fp, "%llu,%llu,%llu,%.3f,%llu,%llu,%llu,%llu,%u,%llu,%llu,%llu,%llu,%llu\n",
+                (unsigned long long)((end - m_start) / 1000),
+                (unsigned long long)m_interval.dataSegments, (unsigned long long)m_interval.retransmits,
+                m_interval.RetransmitPercent(), (unsigned long long)m_interval.fastRetransmits,
+                (unsigned long long)m_interval.timeoutRetransmits, (unsigned long long)m_interval.acks,
+                (unsigned long long)m_interval.eacks, (uint32_t)inFlight,
+                (unsigned long long)m_intervalRtt.GetCount(), (unsigned long long)m_intervalRtt.GetMin(),
+                (unsigned long long)m_intervalRtt.GetPercentile(50.0), (unsigned long long)m_intervalRtt.GetPercentile(99.0),
+                (unsigned long long)m_intervalRtt.GetMax());
+        m_interval = Counters();
+        m_intervalRtt.Reset();
+    }
+
+    FILE* m_fp;
+    uint64_t m_intervalUs;
+    uint64_t m_start;
+    uint64_t m_intervalStart;
+    std::map<uint32_t, Conn> m_conns;
+    Counters m_interval;
+    Counters m_total;
+    LatencyHistogram m_intervalRtt;
+    LatencyHistogram m_rtt;
+};
+
+#endif
@@ -0,0 +1,357 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef _ARDPTESTENDPOINT_H
+#define _ARDPTESTENDPOINT_H
+
+/*
+ * One ARDP endpoint (UDP socket, ArdpHandle and the thread calling ARDP_Run)
+ * that can live next to others in the same process.  ardpstress and friends
+ * keep a single handle in globals; the benchmarks that run both ends of a
+ * connection in one process use this instead.  Callbacks are routed to an
+ * ArdpEndpointListener through the handle context.
+ */
+
+#include <qcc/platform.h>
+#include <qcc/Event.h>
+#include <qcc/IPAddress.h>
+#include <qcc/Mutex.h>
+#include <qcc/Socket.h>
+#include <qcc/SocketTypes.h>
+#include <qcc/Thread.h>
+
+#include <alljoyn/Status.h>
+
+#include <ArdpProtocol.h>
+
+#include <string.h>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/** Largest segbmax: the payload of one UDP datagram over IPv4 */
+const uint16_t ARDP_SEGBMAX_LIMIT = 65507;
+/** Largest segmax the 16 bit config field holds */
+const uint16_t ARDP_SEGMAX_LIMIT = 65535;
+
+/** Fill in the same ArdpGlobalConfig that ardpstress uses */
+static inline void ArdpTestDefaultConfig(ajn::ArdpGlobalConfig& config)
+{
+    memset(&config, 0, sizeof(config));
+    config.connectTimeout = 1000;
+    config.connectRetries = 10;
+    config.initialDataTimeout = 1000;
+    config.totalDataRetryTimeout = 5000;
+    config.minDataRetries = 5;
+    config.persistInterval = 1000;
+    config.totalAppTimeout = 30000;
+    config.linkTimeout = 30000;
+    config.keepaliveRetries = 5;
+    config.fastRetransmitAckCounter = 1;
+    config.timewait = 1000;
+    config.segbmax = 65507;
+    config.segmax = 16;
+    config.delayedAckTimeout = 100;
+}
+
+/**
+ * Pin the calling thread to one CPU.  Linux only; elsewhere, or with a
+ * negative cpu, nothing happens.
+ */
+static inline bool PinCurrentThread(int cpu)
+{
+#if defined(__linux__)
+    if (cpu < 0) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+class ArdpTestEndpoint;
+
+/**
+ * ARDP callbacks for one endpoint.  Every method but Started is called from
+ * ARDP_Run, that is on the endpoint thread with the endpoint lock held; the
+ * lock is recursive, so the endpoint methods may be called from here.
+ */
+class ArdpEndpointListener {
+  public:
+    virtual ~ArdpEndpointListener() { }
+
+    /** Called on the run thread, without the lock, before it first calls ARDP_Run */
+    virtual void Started(ArdpTestEndpoint& ep) { }
+    /** Return false to refuse the connection; it is accepted otherwise */
+    virtual bool Accept(ArdpTestEndpoint& ep, ajn::ArdpConnRecord* conn) { return true; }
+    /** On failure the connection record is released by the endpoint after this returns */
+    virtual void Connected(ArdpTestEndpoint& ep, ajn::ArdpConnRecord* conn, bool passive, QStatus status) { }
+    /** The connection record is released by the endpoint after this returns */
+    virtual void Disconnected(ArdpTestEndpoint& ep, ajn::ArdpConnRecord* conn, QStatus status) { }
+    /** The default hands the buffers straight back */
+    virtual void Received(ArdpTestEndpoint& ep, ajn::ArdpConnRecord* conn, ajn::ArdpRcvBuf* rcv, QStatus status);
+    virtual void Sent(ArdpTestEndpoint& ep, ajn::ArdpConnRecord* conn, uint8_t* buf, uint32_t len, QStatus status) { }
+    virtual void Window(ArdpTestEndpoint& ep, ajn::ArdpConnRecord* conn, uint16_t window, QStatus status) { }
+};
+
+class ArdpTestEndpoint : public qcc::Thread {
+
+  public:
+    ArdpTestEndpoint(const char* name, ArdpEndpointListener* listener) :
+        qcc::Thread(name), m_listener(listener), m_handle(NULL), m_sock(qcc::INVALID_SOCKET_FD), m_port(0),
+        m_reusePort(false), m_cpu(-1), m_stopping(false), m_runCalls(0) { }
+
+    virtual ~ArdpTestEndpoint() {
+        Shutdown();
+    }
+
+    /** Set SO_REUSEPORT before binding, so several endpoints can share a port; call before Init() */
+    void SetReusePort(bool reuse) {
+        m_reusePort = reuse;
+    }
+
+    /** Pin the run thread to a CPU; call before Init() */
+    void SetCpu(int cpu) {
+        m_cpu = cpu;
+    }
+
+    /**
+     * Open and bind the socket (port 0 picks a free one), allocate the handle,
+     * start listening and start the run thread.
+     */
+    QStatus Init(const ajn::ArdpGlobalConfig& config, const char* address = "127.0.0.1", uint16_t port = 0) {
+        m_config = config;
+
+        QStatus status = qcc::Socket(qcc::QCC_AF_INET, qcc::QCC_SOCK_DGRAM, m_sock);
+        if (status != ER_OK) {
+            return status;
+        }
+        status = qcc::SetBlocking(m_sock, false);
+        if (status != ER_OK) {
+            return status;
+        }
+        if (m_reusePort) {
+            status = qcc::SetReusePort(m_sock, true);
+            if (status != ER_OK) {
+                return status;
+            }
+        }
+        status = qcc::Bind(m_sock, qcc::IPAddress(address), port);
+        if (status != ER_OK) {
+            return status;
+        }
+        qcc::IPAddress boundAddress;
+        status = qcc::GetLocalAddress(m_sock, boundAddress, m_port);
+        if (status != ER_OK) {
+            return status;
+        }
+
+        m_handle = ajn::ARDP_AllocHandle(&m_config);
+        if (m_handle == NULL) {
+            return ER_OUT_OF_MEMORY;
+        }
+        ajn::ARDP_SetHandleContext(m_handle, this);
+        ajn::ARDP_SetAcceptCb(m_handle, AcceptCb);
+        ajn::ARDP_SetConnectCb(m_handle, ConnectCb);
+        ajn::ARDP_SetDisconnectCb(m_handle, DisconnectCb);
+        ajn::ARDP_SetRecvCb(m_handle, RecvCb);
+        ajn::ARDP_SetSendCb(m_handle, SendCb);
+        ajn::ARDP_SetSendWindowCb(m_handle, SendWindowCb);
+
+        m_lock.Lock(MUTEX_CONTEXT);
+        status = ajn::ARDP_StartPassive(m_handle);
+        m_lock.Unlock(MUTEX_CONTEXT);
+        if (status != ER_OK) {
+            return status;
+        }
+        return Start();
+    }
+
+    /** Stop the run thread, then free the handle (and with it every connection) and close the socket */
+    void Shutdown() {
+        m_stopping = true;
+        m_wakeEvent.SetEvent();
+        Stop();
+        Join();
+        if (m_handle) {
+            ajn::ARDP_FreeHandle(m_handle);
+            m_handle = NULL;
+        }
+        if (m_sock != qcc::INVALID_SOCKET_FD) {
+            qcc::Close(m_sock);
+            m_sock = qcc::INVALID_SOCKET_FD;
+        }
+    }
+
+    QStatus Connect(const char* address, uint16_t port, ajn::ArdpConnRecord** conn, void* context = NULL) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        QStatus status = ajn::ARDP_Connect(m_handle, m_sock, qcc::IPAddress(address), port, m_config.segmax, m_config.segbmax,
+                                           conn, (uint8_t*)s_connString, strlen(s_connString) + 1, context);
+        m_lock.Unlock(MUTEX_CONTEXT);
+        m_wakeEvent.SetEvent();
+        return status;
+    }
+
+    QStatus Send(ajn::ArdpConnRecord* conn, uint8_t* buf, uint32_t len, uint32_t ttl = 0) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        QStatus status = ajn::ARDP_Send(m_handle, conn, buf, len, ttl);
+        m_lock.Unlock(MUTEX_CONTEXT);
+        if (status == ER_OK) {
+            m_wakeEvent.SetEvent();
+        }
+        return status;
+    }
+
+    QStatus RecvReady(ajn::ArdpConnRecord* conn, ajn::ArdpRcvBuf* rcv) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        QStatus status = ajn::ARDP_RecvReady(m_handle, conn, rcv);
+        m_lock.Unlock(MUTEX_CONTEXT);
+        m_wakeEvent.SetEvent();
+        return status;
+    }
+
+    QStatus Disconnect(ajn::ArdpConnRecord* conn) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        QStatus status = ajn::ARDP_Disconnect(m_handle, conn);
+        m_lock.Unlock(MUTEX_CONTEXT);
+        m_wakeEvent.SetEvent();
+        return status;
+    }
+
+    /** Kick the run thread after touching the handle directly under GetLock() */
+    void Wake() {
+        m_wakeEvent.SetEvent();
+    }
+
+    qcc::Mutex& GetLock() { return m_lock; }
+    ajn::ArdpHandle* GetHandle() const { return m_handle; }
+    qcc::SocketFd GetSocket() const { return m_sock; }
+    uint16_t GetPort() const { return m_port; }
+    const ajn::ArdpGlobalConfig& GetConfig() const { return m_config; }
+    uint64_t GetRunCalls() const { return m_runCalls; }
+
+  protected:
+    /* Same event driven loop as ardpstress -e */
+    qcc::ThreadReturn STDCALL Run(void* arg) {
+        PinCurrentThread(m_cpu);
+        m_listener->Started(*this);
+
+        qcc::Event sockEvent(m_sock, qcc::Event::IO_READ);
+        std::vector<qcc::Event*> checkEvents;
+        std::vector<qcc::Event*> signaledEvents;
+        checkEvents.push_back(&sockEvent);
+        checkEvents.push_back(&m_wakeEvent);
+
+        bool sockRead = true;
+        while (!m_stopping) {
+            uint32_t ms = qcc::Event::WAIT_FOREVER;
+            m_lock.Lock(MUTEX_CONTEXT);
+            ajn::ARDP_Run(m_handle, m_sock, sockRead, true, &ms);
+            m_lock.Unlock(MUTEX_CONTEXT);
+            m_runCalls++;
+
+            signaledEvents.clear();
+            QStatus status = qcc::Event::Wait(checkEvents, signaledEvents, ms);
+            sockRead = false;
+            if (status != ER_OK) {
+                continue;
+            }
+            for (std::vector<qcc::Event*>::iterator it = signaledEvents.begin(); it != signaledEvents.end(); ++it) {
+                if (*it == &sockEvent) {
+                    sockRead = true;
+                } else if (*it == &m_wakeEvent) {
+                    m_wakeEvent.ResetEvent();
+                }
+            }
+        }
+        return this;
+    }
+
+  private:
+    static ArdpTestEndpoint* FromHandle(ajn::ArdpHandle* handle) {
+        return reinterpret_cast<ArdpTestEndpoint*>(ajn::ARDP_GetHandleContext(handle));
+    }
+
+    static bool AcceptCb(ajn::ArdpHandle* handle, qcc::IPAddress ipAddr, uint16_t ipPort, ajn::ArdpConnRecord* conn, uint8_t* buf, uint16_t len, QStatus status) {
+        ArdpTestEndpoint* ep = FromHandle(handle);
+        if (!ep->m_listener->Accept(*ep, conn)) {
+            return false;
+        }
+        status = ajn::ARDP_Accept(handle, conn, ep->m_config.segmax, ep->m_config.segbmax, (uint8_t*)s_acceptString, strlen(s_acceptString) + 1);
+        return status == ER_OK;
+    }
+
+    static void ConnectCb(ajn::ArdpHandle* handle, ajn::ArdpConnRecord* conn, bool passive, uint8_t* buf, uint16_t len, QStatus status) {
+        ArdpTestEndpoint* ep = FromHandle(handle);
+        ep->m_listener->Connected(*ep, conn, passive, status);
+        if (status != ER_OK) {
+            ajn::ARDP_ReleaseConnection(handle, conn);
+        }
+    }
+
+    static void DisconnectCb(ajn::ArdpHandle* handle, ajn::ArdpConnRecord* conn, QStatus status) {
+        ArdpTestEndpoint* ep = FromHandle(handle);
+        ep->m_listener->Disconnected(*ep, conn, status);
+        ajn::ARDP_ReleaseConnection(handle, conn);
+    }
+
+    static void RecvCb(ajn::ArdpHandle* handle, ajn::ArdpConnRecord* conn, ajn::ArdpRcvBuf* rcv, QStatus status) {
+        ArdpTestEndpoint* ep = FromHandle(handle);
+        ep->m_listener->Received(*ep, conn, rcv, status);
+    }
+
+    static void SendCb(ajn::ArdpHandle* handle, ajn::ArdpConnRecord* conn, uint8_t* buf, uint32_t len, QStatus status) {
+        ArdpTestEndpoint* ep = FromHandle(handle);
+        ep->m_listener->Sent(*ep, conn, buf, len, status);
+    }
+
+    static void SendWindowCb(ajn::ArdpHandle* handle, ajn::ArdpConnRecord* conn, uint16_t window, QStatus status) {
+        ArdpTestEndpoint* ep = FromHandle(handle);
+        ep->m_listener->Window(*ep, conn, window, status);
+    }
+
+    static const char* const s_connString;
+    static const char* const s_acceptString;
+
+    ArdpEndpointListener* m_listener;
+    ajn::ArdpGlobalConfig m_config;
+    ajn::ArdpHandle* m_handle;
+    qcc::SocketFd m_sock;
+    uint16_t m_port;
+    bool m_reusePort;
+    int m_cpu;
+    qcc::Mutex m_lock;
+    qcc::Event m_wakeEvent;
+    volatile bool m_stopping;
+    uint64_t m_runCalls;
+};
+
+/* The tools are single translation units, so defining these here is fine */
+const char* const ArdpTestEndpoint::s_connString = "ARDP TEST CONNECT REQUEST";
+const char* const ArdpTestEndpoint::s_acceptString = "ARDP TEST CONNECT RESPONSE";
+
+inline void ArdpEndpointListener::Received(ArdpTestEndpoint& ep, ajn::ArdpConnRecord* conn, ajn::ArdpRcvBuf* rcv, QStatus status)
+{
+    ep.RecvReady(conn, rcv);
+}
+
+#endif
@@ -0,0 +1,225 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef _LATENCYHISTOGRAM_H
+#define _LATENCYHISTOGRAM_H
+
+/*
+ * Header-only latency histogram shared by the benchmark programs in misc.
+ * The test programs are each built from a single source file, so everything
+ * here is inline.
+ */
+
+#include <qcc/platform.h>
+#include <qcc/String.h>
+
+#include <stdio.h>
+#include <vector>
+
+#ifdef _WIN32
+#include <qcc/time.h>
+#else
+#include <time.h>
+#endif
+
+/**
+ * Monotonic time in microseconds.  On Linux this is CLOCK_MONOTONIC, which is
+ * system wide, so timestamps taken by two processes on the same host can be
+ * subtracted from each other.
+ */
+static inline uint64_t GetTimestampMicros()
+{
+#ifdef _WIN32
+    return qcc::GetTimestamp64() * 1000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/**
+ * Log-linear (HDR style) histogram of non-negative integer values, normally
+ * microseconds.  Values below 2^subBucketBits are counted exactly; above that
+ * every power of two is split into 2^(subBucketBits - 1) equal buckets, so a
+ * reported percentile is never more than 1/2^(subBucketBits - 1) above the
+ * true value.  Memory grows with the largest recorded value only, a few
+ * kilobytes for anything up to an hour.
+ *
+ * Not thread safe; callers serialize Record() with their own lock.
+ */
+class LatencyHistogram {
+
+  public:
+    LatencyHistogram(const char* name = "", uint32_t subBucketBits = 7) :
+        m_name(name), m_subBucketBits(subBucketBits), m_subBucketCount(1ULL << subBucketBits),
+        m_count(0), m_sum(0), m_min(0), m_max(0) { }
+
+    void Record(uint64_t value, uint64_t count = 1) {
+        size_t index = IndexOf(value);
+        if (index >= m_counts.size()) {
+            m_counts.resize(index + 1, 0);
+        }
+        m_counts[index] += count;
+        if (m_count == 0 || value < m_min) {
+            m_min = value;
+        }
+        if (value > m_max) {
+            m_max = value;
+        }
+        m_count += count;
+        m_sum += value * count;
+    }
+
+    void Merge(const LatencyHistogram& other) {
+        if (other.m_count == 0) {
+            return;
+        }
+        if (other.m_counts.size() > m_counts.size()) {
+            m_counts.resize(other.m_counts.size(), 0);
+        }
+        for (size_t i = 0; i < other.m_counts.size(); ++i) {
+            m_counts[i] += other.m_counts[i];
+        }
+        if (m_count == 0 || other.m_min < m_min) {
+            m_min = other.m_min;
+        }
+        if (other.m_max > m_max) {
+            m_max = other.m_max;
+        }
+        m_count += other.m_count;
+        m_sum += other.m_sum;
+    }
+
+    void Reset() {
+        m_counts.clear();
+        m_count = m_sum = m_min = m_max = 0;
+    }
+
+    const char* GetName() const { return m_name.c_str(); }
+    uint64_t GetCount() const { return m_count; }
+    uint64_t GetMin() const { return m_min; }
+    uint64_t GetMax() const { return m_max; }
+    double GetMean() const { return m_count ? (double)m_sum / m_count : 0.0; }
+
+    /**
+     * Smallest recorded value such that percentile% of all values are at or
+     * below it (to the resolution of the bucket it falls in).
+     *
+     * @param percentile  0.0 to 100.0
+     */
+    uint64_t GetPercentile(double percentile) const {
+        if (m_count == 0) {
+            return 0;
+        }
+        uint64_t target = (uint64_t)((percentile / 100.0) * m_count + 0.5);
+        if (target < 1) {
+            target = 1;
+        }
+        if (target > m_count) {
+            target = m_count;
+        }
+        uint64_t seen = 0;
+        for (size_t i = 0; i < m_counts.size(); ++i) {
+            seen += m_counts[i];
+            if (seen >= target) {
+                uint64_t value = HighestEquivalent(i);
+                return (value > m_max) ? m_max : value;
+            }
+        }
+        return m_max;
+    }
+
+    /** One line: count, mean, p50/p90/p99/p99.9 and max */
+    void PrintSummary(FILE* fp = stdout) const {
+        fprintf(fp, "%-24s count %10llu  mean %10.1f  p50 %8llu  p90 %8llu  p99 %8llu  p99.9 %8llu  max %8llu (us)\n",
+                m_name.c_str(), (unsigned long long)m_count, GetMean(),
+                (unsigned long long)GetPercentile(50.0), (unsigned long long)GetPercentile(90.0),
+                (unsigned long long)GetPercentile(99.0), (unsigned long long)GetPercentile(99.9),
+                (unsigned long long)m_max);
+    }
+
+    static void WriteCsvHeader(FILE* fp) {
+        fprintf(fp, "histogram,count,min_us,mean_us,p50_us,p90_us,p99_us,p999_us,max_us\n");
+    }
+
+    void WriteCsvRow(FILE* fp) const {
+        fprintf(fp, "%s,%llu,%llu,%.1f,%llu,%llu,%llu,%llu,%llu\n", m_name.c_str(),
+                (unsigned long long)m_count, (unsigned long long)m_min, GetMean(),
+                (unsigned long long)GetPercentile(50.0), (unsigned long long)GetPercentile(90.0),
+                (unsigned long long)GetPercentile(99.0), (unsigned long long)GetPercentile(99.9),
+                (unsigned long long)m_max);
+    }
+
+    /** JSON object with the summary and the non-empty buckets as [upper bound, count] pairs */
+    void WriteJson(FILE* fp) const {
+        fprintf(fp, "{\"name\": \"%s\", \"count\": %llu, \"min_us\": %llu, \"mean_us\": %.1f, "
+                "\"p50_us\": %llu, \"p90_us\": %llu, \"p99_us\": %llu, \"p999_us\": %llu, \"max_us\": %llu, \"buckets\": [",
+                m_name.c_str(), (unsigned long long)m_count, (unsigned long long)m_min, GetMean(),
+                (unsigned long long)GetPercentile(50.0), (unsigned long long)GetPercentile(90.0),
+                (unsigned long long)GetPercentile(99.0), (unsigned long long)GetPercentile(99.9),
+                (unsigned long long)m_max);
+        bool first = true;
+        for (size_t i = 0; i < m_counts.size(); ++i) {
+            if (m_counts[i]) {
+                fprintf(fp, "%s[%llu, %llu]", first ? "" : ", ", (unsigned long long)HighestEquivalent(i), (unsigned long long)m_counts[i]);
+                first = false;
+            }
+        }
+        fprintf(fp, "]}");
+    }
+
+  private:
+    static uint32_t HighestBit(uint64_t value) {
+#if defined(__GNUC__)
+        return 63 - __builtin_clzll(value);
+#else
+        uint32_t bit = 0;
+        while (value >>= 1) {
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+
+    size_t IndexOf(uint64_t value) const {
+        if (value < m_subBucketCount) {
+            return (size_t)value;
+        }
+        uint32_t shift = HighestBit(value) - m_subBucketBits + 1;
+        return (size_t)(shift * (m_subBucketCount >> 1) + (value >> shift));
+    }
+
+    uint64_t HighestEquivalent(size_t index) const {
+        if (index < m_subBucketCount) {
+            return index;
+        }
+        uint64_t half = m_subBucketCount >> 1;
+        uint32_t shift = (uint32_t)(index / half - 1);
+        uint64_t mantissa = index - shift * half;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    qcc::String m_name;
+    uint32_t m_subBucketBits;
+    uint64_t m_subBucketCount;
+    std::vector<uint64_t> m_counts;
+    uint64_t m_count;
+    uint64_t m_sum;
+    uint64_t m_min;
+    uint64_t m_max;
+};
+
+#endif
@@ -0,0 +1,505 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef _MDNSPACKET_H
+#define _MDNSPACKET_H
+
+/*
+ * Builder and parser for the mDNS packets of the AllJoyn name service, for
+ * the test programs only.  Everything works in a buffer the caller owns,
+ * nothing is allocated.
+ *
+ * MdnsBuildIsAt() and MdnsBuildWhoHas() lay packets out the way the router
+ * does: the _alljoyn._tcp.local PTR, SRV and TXT answers, the advertise or
+ * search TXT record with txtvers, t_# and n_# entries, the sender-info TXT
+ * record and the A/AAAA records, with the same compression pointers.
+ *
+ * MdnsParse() splits a packet into its fields (counts, label lengths,
+ * compression pointers, rdlengths, TXT strings, ...), so a fuzzer can
+ * mutate one field at a time instead of random byte ranges.
+ */
+
+#include <qcc/platform.h>
+
+#include <stdio.h>
+#include <string.h>
+
+enum {
+    MDNS_TYPE_A = 1,
+    MDNS_TYPE_PTR = 12,
+    MDNS_TYPE_TXT = 16,
+    MDNS_TYPE_AAAA = 28,
+    MDNS_TYPE_SRV = 33
+};
+
+const uint16_t MDNS_CLASS_IN = 1;
+const uint16_t MDNS_CLASS_QU = 0x8001;   /**< IN with the unicast-response bit, used by WHO-HAS */
+const uint16_t MDNS_FLAG_RESPONSE = 0x8000;
+
+/* Writes a packet front to back; once something does not fit, Ok() is false and nothing more is written */
+class MdnsWriter {
+
+  public:
+    MdnsWriter(uint8_t* buf, size_t size) : m_buf(buf), m_size(size), m_pos(0), m_ok(true) { }
+
+    size_t Offset() const { return m_pos; }
+    bool Ok() const { return m_ok; }
+
+    void U8(uint8_t v) {
+        if (Room(1)) {
+            m_buf[m_pos++] = v;
+        }
+    }
+
+    void U16(uint16_t v) {
+        if (Room(2)) {
+            m_buf[m_pos++] = (uint8_t)(v >> 8);
+            m_buf[m_pos++] = (uint8_t)v;
+        }
+    }
+
+    void U32(uint32_t v) {
+        U16((uint16_t)(v >> 16));
+        U16((uint16_t)v);
+    }
+
+    void Bytes(const void* data, size_t len) {
+        if (Room(len)) {
+            memcpy(m_buf + m_pos, data, len);
+            m_pos += len;
+        }
+    }
+
+    void Header(uint16_t id, uint16_t flags, uint16_t qdCount, uint16_t anCount, uint16_t nsCount, uint16_t arCount) {
+        U16(id);
+        U16(flags);
+        U16(qdCount);
+        U16(anCount);
+        U16(nsCount);
+        U16(arCount);
+    }
+
+    /** One label of a name; returns its offset for compression pointers to it */
+    uint16_t Label(const char* label) {
+        uint16_t offset = (uint16_t)m_pos;
+        size_t len = strlen(label);
+        if (len > 63) {
+            m_ok = false;
+            return offset;
+        }
+        U8((uint8_t)len);
+        Bytes(label, len);
+        return offset;
+    }
+
+    /** End a name with a compression pointer to an earlier label */
+    void Pointer(uint16_t offset) {
+        U16(0xC000 | offset);
+    }
+
+    /** End a name with the root label */
+    void Root() {
+        U8(0);
+    }
+
+    void Question(uint16_t type, uint16_t cls) {
+        U16(type);
+        U16(cls);
+    }
+
+    /** Type, class, TTL and a placeholder rdlength, after the owner name; pass the result to EndRecord() */
+    size_t BeginRecord(uint16_t type, uint16_t cls, uint32_t ttl) {
+        U16(type);
+        U16(cls);
+        U32(ttl);
+        size_t rdLength = m_pos;
+        U16(0);
+        return rdLength;
+    }
+
+    void EndRecord(size_t rdLength) {
+        if (m_ok) {
+            uint16_t len = (uint16_t)(m_pos - rdLength - 2);
+            m_buf[rdLength] = (uint8_t)(len >> 8);
+            m_buf[rdLength + 1] = (uint8_t)len;
+        }
+    }
+
+    /** One TXT string "key=value" */
+    void Txt(const char* key, const char* value) {
+        size_t keyLen = strlen(key);
+        size_t valueLen = strlen(value);
+        if (keyLen + 1 + valueLen > 255) {
+            m_ok = false;
+            return;
+        }
+        U8((uint8_t)(keyLen + 1 + valueLen));
+        Bytes(key, keyLen);
+        U8('=');
+        Bytes(value, valueLen);
+    }
+
+    void Txt(const char* key, uint32_t value) {
+        char digits[12];
+        snprintf(digits, sizeof(digits), "%u", value);
+        Txt(key, digits);
+    }
+
+    /** A numbered TXT string, t_# or n_# */
+    void TxtNumbered(char prefix, uint32_t number, const char* value) {
+        char key[16];
+        snprintf(key, sizeof(key), "%c_%u", prefix, number);
+        Txt(key, value);
+    }
+
+  private:
+    bool Room(size_t len) {
+        if (!m_ok || m_pos + len > m_size) {
+            m_ok = false;
+            return false;
+        }
+        return true;
+    }
+
+    uint8_t* m_buf;
+    size_t m_size;
+    size_t m_pos;
+    bool m_ok;
+};
+
+/** The sender-info TXT record; ipv4 NULL and zero ports are left out */
+struct MdnsSenderInfo {
+    uint32_t pv;
+    uint32_t sid;
+    const char* ipv4;
+    uint16_t upcv4;
+    uint16_t upcv6;
+};
+
+struct MdnsIsAt {
+    uint16_t id;
+    const char* guid;           /**< Daemon GUID, 32 hex digits */
+    uint16_t port;              /**< SRV port */
+    uint16_t transport;         /**< t_# transport mask of the names */
+    const char* const* names;
+    size_t numNames;
+    uint32_t ttl;
+    const uint8_t* ipv4;        /**< A record, NULL for none */
+    const uint8_t* ipv6;        /**< AAAA record, NULL for none */
+    MdnsSenderInfo sender;
+};
+
+struct MdnsWhoHas {
+    uint16_t id;
+    const char* guid;
+    const char* const* names;   /**< Names or prefixes ending in '*' */
+    size_t numNames;
+    uint32_t ttl;
+    MdnsSenderInfo sender;
+};
+
+static inline void MdnsWriteSenderInfo(MdnsWriter& w, uint16_t owner, uint32_t ttl, const MdnsSenderInfo& info)
+{
+    w.Label("sender-info");
+    w.Pointer(owner);
+    size_t rd = w.BeginRecord(MDNS_TYPE_TXT, MDNS_CLASS_IN, ttl);
+    w.Txt("txtvers", 0u);
+    if (info.ipv4) {
+        w.Txt("ipv4", info.ipv4);
+    }
+    w.Txt("pv", info.pv);
+    w.Txt("sid", info.sid);
+    if (info.upcv4) {
+        w.Txt("upcv4", info.upcv4);
+    }
+    if (info.upcv6) {
+        w.Txt("upcv6", info.upcv6);
+    }
+    w.EndRecord(rd);
+}
+
+/** Build an IS-AT response into buf; returns its length, 0 if it does not fit */
+static inline size_t MdnsBuildIsAt(const MdnsIsAt& p, uint8_t* buf, size_t size)
+{
+    MdnsWriter w(buf, size);
+    w.Header(p.id, MDNS_FLAG_RESPONSE, 0, 3, 0, 2 + (p.ipv4 ? 1 : 0) + (p.ipv6 ? 1 : 0));
+
+    /* _alljoyn._tcp.local PTR <guid>._alljoyn._tcp.local */
+    uint16_t service = w.Label("_alljoyn");
+    w.Label("_tcp");
+    uint16_t local = w.Label("local");
+    w.Root();
+    size_t rd = w.BeginRecord(MDNS_TYPE_PTR, MDNS_CLASS_IN, p.ttl);
+    uint16_t instance = w.Label(p.guid);
+    w.Pointer(service);
+    w.EndRecord(rd);
+
+    /* <guid>._alljoyn._tcp.local SRV <guid>.local */
+    w.Pointer(instance);
+    rd = w.BeginRecord(MDNS_TYPE_SRV, MDNS_CLASS_IN, p.ttl);
+    w.U16(1);
+    w.U16(1);
+    w.U16(p.port);
+    uint16_t target = w.Label(p.guid);
+    w.Pointer(local);
+    w.EndRecord(rd);
+
+    w.Pointer(instance);
+    rd = w.BeginRecord(MDNS_TYPE_TXT, MDNS_CLASS_IN, p.ttl);
+    w.Txt("txtvers", 0u);
+    w.EndRecord(rd);
+
+    /* advertise.<guid>.local TXT with the names */
+    w.Label("advertise");
+    w.Pointer(target);
+    rd = w.BeginRecord(MDNS_TYPE_TXT, MDNS_CLASS_IN, p.ttl);
+    w.Txt("txtvers", 0u);
+    uint32_t n = 1;
+    char transport[8];
+    snprintf(transport, sizeof(transport), "%x", p.transport);
+    w.TxtNumbered('t', n++, transport);
+    for (size_t i = 0; i < p.numNames; ++i) {
+        w.TxtNumbered('n', n++, p.names[i]);
+    }
+    w.EndRecord(rd);
+
+    MdnsWriteSenderInfo(w, target, p.ttl, p.sender);
+
+    if (p.ipv4) {
+        w.Pointer(target);
+        rd = w.BeginRecord(MDNS_TYPE_A, MDNS_CLASS_IN, p.ttl);
+        w.Bytes(p.ipv4, 4);
+        w.EndRecord(rd);
+    }
+    if (p.ipv6) {
+        w.Pointer(target);
+        rd = w.BeginRecord(MDNS_TYPE_AAAA, MDNS_CLASS_IN, p.ttl);
+        w.Bytes(p.ipv6, 16);
+        w.EndRecord(rd);
+    }
+    return w.Ok() ? w.Offset() : 0;
+}
+
+/** Build a WHO-HAS query into buf; returns its length, 0 if it does not fit */
+static inline size_t MdnsBuildWhoHas(const MdnsWhoHas& p, uint8_t* buf, size_t size)
+{
+    MdnsWriter w(buf, size);
+    w.Header(p.id, 0, 2, 0, 0, 2);
+
+    w.Label("_alljoyn");
+    w.Label("_tcp");
+    uint16_t local = w.Label("local");
+    w.Root();
+    w.Question(MDNS_TYPE_PTR, MDNS_CLASS_QU);
+    w.Label("_alljoyn");
+    w.Label("_udp");
+    w.Pointer(local);
+    w.Question(MDNS_TYPE_PTR, MDNS_CLASS_QU);
+
+    /* search.<guid>.local TXT with the names */
+    w.Label("search");
+    uint16_t owner = w.Label(p.guid);
+    w.Pointer(local);
+    size_t rd = w.BeginRecord(MDNS_TYPE_TXT, MDNS_CLASS_IN, p.ttl);
+    w.Txt("txtvers", 0u);
+    for (size_t i = 0; i < p.numNames; ++i) {
+        w.TxtNumbered('n', (uint32_t)i + 1, p.names[i]);
+    }
+    w.EndRecord(rd);
+
+    MdnsWriteSenderInfo(w, owner, p.ttl, p.sender);
+    return w.Ok() ? w.Offset() : 0;
+}
+
+/* What a byte range of a parsed packet holds */
+enum MdnsFieldKind {
+    MDNS_FIELD_ID,              /**< Header id and flags */
+    MDNS_FIELD_COUNT,           /**< Header section counts */
+    MDNS_FIELD_LABEL_LENGTH,    /**< Label length byte, the root label included */
+    MDNS_FIELD_LABEL,           /**< Label text */
+    MDNS_FIELD_POINTER,         /**< Compression pointer */
+    MDNS_FIELD_TYPE,
+    MDNS_FIELD_CLASS,
+    MDNS_FIELD_TTL,
+    MDNS_FIELD_RDLENGTH,
+    MDNS_FIELD_TXT_LENGTH,      /**< Length byte of one TXT string */
+    MDNS_FIELD_TXT,             /**< TXT string text */
+    MDNS_FIELD_SRV,             /**< SRV priority and weight */
+    MDNS_FIELD_PORT,            /**< SRV port */
+    MDNS_FIELD_ADDRESS,         /**< A or AAAA address */
+    MDNS_FIELD_RDATA,           /**< Record data of any other type */
+    MDNS_FIELD_KINDS
+};
+
+struct MdnsField {
+    uint16_t offset;
+    uint16_t length;
+    uint8_t kind;
+};
+
+/* The fields of one packet, fixed capacity; a packet with more fields is only mapped up to it */
+struct MdnsFieldMap {
+    static const size_t MAX_FIELDS = 256;
+    MdnsField fields[MAX_FIELDS];
+    size_t count;
+
+    MdnsFieldMap() : count(0) { }
+
+    void Add(size_t offset, size_t length, MdnsFieldKind kind) {
+        if (count < MAX_FIELDS) {
+            fields[count].offset = (uint16_t)offset;
+            fields[count].length = (uint16_t)length;
+            fields[count].kind = (uint8_t)kind;
+            count++;
+        }
+    }
+};
+
+static inline uint16_t MdnsGet16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline void MdnsPut16(uint8_t* p, uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+/* Map one name at pos; compression pointers are recorded, not followed */
+static inline bool MdnsParseName(const uint8_t* buf, size_t end, size_t& pos, MdnsFieldMap& map)
+{
+    while (pos < end) {
+        uint8_t len = buf[pos];
+        if ((len & 0xC0) == 0xC0) {
+            if (pos + 2 > end) {
+                return false;
+            }
+            map.Add(pos, 2, MDNS_FIELD_POINTER);
+            pos += 2;
+            return true;
+        }
+        if (len & 0xC0) {
+            return false;
+        }
+        map.Add(pos, 1, MDNS_FIELD_LABEL_LENGTH);
+        pos++;
+        if (len == 0) {
+            return true;
+        }
+        if (pos + len > end) {
+            return false;
+        }
+        map.Add(pos, len, MDNS_FIELD_LABEL);
+        pos += len;
+    }
+    return false;
+}
+
+/**
+ * Map the fields of a packet.  Returns false where the packet stops making
+ * sense; the fields up to there are still in map.
+ */
+static inline bool MdnsParse(const uint8_t* buf, size_t len, MdnsFieldMap& map)
+{
+    map.count = 0;
+    if (len < 12) {
+        return false;
+    }
+    map.Add(0, 4, MDNS_FIELD_ID);
+    uint32_t counts[4];
+    for (int i = 0; i < 4; ++i) {
+        map.Add(4 + 2 * i, 2, MDNS_FIELD_COUNT);
+        counts[i] = MdnsGet16(buf + 4 + 2 * i);
+    }
+    size_t pos = 12;
+    for (uint32_t q = 0; q < counts[0]; ++q) {
+        if (!MdnsParseName(buf, len, pos, map) || pos + 4 > len) {
+            return false;
+        }
+        map.Add(pos, 2, MDNS_FIELD_TYPE);
+        map.Add(pos + 2, 2, MDNS_FIELD_CLASS);
+        pos += 4;
+    }
+    uint32_t records = counts[1] + counts[2] + counts[3];
+    for (uint32_t r = 0; r < records; ++r) {
+        if (!MdnsParseName(buf, len, pos, map) || pos + 10 > len) {
+            return false;
+        }
+        uint16_t type = MdnsGet16(buf + pos);
+        uint16_t rdLength = MdnsGet16(buf + pos + 8);
+        map.Add(pos, 2, MDNS_FIELD_TYPE);
+        map.Add(pos + 2, 2, MDNS_FIELD_CLASS);
+        map.Add(pos + 4, 4, MDNS_FIELD_TTL);
+        map.Add(pos + 8, 2, MDNS_FIELD_RDLENGTH);
+        pos += 10;
+        size_t end = pos + rdLength;
+        if (end > len) {
+            return false;
+        }
+        switch (type) {
+        case MDNS_TYPE_PTR:
+            if (!MdnsParseName(buf, end, pos, map)) {
+                return false;
+            }
+            break;
+
+        case MDNS_TYPE_SRV:
+            if (pos + 6 > end) {
+                return false;
+            }
+            map.Add(pos, 4, MDNS_FIELD_SRV);
+            map.Add(pos + 4, 2, MDNS_FIELD_PORT);
+            pos += 6;
+            if (!MdnsParseName(buf, end, pos, map)) {
+                return false;
+            }
+            break;
+
+        case MDNS_TYPE_TXT:
+            while (pos < end) {
+                uint8_t txtLength = buf[pos];
+                map.Add(pos, 1, MDNS_FIELD_TXT_LENGTH);
+                pos++;
+                if (pos + txtLength > end) {
+                    return false;
+                }
+                if (txtLength) {
+                    map.Add(pos, txtLength, MDNS_FIELD_TXT);
+                }
+                pos += txtLength;
+            }
+            break;
+
+        case MDNS_TYPE_A:
+        case MDNS_TYPE_AAAA:
+            if (rdLength) {
+                map.Add(pos, rdLength, MDNS_FIELD_ADDRESS);
+            }
+            break;
+
+        default:
+            if (rdLength) {
+                map.Add(pos, rdLength, MDNS_FIELD_RDATA);
+            }
+            break;
+        }
+        /* Anything a PTR or SRV name leaves over is skipped with the record */
+        pos = end;
+    }
+    return pos == len;
+}
+
+#endif
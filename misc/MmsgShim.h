@@ -0,0 +1,367 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef _MMSGSHIM_H
+#define _MMSGSHIM_H
+
+/*
+ * Batched UDP I/O under ARDP, for the benchmarks only (Linux).
+ *
+ * ARDP reads with qcc::RecvFrom and writes with qcc::SendTo/SendToSG, which
+ * end up in recvfrom(), sendto() and sendmsg().  The test hooks see those
+ * datagrams but cannot change how they reach the kernel, so this header
+ * interposes the three libc calls instead.  For a socket registered with
+ * MmsgShim::Register():
+ *
+ *  - recvfrom() is served from a ring that one recvmmsg() call fills with
+ *    up to <batch> datagrams;
+ *  - sendto()/sendmsg() copy the datagram into a queue and return at once;
+ *    the queue goes out with one sendmmsg() when it is full or when the run
+ *    loop calls Flush() after ARDP_Run.
+ *
+ * Every other descriptor goes straight to libc.  Including this header in a
+ * program interposes the calls process wide, so only the benchmark programs
+ * include it.  A batch size of 1 goes through the same path with one
+ * syscall per datagram, which is the baseline to compare against.
+ *
+ * The run loop must treat Pending() as "socket readable", since datagrams
+ * already pulled into the ring no longer wake up a poll on the socket.
+ */
+
+#include <qcc/platform.h>
+#include <qcc/Mutex.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__linux__)
+#include <dlfcn.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#endif
+
+class MmsgShim {
+
+  public:
+    struct Stats {
+        uint64_t recvCalls;          /**< recvfrom() calls made by ARDP */
+        uint64_t recvSyscalls;       /**< recvmmsg() calls made on its behalf */
+        uint64_t recvDatagrams;
+        uint64_t sendCalls;          /**< sendto()/sendmsg() calls made by ARDP */
+        uint64_t sendSyscalls;       /**< sendmmsg() calls made on its behalf */
+        uint64_t sendDatagrams;
+        uint64_t sendDropped;        /**< Queued datagrams the kernel would not take */
+
+        Stats() : recvCalls(0), recvSyscalls(0), recvDatagrams(0), sendCalls(0), sendSyscalls(0), sendDatagrams(0), sendDropped(0) { }
+    };
+
+    /** Datagrams one recvmmsg/sendmmsg takes at most (UIO_MAXIOV) */
+    static const uint32_t MAX_BATCH = 1024;
+
+    static MmsgShim& Instance() {
+        static MmsgShim shim;
+        return shim;
+    }
+
+    /** Start batching on fd, up to batch datagrams per syscall.  False where unsupported. */
+    bool Register(int fd, uint32_t batch) {
+#if defined(__linux__)
+        if (fd < 0 || fd >= MAX_FDS || batch == 0) {
+            return false;
+        }
+        if (batch > MAX_BATCH) {
+            batch = MAX_BATCH;
+        }
+        FdState* st = new FdState(batch);
+        m_fds[fd] = st;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /** Datagrams already read from the kernel but not yet handed to ARDP */
+    bool Pending(int fd) {
+        FdState* st = Lookup(fd);
+        if (!st) {
+            return false;
+        }
+        st->lock.Lock(MUTEX_CONTEXT);
+        bool pending = st->rxNext < st->rxCount;
+        st->lock.Unlock(MUTEX_CONTEXT);
+        return pending;
+    }
+
+    /** Send everything queued on fd */
+    void Flush(int fd) {
+        FdState* st = Lookup(fd);
+        if (st) {
+            st->lock.Lock(MUTEX_CONTEXT);
+            FlushLocked(fd, st);
+            st->lock.Unlock(MUTEX_CONTEXT);
+        }
+    }
+
+    Stats GetStats(int fd) {
+        Stats stats;
+        FdState* st = Lookup(fd);
+        if (st) {
+            st->lock.Lock(MUTEX_CONTEXT);
+            stats = st->stats;
+            st->lock.Unlock(MUTEX_CONTEXT);
+        }
+        return stats;
+    }
+
+    /**
+     * Syscall accounting for fd.  messages is the number of application
+     * messages sent plus received over the run, used for the per message
+     * ratio.
+     */
+    void PrintStats(int fd, uint64_t messages, FILE* fp = stdout) {
+        FdState* st = Lookup(fd);
+        if (!st) {
+            return;
+        }
+        Stats s = GetStats(fd);
+        uint64_t syscalls = s.recvSyscalls + s.sendSyscalls;
+        fprintf(fp, "MMSG: batch %u: in %llu datagrams via %llu recvfrom -> %llu recvmmsg (%.2f per syscall)\n", st->batch,
+                (unsigned long long)s.recvDatagrams, (unsigned long long)s.recvCalls, (unsigned long long)s.recvSyscalls,
+                s.recvSyscalls ? (double)s.recvDatagrams / s.recvSyscalls : 0.0);
+        fprintf(fp, "MMSG: out %llu datagrams via %llu sendmsg/sendto -> %llu sendmmsg (%.2f per syscall), %llu dropped\n",
+                (unsigned long long)s.sendDatagrams, (unsigned long long)s.sendCalls, (unsigned long long)s.sendSyscalls,
+                s.sendSyscalls ? (double)s.sendDatagrams / s.sendSyscalls : 0.0, (unsigned long long)s.sendDropped);
+        fprintf(fp, "MMSG: %llu socket syscalls for %llu messages, %.3f per message\n",
+                (unsigned long long)syscalls, (unsigned long long)messages, messages ? (double)syscalls / messages : 0.0);
+    }
+
+#if defined(__linux__)
+    ssize_t RecvFrom(int fd, void* buf, size_t len, int flags, struct sockaddr* addr, socklen_t* addrlen) {
+        FdState* st = Lookup(fd);
+        if (!st) {
+            return RealRecvFrom()(fd, buf, len, flags, addr, addrlen);
+        }
+        st->lock.Lock(MUTEX_CONTEXT);
+        st->stats.recvCalls++;
+        if (st->rxNext == st->rxCount) {
+            for (uint32_t i = 0; i < st->batch; ++i) {
+                st->rxMsgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+            }
+            st->stats.recvSyscalls++;
+            int n = recvmmsg(fd, &st->rxMsgs[0], st->batch, MSG_DONTWAIT, NULL);
+            if (n <= 0) {
+                int err = errno;
+                st->lock.Unlock(MUTEX_CONTEXT);
+                errno = err;
+                return n;
+            }
+            st->rxCount = n;
+            st->rxNext = 0;
+        }
+        struct mmsghdr& m = st->rxMsgs[st->rxNext++];
+        size_t copy = (m.msg_len < len) ? m.msg_len : len;
+        memcpy(buf, m.msg_hdr.msg_iov->iov_base, copy);
+        if (addr && addrlen) {
+            socklen_t alen = (m.msg_hdr.msg_namelen < *addrlen) ? m.msg_hdr.msg_namelen : *addrlen;
+            memcpy(addr, m.msg_hdr.msg_name, alen);
+            *addrlen = m.msg_hdr.msg_namelen;
+        }
+        st->stats.recvDatagrams++;
+        st->lock.Unlock(MUTEX_CONTEXT);
+        return (ssize_t)copy;
+    }
+
+    ssize_t SendMsg(int fd, const struct msghdr* msg, int flags) {
+        FdState* st = Lookup(fd);
+        if (!st) {
+            return RealSendMsg()(fd, msg, flags);
+        }
+        st->lock.Lock(MUTEX_CONTEXT);
+        st->stats.sendCalls++;
+        uint32_t slot = st->txCount++;
+        uint8_t* p = &st->txBuf[slot * SLOT_SIZE];
+        size_t total = 0;
+        for (size_t i = 0; i < msg->msg_iovlen; ++i) {
+            size_t n = msg->msg_iov[i].iov_len;
+            if (total + n > SLOT_SIZE) {
+                n = SLOT_SIZE - total;
+            }
+            memcpy(p + total, msg->msg_iov[i].iov_base, n);
+            total += n;
+        }
+        Queue(st, slot, total, msg->msg_name, msg->msg_namelen);
+        if (st->txCount == st->batch) {
+            FlushLocked(fd, st);
+        }
+        st->lock.Unlock(MUTEX_CONTEXT);
+        return (ssize_t)total;
+    }
+
+    ssize_t SendTo(int fd, const void* buf, size_t len, int flags, const struct sockaddr* addr, socklen_t addrlen) {
+        FdState* st = Lookup(fd);
+        if (!st) {
+            return RealSendTo()(fd, buf, len, flags, addr, addrlen);
+        }
+        st->lock.Lock(MUTEX_CONTEXT);
+        st->stats.sendCalls++;
+        uint32_t slot = st->txCount++;
+        size_t n = (len < SLOT_SIZE) ? len : SLOT_SIZE;
+        memcpy(&st->txBuf[slot * SLOT_SIZE], buf, n);
+        Queue(st, slot, n, addr, addrlen);
+        if (st->txCount == st->batch) {
+            FlushLocked(fd, st);
+        }
+        st->lock.Unlock(MUTEX_CONTEXT);
+        return (ssize_t)len;
+    }
+#endif
+
+  private:
+    static const int MAX_FDS = 4096;
+    static const size_t SLOT_SIZE = 65536;
+
+#if defined(__linux__)
+    typedef ssize_t (*RecvFromFn)(int, void*, size_t, int, struct sockaddr*, socklen_t*);
+    typedef ssize_t (*SendMsgFn)(int, const struct msghdr*, int);
+    typedef ssize_t (*SendToFn)(int, const void*, size_t, int, const struct sockaddr*, socklen_t);
+
+    static RecvFromFn RealRecvFrom() {
+        static RecvFromFn fn = (RecvFromFn)dlsym(RTLD_NEXT, "recvfrom");
+        return fn;
+    }
+    static SendMsgFn RealSendMsg() {
+        static SendMsgFn fn = (SendMsgFn)dlsym(RTLD_NEXT, "sendmsg");
+        return fn;
+    }
+    static SendToFn RealSendTo() {
+        static SendToFn fn = (SendToFn)dlsym(RTLD_NEXT, "sendto");
+        return fn;
+    }
+
+    struct FdState {
+        uint32_t batch;
+        qcc::Mutex lock;
+        Stats stats;
+
+        std::vector<uint8_t> rxBuf;
+        std::vector<struct iovec> rxIov;
+        std::vector<struct sockaddr_storage> rxAddr;
+        std::vector<struct mmsghdr> rxMsgs;
+        uint32_t rxCount;
+        uint32_t rxNext;
+
+        std::vector<uint8_t> txBuf;
+        std::vector<struct iovec> txIov;
+        std::vector<struct sockaddr_storage> txAddr;
+        std::vector<struct mmsghdr> txMsgs;
+        uint32_t txCount;
+
+        FdState(uint32_t batch) : batch(batch),
+            rxBuf(batch * SLOT_SIZE), rxIov(batch), rxAddr(batch), rxMsgs(batch), rxCount(0), rxNext(0),
+            txBuf(batch * SLOT_SIZE), txIov(batch), txAddr(batch), txMsgs(batch), txCount(0) {
+            memset(&rxMsgs[0], 0, batch * sizeof(struct mmsghdr));
+            memset(&txMsgs[0], 0, batch * sizeof(struct mmsghdr));
+            for (uint32_t i = 0; i < batch; ++i) {
+                rxIov[i].iov_base = &rxBuf[i * SLOT_SIZE];
+                rxIov[i].iov_len = SLOT_SIZE;
+                rxMsgs[i].msg_hdr.msg_iov = &rxIov[i];
+                rxMsgs[i].msg_hdr.msg_iovlen = 1;
+                rxMsgs[i].msg_hdr.msg_name = &rxAddr[i];
+                txIov[i].iov_base = &txBuf[i * SLOT_SIZE];
+                txMsgs[i].msg_hdr.msg_iov = &txIov[i];
+                txMsgs[i].msg_hdr.msg_iovlen = 1;
+                txMsgs[i].msg_hdr.msg_name = &txAddr[i];
+            }
+        }
+    };
+
+    static void Queue(FdState* st, uint32_t slot, size_t len, const void* addr, socklen_t addrlen) {
+        st->txIov[slot].iov_len = len;
+        if (addr && addrlen <= sizeof(struct sockaddr_storage)) {
+            memcpy(&st->txAddr[slot], addr, addrlen);
+            st->txMsgs[slot].msg_hdr.msg_namelen = addrlen;
+        } else {
+            st->txMsgs[slot].msg_hdr.msg_namelen = 0;
+        }
+    }
+
+    /* UDP may drop anyway, so whatever the kernel refuses is counted and dropped; ARDP retransmits */
+    static void FlushLocked(int fd, FdState* st) {
+        uint32_t done = 0;
+        while (done < st->txCount) {
+            st->stats.sendSyscalls++;
+            int n = sendmmsg(fd, &st->txMsgs[done], st->txCount - done, MSG_DONTWAIT);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                st->stats.sendDropped += st->txCount - done;
+                break;
+            }
+            st->stats.sendDatagrams += n;
+            done += n;
+        }
+        st->txCount = 0;
+    }
+
+    FdState* Lookup(int fd) {
+        return (fd >= 0 && fd < MAX_FDS) ? m_fds[fd] : NULL;
+    }
+
+    MmsgShim() {
+        for (int i = 0; i < MAX_FDS; ++i) {
+            m_fds[i] = NULL;
+        }
+    }
+
+    FdState* volatile m_fds[MAX_FDS];
+#else
+    struct FdState {
+        uint32_t batch;
+        qcc::Mutex lock;
+        Stats stats;
+        uint32_t rxCount;
+        uint32_t rxNext;
+    };
+
+    static void FlushLocked(int fd, FdState* st) { }
+
+    FdState* Lookup(int fd) {
+        return NULL;
+    }
+#endif
+};
+
+#if defined(__linux__)
+/* The interposers; they must have exactly the libc signatures */
+extern "C" ssize_t recvfrom(int fd, void* buf, size_t len, int flags, struct sockaddr* addr, socklen_t* addrlen)
+{
+    return MmsgShim::Instance().RecvFrom(fd, buf, len, flags, addr, addrlen);
+}
+
+extern "C" ssize_t sendmsg(int fd, const struct msghdr* msg, int flags)
+{
+    return MmsgShim::Instance().SendMsg(fd, msg, flags);
+}
+
+extern "C" ssize_t sendto(int fd, const void* buf, size_t len, int flags, const struct sockaddr* addr, socklen_t addrlen)
+{
+    return MmsgShim::Instance().SendTo(fd, buf, len, flags, addr, addrlen);
+}
+#endif
+
+#endif
@@ -0,0 +1,64 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef _XORSHIFTRNG_H
+#define _XORSHIFTRNG_H
+
+#include <qcc/platform.h>
+
+/**
+ * Small seeded pseudo random generator (xorshift64*).  Unlike random() and
+ * qcc::Rand32() it has no shared state, so every thread or every simulated
+ * link can own one and a run can be repeated exactly from its seed.
+ * Not suitable for anything security related.
+ */
+class XorShiftRng {
+
+  public:
+    XorShiftRng(uint64_t seed = 1) {
+        Seed(seed);
+    }
+
+    void Seed(uint64_t seed) {
+        /* The all-zero state is a fixed point of xorshift */
+        m_state = seed ? seed : 0x9E3779B97F4A7C15ULL;
+    }
+
+    uint64_t Next() {
+        m_state ^= m_state >> 12;
+        m_state ^= m_state << 25;
+        m_state ^= m_state >> 27;
+        return m_state * 2685821657736338717ULL;
+    }
+
+    uint32_t Next32() {
+        return (uint32_t)(Next() >> 32);
+    }
+
+    /** Uniform in [0, bound), bound > 0 */
+    uint32_t Below(uint32_t bound) {
+        return (uint32_t)(((Next() >> 32) * bound) >> 32);
+    }
+
+    /** Uniform in [0.0, 1.0) */
+    double NextDouble() {
+        return (Next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+  private:
+    uint64_t m_state;
+};
+
+#endif
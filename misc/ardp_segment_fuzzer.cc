@@ -0,0 +1,560 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Coverage guided fuzz target for the ARDP receive path (libFuzzer, or AFL
+ * with ARDP_FUZZ_STANDALONE).  Unlike ardpfuzz, nothing goes over a real
+ * network: the two handles involved sit on UDP sockets whose recvfrom,
+ * sendto and sendmsg are interposed and served from in-memory queues, so an
+ * input costs no syscalls and the handshake completes within a few ARDP_Run
+ * calls.
+ *
+ * Input layout:
+ *
+ *   u8 flags    FUZZ_CONNECTED: handle B first accepts a real connection
+ *               from handle A, and the datagrams arrive on it as if from A;
+ *               otherwise B is only listening.
+ *               FUZZ_FIX_PORTS: overwrite the ARDP ports of each datagram
+ *               with those of the connection.
+ *               FUZZ_FIX_SEQ: overwrite SEQ/ACK (and move SOM with SEQ)
+ *               with what B expects next.
+ *   then datagrams, each a big endian u16 length and that many bytes; a
+ *   short last one takes whatever is left.
+ *
+ * Both handles are created afresh for every input, so a crash reproduces
+ * from the input alone.  Setting ARDP_FUZZ_CORPUS=<dir> makes the target
+ * write a seed corpus captured from a well-formed exchange (SYN, handshake
+ * ACK, single and fragmented data, TTL data, acknowledgements, RST) into
+ * <dir> and exit.
+ */
+
+#include <qcc/platform.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <alljoyn/Init.h>
+#include <alljoyn/Status.h>
+
+#include <ArdpProtocol.h>
+
+#include "ArdpSegmentHeader.h"
+#include "ArdpTestEndpoint.h"
+
+using namespace ajn;
+
+const uint8_t FUZZ_CONNECTED = 0x01;
+const uint8_t FUZZ_FIX_PORTS = 0x02;
+const uint8_t FUZZ_FIX_SEQ = 0x04;
+
+/* Upper bound on ARDP_Run rounds per pump, in case two handles keep talking */
+const uint32_t MAX_PUMP_ROUNDS = 16;
+
+struct Datagram {
+    std::vector<uint8_t> data;
+    struct sockaddr_in from;
+};
+
+/* A real, bound UDP socket whose traffic never reaches the kernel */
+struct FakeSocket {
+    int fd;
+    struct sockaddr_in addr;
+    FakeSocket* peer;
+    std::deque<Datagram> rx;
+    /* Everything sent, kept only while generating the corpus */
+    std::vector<std::vector<uint8_t> >* capture;
+
+    FakeSocket() : fd(-1), peer(NULL), capture(NULL) {
+        memset(&addr, 0, sizeof(addr));
+    }
+};
+
+static FakeSocket g_sockA;
+static FakeSocket g_sockB;
+
+/* What the connection between A and B looks like, learned from A's and B's own segments */
+static uint16_t g_portA = 0;
+static uint16_t g_portB = 0;
+static uint32_t g_nextSeqA = 0;
+static uint32_t g_lastSeqB = 0;
+static bool g_connected = false;
+
+static FakeSocket* Lookup(int fd)
+{
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fd == g_sockA.fd) {
+        return &g_sockA;
+    }
+    if (fd == g_sockB.fd) {
+        return &g_sockB;
+    }
+    return NULL;
+}
+
+/* Follow the sequence numbers of the real traffic so injected datagrams can be made to fit */
+static void Observe(FakeSocket* s, const uint8_t* buf, size_t len)
+{
+    ArdpSegmentInfo info;
+    if (!ArdpParseSegment(buf, len, info)) {
+        return;
+    }
+    bool advances = info.IsSyn() || info.IsData();
+    if (s == &g_sockA) {
+        g_portA = info.src;
+        if (info.dst) {
+            g_portB = info.dst;
+        }
+        g_nextSeqA = advances ? info.seq + 1 : info.seq;
+    } else {
+        g_portB = info.src;
+        if (advances) {
+            g_lastSeqB = info.seq;
+        }
+    }
+}
+
+static ssize_t FakeSend(FakeSocket* s, const uint8_t* buf, size_t len)
+{
+    Observe(s, buf, len);
+    if (s->capture) {
+        s->capture->push_back(std::vector<uint8_t>(buf, buf + len));
+    }
+    if (s->peer) {
+        s->peer->rx.push_back(Datagram());
+        Datagram& d = s->peer->rx.back();
+        d.data.assign(buf, buf + len);
+        d.from = s->addr;
+    }
+    return (ssize_t)len;
+}
+
+/* The interposers, with exactly the libc signatures; other descriptors go to libc */
+extern "C" ssize_t recvfrom(int fd, void* buf, size_t len, int flags, struct sockaddr* addr, socklen_t* addrlen)
+{
+    FakeSocket* s = Lookup(fd);
+    if (!s) {
+        typedef ssize_t (*RecvFromFn)(int, void*, size_t, int, struct sockaddr*, socklen_t*);
+        static RecvFromFn real = (RecvFromFn)dlsym(RTLD_NEXT, "recvfrom");
+        return real(fd, buf, len, flags, addr, addrlen);
+    }
+    if (s->rx.empty()) {
+        errno = EAGAIN;
+        return -1;
+    }
+    Datagram& d = s->rx.front();
+    size_t n = (d.data.size() < len) ? d.data.size() : len;
+    if (n) {
+        memcpy(buf, &d.data[0], n);
+    }
+    if (addr && addrlen) {
+        socklen_t alen = (*addrlen < sizeof(d.from)) ? *addrlen : (socklen_t)sizeof(d.from);
+        memcpy(addr, &d.from, alen);
+        *addrlen = sizeof(d.from);
+    }
+    s->rx.pop_front();
+    return (ssize_t)n;
+}
+
+extern "C" ssize_t sendto(int fd, const void* buf, size_t len, int flags, const struct sockaddr* addr, socklen_t addrlen)
+{
+    FakeSocket* s = Lookup(fd);
+    if (!s) {
+        typedef ssize_t (*SendToFn)(int, const void*, size_t, int, const struct sockaddr*, socklen_t);
+        static SendToFn real = (SendToFn)dlsym(RTLD_NEXT, "sendto");
+        return real(fd, buf, len, flags, addr, addrlen);
+    }
+    return FakeSend(s, (const uint8_t*)buf, len);
+}
+
+extern "C" ssize_t sendmsg(int fd, const struct msghdr* msg, int flags)
+{
+    FakeSocket* s = Lookup(fd);
+    if (!s) {
+        typedef ssize_t (*SendMsgFn)(int, const struct msghdr*, int);
+        static SendMsgFn real = (SendMsgFn)dlsym(RTLD_NEXT, "sendmsg");
+        return real(fd, msg, flags);
+    }
+    static std::vector<uint8_t> flat;
+    flat.clear();
+    for (size_t i = 0; i < msg->msg_iovlen; ++i) {
+        const uint8_t* p = (const uint8_t*)msg->msg_iov[i].iov_base;
+        flat.insert(flat.end(), p, p + msg->msg_iov[i].iov_len);
+    }
+    return FakeSend(s, flat.empty() ? NULL : &flat[0], flat.size());
+}
+
+static bool OpenFakeSocket(FakeSocket& s)
+{
+    s.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s.fd < 0) {
+        return false;
+    }
+    s.addr.sin_family = AF_INET;
+    s.addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    s.addr.sin_port = 0;
+    socklen_t len = sizeof(s.addr);
+    return (bind(s.fd, (struct sockaddr*)&s.addr, sizeof(s.addr)) == 0) &&
+           (getsockname(s.fd, (struct sockaddr*)&s.addr, &len) == 0);
+}
+
+static const char* const s_connString = "ARDP FUZZ CONNECT REQUEST";
+static const char* const s_acceptString = "ARDP FUZZ CONNECT RESPONSE";
+static ArdpGlobalConfig g_config;
+
+static bool AcceptCb(ArdpHandle* handle, qcc::IPAddress ipAddr, uint16_t ipPort, ArdpConnRecord* conn, uint8_t* buf, uint16_t len, QStatus status)
+{
+    status = ARDP_Accept(handle, conn, g_config.segmax, g_config.segbmax, (uint8_t*)s_acceptString, strlen(s_acceptString) + 1);
+    return status == ER_OK;
+}
+
+static void ConnectCb(ArdpHandle* handle, ArdpConnRecord* conn, bool passive, uint8_t* buf, uint16_t len, QStatus status)
+{
+    if (status != ER_OK) {
+        ARDP_ReleaseConnection(handle, conn);
+    } else if (!passive) {
+        g_connected = true;
+    }
+}
+
+static void DisconnectCb(ArdpHandle* handle, ArdpConnRecord* conn, QStatus status)
+{
+    ARDP_ReleaseConnection(handle, conn);
+}
+
+static void RecvCb(ArdpHandle* handle, ArdpConnRecord* conn, ArdpRcvBuf* rcv, QStatus status)
+{
+    ARDP_RecvReady(handle, conn, rcv);
+}
+
+static void SendCb(ArdpHandle* handle, ArdpConnRecord* conn, uint8_t* buf, uint32_t len, QStatus status)
+{
+}
+
+static void SendWindowCb(ArdpHandle* handle, ArdpConnRecord* conn, uint16_t window, QStatus status)
+{
+}
+
+static ArdpHandle* NewHandle()
+{
+    ArdpHandle* handle = ARDP_AllocHandle(&g_config);
+    ARDP_SetAcceptCb(handle, AcceptCb);
+    ARDP_SetConnectCb(handle, ConnectCb);
+    ARDP_SetDisconnectCb(handle, DisconnectCb);
+    ARDP_SetRecvCb(handle, RecvCb);
+    ARDP_SetSendCb(handle, SendCb);
+    ARDP_SetSendWindowCb(handle, SendWindowCb);
+    ARDP_StartPassive(handle);
+    return handle;
+}
+
+/* Let the handles answer each other until both queues are empty */
+static void Pump(ArdpHandle* a, ArdpHandle* b)
+{
+    for (uint32_t i = 0; i < MAX_PUMP_ROUNDS; ++i) {
+        if (g_sockB.rx.empty() && (!a || g_sockA.rx.empty())) {
+            break;
+        }
+        uint32_t ms;
+        ARDP_Run(b, g_sockB.fd, !g_sockB.rx.empty(), true, &ms);
+        if (a) {
+            ARDP_Run(a, g_sockA.fd, !g_sockA.rx.empty(), true, &ms);
+        }
+    }
+}
+
+/* Fresh handles, connected if asked; false if the handshake did not complete */
+static bool Setup(bool connect, ArdpHandle*& a, ArdpHandle*& b, ArdpConnRecord*& conn)
+{
+    g_sockA.rx.clear();
+    g_sockB.rx.clear();
+    g_portA = g_portB = 0;
+    g_nextSeqA = g_lastSeqB = 0;
+    g_connected = false;
+    a = NULL;
+    conn = NULL;
+    b = NewHandle();
+    if (!connect) {
+        return true;
+    }
+    a = NewHandle();
+    qcc::IPAddress address("127.0.0.1");
+    if (ARDP_Connect(a, g_sockA.fd, address, ntohs(g_sockB.addr.sin_port), g_config.segmax, g_config.segbmax,
+                     &conn, (uint8_t*)s_connString, strlen(s_connString) + 1, NULL) != ER_OK) {
+        return false;
+    }
+    Pump(a, b);
+    return g_connected;
+}
+
+static void Teardown(ArdpHandle* a, ArdpHandle* b)
+{
+    if (a) {
+        ARDP_FreeHandle(a);
+    }
+    ARDP_FreeHandle(b);
+    g_sockA.rx.clear();
+    g_sockB.rx.clear();
+}
+
+/* Make a datagram fit the connection, as asked by the flags */
+static void FixUp(uint8_t flags, uint8_t* buf, size_t len)
+{
+    if (len < ARDP_SEG_FIXED_LEN) {
+        return;
+    }
+    if (flags & FUZZ_FIX_PORTS) {
+        ArdpSegPut16(buf, ARDP_SEG_SRC, g_portA);
+        ArdpSegPut16(buf, ARDP_SEG_DST, g_portB);
+    }
+    if (flags & FUZZ_FIX_SEQ) {
+        uint32_t delta = g_nextSeqA - ArdpSegGet32(buf, ARDP_SEG_SEQ);
+        ArdpSegPut32(buf, ARDP_SEG_SEQ, g_nextSeqA);
+        ArdpSegPut32(buf, ARDP_SEG_SOM, ArdpSegGet32(buf, ARDP_SEG_SOM) + delta);
+        ArdpSegPut32(buf, ARDP_SEG_ACK, g_lastSeqB);
+    }
+}
+
+static bool g_ready = false;
+
+static void WriteCorpus(const char* dir);
+
+extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv)
+{
+    if (AllJoynInit() != ER_OK) {
+        abort();
+    }
+    ArdpTestDefaultConfig(g_config);
+    if (!OpenFakeSocket(g_sockA) || !OpenFakeSocket(g_sockB)) {
+        fprintf(stderr, "unable to open the loopback sockets\n");
+        abort();
+    }
+    g_sockA.peer = &g_sockB;
+    g_sockB.peer = &g_sockA;
+    g_ready = true;
+
+    const char* corpus = getenv("ARDP_FUZZ_CORPUS");
+    if (corpus) {
+        WriteCorpus(corpus);
+        exit(0);
+    }
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (!g_ready || size < 1) {
+        return 0;
+    }
+    uint8_t flags = data[0];
+    ArdpHandle* a;
+    ArdpHandle* b;
+    ArdpConnRecord* conn;
+    if (!Setup((flags & FUZZ_CONNECTED) != 0, a, b, conn)) {
+        Teardown(a, b);
+        return 0;
+    }
+
+    static std::vector<uint8_t> buf;
+    size_t pos = 1;
+    while (pos < size) {
+        size_t len = size - pos;
+        if (len >= 2) {
+            size_t want = ((size_t)data[pos] << 8) | data[pos + 1];
+            pos += 2;
+            len = (want < size - pos) ? want : size - pos;
+        }
+        buf.assign(data + pos, data + pos + len);
+        pos += len;
+
+        /* An injected data segment takes a sequence number, the next one must follow it */
+        bool advances = false;
+        if (a && !buf.empty()) {
+            FixUp(flags, &buf[0], buf.size());
+            ArdpSegmentInfo info;
+            advances = (flags & FUZZ_FIX_SEQ) && ArdpParseSegment(&buf[0], buf.size(), info) && info.IsData();
+        }
+
+        g_sockB.rx.push_back(Datagram());
+        Datagram& d = g_sockB.rx.back();
+        d.data.swap(buf);
+        d.from = g_sockA.addr;
+        Pump(a, b);
+        if (advances) {
+            g_nextSeqA++;
+        }
+    }
+
+    Teardown(a, b);
+    return 0;
+}
+
+/* One corpus file: flags followed by the datagrams, each with its length */
+static void WriteSeed(const char* dir, const char* name, uint8_t flags, const std::vector<std::vector<uint8_t> >& datagrams)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        fprintf(stderr, "unable to write %s\n", path);
+        return;
+    }
+    fputc(flags, fp);
+    for (size_t i = 0; i < datagrams.size(); ++i) {
+        size_t len = datagrams[i].size();
+        fputc((int)((len >> 8) & 0xFF), fp);
+        fputc((int)(len & 0xFF), fp);
+        if (len) {
+            fwrite(&datagrams[i][0], 1, len, fp);
+        }
+    }
+    fclose(fp);
+    printf("%s: %u datagrams\n", path, (uint32_t)datagrams.size());
+}
+
+static const char* SegmentKind(const std::vector<uint8_t>& d)
+{
+    ArdpSegmentInfo info;
+    if (!ArdpParseSegment(d.empty() ? NULL : &d[0], d.size(), info)) {
+        return "short";
+    }
+    if (info.IsSyn()) {
+        return info.HasAck() ? "synack" : "syn";
+    }
+    if (info.IsRst()) {
+        return "rst";
+    }
+    if (info.IsNul()) {
+        return "nul";
+    }
+    if (info.flags & ARDP_SEG_EACK) {
+        return "eack";
+    }
+    if (info.IsData()) {
+        return (info.fcnt > 1) ? "fragment" : "data";
+    }
+    return "ack";
+}
+
+/*
+ * Run a well-formed exchange from A to B and keep every datagram A sent:
+ * handshake, a small message, one that needs several fragments, one with
+ * a TTL, and the disconnect.
+ */
+static void WriteCorpus(const char* dir)
+{
+    mkdir(dir, 0755);
+
+    std::vector<std::vector<uint8_t> > sent;
+    g_sockA.capture = &sent;
+    ArdpHandle* a;
+    ArdpHandle* b;
+    ArdpConnRecord* conn;
+    if (!Setup(true, a, b, conn)) {
+        fprintf(stderr, "handshake did not complete, no corpus written\n");
+        Teardown(a, b);
+        exit(1);
+    }
+    size_t handshake = sent.size();
+
+    static uint8_t small[64];
+    static uint8_t large[140000];
+    static uint8_t timed[512];
+    memset(small, 'a', sizeof(small));
+    memset(large, 'b', sizeof(large));
+    memset(timed, 'c', sizeof(timed));
+    ARDP_Send(a, conn, small, sizeof(small), 0);
+    Pump(a, b);
+    ARDP_Send(a, conn, large, sizeof(large), 0);
+    Pump(a, b);
+    ARDP_Send(a, conn, timed, sizeof(timed), 1000);
+    Pump(a, b);
+    ARDP_Disconnect(a, conn);
+    Pump(a, b);
+    Teardown(a, b);
+    g_sockA.capture = NULL;
+
+    for (size_t i = 0; i < sent.size(); ++i) {
+        char name[64];
+        std::vector<std::vector<uint8_t> > one(1, sent[i]);
+        if (i == 0) {
+            WriteSeed(dir, "listen_syn", 0, one);
+        }
+        snprintf(name, sizeof(name), "conn_%02u_%s", (uint32_t)i, SegmentKind(sent[i]));
+        WriteSeed(dir, name, FUZZ_CONNECTED | FUZZ_FIX_PORTS | FUZZ_FIX_SEQ, one);
+    }
+    if (sent.size() > handshake) {
+        std::vector<std::vector<uint8_t> > rest(sent.begin() + handshake, sent.end());
+        WriteSeed(dir, "conn_sequence", FUZZ_CONNECTED | FUZZ_FIX_PORTS | FUZZ_FIX_SEQ, rest);
+        WriteSeed(dir, "conn_sequence_raw", FUZZ_CONNECTED, rest);
+    }
+}
+
+#ifdef ARDP_FUZZ_STANDALONE
+/*
+ * Without libFuzzer: run every file named on the command line, or stdin
+ * (the AFL way, in persistent mode when built with afl-clang-fast).
+ */
+static void RunOne(FILE* fp)
+{
+    static std::vector<uint8_t> input;
+    input.clear();
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        input.insert(input.end(), chunk, chunk + n);
+    }
+    LLVMFuzzerTestOneInput(input.empty() ? NULL : &input[0], input.size());
+}
+
+int main(int argc, char** argv)
+{
+    LLVMFuzzerInitialize(&argc, &argv);
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) {
+            FILE* fp = fopen(argv[i], "rb");
+            if (!fp) {
+                fprintf(stderr, "unable to open %s\n", argv[i]);
+                return 1;
+            }
+            RunOne(fp);
+            fclose(fp);
+        }
+        return 0;
+    }
+#ifdef __AFL_LOOP
+    while (__AFL_LOOP(10000)) {
+        RunOne(stdin);
+        clearerr(stdin);
+    }
+#else
+    RunOne(stdin);
+#endif
+    return 0;
+}
+#endif
@@ -0,0 +1,552 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * How many ARDP connections per second can a handle set up and tear down?
+ * A server endpoint accepts everything; -n peer slots spread over -clients
+ * client endpoints each loop ARDP_Connect -> ConnectCb -> (hold) ->
+ * ARDP_Disconnect -> DisconnectCb -> ARDP_ReleaseConnection as fast as the
+ * callbacks come back.
+ *
+ * Setup latency is ARDP_Connect to the active ConnectCb; teardown latency is
+ * ARDP_Disconnect to the active DisconnectCb, which includes the time the
+ * record spends in TIMEWAIT.  The number of records waiting for their
+ * DisconnectCb, and the number the server holds, are sampled every 100 ms
+ * so the memory cost of TIMEWAIT under churn is visible.
+ */
+
+#include <qcc/Debug.h>
+#include <qcc/Log.h>
+
+#include <stdlib.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <qcc/Event.h>
+#include <qcc/Mutex.h>
+#include <qcc/String.h>
+#include <qcc/StringUtil.h>
+#include <qcc/Thread.h>
+
+#include <alljoyn/Init.h>
+#include <alljoyn/Status.h>
+
+#include <ArdpProtocol.h>
+
+#include "ArdpTestEndpoint.h"
+#include "LatencyHistogram.h"
+
+#define QCC_MODULE "ARDP"
+
+using namespace std;
+using namespace qcc;
+using namespace ajn;
+
+static volatile sig_atomic_t g_interrupt = false;
+
+static void CDECL_CALL SigIntHandler(int sig)
+{
+    g_interrupt = true;
+}
+
+static uint32_t g_peers = 64;
+static uint32_t g_clients = 1;
+static uint32_t g_holdMs = 0;
+static uint32_t g_duration = 10000;
+static bool g_quiet = false;
+
+enum SlotState {
+    SLOT_IDLE,
+    SLOT_CONNECTING,
+    SLOT_UP,
+    SLOT_CLOSING     /**< ARDP_Disconnect called, DisconnectCb not yet seen */
+};
+
+/* One peer going round the connect/disconnect loop.  Guarded by the lock of its endpoint. */
+struct Slot {
+    uint32_t id;
+    ArdpTestEndpoint* ep;
+    ArdpConnRecord* conn;
+    SlotState state;
+    uint64_t since;        /**< When the current state was entered, us */
+
+    Slot() : id(0), ep(NULL), conn(NULL), state(SLOT_IDLE), since(0) { }
+};
+
+/* What the sampler sees; a snapshot of ChurnDriver counters */
+struct ChurnCounters {
+    uint64_t cycles;            /**< Connect + disconnect round trips completed */
+    uint64_t connects;          /**< Successful ConnectCb on the active side */
+    uint64_t connectFailed;
+    uint64_t connectErrors;     /**< ARDP_Connect itself failed */
+    uint64_t disconnectErrors;  /**< ARDP_Disconnect itself failed */
+    uint64_t unexpected;        /**< DisconnectCb on a connection we did not close */
+    uint64_t accepts;
+    uint64_t serverReleases;
+    uint32_t idle;
+    uint32_t connecting;
+    uint32_t up;
+    uint32_t closing;
+    uint32_t serverRecords;     /**< Records accepted by the server and not yet released */
+
+    ChurnCounters() : cycles(0), connects(0), connectFailed(0), connectErrors(0), disconnectErrors(0), unexpected(0),
+        accepts(0), serverReleases(0), idle(0), connecting(0), up(0), closing(0), serverRecords(0) { }
+};
+
+/*
+ * Owns the endpoints and drives the slots.  Callbacks run on the endpoint
+ * threads with the endpoint lock held and take m_lock inside it; the driver
+ * thread takes the slot's endpoint lock first, and never calls into an
+ * endpoint with only m_lock held.
+ */
+class ChurnDriver : public ArdpEndpointListener, public qcc::Thread {
+
+  public:
+    ChurnDriver() : qcc::Thread("ChurnDriver"), m_server("server", this), m_draining(false), m_stopping(false),
+        m_setup("connect_to_connectcb"), m_teardown("disconnect_to_disconnectcb") { }
+
+    ~ChurnDriver() {
+        m_stopping = true;
+        m_event.SetEvent();
+        Stop();
+        Join();
+        for (size_t i = 0; i < m_clients.size(); ++i) {
+            m_clients[i]->Shutdown();
+        }
+        m_server.Shutdown();
+        for (size_t i = 0; i < m_clients.size(); ++i) {
+            delete m_clients[i];
+        }
+    }
+
+    QStatus Init(const ArdpGlobalConfig& config) {
+        QStatus status = m_server.Init(config);
+        if (status != ER_OK) {
+            return status;
+        }
+        for (uint32_t i = 0; i < g_clients; ++i) {
+            ArdpTestEndpoint* ep = new ArdpTestEndpoint("client", this);
+            m_clients.push_back(ep);
+            status = ep->Init(config);
+            if (status != ER_OK) {
+                return status;
+            }
+        }
+        m_slots.resize(g_peers);
+        for (uint32_t i = 0; i < g_peers; ++i) {
+            m_slots[i].id = i;
+            m_slots[i].ep = m_clients[i % m_clients.size()];
+            m_ready.push_back(i);
+        }
+        m_counters.idle = g_peers;
+        return Start();
+    }
+
+    /** Stop opening connections and close everything that is up */
+    void Drain() {
+        m_lock.Lock(MUTEX_CONTEXT);
+        m_draining = true;
+        for (size_t i = 0; i < m_slots.size(); ++i) {
+            m_ready.push_back(i);
+        }
+        m_lock.Unlock(MUTEX_CONTEXT);
+        m_event.SetEvent();
+    }
+
+    /** True once no slot has a connection record left */
+    bool Drained() {
+        m_lock.Lock(MUTEX_CONTEXT);
+        bool drained = (m_counters.connecting + m_counters.up + m_counters.closing) == 0;
+        m_lock.Unlock(MUTEX_CONTEXT);
+        return drained;
+    }
+
+    ChurnCounters GetCounters() {
+        m_lock.Lock(MUTEX_CONTEXT);
+        ChurnCounters c = m_counters;
+        m_lock.Unlock(MUTEX_CONTEXT);
+        return c;
+    }
+
+    /** Only once the driver and endpoints are idle */
+    const LatencyHistogram& GetSetup() const { return m_setup; }
+    const LatencyHistogram& GetTeardown() const { return m_teardown; }
+
+    /* ArdpEndpointListener, called under the lock of the endpoint in question */
+
+    bool Accept(ArdpTestEndpoint& ep, ArdpConnRecord* conn) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        m_counters.accepts++;
+        m_counters.serverRecords++;
+        m_lock.Unlock(MUTEX_CONTEXT);
+        return true;
+    }
+
+    void Connected(ArdpTestEndpoint& ep, ArdpConnRecord* conn, bool passive, QStatus status) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        if (&ep == &m_server) {
+            if (status != ER_OK) {
+                m_counters.serverRecords--;
+            }
+            m_lock.Unlock(MUTEX_CONTEXT);
+            return;
+        }
+        Slot* slot = Find(conn);
+        if (slot) {
+            uint64_t now = GetTimestampMicros();
+            if (status == ER_OK) {
+                m_setup.Record(now - slot->since);
+                m_counters.connects++;
+                SetState(*slot, SLOT_UP, now);
+                if (g_holdMs && !m_draining) {
+                    m_holding.push_back(slot->id);
+                } else {
+                    m_ready.push_back(slot->id);
+                }
+            } else {
+                m_counters.connectFailed++;
+                m_connMap.erase(conn);
+                slot->conn = NULL;
+                SetState(*slot, SLOT_IDLE, now);
+                m_ready.push_back(slot->id);
+            }
+            m_event.SetEvent();
+        }
+        m_lock.Unlock(MUTEX_CONTEXT);
+    }
+
+    void Disconnected(ArdpTestEndpoint& ep, ArdpConnRecord* conn, QStatus status) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        if (&ep == &m_server) {
+            m_counters.serverRecords--;
+            m_counters.serverReleases++;
+            m_lock.Unlock(MUTEX_CONTEXT);
+            return;
+        }
+        Slot* slot = Find(conn);
+        if (slot) {
+            uint64_t now = GetTimestampMicros();
+            if (slot->state == SLOT_CLOSING) {
+                m_teardown.Record(now - slot->since);
+                m_counters.cycles++;
+            } else {
+                m_counters.unexpected++;
+            }
+            m_connMap.erase(conn);
+            slot->conn = NULL;
+            SetState(*slot, SLOT_IDLE, now);
+            m_ready.push_back(slot->id);
+            m_event.SetEvent();
+        }
+        m_lock.Unlock(MUTEX_CONTEXT);
+    }
+
+  protected:
+    qcc::ThreadReturn STDCALL Run(void* arg) {
+        vector<uint32_t> work;
+        while (!m_stopping) {
+            qcc::Event::Wait(m_event, g_holdMs ? (g_holdMs < 10 ? g_holdMs : 10) : 100);
+            m_event.ResetEvent();
+
+            work.clear();
+            m_lock.Lock(MUTEX_CONTEXT);
+            work.swap(m_ready);
+            uint64_t now = GetTimestampMicros();
+            while (!m_holding.empty()) {
+                Slot& slot = m_slots[m_holding.front()];
+                if (!m_draining && (slot.state == SLOT_UP) && (now - slot.since < g_holdMs * 1000ULL)) {
+                    break;
+                }
+                work.push_back(slot.id);
+                m_holding.pop_front();
+            }
+            m_lock.Unlock(MUTEX_CONTEXT);
+
+            for (size_t i = 0; (i < work.size()) && !m_stopping; ++i) {
+                Step(m_slots[work[i]]);
+            }
+        }
+        return this;
+    }
+
+  private:
+    /* Move the slot on from where it is; IDLE connects, UP disconnects */
+    void Step(Slot& slot) {
+        ArdpTestEndpoint& ep = *slot.ep;
+        ep.GetLock().Lock(MUTEX_CONTEXT);
+        m_lock.Lock(MUTEX_CONTEXT);
+        bool draining = m_draining;
+        m_lock.Unlock(MUTEX_CONTEXT);
+
+        if (slot.state == SLOT_IDLE && !draining) {
+            m_lock.Lock(MUTEX_CONTEXT);
+            SetState(slot, SLOT_CONNECTING, GetTimestampMicros());
+            m_lock.Unlock(MUTEX_CONTEXT);
+            QStatus status = ep.Connect("127.0.0.1", m_server.GetPort(), &slot.conn);
+            m_lock.Lock(MUTEX_CONTEXT);
+            if (status == ER_OK) {
+                m_connMap[slot.conn] = &slot;
+            } else {
+                /* Retried on the next pass, after the wait times out */
+                m_counters.connectErrors++;
+                slot.conn = NULL;
+                SetState(slot, SLOT_IDLE, GetTimestampMicros());
+                m_ready.push_back(slot.id);
+            }
+            m_lock.Unlock(MUTEX_CONTEXT);
+        } else if (slot.state == SLOT_UP) {
+            m_lock.Lock(MUTEX_CONTEXT);
+            SetState(slot, SLOT_CLOSING, GetTimestampMicros());
+            m_lock.Unlock(MUTEX_CONTEXT);
+            QStatus status = ep.Disconnect(slot.conn);
+            if (status != ER_OK) {
+                /* No DisconnectCb will follow; forget the record and start over */
+                m_lock.Lock(MUTEX_CONTEXT);
+                m_counters.disconnectErrors++;
+                m_connMap.erase(slot.conn);
+                slot.conn = NULL;
+                SetState(slot, SLOT_IDLE, GetTimestampMicros());
+                m_ready.push_back(slot.id);
+                m_lock.Unlock(MUTEX_CONTEXT);
+            }
+        }
+        ep.GetLock().Unlock(MUTEX_CONTEXT);
+    }
+
+    /* With m_lock held */
+    void SetState(Slot& slot, SlotState state, uint64_t now) {
+        Count(slot.state)--;
+        Count(state)++;
+        slot.state = state;
+        slot.since = now;
+    }
+
+    uint32_t& Count(SlotState state) {
+        switch (state) {
+        case SLOT_CONNECTING:
+            return m_counters.connecting;
+
+        case SLOT_UP:
+            return m_counters.up;
+
+        case SLOT_CLOSING:
+            return m_counters.closing;
+
+        default:
+            return m_counters.idle;
+        }
+    }
+
+    /* With m_lock held */
+    Slot* Find(ArdpConnRecord* conn) {
+        map<ArdpConnRecord*, Slot*>::iterator it = m_connMap.find(conn);
+        return (it == m_connMap.end()) ? NULL : it->second;
+    }
+
+    ArdpTestEndpoint m_server;
+    vector<ArdpTestEndpoint*> m_clients;
+    vector<Slot> m_slots;
+
+    qcc::Mutex m_lock;
+    qcc::Event m_event;
+    vector<uint32_t> m_ready;          /**< Slots with something to do */
+    deque<uint32_t> m_holding;         /**< UP slots in the order their -hold runs out */
+    map<ArdpConnRecord*, Slot*> m_connMap;
+    bool m_draining;
+    volatile bool m_stopping;
+
+    ChurnCounters m_counters;
+    LatencyHistogram m_setup;
+    LatencyHistogram m_teardown;
+};
+
+/* Running mean and maximum of a sampled gauge */
+struct Gauge {
+    uint64_t sum;
+    uint32_t samples;
+    uint32_t max;
+
+    Gauge() : sum(0), samples(0), max(0) { }
+
+    void Sample(uint32_t value) {
+        sum += value;
+        samples++;
+        if (value > max) {
+            max = value;
+        }
+    }
+
+    double Mean() const { return samples ? (double)sum / samples : 0.0; }
+};
+
+static void usage() {
+    printf("./ardpchurn -n 64 -clients 1 -hold 0 -time 10000 -timewait 1000\n");
+    printf(" -n # :  Number of peers connecting and disconnecting concurrently, default is 64\n");
+    printf(" -clients # :  Number of client handles (sockets) the peers are spread over, default is 1\n");
+    printf(" -hold # :  Time in ms each connection stays up before it is closed, default is 0\n");
+    printf(" -time # :  Run time in ms, default is 10000\n");
+    printf(" -timewait # :  ArdpGlobalConfig timewait in ms, default is 1000\n");
+    printf(" -ct # :  ArdpGlobalConfig connectTimeout in ms, default is 1000\n");
+    printf(" -cr # :  ArdpGlobalConfig connectRetries, default is 10\n");
+    printf(" -q :  Quiet, do not print the once a second progress lines\n");
+}
+
+static const char* NextArg(int argc, char** argv, int& i)
+{
+    ++i;
+    if (i == argc) {
+        printf("option %s requires a parameter\n", argv[i - 1]);
+        usage();
+        exit(1);
+    }
+    return argv[i];
+}
+
+int main(int argc, char** argv)
+{
+    if (AllJoynInit() != ER_OK) {
+        return 1;
+    }
+    if (AllJoynRouterInit() != ER_OK) {
+        AllJoynShutdown();
+        return 1;
+    }
+
+    ArdpGlobalConfig config;
+    ArdpTestDefaultConfig(config);
+
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp("-h", argv[i])) {
+            usage();
+            exit(0);
+        } else if (0 == strcmp("-n", argv[i])) {
+            g_peers = qcc::StringToU32(NextArg(argc, argv, i), 0, 64);
+        } else if (0 == strcmp("-clients", argv[i])) {
+            g_clients = qcc::StringToU32(NextArg(argc, argv, i), 0, 1);
+        } else if (0 == strcmp("-hold", argv[i])) {
+            g_holdMs = qcc::StringToU32(NextArg(argc, argv, i), 0, 0);
+        } else if (0 == strcmp("-time", argv[i])) {
+            g_duration = qcc::StringToU32(NextArg(argc, argv, i), 0, 10000);
+        } else if (0 == strcmp("-timewait", argv[i])) {
+            config.timewait = qcc::StringToU32(NextArg(argc, argv, i), 0, 1000);
+        } else if (0 == strcmp("-ct", argv[i])) {
+            config.connectTimeout = qcc::StringToU32(NextArg(argc, argv, i), 0, 1000);
+        } else if (0 == strcmp("-cr", argv[i])) {
+            config.connectRetries = qcc::StringToU32(NextArg(argc, argv, i), 0, 10);
+        } else if (0 == strcmp("-q", argv[i])) {
+            g_quiet = true;
+        } else {
+            printf("Unknown option %s\n", argv[i]);
+            usage();
+            exit(1);
+        }
+    }
+    if (g_peers == 0 || g_clients == 0) {
+        printf("-n and -clients must be at least 1\n");
+        exit(1);
+    }
+
+    signal(SIGINT, SigIntHandler);
+
+    printf("%u peers over %u client handles, hold %u ms, timewait %u ms, connectTimeout %u ms x %u\n",
+           g_peers, g_clients, g_holdMs, config.timewait, config.connectTimeout, config.connectRetries);
+
+    ChurnDriver* driver = new ChurnDriver();
+    QStatus status = driver->Init(config);
+    if (status != ER_OK) {
+        QCC_LogError(status, ("Failed to start the endpoints"));
+        delete driver;
+        AllJoynRouterShutdown();
+        AllJoynShutdown();
+        return 1;
+    }
+
+    if (!g_quiet) {
+        printf("%8s %10s %10s %8s %8s %8s %10s %10s\n", "time_s", "cycles/s", "cycles", "connect", "up", "closing", "srv_recs", "failures");
+    }
+
+    Gauge closing, serverRecords, up;
+    uint64_t start = GetTimestampMicros();
+    uint64_t lastPrint = start;
+    uint64_t lastCycles = 0;
+    while (!g_interrupt && (GetTimestampMicros() - start) < g_duration * 1000ULL) {
+        qcc::Sleep(100);
+        ChurnCounters c = driver->GetCounters();
+        closing.Sample(c.closing);
+        serverRecords.Sample(c.serverRecords);
+        up.Sample(c.up);
+        uint64_t now = GetTimestampMicros();
+        if (!g_quiet && (now - lastPrint) >= 1000000) {
+            printf("%8.1f %10.0f %10llu %8u %8u %8u %10u %10llu\n", (now - start) / 1000000.0,
+                   (c.cycles - lastCycles) * 1000000.0 / (now - lastPrint), (unsigned long long)c.cycles,
+                   c.connecting, c.up, c.closing, c.serverRecords,
+                   (unsigned long long)(c.connectFailed + c.connectErrors + c.unexpected));
+            fflush(stdout);
+            lastPrint = now;
+            lastCycles = c.cycles;
+        }
+    }
+    double seconds = (GetTimestampMicros() - start) / 1000000.0;
+    ChurnCounters c = driver->GetCounters();
+
+    /* Let everything still open close and leave TIMEWAIT so nothing is freed under ARDP's feet */
+    driver->Drain();
+    uint64_t drainLimit = (config.connectTimeout * (config.connectRetries + 1) + config.timewait + 2000) * 1000ULL;
+    uint64_t drainStart = GetTimestampMicros();
+    while (!driver->Drained() && (GetTimestampMicros() - drainStart) < drainLimit) {
+        qcc::Sleep(10);
+    }
+    bool drained = driver->Drained();
+    uint32_t drainMs = (uint32_t)((GetTimestampMicros() - drainStart) / 1000);
+    ChurnCounters end = driver->GetCounters();
+
+    printf("CHURN: %llu cycles in %.1f s, %.1f connections/s set up and torn down\n",
+           (unsigned long long)c.cycles, seconds, seconds > 0 ? c.cycles / seconds : 0.0);
+    printf("CHURN: %llu connected, %llu connect failures, %llu ARDP_Connect errors, %llu ARDP_Disconnect errors, %llu unexpected disconnects\n",
+           (unsigned long long)c.connects, (unsigned long long)c.connectFailed, (unsigned long long)c.connectErrors,
+           (unsigned long long)c.disconnectErrors, (unsigned long long)c.unexpected);
+    printf("CHURN: server accepted %llu, released %llu\n", (unsigned long long)end.accepts, (unsigned long long)end.serverReleases);
+    driver->GetSetup().PrintSummary();
+    driver->GetTeardown().PrintSummary();
+    printf("TIMEWAIT: timewait %u ms; client records closing mean %.1f max %u, up mean %.1f; server records mean %.1f max %u\n",
+           config.timewait, closing.Mean(), closing.max, up.Mean(), serverRecords.Mean(), serverRecords.max);
+    double expected = seconds > 0 ? (c.cycles / seconds) * driver->GetTeardown().GetMean() / 1000000.0 : 0.0;
+    printf("TIMEWAIT: teardown rate x mean teardown time predicts %.1f closing records\n", expected);
+    printf("DRAIN: %s after %u ms, %u connecting, %u up, %u closing, %u server records left\n",
+           drained ? "done" : "timed out", drainMs, end.connecting, end.up, end.closing, end.serverRecords);
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        double user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0;
+        double sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+        printf("CPU: user %.2f s, system %.2f s\n", user, sys);
+    }
+#endif
+
+    delete driver;
+
+    AllJoynRouterShutdown();
+    AllJoynShutdown();
+    return drained ? 0 : 1;
+}
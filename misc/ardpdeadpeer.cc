@@ -0,0 +1,522 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * How long ARDP takes to notice a peer that went silent.  For every
+ * combination of the given linkTimeout and keepaliveRetries values,
+ * endpoint A connects to endpoint B through an ArdpLinkEmulator, the
+ * connections are left idle (or carry a trickle of messages with -send)
+ * while the keepalive traffic is counted, then the emulator silently drops
+ * everything one side sends and the time until each DisconnectCb fires is
+ * measured.  The datagrams the other side sends into the void until then
+ * are the probing cost of the detection.
+ *
+ * The send hooks cannot withhold a datagram, only rewrite it, so the
+ * silence is the emulator's blackhole rather than a hook.
+ */
+
+#include <qcc/Debug.h>
+#include <qcc/Log.h>
+
+#include <stdlib.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <vector>
+
+#include <qcc/Mutex.h>
+#include <qcc/StringUtil.h>
+#include <qcc/Thread.h>
+
+#include <alljoyn/Init.h>
+#include <alljoyn/Status.h>
+
+#include <ArdpProtocol.h>
+
+#include "ArdpLinkEmulator.h"
+#include "ArdpRange.h"
+#include "ArdpTestEndpoint.h"
+#include "LatencyHistogram.h"
+
+#define QCC_MODULE "ARDP"
+
+using namespace std;
+using namespace qcc;
+using namespace ajn;
+
+static volatile sig_atomic_t g_interrupt = false;
+
+static void CDECL_CALL SigIntHandler(int sig)
+{
+    g_interrupt = true;
+}
+
+/** Which side goes silent */
+enum Silent {
+    SILENT_A,       /**< A->B is dropped, B has to notice */
+    SILENT_B,       /**< B->A is dropped, A has to notice */
+    SILENT_BOTH
+};
+
+struct DeadPeerParams {
+    ArdpGlobalConfig config;
+    uint32_t connections;
+    uint32_t settleMs;          /**< Before the keepalive traffic is counted */
+    uint32_t idleMs;            /**< How long it is counted, 0 for one linkTimeout */
+    uint32_t sendIntervalMs;    /**< A sends a small message this often on each connection, 0 for never */
+    Silent silent;
+
+    DeadPeerParams() : connections(1), settleMs(500), idleMs(0), sendIntervalMs(0), silent(SILENT_B) {
+        ArdpTestDefaultConfig(config);
+    }
+};
+
+struct DeadPeerResult {
+    uint32_t connected;
+    double steadySeconds;
+    LinkStats steadyAToB;       /**< Traffic while everything was fine */
+    LinkStats steadyBToA;
+    LinkStats silentAToB;       /**< Traffic from the blackhole until the end */
+    LinkStats silentBToA;
+    LatencyHistogram detectA;   /**< Blackhole to DisconnectCb on A, us */
+    LatencyHistogram detectB;
+    uint32_t undetectedA;
+    uint32_t undetectedB;
+    QStatus statusA;            /**< Status of the first DisconnectCb on each side */
+    QStatus statusB;
+
+    DeadPeerResult() : detectA("detect_a"), detectB("detect_b") {
+        connected = 0;
+        steadySeconds = 0.0;
+        undetectedA = undetectedB = 0;
+        statusA = statusB = ER_OK;
+    }
+};
+
+/* Difference of two snapshots of the same counters */
+static LinkStats Delta(const LinkStats& later, const LinkStats& earlier)
+{
+    LinkStats d;
+    d.datagrams = later.datagrams - earlier.datagrams;
+    d.bytes = later.bytes - earlier.bytes;
+    d.dataSegments = later.dataSegments - earlier.dataSegments;
+    d.controlSegments = later.controlSegments - earlier.controlSegments;
+    d.droppedBlackhole = later.droppedBlackhole - earlier.droppedBlackhole;
+    return d;
+}
+
+class DeadPeerRun : public ArdpEndpointListener {
+
+  public:
+    DeadPeerRun() : m_sender(NULL), m_upB(0), m_blackholeTime(0), m_result(NULL) { }
+
+    QStatus Run(const DeadPeerParams& params, DeadPeerResult& result) {
+        m_params = params;
+        m_result = &result;
+        m_blackholeTime = 0;
+        m_upB = 0;
+
+        ArdpTestEndpoint receiver("deadpeer-b", this);
+        ArdpTestEndpoint sender("deadpeer-a", this);
+        ArdpLinkEmulator emulator;
+        m_sender = &sender;
+
+        QStatus status = receiver.Init(m_params.config);
+        if (status == ER_OK) {
+            status = emulator.Init("127.0.0.1", receiver.GetPort());
+        }
+        if (status == ER_OK) {
+            status = sender.Init(m_params.config);
+        }
+        m_conns.assign(m_params.connections, Conn());
+        for (uint32_t i = 0; (status == ER_OK) && (i < m_params.connections); ++i) {
+            sender.GetLock().Lock(MUTEX_CONTEXT);
+            status = sender.Connect("127.0.0.1", emulator.GetPortForA(), &m_conns[i].conn);
+            if (status == ER_OK) {
+                m_lock.Lock(MUTEX_CONTEXT);
+                m_index[m_conns[i].conn] = i;
+                m_lock.Unlock(MUTEX_CONTEXT);
+            }
+            sender.GetLock().Unlock(MUTEX_CONTEXT);
+        }
+
+        if (status == ER_OK) {
+            status = WaitForConnections();
+        }
+        if (status == ER_OK) {
+            Idle(m_params.settleMs);
+
+            uint32_t idleMs = m_params.idleMs ? m_params.idleMs : m_params.config.linkTimeout;
+            LinkStats aToB = emulator.GetStats(ArdpLinkEmulator::A_TO_B);
+            LinkStats bToA = emulator.GetStats(ArdpLinkEmulator::B_TO_A);
+            uint64_t start = GetTimestampMicros();
+            Idle(idleMs);
+            result.steadySeconds = (GetTimestampMicros() - start) / 1000000.0;
+            result.steadyAToB = Delta(emulator.GetStats(ArdpLinkEmulator::A_TO_B), aToB);
+            result.steadyBToA = Delta(emulator.GetStats(ArdpLinkEmulator::B_TO_A), bToA);
+
+            aToB = emulator.GetStats(ArdpLinkEmulator::A_TO_B);
+            bToA = emulator.GetStats(ArdpLinkEmulator::B_TO_A);
+            m_lock.Lock(MUTEX_CONTEXT);
+            m_blackholeTime = GetTimestampMicros();
+            m_lock.Unlock(MUTEX_CONTEXT);
+            if (m_params.silent != SILENT_B) {
+                emulator.SetBlackhole(ArdpLinkEmulator::A_TO_B, true);
+            }
+            if (m_params.silent != SILENT_A) {
+                emulator.SetBlackhole(ArdpLinkEmulator::B_TO_A, true);
+            }
+            WaitForDetection();
+            result.silentAToB = Delta(emulator.GetStats(ArdpLinkEmulator::A_TO_B), aToB);
+            result.silentBToA = Delta(emulator.GetStats(ArdpLinkEmulator::B_TO_A), bToA);
+        }
+
+        m_lock.Lock(MUTEX_CONTEXT);
+        for (size_t i = 0; i < m_conns.size(); ++i) {
+            if (m_conns[i].up) {
+                result.undetectedA++;
+            }
+        }
+        result.undetectedB = m_upB;
+        m_result = NULL;
+        m_lock.Unlock(MUTEX_CONTEXT);
+
+        sender.Shutdown();
+        receiver.Shutdown();
+        emulator.Shutdown();
+        m_sender = NULL;
+        m_conns.clear();
+        m_index.clear();
+        return status;
+    }
+
+    /* ArdpEndpointListener, called under the lock of the endpoint in question; m_lock nests inside it */
+
+    void Connected(ArdpTestEndpoint& ep, ArdpConnRecord* conn, bool passive, QStatus status) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        if (status == ER_OK && m_result) {
+            if (passive) {
+                m_upB++;
+            } else {
+                Conn* c = Find(conn);
+                if (c) {
+                    c->up = true;
+                    m_result->connected++;
+                }
+            }
+        }
+        m_lock.Unlock(MUTEX_CONTEXT);
+    }
+
+    void Disconnected(ArdpTestEndpoint& ep, ArdpConnRecord* conn, QStatus status) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        uint64_t now = GetTimestampMicros();
+        bool afterBlackhole = m_blackholeTime && m_result;
+        if (&ep == m_sender) {
+            Conn* c = Find(conn);
+            if (c && c->up) {
+                c->up = false;
+                c->conn = NULL;
+                if (afterBlackhole) {
+                    if (m_result->detectA.GetCount() == 0) {
+                        m_result->statusA = status;
+                    }
+                    m_result->detectA.Record(now - m_blackholeTime);
+                }
+            }
+            m_index.erase(conn);
+        } else if (m_upB) {
+            m_upB--;
+            if (afterBlackhole) {
+                if (m_result->detectB.GetCount() == 0) {
+                    m_result->statusB = status;
+                }
+                m_result->detectB.Record(now - m_blackholeTime);
+            }
+        }
+        m_lock.Unlock(MUTEX_CONTEXT);
+    }
+
+  private:
+    struct Conn {
+        ArdpConnRecord* conn;
+        bool up;
+        Conn() : conn(NULL), up(false) { }
+    };
+
+    Conn* Find(ArdpConnRecord* conn) {
+        std::map<ArdpConnRecord*, size_t>::iterator it = m_index.find(conn);
+        return (it == m_index.end()) ? NULL : &m_conns[it->second];
+    }
+
+    bool AllUp() {
+        m_lock.Lock(MUTEX_CONTEXT);
+        bool up = (m_result->connected == m_conns.size()) && (m_upB == m_conns.size());
+        m_lock.Unlock(MUTEX_CONTEXT);
+        return up;
+    }
+
+    bool AllDetected() {
+        m_lock.Lock(MUTEX_CONTEXT);
+        bool pendingA = false;
+        for (size_t i = 0; i < m_conns.size(); ++i) {
+            pendingA = pendingA || m_conns[i].up;
+        }
+        /* A side that keeps hearing from its peer has nothing to detect */
+        bool done = (!pendingA || m_params.silent == SILENT_A) && (m_upB == 0 || m_params.silent == SILENT_B);
+        m_lock.Unlock(MUTEX_CONTEXT);
+        return done;
+    }
+
+    QStatus WaitForConnections() {
+        uint64_t limit = (uint64_t)m_params.config.connectTimeout * (m_params.config.connectRetries + 1);
+        uint64_t start = GetTimestampMicros();
+        while (!g_interrupt && !AllUp()) {
+            if ((GetTimestampMicros() - start) / 1000 > limit) {
+                return ER_TIMEOUT;
+            }
+            qcc::Sleep(10);
+        }
+        return g_interrupt ? ER_FAIL : ER_OK;
+    }
+
+    /* Let time pass, sending the -send trickle if there is one */
+    void Idle(uint32_t ms) {
+        static uint8_t message[64];
+        uint64_t start = GetTimestampMicros();
+        uint64_t nextSend = start;
+        while (!g_interrupt && (GetTimestampMicros() - start) / 1000 < ms) {
+            if (m_params.sendIntervalMs && GetTimestampMicros() >= nextSend) {
+                m_sender->GetLock().Lock(MUTEX_CONTEXT);
+                for (size_t i = 0; i < m_conns.size(); ++i) {
+                    if (m_conns[i].up) {
+                        ARDP_Send(m_sender->GetHandle(), m_conns[i].conn, message, sizeof(message), 0);
+                    }
+                }
+                m_sender->GetLock().Unlock(MUTEX_CONTEXT);
+                m_sender->Wake();
+                nextSend += (uint64_t)m_params.sendIntervalMs * 1000;
+            }
+            qcc::Sleep(5);
+        }
+    }
+
+    /* Wait for DisconnectCb on the side(s) that lost their peer, sending the -send trickle meanwhile */
+    void WaitForDetection() {
+        const ArdpGlobalConfig& c = m_params.config;
+        uint64_t limit = 3ULL * c.linkTimeout + c.totalDataRetryTimeout + c.persistInterval;
+        uint64_t start = GetTimestampMicros();
+        while (!g_interrupt && !AllDetected() && (GetTimestampMicros() - start) / 1000 < limit) {
+            Idle(10);
+        }
+    }
+
+    DeadPeerParams m_params;
+    ArdpTestEndpoint* m_sender;
+    qcc::Mutex m_lock;
+    std::vector<Conn> m_conns;
+    std::map<ArdpConnRecord*, size_t> m_index;
+    uint32_t m_upB;
+    uint64_t m_blackholeTime;   /**< 0 until the blackhole is switched on */
+    DeadPeerResult* m_result;   /**< NULL outside Run */
+};
+
+static void usage() {
+    printf("./ardpdeadpeer -lt 2000,5000,10000 -ka 1,3,5\n");
+    printf("./ardpdeadpeer -lt 1000:8000:x2 -ka 2 -n 10 -silent both -send 100 -csv deadpeer.csv\n");
+    printf("A range is a comma separated list (4,8,16), lo:hi:step (0:100:25) or lo:hi:xN for a geometric series\n");
+    printf(" -lt range :  linkTimeout in ms, default is 2000,5000,10000\n");
+    printf(" -ka range :  keepaliveRetries, default is 1,3,5\n");
+    printf(" -n # :  Number of connections, default is 1\n");
+    printf(" -silent a|b|both :  Side whose traffic is dropped, default is b (A has to notice)\n");
+    printf(" -send # :  A sends a 64 byte message every # ms on each connection, default is to stay idle\n");
+    printf(" -settle # :  Time in ms after connecting before the keepalive traffic is counted, default is 500\n");
+    printf(" -idle # :  Time in ms the keepalive traffic is counted, default is one linkTimeout\n");
+    printf(" -repeat # :  Runs per combination, one row each, default is 1\n");
+    printf(" -csv file :  Also write the table to a csv file\n");
+}
+
+static const char* NextArg(int argc, char** argv, int& i)
+{
+    ++i;
+    if (i == argc) {
+        printf("option %s requires a parameter\n", argv[i - 1]);
+        usage();
+        exit(1);
+    }
+    return argv[i];
+}
+
+static void ParseRangeOption(int argc, char** argv, int& i, vector<uint32_t>& values)
+{
+    const char* arg = NextArg(argc, argv, i);
+    if (!ParseRange(arg, values)) {
+        printf("bad range %s for option %s\n", arg, argv[i - 1]);
+        usage();
+        exit(1);
+    }
+}
+
+static void PrintHeader(FILE* fp, bool csv)
+{
+    if (csv) {
+        fprintf(fp, "link_timeout,keepalive_retries,run,connections,"
+                "steady_a_pps,steady_b_pps,steady_bytes_per_s,"
+                "detect_a_p50_ms,detect_a_max_ms,detect_b_p50_ms,detect_b_max_ms,"
+                "probes_a,probes_b,undetected_a,undetected_b,status_a,status_b\n");
+    } else {
+        fprintf(fp, "%6s %3s %3s %4s | %8s %8s %9s | %9s %9s %9s %9s | %7s %7s | %5s %5s | %s\n",
+                "lt", "ka", "run", "conn",
+                "A pkt/s", "B pkt/s", "bytes/s",
+                "A p50 ms", "A max ms", "B p50 ms", "B max ms",
+                "A probe", "B probe", "A und", "B und", "status");
+    }
+}
+
+static void PrintRow(FILE* fp, bool csv, const ArdpGlobalConfig& c, uint32_t run, uint32_t connections, const DeadPeerResult& r)
+{
+    /* Keepalive traffic per connection and second; datagrams offered into the blackhole per connection */
+    double perConn = connections ? connections : 1;
+    double secs = r.steadySeconds > 0.0 ? r.steadySeconds : 1.0;
+    double aPps = r.steadyAToB.datagrams / secs / perConn;
+    double bPps = r.steadyBToA.datagrams / secs / perConn;
+    double bytes = (r.steadyAToB.bytes + r.steadyBToA.bytes) / secs / perConn;
+    double aProbes = r.silentAToB.datagrams / perConn;
+    double bProbes = r.silentBToA.datagrams / perConn;
+    double aP50 = r.detectA.GetPercentile(50.0) / 1000.0;
+    double aMax = r.detectA.GetMax() / 1000.0;
+    double bP50 = r.detectB.GetPercentile(50.0) / 1000.0;
+    double bMax = r.detectB.GetMax() / 1000.0;
+    if (csv) {
+        fprintf(fp, "%u,%u,%u,%u,%.2f,%.2f,%.0f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%u,%u,%s,%s\n",
+                c.linkTimeout, c.keepaliveRetries, run, connections, aPps, bPps, bytes,
+                aP50, aMax, bP50, bMax, aProbes, bProbes, r.undetectedA, r.undetectedB,
+                QCC_StatusText(r.statusA), QCC_StatusText(r.statusB));
+    } else {
+        fprintf(fp, "%6u %3u %3u %4u | %8.2f %8.2f %9.0f | %9.1f %9.1f %9.1f %9.1f | %7.1f %7.1f | %5u %5u | %s %s\n",
+                c.linkTimeout, c.keepaliveRetries, run, connections, aPps, bPps, bytes,
+                aP50, aMax, bP50, bMax, aProbes, bProbes, r.undetectedA, r.undetectedB,
+                QCC_StatusText(r.statusA), QCC_StatusText(r.statusB));
+    }
+    fflush(fp);
+}
+
+int main(int argc, char** argv)
+{
+    if (AllJoynInit() != ER_OK) {
+        return 1;
+    }
+    if (AllJoynRouterInit() != ER_OK) {
+        AllJoynShutdown();
+        return 1;
+    }
+
+    DeadPeerParams params;
+    uint32_t repeat = 1;
+    const char* csvFile = NULL;
+    vector<uint32_t> lt;
+    vector<uint32_t> ka;
+    ParseRange("2000,5000,10000", lt);
+    ParseRange("1,3,5", ka);
+
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp("-h", argv[i])) {
+            usage();
+            exit(0);
+        } else if (0 == strcmp("-lt", argv[i])) {
+            ParseRangeOption(argc, argv, i, lt);
+        } else if (0 == strcmp("-ka", argv[i])) {
+            ParseRangeOption(argc, argv, i, ka);
+        } else if (0 == strcmp("-n", argv[i])) {
+            params.connections = qcc::StringToU32(NextArg(argc, argv, i), 0, 1);
+        } else if (0 == strcmp("-silent", argv[i])) {
+            const char* side = NextArg(argc, argv, i);
+            if (0 == strcmp("a", side)) {
+                params.silent = SILENT_A;
+            } else if (0 == strcmp("b", side)) {
+                params.silent = SILENT_B;
+            } else if (0 == strcmp("both", side)) {
+                params.silent = SILENT_BOTH;
+            } else {
+                printf("bad side %s for option -silent\n", side);
+                usage();
+                exit(1);
+            }
+        } else if (0 == strcmp("-send", argv[i])) {
+            params.sendIntervalMs = qcc::StringToU32(NextArg(argc, argv, i), 0, 0);
+        } else if (0 == strcmp("-settle", argv[i])) {
+            params.settleMs = qcc::StringToU32(NextArg(argc, argv, i), 0, 500);
+        } else if (0 == strcmp("-idle", argv[i])) {
+            params.idleMs = qcc::StringToU32(NextArg(argc, argv, i), 0, 0);
+        } else if (0 == strcmp("-repeat", argv[i])) {
+            repeat = qcc::StringToU32(NextArg(argc, argv, i), 0, 1);
+        } else if (0 == strcmp("-csv", argv[i])) {
+            csvFile = NextArg(argc, argv, i);
+        } else {
+            printf("Unknown option %s\n", argv[i]);
+            usage();
+            exit(1);
+        }
+    }
+
+    FILE* csv = NULL;
+    if (csvFile) {
+        csv = fopen(csvFile, "w");
+        if (csv == NULL) {
+            printf("cannot open %s\n", csvFile);
+            exit(1);
+        }
+        PrintHeader(csv, true);
+    }
+
+    signal(SIGINT, SigIntHandler);
+
+    printf("%u combinations x %u runs, %u connections, %s silent\n", (uint32_t)(lt.size() * ka.size()), repeat,
+           params.connections, params.silent == SILENT_A ? "A" : (params.silent == SILENT_B ? "B" : "A and B"));
+    PrintHeader(stdout, false);
+
+    DeadPeerRun deadPeer;
+    int failures = 0;
+    for (size_t a = 0; a < lt.size() && !g_interrupt; ++a) {
+        for (size_t b = 0; b < ka.size() && !g_interrupt; ++b) {
+            params.config.linkTimeout = lt[a];
+            params.config.keepaliveRetries = ka[b];
+            for (uint32_t run = 0; run < repeat && !g_interrupt; ++run) {
+                DeadPeerResult result;
+                QStatus status = deadPeer.Run(params, result);
+                if (status != ER_OK) {
+                    QCC_LogError(status, ("Run failed for linkTimeout %u keepaliveRetries %u", lt[a], ka[b]));
+                    failures++;
+                    continue;
+                }
+                PrintRow(stdout, false, params.config, run, params.connections, result);
+                if (csv) {
+                    PrintRow(csv, true, params.config, run, params.connections, result);
+                }
+            }
+        }
+    }
+
+    if (csv) {
+        fclose(csv);
+    }
+
+    AllJoynRouterShutdown();
+    AllJoynShutdown();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,295 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Cost of ARDP fragmentation and reassembly.  Message sizes are chosen
+ * around every multiple of the fragment payload (segbmax less the ARDP
+ * header), so consecutive rows differ by one fragment: half way into the
+ * k-th fragment, exactly k fragments, and one byte more.  Each size runs
+ * the same fixed duration loopback transfer as ardpsweep and prints the
+ * fragments per message (rcv->fcnt), CPU time per message, goodput,
+ * delivery latency, and how much of the receive window and of the
+ * fragments the message occupies.
+ *
+ * The fragment payload is measured by bisection unless given with
+ * -fraglen.  By default as many messages are kept in flight as the window
+ * allows; -inflight 1 measures latency without queueing.
+ */
+
+#include <qcc/Debug.h>
+#include <qcc/Log.h>
+
+#include <stdlib.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include <qcc/StringUtil.h>
+
+#include <alljoyn/Init.h>
+#include <alljoyn/Status.h>
+
+#include <ArdpProtocol.h>
+
+#include "ArdpLoopbackTransfer.h"
+
+#define QCC_MODULE "ARDP"
+
+using namespace std;
+using namespace qcc;
+using namespace ajn;
+
+/* Duration of each probe while looking for the fragment payload */
+const uint32_t PROBE_MS = 30;
+
+static ArdpLoopbackTransfer g_transfer;
+static volatile sig_atomic_t g_interrupt = false;
+
+static void CDECL_CALL SigIntHandler(int sig)
+{
+    g_interrupt = true;
+    g_transfer.Abort();
+}
+
+static void usage() {
+    printf("./ardpfragbench -maxsegs 4 -time 2000\n");
+    printf("./ardpfragbench -segbmax 1472 -maxsegs 12 -inflight 1 -csv frag.csv\n");
+    printf(" -segmax # :  Maximum messages in flight, default is 16\n");
+    printf(" -segbmax # :  Maximum segment size, default is 65507\n");
+    printf(" -maxsegs # :  Sweep messages of up to # fragments (and one byte more), default is 4\n");
+    printf(" -fraglen # :  Data bytes per fragment, default is to measure it\n");
+    printf(" -inflight # :  Messages in flight, default is segmax\n");
+    printf(" -time # :  Duration of each size class in ms, default is 2000\n");
+    printf(" -n # :  Number of concurrent connections, default is 1\n");
+    printf(" -link :  Go through the (unimpaired) emulated link rather than straight to the receiver\n");
+    printf(" -csv file :  Also write the table to a csv file\n");
+}
+
+static const char* NextArg(int argc, char** argv, int& i)
+{
+    ++i;
+    if (i == argc) {
+        printf("option %s requires a parameter\n", argv[i - 1]);
+        usage();
+        exit(1);
+    }
+    return argv[i];
+}
+
+/* The value of a 16 bit ARDP config option, which must be 1 to max */
+static uint16_t NextArgU16(int argc, char** argv, int& i, uint16_t max)
+{
+    const char* arg = NextArg(argc, argv, i);
+    uint32_t value = qcc::StringToU32(arg, 0, 0);
+    if (value == 0 || value > max) {
+        printf("option %s takes 1 to %u\n", argv[i - 1], max);
+        usage();
+        exit(1);
+    }
+    return (uint16_t)value;
+}
+
+/* The most fragments a message of len bytes arrived in, 0 if none arrived */
+static uint16_t Probe(ArdpTransferParams params, uint32_t len)
+{
+    params.minPayload = params.maxPayload = len;
+    params.connections = 1;
+    params.maxInFlight = 1;
+    params.durationMs = PROBE_MS;
+    ArdpTransferResult result;
+    if (g_transfer.Run(params, result) != ER_OK) {
+        return 0;
+    }
+    return result.maxFragments;
+}
+
+/* The largest message that still fits one fragment */
+static uint32_t MeasureFragmentLength(const ArdpTransferParams& params)
+{
+    uint32_t lo = TRANSFER_HEADER_LEN;
+    uint32_t hi = params.config.segbmax;
+    if (Probe(params, lo) != 1) {
+        return 0;
+    }
+    while (lo < hi && !g_interrupt) {
+        uint32_t mid = lo + (hi - lo + 1) / 2;
+        uint16_t fcnt = Probe(params, mid);
+        if (fcnt == 0) {
+            return 0;
+        }
+        if (fcnt == 1) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+static void PrintHeader(FILE* fp, bool csv)
+{
+    if (csv) {
+        fprintf(fp, "length,expected_fragments,fragments,messages_per_s,goodput_mbps,cpu_us_per_message,"
+                "p50_us,p99_us,max_us,window_pct,fragment_fill_pct,stalls,send_errors\n");
+    } else {
+        fprintf(fp, "%8s %4s %6s | %10s %9s %9s | %9s %9s %9s | %8s %6s | %7s %6s\n",
+                "bytes", "exp", "segs", "msg/s", "MB/s", "cpu us",
+                "p50 us", "p99 us", "max us", "window %", "fill %", "stalls", "errors");
+    }
+}
+
+static void PrintRow(FILE* fp, bool csv, uint32_t len, uint32_t expected, uint32_t fragLen, uint16_t segmax, const ArdpTransferResult& r)
+{
+    double mps = r.seconds > 0.0 ? r.messagesDelivered / r.seconds : 0.0;
+    double segs = r.FragmentsPerMessage();
+    /* Receive slots one message holds until RecvReady, and how full its fragments are */
+    double window = segmax ? 100.0 * segs / segmax : 0.0;
+    double fill = segs > 0.0 ? 100.0 * len / (segs * fragLen) : 0.0;
+    if (csv) {
+        fprintf(fp, "%u,%u,%.2f,%.0f,%.3f,%.2f,%llu,%llu,%llu,%.1f,%.1f,%u,%llu\n",
+                len, expected, segs, mps, r.GoodputMBps(), r.CpuUsPerMessage(),
+                (unsigned long long)r.latency.GetPercentile(50.0), (unsigned long long)r.latency.GetPercentile(99.0),
+                (unsigned long long)r.latency.GetMax(), window, fill, r.stalls, (unsigned long long)r.sendErrors);
+    } else {
+        fprintf(fp, "%8u %4u %6.2f | %10.0f %9.3f %9.2f | %9llu %9llu %9llu | %8.1f %6.1f | %7u %6llu\n",
+                len, expected, segs, mps, r.GoodputMBps(), r.CpuUsPerMessage(),
+                (unsigned long long)r.latency.GetPercentile(50.0), (unsigned long long)r.latency.GetPercentile(99.0),
+                (unsigned long long)r.latency.GetMax(), window, fill, r.stalls, (unsigned long long)r.sendErrors);
+    }
+    fflush(fp);
+}
+
+int main(int argc, char** argv)
+{
+    if (AllJoynInit() != ER_OK) {
+        return 1;
+    }
+    if (AllJoynRouterInit() != ER_OK) {
+        AllJoynShutdown();
+        return 1;
+    }
+
+    ArdpTransferParams params;
+    params.durationMs = 2000;
+    params.useEmulator = false;
+    uint32_t maxSegs = 4;
+    uint32_t fragLen = 0;
+    const char* csvFile = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp("-h", argv[i])) {
+            usage();
+            exit(0);
+        } else if (0 == strcmp("-segmax", argv[i])) {
+            params.config.segmax = NextArgU16(argc, argv, i, ARDP_SEGMAX_LIMIT);
+        } else if (0 == strcmp("-segbmax", argv[i])) {
+            params.config.segbmax = NextArgU16(argc, argv, i, ARDP_SEGBMAX_LIMIT);
+        } else if (0 == strcmp("-maxsegs", argv[i])) {
+            maxSegs = qcc::StringToU32(NextArg(argc, argv, i), 0, 4);
+        } else if (0 == strcmp("-fraglen", argv[i])) {
+            fragLen = qcc::StringToU32(NextArg(argc, argv, i), 0, 0);
+        } else if (0 == strcmp("-inflight", argv[i])) {
+            params.maxInFlight = qcc::StringToU32(NextArg(argc, argv, i), 0, 0);
+        } else if (0 == strcmp("-time", argv[i])) {
+            params.durationMs = qcc::StringToU32(NextArg(argc, argv, i), 0, 2000);
+        } else if (0 == strcmp("-n", argv[i])) {
+            params.connections = qcc::StringToU32(NextArg(argc, argv, i), 0, 1);
+        } else if (0 == strcmp("-link", argv[i])) {
+            params.useEmulator = true;
+        } else if (0 == strcmp("-csv", argv[i])) {
+            csvFile = NextArg(argc, argv, i);
+        } else {
+            printf("Unknown option %s\n", argv[i]);
+            usage();
+            exit(1);
+        }
+    }
+
+    /* A message cannot span more fragments than the window holds */
+    if (maxSegs == 0 || maxSegs + 1 > params.config.segmax) {
+        maxSegs = (params.config.segmax > 1) ? params.config.segmax - 1 : 1;
+        printf("-maxsegs limited to %u by segmax %u\n", maxSegs, params.config.segmax);
+    }
+
+    signal(SIGINT, SigIntHandler);
+
+    if (fragLen == 0) {
+        fragLen = MeasureFragmentLength(params);
+        if (fragLen == 0) {
+            printf("unable to measure the fragment payload, give it with -fraglen\n");
+            AllJoynRouterShutdown();
+            AllJoynShutdown();
+            return 1;
+        }
+        printf("segbmax %u carries %u data bytes per fragment (%u bytes of header)\n",
+               params.config.segbmax, fragLen, params.config.segbmax - fragLen);
+    }
+
+    FILE* csv = NULL;
+    if (csvFile) {
+        csv = fopen(csvFile, "w");
+        if (csv == NULL) {
+            printf("cannot open %s\n", csvFile);
+            exit(1);
+        }
+        PrintHeader(csv, true);
+    }
+
+    vector<uint32_t> lengths;
+    vector<uint32_t> expected;
+    for (uint32_t k = 1; k <= maxSegs; ++k) {
+        uint32_t boundary = k * fragLen;
+        uint32_t half = boundary - fragLen / 2;
+        if (half >= TRANSFER_HEADER_LEN) {
+            lengths.push_back(half);
+            expected.push_back(k);
+        }
+        lengths.push_back(boundary);
+        expected.push_back(k);
+        lengths.push_back(boundary + 1);
+        expected.push_back(k + 1);
+    }
+
+    printf("%u sizes x %u ms, %u in flight\n", (uint32_t)lengths.size(), params.durationMs,
+           params.maxInFlight ? params.maxInFlight : params.config.segmax);
+    PrintHeader(stdout, false);
+
+    int failures = 0;
+    for (size_t i = 0; i < lengths.size() && !g_interrupt; ++i) {
+        params.minPayload = params.maxPayload = lengths[i];
+        ArdpTransferResult result;
+        QStatus status = g_transfer.Run(params, result);
+        if (status != ER_OK) {
+            QCC_LogError(status, ("Transfer failed for %u byte messages", lengths[i]));
+            failures++;
+            continue;
+        }
+        PrintRow(stdout, false, lengths[i], expected[i], fragLen, params.config.segmax, result);
+        if (csv) {
+            PrintRow(csv, true, lengths[i], expected[i], fragLen, params.config.segmax, result);
+        }
+    }
+
+    if (csv) {
+        fclose(csv);
+    }
+
+    AllJoynRouterShutdown();
+    AllJoynShutdown();
+    return failures ? 1 : 0;
+}
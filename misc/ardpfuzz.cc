@@ -25,6 +25,9 @@
 #include <string.h>
 #include <time.h>
 #include <sys/types.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 #include <vector>
 #include <queue>
 #include <qcc/Mutex.h>
@@ -38,6 +41,11 @@
 #include <qcc/time.h>
 #include <ArdpProtocol.h>
 
+#include "ArdpMutationLog.h"
+#include "ArdpPayloadCheck.h"
+#include "LatencyHistogram.h"
+#include "XorShiftRng.h"
+
 #define ARDP_TESTHOOKS 1
 #if ARDP_TESTHOOKS
 #include "ScatterGatherList.h"
@@ -87,10 +95,40 @@ static bool g_debug = false;
 static bool g_connect = true;
 static bool sender = false;
 static bool receiver = false;
+static bool g_eventDriven = false;
+/* PayloadCheckType stamped on every message sent, and bodies that failed the check on receipt */
+static uint32_t g_verify = PAYLOAD_CHECK_NONE;
+static uint32_t g_corrupt = 0;
+/* Set whenever an application thread hands ARDP new work (send, receive release, connect) */
+static qcc::Event g_wakeEvent;
 
 static volatile sig_atomic_t g_interrupt = false;
 uint32_t*PAYLOAD;
 
+/*
+ * Every random choice comes from generators seeded from -seed: g_fuzzRng
+ * picks the mutations (under g_lock, from the hook), g_workloadRng the
+ * message lengths and TTLs (send thread only).  With -log every mutated
+ * segment is recorded; -replay applies a recorded log instead of fuzzing.
+ */
+static uint64_t g_seed = 0;
+static XorShiftRng g_fuzzRng;
+static XorShiftRng g_workloadRng;
+static MutationLogWriter g_mutationLog;
+static const uint32_t HOOK_SOURCES = RECVFROM_SEGMENT + 1;
+static uint32_t g_segmentIndex[HOOK_SOURCES];
+
+static bool g_replaying = false;
+static MutationLogReader g_replayLog;
+/* Positions in g_replayLog of the records of each source, and the next one due */
+static std::vector<size_t> g_replayPending[HOOK_SOURCES];
+static size_t g_replayNext[HOOK_SOURCES];
+/* Only segments with an index in [from, to) are mutated, to bisect a log */
+static uint32_t g_replayFrom = 0;
+static uint32_t g_replayTo = 0xFFFFFFFF;
+static uint32_t g_replayApplied = 0;
+static uint32_t g_replayMismatched = 0;
+
 
 static void SigIntHandler(int sig)
 {
@@ -102,40 +140,46 @@ void GetData(ArdpRcvBuf* rcv) {
     static uint32_t infinite_ttl_packet_count = 0;
     static uint32_t hole = 0;
 
-    ArdpRcvBuf*buf = rcv;
-    uint32_t len = 0;
-    uint16_t fragment = rcv->fcnt;
-
+    /* The payload may have been fuzzed on the way; do not read past what arrived */
+    if (rcv->datalen < 32) {
+        printf("RECEIVER: first fragment holds only %u bytes \n", rcv->datalen);
+        return;
+    }
 
-    uint32_t*data = (uint32_t*)buf->data;
+    const uint8_t* data = rcv->data;
+    uint32_t infiniteTtlCount = PayloadGetWord(data, 0);
+    uint32_t length = PayloadGetWord(data, 1);
+    uint32_t ttl = PayloadGetWord(data, 2);
+    uint32_t count = PayloadGetWord(data, 3);
 
-    printf("RecvCB: Received count is %u, infinite_ttl_count=%u, ttl= %u, length is %u \n", htonl(data[3]), htonl(data[0]), htonl(data[2]), htonl(data[1]));
+    printf("RecvCB: Received count is %u, infinite_ttl_count=%u, ttl= %u, length is %u \n", count, infiniteTtlCount, ttl, length);
 
     /* Detect holes in the receiving side. */
-    if (htonl(data[3]) > hole) {
-        printf(" %u packets lost at receiver \n", htonl(data[3]) - hole);
-        hole = htonl(data[3]) + 1;
+    if (count > hole) {
+        printf(" %u packets lost at receiver \n", count - hole);
+        hole = count + 1;
     } else {
         hole++;
     }
 
-    /* Consume data buffers */
-    for (uint16_t i = 0; i < fragment; i++) {
-        //QCC_DbgPrintf(("RecvCb(): got %d bytes of data \n", buf->datalen));
-        len += buf->datalen;
-        buf = buf->next;
+    /* Walk the fragments in place, checking the body if the sender stamped one */
+    uint32_t len = 0;
+    uint32_t badOffset = 0;
+    if (!CheckRcvChain(rcv, 32, PayloadGetWord(data, 6), PayloadGetWord(data, 7), len, badOffset)) {
+        g_corrupt++;
+        printf("RECEIVER: body check failed at offset %u of %u, %u corrupt so far. Alert!. \n", badOffset, len, g_corrupt);
     }
 
     //infinite_ttl_count should match when there is no ttl.
-    if ((htonl(data[2]) == 0) && (htonl(data[0]) != infinite_ttl_packet_count)) {
-        printf("RECEIVER: Count not matching. count: %u, infinite_ttl_packet_count: %u  Alert!. Program FAILED \n", htonl(data[0]), infinite_ttl_packet_count);
+    if ((ttl == 0) && (infiniteTtlCount != infinite_ttl_packet_count)) {
+        printf("RECEIVER: Count not matching. count: %u, infinite_ttl_packet_count: %u  Alert!. Program FAILED \n", infiniteTtlCount, infinite_ttl_packet_count);
     }
-    if (len != htonl(data[1])) {
-        printf("RECEIVER: Data length not matching. length: %u, callback length: %u Alert!. Program FAILED \n", htonl(data[1]), len);
+    if (len != length) {
+        printf("RECEIVER: Data length not matching. length: %u, callback length: %u Alert!. Program FAILED \n", length, len);
     }
 
     //If ttl==0, only then increment the infinite_ttl_packet_count
-    if (htonl(data[2]) == 0) {
+    if (ttl == 0) {
         infinite_ttl_packet_count++;
     }
     printf("RCBUSERDATA %u\n", len);
@@ -219,116 +263,164 @@ void SendWindowCb(ArdpHandle* handle, ArdpConnRecord* conn, uint16_t window, QSt
     QCC_DbgPrintf(("WINDOW RECEIVED-  %u, conn = %p \n", window, conn));
 }
 
-void ArdpSendToSGHook(ArdpHandle* handle, ArdpConnRecord* conn, TesthookSource source, qcc::ScatterGatherList& msgSG)
+/* Print what a mutation did the way the unseeded fuzzer always has */
+static void PrintMutation(const char* prefix, uint8_t op)
 {
-    if (SEND_MSG_DATA == source) {
-
-        std::list<IOVec>::iterator start(msgSG.Begin());
-        std::list<IOVec>::iterator end(msgSG.End());
-
-        //Fuzz the header
-        uint32_t len = start->len;
-        uint8_t*buf = (uint8_t*)(start)->buf;
-
-        uint32_t toss = random() % 6;
-        if (toss == 0) {
-            //just change the length
-            printf("SEN DATA RAND: header length changed \n");
-            (start)->len = random() % 50;
-        } else if (toss == 1) {
-            //change every 2 bytes of the header
-            printf("SEN DATA RAND: every 2 bytes fuzzed \n");
-            for (uint32_t i = random() % 2; i < len; i = i + 2) {
-                buf[i] = random() % 255;
-            }
-        } else if (toss == 2) {
-            //change every 4 bytes of the header
-            printf("SEN DATA RAND: every 4 bytes fuzzed \n");
-            for (uint32_t i = random() % 4; i < len; i = i + 4) {
-                buf[i] = random() % 255;
-            }
-        } else if (toss == 3) {
-            //change every 8 bytes of the header
-            printf("SEN DATA RAND: every 8 bytes fuzzed \n");
-            for (uint32_t i = random() % 8; i < len; i = i + 8) {
-                buf[i] = random() % 255;
-            }
-        } else if (toss == 4) {
-            //change every 16 bytes of the header
-            printf("SEN DATA RAND: every 16 bytes fuzzed \n");
-            for (uint32_t i = random() % 16; i < len; i = i + 16) {
-                buf[i] = random() % 255;
-            }
-        } else {
-            //send it as it is
-            printf("SEN DATA RAND: Sent as it is \n");
+    static const char* const what[] = {
+        "header length changed", "every 2 bytes fuzzed", "every 4 bytes fuzzed",
+        "every 8 bytes fuzzed", "every 16 bytes fuzzed", "Sent as it is"
+    };
+    printf("%s: %s \n", prefix, what[op < 6 ? op : 5]);
+}
+
+/* Overwrite every stride-th byte of the header from a random start, noting each change */
+static void FuzzStride(uint8_t* buf, uint32_t len, uint32_t stride, MutationRecord& rec)
+{
+    for (uint32_t i = g_fuzzRng.Below(stride); i < len; i = i + stride) {
+        uint8_t to = (uint8_t)g_fuzzRng.Below(255);
+        if (to != buf[i]) {
+            ByteChange c = { (uint16_t)i, buf[i], to };
+            rec.changes.push_back(c);
         }
+        buf[i] = to;
+    }
+}
 
-        start++;
-        std::list<IOVec>::iterator temp(start);
+/* Pick and apply a random mutation to the header and, for data segments, the data length */
+static void Mutate(IOVec& header, IOVec* data, const char* prefix, MutationRecord& rec)
+{
+    uint32_t len = header.len;
+    uint8_t* buf = (uint8_t*)header.buf;
+
+    rec.op = (uint8_t)g_fuzzRng.Below(6);
+    PrintMutation(prefix, rec.op);
+    switch (rec.op) {
+    case 0:
+        header.len = g_fuzzRng.Below(50);
+        break;
+
+    case 1:
+        FuzzStride(buf, len, 2, rec);
+        break;
+
+    case 2:
+        FuzzStride(buf, len, 4, rec);
+        break;
+
+    case 3:
+        FuzzStride(buf, len, 8, rec);
+        break;
+
+    case 4:
+        FuzzStride(buf, len, 16, rec);
+        break;
+
+    default:
+        break;
+    }
 
-        if (++temp == end) {
-            printf("SEN DATA No middle layer.\n");
-            if (random() % 10 == 9) {
-                printf("SEN DATA Changing the data length mod 130000 \n");
-                start->len = random() % 130000;
-            } else if (random() % 10 == 8) {
-                printf("SEN DATA Changing the data length mod 10 \n");
-                start->len = random() % 10;
-            } else {
-                printf("SEN DATA Not changing data length \n");
-            }
+    if (data) {
+        if (g_fuzzRng.Below(10) == 9) {
+            printf("SEN DATA Changing the data length mod 130000 \n");
+            data->len = g_fuzzRng.Below(130000);
+        } else if (g_fuzzRng.Below(10) == 8) {
+            printf("SEN DATA Changing the data length mod 10 \n");
+            data->len = g_fuzzRng.Below(10);
         } else {
-            printf("SEN DATA Yes middle layer exists. \n");
-            exit(-1);
+            printf("SEN DATA Not changing data length \n");
         }
-
     }
+}
 
-    if ((receiver) && (SEND_MSG_HEADER == source) && (g_connect)) {
+/*
+ * Apply the logged mutation for this segment, if there is one.  Bytes are
+ * written with their logged values; a header that does not look like the
+ * one that was logged is counted, since from there on the peer sees
+ * something else than in the original run.
+ */
+static void Replay(IOVec& header, IOVec* data, uint8_t source, uint32_t index)
+{
+    std::vector<size_t>& pending = g_replayPending[source];
+    size_t& next = g_replayNext[source];
+    const std::vector<MutationRecord>& records = g_replayLog.GetRecords();
+    while (next < pending.size() && records[pending[next]].index < index) {
+        ++next;
+    }
+    if (next == pending.size() || records[pending[next]].index != index) {
+        return;
+    }
+    const MutationRecord& rec = records[pending[next++]];
+    if (rec.index < g_replayFrom || rec.index >= g_replayTo) {
+        return;
+    }
 
-        std::list<IOVec>::iterator start(msgSG.Begin());
-        std::list<IOVec>::iterator end(msgSG.End());
+    uint8_t* buf = (uint8_t*)header.buf;
+    bool match = (rec.headerLen == header.len) && (rec.dataLen == (data ? (uint32_t)data->len : MutationRecord::NO_DATA));
+    for (size_t i = 0; i < rec.changes.size(); ++i) {
+        const ByteChange& c = rec.changes[i];
+        if (c.offset < header.len) {
+            match = match && (buf[c.offset] == c.from);
+            buf[c.offset] = c.to;
+        } else {
+            match = false;
+        }
+    }
+    header.len = rec.newHeaderLen;
+    if (data && rec.newDataLen != MutationRecord::NO_DATA) {
+        data->len = rec.newDataLen;
+    }
+    g_replayApplied++;
+    if (!match) {
+        g_replayMismatched++;
+    }
+    printf("REPLAY: source %u segment %u op %u, %u bytes changed%s \n", source, index, rec.op,
+           (uint32_t)rec.changes.size(), match ? "" : ", segment differs from the logged one");
+}
 
-        //Fuzz the header
-        uint32_t len = start->len;
-        uint8_t*buf = (uint8_t*)(start)->buf;
+void ArdpSendToSGHook(ArdpHandle* handle, ArdpConnRecord* conn, TesthookSource source, qcc::ScatterGatherList& msgSG)
+{
+    bool fuzzData = (SEND_MSG_DATA == source);
+    bool fuzzHeader = (receiver) && (SEND_MSG_HEADER == source) && (g_connect);
+    if (!fuzzData && !fuzzHeader) {
+        return;
+    }
 
-        uint32_t toss = random() % 6;
-        if (toss == 0) {
-            //just change the length
-            printf("RECV RAND: header length changed \n");
-            (start)->len = random() % 50;
-        } else if (toss == 1) {
-            //change every 2 bytes of the header
-            printf("RECV RAND: every 2 bytes fuzzed \n");
-            for (uint32_t i = random() % 2; i < len; i = i + 2) {
-                buf[i] = random() % 255;
-            }
-        } else if (toss == 2) {
-            //change every 4 bytes of the header
-            printf("RECV RAND: every 4 bytes fuzzed \n");
-            for (uint32_t i = random() % 4; i < len; i = i + 4) {
-                buf[i] = random() % 255;
-            }
-        } else if (toss == 3) {
-            //change every 8 bytes of the header
-            printf("RCEV RAND: every 8 bytes fuzzed \n");
-            for (uint32_t i = random() % 8; i < len; i = i + 8) {
-                buf[i] = random() % 255;
-            }
-        } else if (toss == 4) {
-            //change every 16 bytes of the header
-            printf("RECV RAND: every 16 bytes fuzzed \n");
-            for (uint32_t i = random() % 16; i < len; i = i + 16) {
-                buf[i] = random() % 255;
-            }
+    std::list<IOVec>::iterator start(msgSG.Begin());
+    std::list<IOVec>::iterator end(msgSG.End());
+    IOVec* data = NULL;
+    if (fuzzData) {
+        std::list<IOVec>::iterator last(start);
+        ++last;
+        std::list<IOVec>::iterator after(last);
+        if (last == end) {
+            //A data segment can go out without a data iovec; fuzz its header only
+            printf("SEN DATA No data iovec, header of %u bytes only.\n", (uint32_t)start->len);
+        } else if (++after == end) {
+            printf("SEN DATA No middle layer.\n");
+            data = &*last;
         } else {
-            //send it as it is
-            printf("RECV RAND: Sent as it is \n");
+            printf("SEN DATA Yes middle layer exists. \n");
+            exit(-1);
         }
+    }
 
+    uint32_t index = g_segmentIndex[source]++;
+    if (g_replaying) {
+        Replay(*start, data, (uint8_t)source, index);
+        return;
+    }
 
+    MutationRecord rec;
+    rec.index = index;
+    rec.source = (uint8_t)source;
+    rec.headerLen = (uint16_t)start->len;
+    rec.dataLen = data ? (uint32_t)data->len : MutationRecord::NO_DATA;
+    Mutate(*start, data, fuzzData ? "SEN DATA RAND" : "RECV RAND", rec);
+    rec.newHeaderLen = (uint16_t)start->len;
+    rec.newDataLen = data ? (uint32_t)data->len : MutationRecord::NO_DATA;
+    if (rec.Changed()) {
+        g_mutationLog.Write(rec);
+        g_mutationLog.Flush();
     }
 }
 
@@ -368,6 +460,7 @@ class RecvClass : public Thread {
                 }
                 QStatus status = ARDP_RecvReady(m_handle, g_conn, rcv);
                 g_lock.Unlock(MUTEX_CONTEXT);
+                g_wakeEvent.SetEvent();
                 if (status != ER_OK) {
                     QCC_LogError(status, ("Error while ARDP_Recv.. %s \n", QCC_StatusText(status)));
                     break;
@@ -402,12 +495,12 @@ class SendClass : public Thread {
             static uint32_t sender_count = 0;
             static uint32_t ttl_expired_at_sender = 0;
 
-            //We need atleast 16 bytes. 4 for infinite_ttl_count, 4 for uint32_t length and 4 for TTL, 4 for sender_count;
-            uint32_t length = 16 + qcc::Rand32() % (g_payloadLength);
+            //We need atleast 32 bytes. 4 for infinite_ttl_count, 4 for uint32_t length and 4 for TTL, 4 for sender_count, 8 for the send timestamp, 8 for the body check (same layout as ardpstress);
+            uint32_t length = 32 + g_workloadRng.Next32() % (g_payloadLength);
             uint32_t ttl = 0;
 
             //double a = (double)qcc::Rand8()/255.0;
-            double a = (double)rand() / (RAND_MAX * 1.0);
+            double a = g_workloadRng.NextDouble();
             double b = (double)g_percent / 100.0;
 
             if (g_debug) { printf("a is %lf, b is %lf \n", a, b); }
@@ -430,10 +523,22 @@ class SendClass : public Thread {
             PAYLOAD[2] = ntohl(ttl);
             //set the sender count
             PAYLOAD[3] = ntohl(sender_count);
+            //set the send timestamp
+            uint64_t now = GetTimestampMicros();
+            PAYLOAD[4] = ntohl((uint32_t)(now >> 32));
+            PAYLOAD[5] = ntohl((uint32_t)now);
+            //fill the body and say how the receiver can check it
+            PAYLOAD[6] = ntohl(g_verify);
+            PAYLOAD[7] = 0;
+            if (g_verify != PAYLOAD_CHECK_NONE) {
+                FillPattern((uint8_t*)PAYLOAD, 32, length, sender_count);
+                PAYLOAD[7] = ntohl((g_verify == PAYLOAD_CHECK_CRC32C) ? Crc32c::Compute((uint8_t*)PAYLOAD + 32, length - 32) : sender_count);
+            }
 
             g_lock.Lock(MUTEX_CONTEXT);
             QStatus status = ARDP_Send(m_handle, g_conn, (uint8_t*)PAYLOAD, length, ttl);
             g_lock.Unlock(MUTEX_CONTEXT);
+            g_wakeEvent.SetEvent();
             if ((status != ER_OK) && (status != ER_ARDP_TTL_EXPIRED)) {
                 if (g_debug) { printf("ARDP_Send Error: sender_count is  %u, sender_infinite_ttl_count is %u, ttl= %u, length is %u status is %s \n", sender_count, sender_infinite_ttl_count, ttl, length, QCC_StatusText(status)); }
                 free(PAYLOAD);
@@ -476,25 +581,96 @@ class ThreadClass : public Thread {
     ThreadClass(char*name, ArdpHandle* handle, qcc::SocketFd sock) : Thread(name) {
         m_handle = handle;
         m_sock = sock;
+        m_runCalls = 0;
+        m_sockWakeups = 0;
+        m_appWakeups = 0;
+        m_timerWakeups = 0;
+    }
+
+    void PrintStats(uint32_t elapsed) {
+        printf("ARDP_Run driver: %s, %llu ARDP_Run calls (%.1f/s)", g_eventDriven ? "event-driven" : "Sleep(1) polling",
+               (unsigned long long)m_runCalls, elapsed ? m_runCalls * 1000.0 / elapsed : 0.0);
+        if (g_eventDriven) {
+            printf(", wakeups: %llu socket, %llu application, %llu timer", (unsigned long long)m_sockWakeups,
+                   (unsigned long long)m_appWakeups, (unsigned long long)m_timerWakeups);
+        }
+        printf("\n");
+#ifndef _WIN32
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) {
+            double user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0;
+            double sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+            printf("CPU: user %.2f s, system %.2f s (%.1f%% of one core)\n", user, sys, elapsed ? (user + sys) * 100000.0 / elapsed : 0.0);
+        }
+#endif
     }
 
   protected:
     qcc::ThreadReturn STDCALL Run(void* arg) {
 
+        if (g_eventDriven) {
+            RunEventDriven();
+            return this;
+        }
+
         while ((!g_interrupt) && (IsRunning())) {
             uint32_t ms;
             g_lock.Lock(MUTEX_CONTEXT);
             ARDP_Run(m_handle, m_sock, true, true, &ms);
             g_lock.Unlock(MUTEX_CONTEXT);
+            m_runCalls++;
             qcc::Sleep(1);
         }
 
         return this;
     }
 
+    /*
+     * Only call ARDP_Run when there is something for it to do: the socket is
+     * readable, the timeout it returned last time has expired, or another
+     * thread has just queued work on the handle.
+     */
+    void RunEventDriven() {
+        qcc::Event sockEvent(m_sock, qcc::Event::IO_READ);
+        std::vector<qcc::Event*> checkEvents;
+        std::vector<qcc::Event*> signaledEvents;
+        checkEvents.push_back(&sockEvent);
+        checkEvents.push_back(&g_wakeEvent);
+
+        bool sockRead = true;
+        while ((!g_interrupt) && (IsRunning())) {
+            uint32_t ms = qcc::Event::WAIT_FOREVER;
+            g_lock.Lock(MUTEX_CONTEXT);
+            ARDP_Run(m_handle, m_sock, sockRead, true, &ms);
+            g_lock.Unlock(MUTEX_CONTEXT);
+            m_runCalls++;
+
+            signaledEvents.clear();
+            QStatus status = qcc::Event::Wait(checkEvents, signaledEvents, ms);
+            sockRead = false;
+            if (status == ER_TIMEOUT) {
+                m_timerWakeups++;
+                continue;
+            }
+            for (std::vector<qcc::Event*>::iterator it = signaledEvents.begin(); it != signaledEvents.end(); ++it) {
+                if (*it == &sockEvent) {
+                    sockRead = true;
+                    m_sockWakeups++;
+                } else if (*it == &g_wakeEvent) {
+                    g_wakeEvent.ResetEvent();
+                    m_appWakeups++;
+                }
+            }
+        }
+    }
+
   private:
     ArdpHandle* m_handle;
     qcc::SocketFd m_sock;
+    uint64_t m_runCalls;
+    uint64_t m_sockWakeups;
+    uint64_t m_appWakeups;
+    uint64_t m_timerWakeups;
 
 };
 
@@ -516,13 +692,22 @@ static void usage() {
     printf(" -percent #: percentage of packets with TTL\n");
     printf(" -sleep # :  program run time\n");
     printf(" -d :  Enable program debug\n");
+    printf(" -e :  Event-driven ARDP_Run loop (socket + ARDP timeout + send wakeup) instead of Sleep(1) polling\n");
+    printf(" -verify none|pattern|crc :  Fill sent bodies with a per-message pattern (checked in place, or by CRC32C) and count received bodies that fail\n");
+    printf(" -seed # :  Seed for the mutations and the message lengths, default is taken from the clock and printed\n");
+    printf(" -log <file> :  Write every mutated segment to <file> in binary\n");
+    printf(" -replay <file> :  Apply the mutations logged in <file> instead of random ones, with the seed of that run\n");
+    printf(" -replayfrom # :  With -replay, leave segments with a lower index alone\n");
+    printf(" -replayto # :  With -replay, leave segments with this or a higher index alone\n");
 }
 
 int main(int argc, char** argv)
 {
     QStatus status = ER_OK;
     bool connector = false;
-    srandom(time(NULL));
+    bool seedSet = false;
+    char const* logFile = NULL;
+    char const* replayFile = NULL;
     for (int i = 1; i < argc; ++i) {
         if (0 == strcmp("-lp", argv[i])) {
             g_local_port = argv[i + 1];
@@ -540,6 +725,71 @@ int main(int argc, char** argv)
             i++;
         } else if (0 == strcmp("-d", argv[i])) {
             g_debug = true;
+        } else if (0 == strcmp("-e", argv[i])) {
+            g_eventDriven = true;
+        } else if (0 == strcmp("-verify", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else if (0 == strcmp("pattern", argv[i])) {
+                g_verify = PAYLOAD_CHECK_PATTERN;
+            } else if (0 == strcmp("crc", argv[i])) {
+                g_verify = PAYLOAD_CHECK_CRC32C;
+            } else if (0 == strcmp("none", argv[i])) {
+                g_verify = PAYLOAD_CHECK_NONE;
+            } else {
+                printf("option %s takes none, pattern or crc\n", argv[i - 1]);
+                usage();
+                exit(1);
+            }
+        } else if (0 == strcmp("-seed", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else {
+                g_seed = qcc::StringToU64(argv[i], 0);
+                seedSet = true;
+            }
+        } else if (0 == strcmp("-log", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else {
+                logFile = argv[i];
+            }
+        } else if (0 == strcmp("-replay", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else {
+                replayFile = argv[i];
+            }
+        } else if (0 == strcmp("-replayfrom", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else {
+                g_replayFrom = qcc::StringToU32(argv[i], 0);
+            }
+        } else if (0 == strcmp("-replayto", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else {
+                g_replayTo = qcc::StringToU32(argv[i], 0);
+            }
         } else if (0 == strcmp("-c", argv[i])) {
             connector = true;
         } else if (0 == strcmp("-r", argv[i])) {
@@ -602,6 +852,36 @@ int main(int argc, char** argv)
 
     signal(SIGINT, SigIntHandler);
 
+    if (replayFile) {
+        if (!g_replayLog.Load(replayFile)) {
+            printf("Unable to read a mutation log from %s \n", replayFile);
+            return 1;
+        }
+        if (g_replayLog.IsTruncated()) {
+            printf("%s ends in a partial record, which is ignored \n", replayFile);
+        }
+        const std::vector<MutationRecord>& records = g_replayLog.GetRecords();
+        for (size_t i = 0; i < records.size(); ++i) {
+            if (records[i].source < HOOK_SOURCES) {
+                g_replayPending[records[i].source].push_back(i);
+            }
+        }
+        if (!seedSet) {
+            g_seed = g_replayLog.GetSeed();
+        }
+        g_replaying = true;
+        printf("Replaying %u mutations from %s, segments %u to %u \n", (uint32_t)records.size(), replayFile, g_replayFrom, g_replayTo);
+    } else if (!seedSet) {
+        g_seed = ((uint64_t)time(NULL) << 20) ^ GetTimestampMicros();
+    }
+    printf("Seed %llu \n", (unsigned long long)g_seed);
+    g_fuzzRng.Seed(g_seed);
+    g_workloadRng.Seed(g_seed ^ 0x5DEECE66DULL);
+    if (logFile && !g_mutationLog.Open(logFile, g_seed)) {
+        printf("Unable to open %s \n", logFile);
+        return 1;
+    }
+
     //One time activity- Create a socket, set to blocking, bind it to local port, local address
     qcc::SocketFd sock;
 
@@ -695,6 +975,7 @@ int main(int argc, char** argv)
             g_lock.Lock();
             status = ARDP_Connect(handle, sock, qcc::IPAddress(g_foreign_address), atoi(g_foreign_port), UDP_SEGMAX, UDP_SEGBMAX, &conn, (uint8_t* )g_ajnConnString, strlen(g_ajnConnString) + 1, NULL); \
             g_lock.Unlock();
+            g_wakeEvent.SetEvent();
             if (status != ER_OK) {
                 printf("Error while calling ARDP_Connect..  %s \n", QCC_StatusText(status));
                 return 0;
@@ -711,6 +992,7 @@ int main(int argc, char** argv)
 
     t1.Stop();
     t1.Join();
+    t1.PrintStats(endTime - startTime);
 
     s1.Stop();
     s1.Join();
@@ -718,5 +1000,13 @@ int main(int argc, char** argv)
     r1.Stop();
     r1.Join();
 
+    if (g_replaying) {
+        printf("Replay: %u mutations applied, %u to segments that differed from the logged ones \n", g_replayApplied, g_replayMismatched);
+    }
+    if (logFile) {
+        printf("Logged %llu mutated segments to %s \n", (unsigned long long)g_mutationLog.GetRecords(), logFile);
+        g_mutationLog.Close();
+    }
+
     return 0;
 }
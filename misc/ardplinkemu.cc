@@ -0,0 +1,221 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Run both ends of an ARDP bulk transfer in this process, through an
+ * emulated lossy, slow or jittery link, and report what it did to goodput,
+ * latency and retransmissions.  Needs neither root nor netem, and the same
+ * seed gives the same loss pattern, so fastRetransmitAckCounter and
+ * initialDataTimeout can be compared run against run.
+ */
+
+#include <qcc/Debug.h>
+#include <qcc/Log.h>
+
+#include <stdlib.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <qcc/String.h>
+#include <qcc/StringUtil.h>
+
+#include <alljoyn/Init.h>
+#include <alljoyn/Status.h>
+
+#include <ArdpProtocol.h>
+
+#include "ArdpLinkEmulator.h"
+#include "ArdpLoopbackTransfer.h"
+
+#define QCC_MODULE "ARDP"
+
+using namespace std;
+using namespace qcc;
+using namespace ajn;
+
+static ArdpLoopbackTransfer g_transfer;
+
+static void CDECL_CALL SigIntHandler(int sig)
+{
+    g_transfer.Abort();
+}
+
+static void usage() {
+    printf("./ardplinkemu -loss 1 -delay 20 -jitter 5 -time 10000\n");
+    printf("./ardplinkemu -gep 1 -ger 25 -rate 8000 -fr 3 -idt 500 -seed 7\n");
+    printf(" -n # :  Number of concurrent connections, default is 1\n");
+    printf(" -time # :  Transfer duration in ms, default is 10000\n");
+    printf(" -payload # :  Message length, default is 1024\n");
+    printf(" -minpayload # :  Pick message lengths at random between this and -payload\n");
+    printf(" -ttl # :  Message TTL in ms, default is 0 (infinite)\n");
+    printf(" -seed # :  Seed for the loss, jitter and reordering decisions, default is 1\n");
+    printf(" -direct :  Connect the endpoints directly, no emulated link\n");
+    printf(" -both :  Impair the acknowledgement path (B->A) as well as the data path\n");
+    printf("Link, A->B unless -both:\n");
+    printf(" -loss # :  Random loss in percent\n");
+    printf(" -gep # :  Gilbert-Elliott: percent chance per packet of entering the bad state\n");
+    printf(" -ger # :  Gilbert-Elliott: percent chance per packet of leaving the bad state, default is 100\n");
+    printf(" -gebad # :  Gilbert-Elliott: loss percent in the bad state, default is 100\n");
+    printf(" -gegood # :  Gilbert-Elliott: loss percent in the good state, default is 0\n");
+    printf(" -delay # :  One way delay in ms\n");
+    printf(" -jitter # :  Extra uniform delay, 0 to # ms\n");
+    printf(" -reorder # :  Percent of datagrams held back\n");
+    printf(" -reorderdelay # :  How long a held back datagram waits in ms, default is 10\n");
+    printf(" -rate # :  Bandwidth cap in kbit/s, default is unlimited\n");
+    printf(" -bucket # :  Token bucket depth in bytes, default is 65536\n");
+    printf(" -queue # :  Bytes queued behind the cap before drop-tail, default is 262144\n");
+    printf("ArdpGlobalConfig:\n");
+    printf(" -segmax # :  Maximum messages in flight, default is 16\n");
+    printf(" -segbmax # :  Maximum message size, default is 65507\n");
+    printf(" -dat # :  delayedAckTimeout in ms, default is 100\n");
+    printf(" -fr # :  fastRetransmitAckCounter, default is 1\n");
+    printf(" -idt # :  initialDataTimeout in ms, default is 1000\n");
+    printf(" -tdrt # :  totalDataRetryTimeout in ms, default is 5000\n");
+}
+
+static const char* NextArg(int argc, char** argv, int& i)
+{
+    ++i;
+    if (i == argc) {
+        printf("option %s requires a parameter\n", argv[i - 1]);
+        usage();
+        exit(1);
+    }
+    return argv[i];
+}
+
+/* The value of a 16 bit ARDP config option, which must be 1 to max */
+static uint16_t NextArgU16(int argc, char** argv, int& i, uint16_t max)
+{
+    const char* arg = NextArg(argc, argv, i);
+    uint32_t value = qcc::StringToU32(arg, 0, 0);
+    if (value == 0 || value > max) {
+        printf("option %s takes 1 to %u\n", argv[i - 1], max);
+        usage();
+        exit(1);
+    }
+    return (uint16_t)value;
+}
+
+int main(int argc, char** argv)
+{
+    if (AllJoynInit() != ER_OK) {
+        return 1;
+    }
+    if (AllJoynRouterInit() != ER_OK) {
+        AllJoynShutdown();
+        return 1;
+    }
+
+    ArdpTransferParams params;
+    LinkImpairment link;
+    link.reorderDelayUs = 10000;
+    bool both = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp("-h", argv[i])) {
+            usage();
+            exit(0);
+        } else if (0 == strcmp("-n", argv[i])) {
+            params.connections = qcc::StringToU32(NextArg(argc, argv, i), 0, 1);
+        } else if (0 == strcmp("-time", argv[i])) {
+            params.durationMs = qcc::StringToU32(NextArg(argc, argv, i), 0, 10000);
+        } else if (0 == strcmp("-payload", argv[i])) {
+            params.maxPayload = qcc::StringToU32(NextArg(argc, argv, i), 0, 1024);
+            if (params.minPayload > params.maxPayload) {
+                params.minPayload = params.maxPayload;
+            }
+        } else if (0 == strcmp("-minpayload", argv[i])) {
+            params.minPayload = qcc::StringToU32(NextArg(argc, argv, i), 0, 1024);
+        } else if (0 == strcmp("-ttl", argv[i])) {
+            params.ttl = qcc::StringToU32(NextArg(argc, argv, i), 0, 0);
+        } else if (0 == strcmp("-seed", argv[i])) {
+            params.seed = qcc::StringToU32(NextArg(argc, argv, i), 0, 1);
+        } else if (0 == strcmp("-direct", argv[i])) {
+            params.useEmulator = false;
+        } else if (0 == strcmp("-both", argv[i])) {
+            both = true;
+        } else if (0 == strcmp("-loss", argv[i])) {
+            link.lossRate = atof(NextArg(argc, argv, i)) / 100.0;
+        } else if (0 == strcmp("-gep", argv[i])) {
+            link.geGoodToBad = atof(NextArg(argc, argv, i)) / 100.0;
+        } else if (0 == strcmp("-ger", argv[i])) {
+            link.geBadToGood = atof(NextArg(argc, argv, i)) / 100.0;
+        } else if (0 == strcmp("-gebad", argv[i])) {
+            link.geLossBad = atof(NextArg(argc, argv, i)) / 100.0;
+        } else if (0 == strcmp("-gegood", argv[i])) {
+            link.geLossGood = atof(NextArg(argc, argv, i)) / 100.0;
+        } else if (0 == strcmp("-delay", argv[i])) {
+            link.delayUs = (uint32_t)(atof(NextArg(argc, argv, i)) * 1000);
+        } else if (0 == strcmp("-jitter", argv[i])) {
+            link.jitterUs = (uint32_t)(atof(NextArg(argc, argv, i)) * 1000);
+        } else if (0 == strcmp("-reorder", argv[i])) {
+            link.reorderRate = atof(NextArg(argc, argv, i)) / 100.0;
+        } else if (0 == strcmp("-reorderdelay", argv[i])) {
+            link.reorderDelayUs = (uint32_t)(atof(NextArg(argc, argv, i)) * 1000);
+        } else if (0 == strcmp("-rate", argv[i])) {
+            link.rateKbps = qcc::StringToU32(NextArg(argc, argv, i), 0, 0);
+        } else if (0 == strcmp("-bucket", argv[i])) {
+            link.bucketBytes = qcc::StringToU32(NextArg(argc, argv, i), 0, 65536);
+        } else if (0 == strcmp("-queue", argv[i])) {
+            link.queueBytes = qcc::StringToU32(NextArg(argc, argv, i), 0, 256 * 1024);
+        } else if (0 == strcmp("-segmax", argv[i])) {
+            params.config.segmax = NextArgU16(argc, argv, i, ARDP_SEGMAX_LIMIT);
+        } else if (0 == strcmp("-segbmax", argv[i])) {
+            params.config.segbmax = NextArgU16(argc, argv, i, ARDP_SEGBMAX_LIMIT);
+        } else if (0 == strcmp("-dat", argv[i])) {
+            params.config.delayedAckTimeout = qcc::StringToU32(NextArg(argc, argv, i), 0, 100);
+        } else if (0 == strcmp("-fr", argv[i])) {
+            params.config.fastRetransmitAckCounter = qcc::StringToU32(NextArg(argc, argv, i), 0, 1);
+        } else if (0 == strcmp("-idt", argv[i])) {
+            params.config.initialDataTimeout = qcc::StringToU32(NextArg(argc, argv, i), 0, 1000);
+        } else if (0 == strcmp("-tdrt", argv[i])) {
+            params.config.totalDataRetryTimeout = qcc::StringToU32(NextArg(argc, argv, i), 0, 5000);
+        } else {
+            printf("Unknown option %s\n", argv[i]);
+            usage();
+            exit(1);
+        }
+    }
+
+    params.forward = link;
+    if (both) {
+        params.reverse = link;
+    }
+
+    signal(SIGINT, SigIntHandler);
+
+    printf("segmax %u, segbmax %u, delayedAckTimeout %u, fastRetransmitAckCounter %u, initialDataTimeout %u, seed %llu\n",
+           params.config.segmax, params.config.segbmax, params.config.delayedAckTimeout,
+           params.config.fastRetransmitAckCounter, params.config.initialDataTimeout, (unsigned long long)params.seed);
+
+    ArdpTransferResult result;
+    QStatus status = g_transfer.Run(params, result);
+    if (status != ER_OK) {
+        QCC_LogError(status, ("Loopback transfer failed"));
+    } else {
+        result.Print();
+        if (params.useEmulator) {
+            ArdpLinkEmulator::PrintStats("A->B", result.forward);
+            ArdpLinkEmulator::PrintStats("B->A", result.reverse);
+        }
+    }
+
+    AllJoynRouterShutdown();
+    AllJoynShutdown();
+    return (status == ER_OK) ? 0 : 1;
+}
@@ -0,0 +1,480 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Heap held per ARDP connection.  Endpoint A opens N connections to
+ * endpoint B through an ArdpLinkEmulator, and the heap of each side is
+ * counted (see AllocCounter.h) in four states:
+ *
+ *   idle                connections up, nothing in flight
+ *   send window full    A has sent as many messages as the window takes
+ *                       and B's acknowledgements are blackholed, so
+ *                       nothing is acknowledged
+ *   receive queue full  B holds every message it received without calling
+ *                       ARDP_RecvReady, until A can send no more
+ *   released            B has handed everything back and A has seen it
+ *                       acknowledged; anything above idle here is retained
+ *
+ * The message buffers belong to the application (ARDP does not copy them)
+ * and are not counted.  Linux with glibc only.
+ */
+
+#include <qcc/Debug.h>
+#include <qcc/Log.h>
+
+#include <stdlib.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <vector>
+
+#include <qcc/Mutex.h>
+#include <qcc/StringUtil.h>
+#include <qcc/Thread.h>
+
+#include <alljoyn/Init.h>
+#include <alljoyn/Status.h>
+
+#include <ArdpProtocol.h>
+
+#include "AllocCounter.h"
+#include "ArdpLinkEmulator.h"
+#include "ArdpTestEndpoint.h"
+#include "LatencyHistogram.h"
+
+#define QCC_MODULE "ARDP"
+
+using namespace std;
+using namespace qcc;
+using namespace ajn;
+
+/* AllocCounter tags */
+const int TAG_OTHER = 0;
+const int TAG_A = 1;
+const int TAG_B = 2;
+
+static volatile sig_atomic_t g_interrupt = false;
+
+static void CDECL_CALL SigIntHandler(int sig)
+{
+    g_interrupt = true;
+}
+
+class FootprintDriver : public ArdpEndpointListener {
+
+  public:
+    FootprintDriver() : m_sender(NULL), m_receiver(NULL), m_connectedA(0), m_connectedB(0), m_hold(false) { }
+
+    void SetEndpoints(ArdpTestEndpoint* sender, ArdpTestEndpoint* receiver) {
+        m_sender = sender;
+        m_receiver = receiver;
+    }
+
+    /** Called under TAG_A; the map node is charged to TAG_OTHER */
+    void AddConnection(ArdpConnRecord* conn) {
+        int tag = AllocCounter::GetThreadTag();
+        AllocCounter::SetThreadTag(TAG_OTHER);
+        m_lock.Lock(MUTEX_CONTEXT);
+        m_conns[conn] = Conn();
+        m_lock.Unlock(MUTEX_CONTEXT);
+        AllocCounter::SetThreadTag(tag);
+    }
+
+    uint32_t GetConnected() {
+        m_lock.Lock(MUTEX_CONTEXT);
+        uint32_t n = (m_connectedA < m_connectedB) ? m_connectedA : m_connectedB;
+        m_lock.Unlock(MUTEX_CONTEXT);
+        return n;
+    }
+
+    uint64_t GetOutstanding() {
+        m_lock.Lock(MUTEX_CONTEXT);
+        uint64_t n = 0;
+        for (std::map<ArdpConnRecord*, Conn>::iterator it = m_conns.begin(); it != m_conns.end(); ++it) {
+            n += it->second.outstanding;
+        }
+        m_lock.Unlock(MUTEX_CONTEXT);
+        return n;
+    }
+
+    size_t GetHeld() {
+        m_lock.Lock(MUTEX_CONTEXT);
+        size_t n = m_held.size();
+        m_lock.Unlock(MUTEX_CONTEXT);
+        return n;
+    }
+
+    /** Keep what B receives rather than handing it back */
+    void SetHold(bool hold) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        m_hold = hold;
+        m_lock.Unlock(MUTEX_CONTEXT);
+    }
+
+    /** Hand back everything B holds, on behalf of B */
+    void ReleaseHeld() {
+        int tag = AllocCounter::GetThreadTag();
+        AllocCounter::SetThreadTag(TAG_OTHER);
+        m_lock.Lock(MUTEX_CONTEXT);
+        std::vector<Held> held;
+        held.swap(m_held);
+        m_lock.Unlock(MUTEX_CONTEXT);
+        AllocCounter::SetThreadTag(TAG_B);
+        for (size_t i = 0; i < held.size(); ++i) {
+            m_receiver->RecvReady(held[i].conn, held[i].rcv);
+        }
+        /* Free the vector under the tag it was charged to */
+        AllocCounter::SetThreadTag(TAG_OTHER);
+        std::vector<Held>().swap(held);
+        AllocCounter::SetThreadTag(tag);
+    }
+
+    /** On behalf of A, send buf on every connection until the window is full; returns the number of messages sent */
+    uint64_t FillWindows(uint8_t* buf, uint32_t len) {
+        int tag = AllocCounter::GetThreadTag();
+        AllocCounter::SetThreadTag(TAG_A);
+        uint64_t sent = 0;
+        m_sender->GetLock().Lock(MUTEX_CONTEXT);
+        m_lock.Lock(MUTEX_CONTEXT);
+        for (std::map<ArdpConnRecord*, Conn>::iterator it = m_conns.begin(); it != m_conns.end(); ++it) {
+            if (!it->second.up) {
+                continue;
+            }
+            for (uint32_t i = 0; i < m_sender->GetConfig().segmax; ++i) {
+                if (ARDP_Send(m_sender->GetHandle(), it->first, buf, len, 0) != ER_OK) {
+                    break;
+                }
+                it->second.outstanding++;
+                sent++;
+            }
+        }
+        m_lock.Unlock(MUTEX_CONTEXT);
+        m_sender->GetLock().Unlock(MUTEX_CONTEXT);
+        m_sender->Wake();
+        AllocCounter::SetThreadTag(tag);
+        return sent;
+    }
+
+    /* ArdpEndpointListener; m_lock nests inside the endpoint lock */
+
+    void Started(ArdpTestEndpoint& ep) {
+        AllocCounter::SetThreadTag((&ep == m_sender) ? TAG_A : TAG_B);
+    }
+
+    void Connected(ArdpTestEndpoint& ep, ArdpConnRecord* conn, bool passive, QStatus status) {
+        if (status != ER_OK) {
+            return;
+        }
+        m_lock.Lock(MUTEX_CONTEXT);
+        if (passive) {
+            m_connectedB++;
+        } else {
+            std::map<ArdpConnRecord*, Conn>::iterator it = m_conns.find(conn);
+            if (it != m_conns.end()) {
+                it->second.up = true;
+                m_connectedA++;
+            }
+        }
+        m_lock.Unlock(MUTEX_CONTEXT);
+    }
+
+    void Disconnected(ArdpTestEndpoint& ep, ArdpConnRecord* conn, QStatus status) {
+        int tag = AllocCounter::GetThreadTag();
+        AllocCounter::SetThreadTag(TAG_OTHER);
+        m_lock.Lock(MUTEX_CONTEXT);
+        if (&ep == m_sender) {
+            if (m_conns.erase(conn)) {
+                m_connectedA--;
+            }
+        } else {
+            m_connectedB--;
+            for (size_t i = 0; i < m_held.size(); ) {
+                if (m_held[i].conn == conn) {
+                    m_held.erase(m_held.begin() + i);
+                } else {
+                    ++i;
+                }
+            }
+        }
+        m_lock.Unlock(MUTEX_CONTEXT);
+        AllocCounter::SetThreadTag(tag);
+    }
+
+    void Received(ArdpTestEndpoint& ep, ArdpConnRecord* conn, ArdpRcvBuf* rcv, QStatus status) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        bool hold = m_hold;
+        if (hold) {
+            /* The driver's bookkeeping is not part of B's footprint */
+            int tag = AllocCounter::GetThreadTag();
+            AllocCounter::SetThreadTag(TAG_OTHER);
+            m_held.push_back(Held(conn, rcv));
+            AllocCounter::SetThreadTag(tag);
+        }
+        m_lock.Unlock(MUTEX_CONTEXT);
+        if (!hold) {
+            ep.RecvReady(conn, rcv);
+        }
+    }
+
+    void Sent(ArdpTestEndpoint& ep, ArdpConnRecord* conn, uint8_t* buf, uint32_t len, QStatus status) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        std::map<ArdpConnRecord*, Conn>::iterator it = m_conns.find(conn);
+        if (it != m_conns.end() && it->second.outstanding) {
+            it->second.outstanding--;
+        }
+        m_lock.Unlock(MUTEX_CONTEXT);
+    }
+
+  private:
+    struct Conn {
+        bool up;
+        uint32_t outstanding;       /**< Sent, SendCb not seen yet */
+        Conn() : up(false), outstanding(0) { }
+    };
+
+    struct Held {
+        ArdpConnRecord* conn;
+        ArdpRcvBuf* rcv;
+        Held(ArdpConnRecord* conn, ArdpRcvBuf* rcv) : conn(conn), rcv(rcv) { }
+    };
+
+    ArdpTestEndpoint* m_sender;
+    ArdpTestEndpoint* m_receiver;
+    qcc::Mutex m_lock;
+    std::map<ArdpConnRecord*, Conn> m_conns;
+    uint32_t m_connectedA;
+    uint32_t m_connectedB;
+    bool m_hold;
+    std::vector<Held> m_held;
+};
+
+static void usage() {
+    printf("./ardpmemfootprint -n 1000\n");
+    printf("./ardpmemfootprint -n 200 -segmax 32 -segbmax 1472 -msglen 4096\n");
+    printf(" -n # :  Number of connections, default is 100\n");
+    printf(" -segmax # :  Maximum messages in flight, default is 16\n");
+    printf(" -segbmax # :  Maximum segment size, default is 65507\n");
+    printf(" -msglen # :  Length of the messages that fill the windows, default is 1024\n");
+    printf(" -settle # :  Time in ms given to each state before it is measured, default is 500\n");
+}
+
+static const char* NextArg(int argc, char** argv, int& i)
+{
+    ++i;
+    if (i == argc) {
+        printf("option %s requires a parameter\n", argv[i - 1]);
+        usage();
+        exit(1);
+    }
+    return argv[i];
+}
+
+/* The value of a 16 bit ARDP config option, which must be 1 to max */
+static uint16_t NextArgU16(int argc, char** argv, int& i, uint16_t max)
+{
+    const char* arg = NextArg(argc, argv, i);
+    uint32_t value = qcc::StringToU32(arg, 0, 0);
+    if (value == 0 || value > max) {
+        printf("option %s takes 1 to %u\n", argv[i - 1], max);
+        usage();
+        exit(1);
+    }
+    return (uint16_t)value;
+}
+
+/* Wait up to ms for done() to hold */
+template <typename Pred>
+static bool WaitFor(Pred done, uint32_t ms)
+{
+    uint64_t start = GetTimestampMicros();
+    while (!g_interrupt && !done()) {
+        if ((GetTimestampMicros() - start) / 1000 > ms) {
+            return false;
+        }
+        qcc::Sleep(10);
+    }
+    return !g_interrupt;
+}
+
+static void PrintRow(const char* state, const AllocCounter::Snapshot& now, const AllocCounter::Snapshot& base, uint32_t n, uint64_t messages)
+{
+    double conns = n ? n : 1;
+    printf("%-20s | %12.0f %8.1f | %12.0f %8.1f | %10.3f | %8.1f\n", state,
+           (now.liveBytes[TAG_A] - base.liveBytes[TAG_A]) / conns, (now.liveBlocks[TAG_A] - base.liveBlocks[TAG_A]) / conns,
+           (now.liveBytes[TAG_B] - base.liveBytes[TAG_B]) / conns, (now.liveBlocks[TAG_B] - base.liveBlocks[TAG_B]) / conns,
+           (now.liveBytes[TAG_A] + now.liveBytes[TAG_B] - base.liveBytes[TAG_A] - base.liveBytes[TAG_B]) / (1024.0 * 1024.0),
+           messages / conns);
+}
+
+struct Connected {
+    FootprintDriver& d;
+    uint32_t n;
+    Connected(FootprintDriver& d, uint32_t n) : d(d), n(n) { }
+    bool operator()() const { return d.GetConnected() >= n; }
+};
+
+struct Acknowledged {
+    FootprintDriver& d;
+    Acknowledged(FootprintDriver& d) : d(d) { }
+    bool operator()() const { return d.GetOutstanding() == 0; }
+};
+
+struct Holding {
+    FootprintDriver& d;
+    size_t n;
+    Holding(FootprintDriver& d, size_t n) : d(d), n(n) { }
+    bool operator()() const { return d.GetHeld() >= n; }
+};
+
+int main(int argc, char** argv)
+{
+    if (AllJoynInit() != ER_OK) {
+        return 1;
+    }
+    if (AllJoynRouterInit() != ER_OK) {
+        AllJoynShutdown();
+        return 1;
+    }
+
+    ArdpGlobalConfig config;
+    ArdpTestDefaultConfig(config);
+    uint32_t n = 100;
+    uint32_t msgLen = 1024;
+    uint32_t settleMs = 500;
+
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp("-h", argv[i])) {
+            usage();
+            exit(0);
+        } else if (0 == strcmp("-n", argv[i])) {
+            n = qcc::StringToU32(NextArg(argc, argv, i), 0, 100);
+        } else if (0 == strcmp("-segmax", argv[i])) {
+            config.segmax = NextArgU16(argc, argv, i, ARDP_SEGMAX_LIMIT);
+        } else if (0 == strcmp("-segbmax", argv[i])) {
+            config.segbmax = NextArgU16(argc, argv, i, ARDP_SEGBMAX_LIMIT);
+        } else if (0 == strcmp("-msglen", argv[i])) {
+            msgLen = qcc::StringToU32(NextArg(argc, argv, i), 0, 1024);
+        } else if (0 == strcmp("-settle", argv[i])) {
+            settleMs = qcc::StringToU32(NextArg(argc, argv, i), 0, 500);
+        } else {
+            printf("Unknown option %s\n", argv[i]);
+            usage();
+            exit(1);
+        }
+    }
+
+    if (!AllocCounter::Enabled()) {
+        printf("heap accounting needs Linux with glibc\n");
+        AllJoynRouterShutdown();
+        AllJoynShutdown();
+        return 1;
+    }
+    /* Unacknowledged segments must not be retransmitted while the send windows are measured */
+    if (settleMs >= config.initialDataTimeout) {
+        printf("-settle %u is not below initialDataTimeout %u, the send window state will include retransmissions\n",
+               settleMs, config.initialDataTimeout);
+    }
+
+    signal(SIGINT, SigIntHandler);
+
+    uint8_t* message = (uint8_t*)malloc(msgLen);
+    memset(message, 0xA5, msgLen);
+
+    FootprintDriver driver;
+    ArdpTestEndpoint receiver("footprint-b", &driver);
+    ArdpTestEndpoint sender("footprint-a", &driver);
+    ArdpLinkEmulator emulator;
+    driver.SetEndpoints(&sender, &receiver);
+
+    /* The handles, sockets and run threads, charged to the side they belong to */
+    AllocCounter::Snapshot empty = AllocCounter::Take();
+    AllocCounter::SetThreadTag(TAG_B);
+    QStatus status = receiver.Init(config);
+    AllocCounter::SetThreadTag(TAG_OTHER);
+    if (status == ER_OK) {
+        status = emulator.Init("127.0.0.1", receiver.GetPort());
+    }
+    AllocCounter::SetThreadTag(TAG_A);
+    if (status == ER_OK) {
+        status = sender.Init(config);
+    }
+    qcc::Sleep(10);
+    AllocCounter::Snapshot handles = AllocCounter::Take();
+    for (uint32_t i = 0; (status == ER_OK) && (i < n); ++i) {
+        ArdpConnRecord* conn;
+        sender.GetLock().Lock(MUTEX_CONTEXT);
+        status = sender.Connect("127.0.0.1", emulator.GetPortForA(), &conn);
+        if (status == ER_OK) {
+            driver.AddConnection(conn);
+        }
+        sender.GetLock().Unlock(MUTEX_CONTEXT);
+    }
+    AllocCounter::SetThreadTag(TAG_OTHER);
+    if (status != ER_OK) {
+        QCC_LogError(status, ("Setup failed"));
+    } else if (!WaitFor(Connected(driver, n), config.connectTimeout * (config.connectRetries + 1))) {
+        printf("only %u of %u connections came up\n", driver.GetConnected(), n);
+        status = ER_TIMEOUT;
+    }
+
+    if (status == ER_OK) {
+        qcc::Sleep(settleMs);
+
+        printf("%u connections, segmax %u, segbmax %u, %u byte messages\n", n, config.segmax, config.segbmax, msgLen);
+        printf("handles before connecting: A %lld bytes, B %lld bytes\n",
+               (long long)(handles.liveBytes[TAG_A] - empty.liveBytes[TAG_A]),
+               (long long)(handles.liveBytes[TAG_B] - empty.liveBytes[TAG_B]));
+        printf("%-20s | %12s %8s | %12s %8s | %10s | %8s\n", "per connection",
+               "A bytes", "A blocks", "B bytes", "B blocks", "total MB", "messages");
+        /* Every row is the whole cost per connection in that state, idle included */
+        AllocCounter::Snapshot base = handles;
+        PrintRow("idle", AllocCounter::Take(), base, n, 0);
+
+        emulator.SetBlackhole(ArdpLinkEmulator::B_TO_A, true);
+        uint64_t sent = driver.FillWindows(message, msgLen);
+        qcc::Sleep(settleMs);
+        PrintRow("send window full", AllocCounter::Take(), base, n, sent);
+        emulator.SetBlackhole(ArdpLinkEmulator::B_TO_A, false);
+        if (!WaitFor(Acknowledged(driver), config.totalDataRetryTimeout)) {
+            printf("%llu messages still unacknowledged\n", (unsigned long long)driver.GetOutstanding());
+        }
+
+        driver.SetHold(true);
+        sent = driver.FillWindows(message, msgLen);
+        WaitFor(Holding(driver, sent), settleMs * 4);
+        qcc::Sleep(settleMs);
+        PrintRow("receive queue full", AllocCounter::Take(), base, n, driver.GetHeld());
+
+        driver.SetHold(false);
+        driver.ReleaseHeld();
+        if (!WaitFor(Acknowledged(driver), config.totalDataRetryTimeout)) {
+            printf("%llu messages still unacknowledged\n", (unsigned long long)driver.GetOutstanding());
+        }
+        qcc::Sleep(settleMs);
+        PrintRow("released", AllocCounter::Take(), base, n, 0);
+    }
+
+    sender.Shutdown();
+    receiver.Shutdown();
+    emulator.Shutdown();
+    free(message);
+
+    AllJoynRouterShutdown();
+    AllJoynShutdown();
+    return (status == ER_OK) ? 0 : 1;
+}
@@ -0,0 +1,570 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * How does ARDP scale across cores?  For each K, start K receiving shards
+ * that share one UDP port through SO_REUSEPORT and K sending shards, each
+ * shard with its own socket, ArdpHandle, lock and run thread, and nothing
+ * shared between shards.  Every sending shard keeps its connections busy
+ * for a fixed time; the aggregate delivery rate is reported per K together
+ * with the speedup over the first K and the CPU time consumed.
+ *
+ * The kernel picks the receiving socket by hashing the sender's address and
+ * port, so two sending shards can land on the same receiving shard; the
+ * per-shard spread is printed so that is visible.  On Linux, -cpubpf
+ * attaches a reuseport program that picks the receiving socket by CPU
+ * instead and turns on -pin: with every thread kept on its CPU, a
+ * connection's segments all reach the same receiving handle and each sender
+ * gets a receiver of its own.
+ */
+
+#include <qcc/Debug.h>
+#include <qcc/Log.h>
+
+#include <stdlib.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <linux/filter.h>
+#endif
+
+#include <vector>
+
+#include <qcc/Event.h>
+#include <qcc/Mutex.h>
+#include <qcc/String.h>
+#include <qcc/StringUtil.h>
+#include <qcc/Thread.h>
+
+#include <alljoyn/Init.h>
+#include <alljoyn/Status.h>
+
+#include <ArdpProtocol.h>
+
+#include "ArdpTestEndpoint.h"
+#include "LatencyHistogram.h"
+
+#define QCC_MODULE "ARDP"
+
+using namespace std;
+using namespace qcc;
+using namespace ajn;
+
+static volatile sig_atomic_t g_interrupt = false;
+
+static void CDECL_CALL SigIntHandler(int sig)
+{
+    g_interrupt = true;
+}
+
+static uint32_t g_payloadLength = 256;
+static uint32_t g_connsPerShard = 4;
+static uint32_t g_duration = 5000;
+static bool g_pin = false;
+static bool g_cpuBpf = false;
+
+/* Receiving side of one shard: count what arrives and release it at once */
+class ReceiverShard : public ArdpEndpointListener {
+
+  public:
+    ReceiverShard() : m_ep("recv", this), m_messages(0), m_bytes(0) { }
+
+    ArdpTestEndpoint& Endpoint() { return m_ep; }
+
+    void Received(ArdpTestEndpoint& ep, ArdpConnRecord* conn, ArdpRcvBuf* rcv, QStatus status) {
+        uint32_t len = 0;
+        ArdpRcvBuf* buf = rcv;
+        for (uint16_t i = 0; i < rcv->fcnt; ++i) {
+            len += buf->datalen;
+            buf = buf->next;
+        }
+        m_messages++;
+        m_bytes += len;
+        ep.RecvReady(conn, rcv);
+    }
+
+    void Snapshot(uint64_t& messages, uint64_t& bytes) {
+        m_ep.GetLock().Lock(MUTEX_CONTEXT);
+        messages = m_messages;
+        bytes = m_bytes;
+        m_ep.GetLock().Unlock(MUTEX_CONTEXT);
+    }
+
+  private:
+    ArdpTestEndpoint m_ep;
+    uint64_t m_messages;
+    uint64_t m_bytes;
+};
+
+/*
+ * Sending side of one shard: a set of connections on one handle, kept full
+ * by one thread that goes round them sending whatever the windows allow.
+ */
+class SenderShard : public ArdpEndpointListener, public qcc::Thread {
+
+  public:
+    SenderShard(int cpu) : qcc::Thread("SenderShard"), m_ep("send", this), m_cpu(cpu),
+        m_stopping(false), m_connected(0), m_failed(0), m_sent(0), m_errors(0) {
+        m_ep.SetCpu(cpu);
+    }
+
+    ~SenderShard() {
+        m_stopping = true;
+        m_event.SetEvent();
+        Stop();
+        Join();
+        m_ep.Shutdown();
+        for (size_t i = 0; i < m_conns.size(); ++i) {
+            for (size_t j = 0; j < m_conns[i].allBufs.size(); ++j) {
+                free(m_conns[i].allBufs[j]);
+            }
+        }
+    }
+
+    QStatus Init(const ArdpGlobalConfig& config, uint16_t port, uint32_t connections) {
+        QStatus status = m_ep.Init(config);
+        m_conns.resize(connections);
+        for (uint32_t i = 0; (status == ER_OK) && (i < connections); ++i) {
+            Conn& c = m_conns[i];
+            for (uint32_t j = 0; j < config.segmax; ++j) {
+                uint8_t* buf = (uint8_t*)malloc(g_payloadLength);
+                memset(buf, 0x5A, g_payloadLength);
+                c.allBufs.push_back(buf);
+                c.freeBufs.push_back(buf);
+            }
+            status = m_ep.Connect("127.0.0.1", port, &c.conn);
+        }
+        return status;
+    }
+
+    /** Wait until every connection is up or has failed */
+    bool WaitConnected(uint32_t ms) {
+        uint64_t start = GetTimestampMicros();
+        while (!g_interrupt && (GetTimestampMicros() - start) / 1000 < ms) {
+            m_ep.GetLock().Lock(MUTEX_CONTEXT);
+            bool done = (m_connected + m_failed) >= m_conns.size();
+            m_ep.GetLock().Unlock(MUTEX_CONTEXT);
+            if (done) {
+                return true;
+            }
+            qcc::Sleep(10);
+        }
+        return false;
+    }
+
+    void StopSending() {
+        m_stopping = true;
+        m_event.SetEvent();
+        Stop();
+        Join();
+    }
+
+    uint32_t GetConnected() const { return m_connected; }
+    uint32_t GetFailed() const { return m_failed; }
+    uint64_t GetErrors() const { return m_errors; }
+
+    void Connected(ArdpTestEndpoint& ep, ArdpConnRecord* conn, bool passive, QStatus status) {
+        Conn* c = Find(conn);
+        if (c) {
+            if (status == ER_OK) {
+                c->connected = true;
+                m_connected++;
+            } else {
+                m_failed++;
+            }
+        }
+    }
+
+    void Disconnected(ArdpTestEndpoint& ep, ArdpConnRecord* conn, QStatus status) {
+        Conn* c = Find(conn);
+        if (c) {
+            c->connected = false;
+            c->conn = NULL;
+        }
+    }
+
+    void Sent(ArdpTestEndpoint& ep, ArdpConnRecord* conn, uint8_t* buf, uint32_t len, QStatus status) {
+        Conn* c = Find(conn);
+        if (c) {
+            c->freeBufs.push_back(buf);
+            c->blocked = false;
+            m_event.SetEvent();
+        }
+    }
+
+    void Window(ArdpTestEndpoint& ep, ArdpConnRecord* conn, uint16_t window, QStatus status) {
+        Conn* c = Find(conn);
+        if (c && window > 0) {
+            c->blocked = false;
+            m_event.SetEvent();
+        }
+    }
+
+  protected:
+    qcc::ThreadReturn STDCALL Run(void* arg) {
+        PinCurrentThread(m_cpu);
+        qcc::Mutex& lock = m_ep.GetLock();
+        while (!m_stopping && !g_interrupt) {
+            bool progress = false;
+            lock.Lock(MUTEX_CONTEXT);
+            for (size_t i = 0; i < m_conns.size(); ++i) {
+                Conn& c = m_conns[i];
+                if (!c.connected || c.blocked || c.freeBufs.empty()) {
+                    continue;
+                }
+                uint8_t* buf = c.freeBufs.back();
+                c.freeBufs.pop_back();
+                QStatus status = ARDP_Send(m_ep.GetHandle(), c.conn, buf, g_payloadLength, 0);
+                if (status == ER_OK) {
+                    m_sent++;
+                    progress = true;
+                } else {
+                    c.freeBufs.push_back(buf);
+                    if (status == ER_ARDP_BACKPRESSURE) {
+                        c.blocked = true;
+                    } else {
+                        m_errors++;
+                    }
+                }
+            }
+            if (!progress) {
+                m_event.ResetEvent();
+            }
+            lock.Unlock(MUTEX_CONTEXT);
+            if (progress) {
+                m_ep.Wake();
+            } else {
+                qcc::Event::Wait(m_event, 100);
+            }
+        }
+        return this;
+    }
+
+  private:
+    struct Conn {
+        ArdpConnRecord* conn;
+        bool connected;
+        bool blocked;
+        std::vector<uint8_t*> allBufs;
+        std::vector<uint8_t*> freeBufs;
+
+        Conn() : conn(NULL), connected(false), blocked(false) { }
+    };
+
+    Conn* Find(ArdpConnRecord* conn) {
+        for (size_t i = 0; i < m_conns.size(); ++i) {
+            if (m_conns[i].conn == conn) {
+                return &m_conns[i];
+            }
+        }
+        return NULL;
+    }
+
+    ArdpTestEndpoint m_ep;
+    int m_cpu;
+    volatile bool m_stopping;
+    qcc::Event m_event;
+    std::vector<Conn> m_conns;
+    uint32_t m_connected;
+    uint32_t m_failed;
+    uint64_t m_sent;
+    uint64_t m_errors;
+};
+
+static uint32_t OnlineCpus()
+{
+#if defined(__linux__)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (uint32_t)n : 1;
+#else
+    return 1;
+#endif
+}
+
+static double CpuSeconds()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#else
+    return 0.0;
+#endif
+}
+
+/*
+ * Let the reuseport group pick the socket by the CPU the datagram is being
+ * processed on, modulo the group size.  On loopback that is the sending CPU.
+ */
+static bool AttachCpuBpf(qcc::SocketFd sock, uint32_t k)
+{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU) },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, k },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+    return setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == 0;
+#else
+    return false;
+#endif
+}
+
+struct ScaleResult {
+    uint32_t k;
+    uint32_t connections;
+    uint32_t failed;
+    double seconds;
+    uint64_t messages;
+    uint64_t bytes;
+    double cpuSeconds;
+    uint64_t minShard;
+    uint64_t maxShard;
+    uint64_t errors;
+};
+
+static QStatus RunScale(const ArdpGlobalConfig& config, uint32_t k, ScaleResult& r)
+{
+    uint32_t cpus = OnlineCpus();
+    vector<ReceiverShard*> receivers;
+    vector<SenderShard*> senders;
+    QStatus status = ER_OK;
+    uint16_t port = 0;
+
+    memset(&r, 0, sizeof(r));
+    r.k = k;
+
+    /* Receiver i runs on CPU i, sender i on CPU k + i, wrapping round */
+    for (uint32_t i = 0; (status == ER_OK) && (i < k); ++i) {
+        ReceiverShard* rs = new ReceiverShard();
+        receivers.push_back(rs);
+        rs->Endpoint().SetReusePort(true);
+        if (g_pin) {
+            rs->Endpoint().SetCpu(i % cpus);
+        }
+        status = rs->Endpoint().Init(config, "127.0.0.1", port);
+        if (status == ER_OK && i == 0) {
+            port = rs->Endpoint().GetPort();
+            if (g_cpuBpf && !AttachCpuBpf(rs->Endpoint().GetSocket(), k)) {
+                printf("cannot attach the reuseport CPU program, falling back to the kernel hash\n");
+            }
+        }
+    }
+    for (uint32_t i = 0; (status == ER_OK) && (i < k); ++i) {
+        SenderShard* ss = new SenderShard(g_pin ? (int)((k + i) % cpus) : -1);
+        senders.push_back(ss);
+        status = ss->Init(config, port, g_connsPerShard);
+    }
+
+    if (status == ER_OK) {
+        uint32_t limit = config.connectTimeout * (config.connectRetries + 1);
+        for (uint32_t i = 0; i < k; ++i) {
+            senders[i]->WaitConnected(limit);
+            r.connections += senders[i]->GetConnected();
+            r.failed += senders[i]->GetFailed();
+        }
+        for (uint32_t i = 0; i < k; ++i) {
+            senders[i]->Start();
+        }
+
+        /* Let the windows fill before measuring */
+        qcc::Sleep(200);
+
+        vector<uint64_t> startMessages(k), startBytes(k);
+        for (uint32_t i = 0; i < k; ++i) {
+            receivers[i]->Snapshot(startMessages[i], startBytes[i]);
+        }
+        uint64_t start = GetTimestampMicros();
+        double cpuStart = CpuSeconds();
+        while (!g_interrupt && (GetTimestampMicros() - start) < (uint64_t)g_duration * 1000) {
+            qcc::Sleep(10);
+        }
+        r.cpuSeconds = CpuSeconds() - cpuStart;
+        r.seconds = (GetTimestampMicros() - start) / 1e6;
+        r.minShard = (uint64_t)-1;
+        for (uint32_t i = 0; i < k; ++i) {
+            uint64_t messages, bytes;
+            receivers[i]->Snapshot(messages, bytes);
+            messages -= startMessages[i];
+            r.messages += messages;
+            r.bytes += bytes - startBytes[i];
+            if (messages < r.minShard) {
+                r.minShard = messages;
+            }
+            if (messages > r.maxShard) {
+                r.maxShard = messages;
+            }
+        }
+        for (uint32_t i = 0; i < k; ++i) {
+            senders[i]->StopSending();
+            r.errors += senders[i]->GetErrors();
+        }
+    }
+
+    for (size_t i = 0; i < senders.size(); ++i) {
+        delete senders[i];
+    }
+    for (size_t i = 0; i < receivers.size(); ++i) {
+        delete receivers[i];
+    }
+    return status;
+}
+
+static void usage() {
+    printf("./ardpscale -k 1,2,4,8 -conns 4 -payload 256 -time 5000 -pin\n");
+    printf(" -k list :  Comma separated shard counts to run, default is 1,2,4,...up to the number of CPUs\n");
+    printf(" -conns # :  Connections per sending shard, default is 4\n");
+    printf(" -payload # :  Message length, default is 256\n");
+    printf(" -time # :  Measurement time per K in ms, default is 5000\n");
+    printf(" -segmax # :  Maximum messages in flight per connection, default is 16\n");
+    printf(" -dat # :  delayedAckTimeout in ms, default is 100\n");
+    printf(" -pin :  Pin receiving shard i to CPU i and sending shard i to CPU K + i (Linux)\n");
+    printf(" -cpubpf :  Pick the receiving shard by CPU rather than by address hash (Linux, implies -pin)\n");
+}
+
+static const char* NextArg(int argc, char** argv, int& i)
+{
+    ++i;
+    if (i == argc) {
+        printf("option %s requires a parameter\n", argv[i - 1]);
+        usage();
+        exit(1);
+    }
+    return argv[i];
+}
+
+/* The value of a 16 bit ARDP config option, which must be 1 to max */
+static uint16_t NextArgU16(int argc, char** argv, int& i, uint16_t max)
+{
+    const char* arg = NextArg(argc, argv, i);
+    uint32_t value = qcc::StringToU32(arg, 0, 0);
+    if (value == 0 || value > max) {
+        printf("option %s takes 1 to %u\n", argv[i - 1], max);
+        usage();
+        exit(1);
+    }
+    return (uint16_t)value;
+}
+
+int main(int argc, char** argv)
+{
+    if (AllJoynInit() != ER_OK) {
+        return 1;
+    }
+    if (AllJoynRouterInit() != ER_OK) {
+        AllJoynShutdown();
+        return 1;
+    }
+
+    ArdpGlobalConfig config;
+    ArdpTestDefaultConfig(config);
+    vector<uint32_t> ks;
+
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp("-h", argv[i])) {
+            usage();
+            exit(0);
+        } else if (0 == strcmp("-k", argv[i])) {
+            qcc::String list(NextArg(argc, argv, i));
+            size_t pos = 0;
+            while (pos <= list.size()) {
+                size_t comma = list.find_first_of(',', pos);
+                if (comma == qcc::String::npos) {
+                    comma = list.size();
+                }
+                uint32_t k = qcc::StringToU32(list.substr(pos, comma - pos), 0, 0);
+                if (k == 0) {
+                    printf("bad shard count list %s\n", list.c_str());
+                    exit(1);
+                }
+                ks.push_back(k);
+                pos = comma + 1;
+            }
+        } else if (0 == strcmp("-conns", argv[i])) {
+            g_connsPerShard = qcc::StringToU32(NextArg(argc, argv, i), 0, 4);
+        } else if (0 == strcmp("-payload", argv[i])) {
+            g_payloadLength = qcc::StringToU32(NextArg(argc, argv, i), 0, 256);
+        } else if (0 == strcmp("-time", argv[i])) {
+            g_duration = qcc::StringToU32(NextArg(argc, argv, i), 0, 5000);
+        } else if (0 == strcmp("-segmax", argv[i])) {
+            config.segmax = NextArgU16(argc, argv, i, ARDP_SEGMAX_LIMIT);
+        } else if (0 == strcmp("-dat", argv[i])) {
+            config.delayedAckTimeout = qcc::StringToU32(NextArg(argc, argv, i), 0, 100);
+        } else if (0 == strcmp("-pin", argv[i])) {
+            g_pin = true;
+        } else if (0 == strcmp("-cpubpf", argv[i])) {
+            //Picking by CPU only keeps a connection on one receiver if its threads stay put
+            g_cpuBpf = true;
+            g_pin = true;
+        } else {
+            printf("Unknown option %s\n", argv[i]);
+            usage();
+            exit(1);
+        }
+    }
+
+    if (ks.empty()) {
+        uint32_t cpus = OnlineCpus();
+        for (uint32_t k = 1; k <= cpus; k *= 2) {
+            ks.push_back(k);
+        }
+    }
+
+    signal(SIGINT, SigIntHandler);
+
+    printf("%u CPUs online, %u connections per shard, %u byte messages, segmax %u\n",
+           OnlineCpus(), g_connsPerShard, g_payloadLength, config.segmax);
+    printf("%4s %6s %12s %10s %8s %8s %8s %12s %12s %8s\n",
+           "K", "conns", "msgs/s", "MB/s", "speedup", "effic", "cores", "shard_min", "shard_max", "errors");
+
+    double base = 0.0;
+    uint32_t baseK = 0;
+    int failures = 0;
+    for (size_t i = 0; (i < ks.size()) && !g_interrupt; ++i) {
+        ScaleResult r;
+        QStatus status = RunScale(config, ks[i], r);
+        if (status != ER_OK) {
+            QCC_LogError(status, ("K=%u failed to start", ks[i]));
+            failures++;
+            continue;
+        }
+        double rate = r.seconds > 0 ? r.messages / r.seconds : 0.0;
+        if (baseK == 0 && rate > 0) {
+            base = rate;
+            baseK = r.k;
+        }
+        double speedup = base > 0 ? rate / base : 0.0;
+        printf("%4u %6u %12.0f %10.2f %8.2f %8.2f %8.2f %12llu %12llu %8llu\n",
+               r.k, r.connections, rate, r.seconds > 0 ? r.bytes / r.seconds / (1024.0 * 1024.0) : 0.0,
+               speedup, baseK ? speedup * baseK / r.k : 0.0, r.seconds > 0 ? r.cpuSeconds / r.seconds : 0.0,
+               (unsigned long long)r.minShard, (unsigned long long)r.maxShard, (unsigned long long)r.errors);
+        if (r.failed) {
+            printf("     %u connections failed to come up\n", r.failed);
+        }
+        fflush(stdout);
+    }
+
+    AllJoynRouterShutdown();
+    AllJoynShutdown();
+    return failures ? 1 : 0;
+}
@@ -30,13 +30,15 @@
 #define random() rand()
 #else
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #endif
 
+#include <map>
 #include <vector>
-#include <queue>
 
+#include <qcc/Condition.h>
 #include <qcc/Event.h>
 #include <qcc/Mutex.h>
 #include <qcc/Socket.h>
@@ -51,6 +53,16 @@
 #include <alljoyn/Status.h>
 
 #include <ArdpProtocol.h>
+#if ARDP_TESTHOOKS
+#include "ScatterGatherList.h"
+#endif
+
+#include "ArdpPayloadCheck.h"
+#if ARDP_TESTHOOKS
+#include "ArdpTelemetry.h"
+#endif
+#include "LatencyHistogram.h"
+#include "MmsgShim.h"
 
 #define QCC_MODULE "ARDP"
 
@@ -73,6 +85,14 @@ const uint32_t UDP_SEGBMAX = 65507;  /**< Maximum size of an ARDP message (for r
 const uint32_t UDP_SEGMAX = 16;      /**< Maximum number of ARDP messages in-flight (bandwidth-delay product sizing) */
 const uint32_t UDP_DELAYED_ACK_TIMEOUT = 100; /**< How long do we wait until acknowledging received segments */
 
+/*
+ * Every message starts with a header of 32-bit words in network byte order:
+ * infinite_ttl_count, length, ttl, sender_count, the 64-bit monotonic send
+ * timestamp in microseconds (high word first), the PayloadCheckType of the
+ * body and its check word (pattern seed or CRC32C).
+ */
+const uint32_t PAYLOAD_HEADER_LEN = 32;
+
 
 char const* g_local_port = "9954";
 char const* g_foreign_port = "9955";
@@ -83,11 +103,160 @@ char const* g_ajnConnString = "AUTH ANONYMOUS; BEGIN THE CONNECTION; Bus Hello;
 char const* g_ajnAcceptString = "OK 123455678; Hello; Redmond";
 char const* g_ajnAcknowledgeString = "Acking: WE ARE ON!";
 
-static ArdpConnRecord* g_conn;
-std::queue<ArdpRcvBuf*> RecvQueue;
+class SendClass;
+class RecvClass;
+
+/*
+ * Hands the messages RecvCb gets over to the RecvClass of the connection,
+ * which sleeps on the condition while there are none.  ARDP delivers at
+ * most UDP_SEGMAX messages per connection before they are given back, so
+ * the ring never fills; should it, Push refuses and RecvCb gives the
+ * message back at once.
+ */
+class RecvHandoff {
+
+  public:
+    RecvHandoff() : m_head(0), m_count(0), m_highWater(0), m_pushes(0), m_waits(0) { }
+
+    bool Push(ArdpRcvBuf* rcv, uint64_t now) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        if (m_count == UDP_SEGMAX) {
+            m_lock.Unlock(MUTEX_CONTEXT);
+            return false;
+        }
+        Entry& e = m_ring[(m_head + m_count) % UDP_SEGMAX];
+        e.rcv = rcv;
+        e.pushed = now;
+        if (++m_count > m_highWater) {
+            m_highWater = m_count;
+        }
+        m_pushes++;
+        m_cond.Signal();
+        m_lock.Unlock(MUTEX_CONTEXT);
+        return true;
+    }
+
+    /** The oldest message, waiting up to waitMs for one; NULL if there is none */
+    ArdpRcvBuf* Pop(uint32_t waitMs, uint64_t& pushed) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        if (m_count == 0 && waitMs) {
+            m_waits++;
+            m_cond.TimedWait(m_lock, waitMs);
+        }
+        ArdpRcvBuf* rcv = NULL;
+        if (m_count) {
+            rcv = m_ring[m_head].rcv;
+            pushed = m_ring[m_head].pushed;
+            m_head = (m_head + 1) % UDP_SEGMAX;
+            m_count--;
+        }
+        m_lock.Unlock(MUTEX_CONTEXT);
+        return rcv;
+    }
+
+    /** Forget everything queued; the connection is gone and its buffers with it */
+    void Clear() {
+        m_lock.Lock(MUTEX_CONTEXT);
+        m_head = m_count = 0;
+        m_lock.Unlock(MUTEX_CONTEXT);
+    }
+
+    uint32_t GetHighWater() const { return m_highWater; }
+    uint64_t GetPushes() const { return m_pushes; }
+    uint64_t GetWaits() const { return m_waits; }
+
+  private:
+    struct Entry {
+        ArdpRcvBuf* rcv;
+        uint64_t pushed;    /**< When RecvCb queued it, us */
+    };
+
+    qcc::Mutex m_lock;
+    qcc::Condition m_cond;
+    Entry m_ring[UDP_SEGMAX];
+    uint32_t m_head;
+    uint32_t m_count;
+    uint32_t m_highWater;
+    uint64_t m_pushes;
+    uint64_t m_waits;       /**< Times the receiver found nothing and went to sleep */
+};
+
+/*
+ * Everything the workload needs to know about one ARDP connection.  The
+ * sequence and loss accounting used to live in function-level statics, which
+ * only worked as long as there was exactly one connection per handle.
+ */
+struct ConnState {
+    ConnState(uint32_t id) : id(id), conn(NULL), connected(false), failed(false),
+        connectTime(0), disconnectTime(0), recvOverflow(0),
+        sender_infinite_ttl_count(0), sender_count(0), ttl_expired_at_sender(0),
+        sendcb_infinite_ttl_count(0), sendcb_count(0), sendcb_bytes(0),
+        infinite_ttl_packet_count(0), hole(0), lost(0), recv_count(0), recv_bytes(0), corrupt(0),
+        checking(false), releasePending(false),
+        window(UDP_SEGMAX), windowBlocked(false), stalls(0), stalledUs(0),
+        sendThread(NULL), recvThread(NULL) { }
+
+    uint32_t id;
+    ArdpConnRecord* conn;
+    bool connected;
+    bool failed;
+    uint32_t connectTime;
+    uint32_t disconnectTime;
+    RecvHandoff recvQueue;
+    uint32_t recvOverflow;
+
+    /* Sender side accounting */
+    uint32_t sender_infinite_ttl_count;
+    uint32_t sender_count;
+    uint32_t ttl_expired_at_sender;
+    uint32_t sendcb_infinite_ttl_count;
+    uint32_t sendcb_count;
+    uint64_t sendcb_bytes;
+
+    /* Receiver side accounting */
+    uint32_t infinite_ttl_packet_count;
+    uint32_t hole;
+    uint32_t lost;
+    uint32_t recv_count;
+    uint64_t recv_bytes;
+    uint32_t corrupt;
+
+    /*
+     * RecvClass checks a message outside g_lock.  If the connection goes away
+     * meanwhile, DisconnectCb leaves ARDP_ReleaseConnection to RecvClass so
+     * the buffers being read are not freed underneath it.
+     */
+    bool checking;
+    bool releasePending;
+
+    /* Send window as last reported by SendWindowCb, and bulk mode stall accounting */
+    uint16_t window;
+    bool windowBlocked;
+    qcc::Event windowEvent;
+    uint32_t stalls;
+    uint64_t stalledUs;
+
+    SendClass* sendThread;
+    RecvClass* recvThread;
+};
+
+/* All connections ever seen by this handle, in the order they were created. */
+static std::vector<ConnState*> g_connStates;
+/* Live connections, looked up from the ARDP callbacks. */
+static std::map<ArdpConnRecord*, ConnState*> g_connMap;
 
 static int g_sender_delay = 10;
 static int g_receiver_delay = 10;
+
+/* When RecvClass hands checked messages back to ARDP */
+enum ReleasePolicy {
+    RELEASE_IMMEDIATE,      /**< as soon as each is checked */
+    RELEASE_BATCH,          /**< g_releaseBatch at a time, or fewer once the queue runs dry */
+    RELEASE_DELAYED         /**< each one g_receiver_delay ms after it was checked */
+};
+static ReleasePolicy g_releasePolicy = RELEASE_DELAYED;
+static uint32_t g_releaseBatch = 8;
+static LatencyHistogram g_recvHold("recvcb_to_recvready");
 static Mutex g_lock;
 static uint32_t g_sleepTime = 60000;
 static uint32_t g_payloadLength = 135000;
@@ -96,55 +265,389 @@ static bool g_ttlSet = false;
 static uint32_t g_percent = 50;
 static bool g_debug = false;
 static bool g_fuzz = false;
+static bool g_quiet = false;
+/* PayloadCheckType the sender stamps on every message; the receiver follows the header */
+static uint32_t g_verify = PAYLOAD_CHECK_NONE;
+static uint32_t g_numConnections = 1;
+static bool g_eventDriven = false;
+/* Datagrams per recvmmsg/sendmmsg on the ARDP socket; 0 leaves the socket alone */
+static uint32_t g_mmsgBatch = 0;
+/* Set whenever an application thread hands ARDP new work (send, receive release, connect) */
+static qcc::Event g_wakeEvent;
+
+/* Per-run latency distributions, updated with g_lock held */
+static LatencyHistogram g_deliveryLatency("send_to_recvcb");
+static LatencyHistogram g_completionLatency("send_to_sendcb");
+static char const* g_csvFile = NULL;
+static char const* g_jsonFile = NULL;
 
 static volatile sig_atomic_t g_interrupt = false;
-uint32_t*PAYLOAD;
 
 static void CDECL_CALL SigIntHandler(int sig)
 {
     g_interrupt = true;
 }
 
-void GetData(ArdpRcvBuf* rcv) {
+static bool g_bulk = false;
+/* Everything handed to the socket by this process, counted by the ARDP test hooks */
+static uint64_t g_wireBytes = 0;
+static uint64_t g_wireDatagrams = 0;
+
+/*
+ * TTL accounting.  Every message sent with a TTL is followed from ARDP_Send
+ * to its SendCb, keyed by its buffer: ARDP transmits data segments straight
+ * out of the application buffer, so the SendToSG hook can charge every
+ * fragment it puts on the wire, retransmissions included, to the message it
+ * came from.  Everything here is guarded by g_lock.
+ */
+struct TtlRecord {
+    uint32_t connId;
+    uint32_t count;
+    uint32_t ttl;               /**< Requested TTL, ms */
+    uint32_t length;
+    uint64_t sent;              /**< GetTimestampMicros() at ARDP_Send */
+    uint64_t wireBytes;         /**< Bytes of this message handed to the socket */
+    uint32_t transmissions;     /**< Fragments handed to the socket, retransmissions included */
+};
 
-    static uint32_t infinite_ttl_packet_count = 0;
-    static uint32_t hole = 0;
+struct TtlTotals {
+    uint32_t tracked;
+    uint32_t expiredAtSend;     /**< ARDP_Send itself returned ER_ARDP_TTL_EXPIRED */
+    uint32_t expired;           /**< SendCb with ER_ARDP_TTL_EXPIRED */
+    uint32_t expiredEarly;      /**< ... before the requested TTL had run out */
+    uint32_t delivered;         /**< SendCb with ER_OK */
+    uint32_t deliveredLate;     /**< ... after the requested TTL had run out */
+    uint32_t otherStatus;
+    uint32_t received;          /**< TTL messages seen by RecvCb */
+    uint32_t receivedLate;      /**< ... older than their TTL */
+    uint64_t expiredWireBytes;
+    uint64_t expiredPayloadBytes;
+    uint64_t deliveredWireBytes;
+    uint64_t deliveredPayloadBytes;
+};
 
-    ArdpRcvBuf*buf = rcv;
-    uint32_t len = 0;
-    uint16_t fragment = rcv->fcnt;
+static std::map<const uint8_t*, TtlRecord> g_ttlInFlight;
+static TtlTotals g_ttlTotals;
+static LatencyHistogram g_ttlExpiredLate("ttl_expired_past_ttl");
+static LatencyHistogram g_ttlExpiredEarly("ttl_expired_before_ttl");
+static LatencyHistogram g_ttlDeliveredAge("ttl_send_to_sendcb");
+static LatencyHistogram g_ttlReceivedAge("ttl_send_to_recvcb");
+static LatencyHistogram g_ttlExpiredWire("ttl_expired_wire_bytes");
+static char const* g_ttlCsvFile = NULL;
+static FILE* g_ttlCsv = NULL;
+
+/* RTT and retransmission time series, fed by the ARDP test hooks */
+static char const* g_telemetryFile = NULL;
+static uint32_t g_telemetryInterval = 1000;
+#if ARDP_TESTHOOKS
+static ArdpTelemetry g_telemetry;
+#endif
 
+static void TtlTrack(ConnState* state, const uint8_t* buf, uint32_t count, uint32_t ttl, uint32_t length, uint64_t sent)
+{
+    TtlRecord& r = g_ttlInFlight[buf];
+    r.connId = state->id;
+    r.count = count;
+    r.ttl = ttl;
+    r.length = length;
+    r.sent = sent;
+    r.wireBytes = 0;
+    r.transmissions = 0;
+}
 
-    uint32_t data[((UDP_SEGBMAX + 3) >> 2) << 2];
-    memcpy((uint8_t*) data, buf->data, buf->datalen);
+/* One CSV row per TTL message: how it ended, when, and what it cost on the wire */
+static void TtlLog(const TtlRecord& r, const char* outcome, uint64_t now)
+{
+    if (g_ttlCsv) {
+        fprintf(g_ttlCsv, "%u,%u,%u,%u,%s,%llu,%llu,%u\n", r.connId, r.count, r.ttl, r.length, outcome,
+                (unsigned long long)(now - r.sent), (unsigned long long)r.wireBytes, r.transmissions);
+    }
+}
 
-    printf("RecvCB(conn %p, seq %u): Received count is %u, infinite_ttl_count=%u, ttl= %u, length is %u \n", g_conn, rcv->seq, htonl(data[3]), htonl(data[0]), htonl(data[2]), htonl(data[1]));
+/* ARDP_Send did not take the message */
+static void TtlSendFailed(const uint8_t* buf, QStatus status)
+{
+    std::map<const uint8_t*, TtlRecord>::iterator it = g_ttlInFlight.find(buf);
+    if (it == g_ttlInFlight.end()) {
+        return;
+    }
+    if (status == ER_ARDP_TTL_EXPIRED) {
+        g_ttlTotals.tracked++;
+        g_ttlTotals.expiredAtSend++;
+        TtlLog(it->second, "expired_at_send", GetTimestampMicros());
+    }
+    g_ttlInFlight.erase(it);
+}
 
-    /* Detect holes in the receiving side. */
-    if (htonl(data[3]) > hole) {
-        printf(" %u packets lost at receiver \n", data[3] - hole);
-        hole = htonl(data[3]) + 1;
+static void TtlSendDone(const uint8_t* buf, QStatus status)
+{
+    std::map<const uint8_t*, TtlRecord>::iterator it = g_ttlInFlight.find(buf);
+    if (it == g_ttlInFlight.end()) {
+        return;
+    }
+    const TtlRecord& r = it->second;
+    uint64_t now = GetTimestampMicros();
+    uint64_t age = now - r.sent;
+    uint64_t deadline = (uint64_t)r.ttl * 1000;
+    g_ttlTotals.tracked++;
+    if (status == ER_ARDP_TTL_EXPIRED) {
+        g_ttlTotals.expired++;
+        if (age < deadline) {
+            g_ttlTotals.expiredEarly++;
+            g_ttlExpiredEarly.Record(deadline - age);
+        } else {
+            g_ttlExpiredLate.Record(age - deadline);
+        }
+        g_ttlExpiredWire.Record(r.wireBytes);
+        g_ttlTotals.expiredWireBytes += r.wireBytes;
+        g_ttlTotals.expiredPayloadBytes += r.length;
+        TtlLog(r, "expired", now);
+    } else if (status == ER_OK) {
+        g_ttlTotals.delivered++;
+        if (age > deadline) {
+            g_ttlTotals.deliveredLate++;
+        }
+        g_ttlDeliveredAge.Record(age);
+        g_ttlTotals.deliveredWireBytes += r.wireBytes;
+        g_ttlTotals.deliveredPayloadBytes += r.length;
+        TtlLog(r, "delivered", now);
     } else {
-        hole++;
+        g_ttlTotals.otherStatus++;
+        TtlLog(r, QCC_StatusText(status), now);
+    }
+    g_ttlInFlight.erase(it);
+}
+
+/* Charge a chunk handed to the socket to the TTL message whose buffer it lies in, if any */
+static void TtlChargeWire(const void* p, size_t len)
+{
+    const uint8_t* ptr = (const uint8_t*)p;
+    std::map<const uint8_t*, TtlRecord>::iterator it = g_ttlInFlight.upper_bound(ptr);
+    if (it == g_ttlInFlight.begin()) {
+        return;
+    }
+    --it;
+    if (ptr < it->first + it->second.length) {
+        it->second.wireBytes += len;
+        it->second.transmissions++;
+    }
+}
+
+static void PrintTtl()
+{
+    const TtlTotals& t = g_ttlTotals;
+    printf("\nTTL: %u messages with a TTL of %u ms finished: %u delivered (%u after their TTL), %u expired in flight (%u before their TTL), %u expired at ARDP_Send, %u other\n",
+           t.tracked, g_ttl, t.delivered, t.deliveredLate, t.expired, t.expiredEarly, t.expiredAtSend, t.otherStatus);
+    printf("TTL: %u received, %u of them older than their TTL (same host only)\n", t.received, t.receivedLate);
+    g_ttlExpiredLate.PrintSummary();
+    g_ttlExpiredEarly.PrintSummary();
+    g_ttlDeliveredAge.PrintSummary();
+    g_ttlReceivedAge.PrintSummary();
+#if ARDP_TESTHOOKS
+    uint64_t wire = t.expiredWireBytes + t.deliveredWireBytes;
+    printf("TTL: expired messages used %llu of %llu TTL wire bytes (%.1f%%); %llu of %llu expired payload bytes never left\n",
+           (unsigned long long)t.expiredWireBytes, (unsigned long long)wire, wire ? t.expiredWireBytes * 100.0 / wire : 0.0,
+           (unsigned long long)(t.expiredPayloadBytes > t.expiredWireBytes ? t.expiredPayloadBytes - t.expiredWireBytes : 0),
+           (unsigned long long)t.expiredPayloadBytes);
+    printf("%-24s count %10llu  mean %10.1f  p50 %8llu  p90 %8llu  p99 %8llu  max %8llu (bytes)\n", g_ttlExpiredWire.GetName(),
+           (unsigned long long)g_ttlExpiredWire.GetCount(), g_ttlExpiredWire.GetMean(),
+           (unsigned long long)g_ttlExpiredWire.GetPercentile(50.0), (unsigned long long)g_ttlExpiredWire.GetPercentile(90.0),
+           (unsigned long long)g_ttlExpiredWire.GetPercentile(99.0), (unsigned long long)g_ttlExpiredWire.GetMax());
+#else
+    printf("TTL: wire bytes per message not available, build with ARDP_TESTHOOKS to count them\n");
+#endif
+}
+
+static bool g_usePool = false;
+static bool g_poolSkip = false;
+static uint32_t g_poolCount = 0;
+
+/*
+ * Fixed set of equally sized send buffers carved out of one allocation, so
+ * that a benchmark run measures ARDP and not the allocator.  Buffers are taken
+ * by the send threads and given back from SendCb (or straight away when
+ * ARDP_Send refuses them).
+ */
+class SendBufferPool {
+
+  public:
+    SendBufferPool() : m_storage(NULL), m_bufferSize(0), m_count(0), m_inUse(0), m_highWater(0),
+        m_takes(0), m_exhausted(0), m_skipped(0), m_waitMs(0) { }
+
+    ~SendBufferPool() {
+        free(m_storage);
     }
 
-    /* Consume data buffers */
-    for (uint16_t i = 0; i < fragment; i++) {
-        //QCC_DbgPrintf(("RecvCb(): got %d bytes of data \n", buf->datalen));
-        len += buf->datalen;
-        buf = buf->next;
+    bool Init(uint32_t bufferSize, uint32_t count) {
+        /* Keep every buffer 4-byte aligned for the uint32_t payload header */
+        m_bufferSize = (bufferSize + 3) & ~3;
+        m_count = count;
+        m_storage = (uint8_t*)malloc((size_t)m_bufferSize * m_count);
+        if (!m_storage) {
+            return false;
+        }
+        m_free.reserve(m_count);
+        for (uint32_t i = m_count; i > 0; --i) {
+            m_free.push_back(m_storage + (size_t)(i - 1) * m_bufferSize);
+        }
+        return true;
     }
 
+    /**
+     * Take a buffer.  When the pool is dry either wait for SendCb to return
+     * one (wait == true) or give up and return NULL.
+     */
+    uint8_t* Take(bool wait) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        if (m_free.empty()) {
+            m_exhausted++;
+            if (!wait) {
+                m_skipped++;
+                m_lock.Unlock(MUTEX_CONTEXT);
+                return NULL;
+            }
+            uint32_t start = GetTimestamp();
+            while (m_free.empty() && !g_interrupt) {
+                m_cond.TimedWait(m_lock, 100);
+            }
+            m_waitMs += GetTimestamp() - start;
+            if (m_free.empty()) {
+                m_lock.Unlock(MUTEX_CONTEXT);
+                return NULL;
+            }
+        }
+        uint8_t* buf = m_free.back();
+        m_free.pop_back();
+        m_takes++;
+        if (++m_inUse > m_highWater) {
+            m_highWater = m_inUse;
+        }
+        m_lock.Unlock(MUTEX_CONTEXT);
+        return buf;
+    }
+
+    void Give(uint8_t* buf) {
+        m_lock.Lock(MUTEX_CONTEXT);
+        m_free.push_back(buf);
+        m_inUse--;
+        m_cond.Signal();
+        m_lock.Unlock(MUTEX_CONTEXT);
+    }
+
+    void PrintStats() {
+        printf("Send buffer pool: %u buffers of %u bytes, %llu takes, high-water %u in use, exhausted %llu times",
+               m_count, m_bufferSize, (unsigned long long)m_takes, m_highWater, (unsigned long long)m_exhausted);
+        if (g_poolSkip) {
+            printf(", %llu sends skipped\n", (unsigned long long)m_skipped);
+        } else {
+            printf(", %u ms spent waiting for a buffer\n", m_waitMs);
+        }
+    }
+
+  private:
+    qcc::Mutex m_lock;
+    qcc::Condition m_cond;
+    uint8_t* m_storage;
+    std::vector<uint8_t*> m_free;
+    uint32_t m_bufferSize;
+    uint32_t m_count;
+    uint32_t m_inUse;
+    uint32_t m_highWater;
+    uint64_t m_takes;
+    uint64_t m_exhausted;
+    uint64_t m_skipped;
+    uint32_t m_waitMs;
+};
+
+static SendBufferPool g_pool;
+
+static uint32_t* AllocPayload(uint32_t length)
+{
+    if (g_usePool) {
+        return (uint32_t*)g_pool.Take(!g_poolSkip);
+    }
+    return (uint32_t*)malloc(length);
+}
+
+static void FreePayload(uint8_t* buf)
+{
+    if (g_usePool) {
+        g_pool.Give(buf);
+    } else {
+        free(buf);
+    }
+}
+
+static ConnState* FindConnState(ArdpConnRecord* conn)
+{
+    std::map<ArdpConnRecord*, ConnState*>::iterator it = g_connMap.find(conn);
+    return (it == g_connMap.end()) ? NULL : it->second;
+}
+
+/*
+ * Check one received message where it lies: the header fields are read
+ * straight out of the first fragment and the body is checked along the
+ * fragment chain.  Called by RecvClass without g_lock; the buffers stay ours
+ * until ARDP_RecvReady and the receive counters of a connection are only
+ * touched by its RecvClass.
+ */
+void GetData(ConnState* state, ArdpRcvBuf* rcv) {
+
+    const uint8_t* data = rcv->data;
+    if (rcv->datalen < PAYLOAD_HEADER_LEN) {
+        printf("RECEIVER: conn %u first fragment holds %u bytes, less than the %u byte header. Alert!. Program FAILED \n", state->id, rcv->datalen, PAYLOAD_HEADER_LEN);
+        state->corrupt++;
+        if (!g_fuzz) {
+            assert(0);
+            exit(-1);
+        }
+        return;
+    }
+
+    uint32_t infiniteTtlCount = PayloadGetWord(data, 0);
+    uint32_t length = PayloadGetWord(data, 1);
+    uint32_t ttl = PayloadGetWord(data, 2);
+    uint32_t count = PayloadGetWord(data, 3);
+    uint32_t checkType = PayloadGetWord(data, 6);
+    uint32_t check = PayloadGetWord(data, 7);
+
+    if (!g_quiet) {
+        printf("RecvCB(conn %u %p, seq %u): Received count is %u, infinite_ttl_count=%u, ttl= %u, length is %u \n", state->id, state->conn, rcv->seq, count, infiniteTtlCount, ttl, length);
+    }
+
+    /* Detect holes in the receiving side. */
+    if (count > state->hole) {
+        printf("conn %u: %u packets lost at receiver \n", state->id, count - state->hole);
+        state->lost += count - state->hole;
+        state->hole = count + 1;
+    } else {
+        state->hole++;
+    }
+
+    /* Walk the fragments, checking the body on the way if the sender asked for it */
+    uint32_t len = 0;
+    uint32_t badOffset = 0;
+    bool intact = CheckRcvChain(rcv, PAYLOAD_HEADER_LEN, checkType, check, len, badOffset);
+
     //infinite_ttl_count should match when there is no ttl.
-    if ((htonl(data[2]) == 0) && (htonl(data[0]) != infinite_ttl_packet_count)) {
-        printf("RECEIVER: Count not matching. count: %u, infinite_ttl_packet_count: %u  Alert!. Program FAILED \n", htonl(data[0]), infinite_ttl_packet_count);
+    if ((ttl == 0) && (infiniteTtlCount != state->infinite_ttl_packet_count)) {
+        printf("RECEIVER: conn %u Count not matching. count: %u, infinite_ttl_packet_count: %u  Alert!. Program FAILED \n", state->id, infiniteTtlCount, state->infinite_ttl_packet_count);
         if (!g_fuzz) {
             assert(0);
             exit(-1);
         }
     }
-    if (len != htonl(data[1])) {
-        printf("RECEIVER: Data length not matching. length: %u, callback length: %u Alert!. Program FAILED \n", htonl(data[1]), len);
+    if (len != length) {
+        printf("RECEIVER: conn %u Data length not matching. length: %u, callback length: %u Alert!. Program FAILED \n", state->id, length, len);
+        if (!g_fuzz) {
+            assert(0);
+            exit(-1);
+        }
+    }
+    if (!intact) {
+        state->corrupt++;
+        printf("RECEIVER: conn %u count %u %s check failed at offset %u of %u. Alert!. Program FAILED \n", state->id, count,
+               (checkType == PAYLOAD_CHECK_CRC32C) ? "CRC32C" : "pattern", badOffset, len);
         if (!g_fuzz) {
             assert(0);
             exit(-1);
@@ -152,11 +655,14 @@ void GetData(ArdpRcvBuf* rcv) {
     }
 
     //If ttl==0, only then increment the infinite_ttl_packet_count
-    if (htonl(data[2]) == 0) {
-        infinite_ttl_packet_count++;
+    if (ttl == 0) {
+        state->infinite_ttl_packet_count++;
+    }
+    state->recv_count++;
+    state->recv_bytes += len;
+    if (!g_quiet) {
+        printf("RCBUSERDATA %u\n", len);
     }
-    printf("RCBUSERDATA %u\n", len);
-
 }
 
 bool AcceptCb(ArdpHandle* handle, qcc::IPAddress ipAddr, uint16_t ipPort, ArdpConnRecord* conn, uint8_t* buf, uint16_t len, QStatus status)
@@ -164,6 +670,12 @@ bool AcceptCb(ArdpHandle* handle, qcc::IPAddress ipAddr, uint16_t ipPort, ArdpCo
     printf("Inside Accept callback(conn %p), we received a SYN from %s:%d, the message is  %s, status %s \n", conn, ipAddr.ToString().c_str(), ipPort, (char*)buf, QCC_StatusText(status));
     g_lock.Lock();
     status = ARDP_Accept(handle, conn, UDP_SEGMAX, UDP_SEGBMAX, (uint8_t* )g_ajnAcceptString, strlen(g_ajnAcceptString) + 1);
+    if (status == ER_OK) {
+        ConnState* state = new ConnState(g_connStates.size());
+        state->conn = conn;
+        g_connStates.push_back(state);
+        g_connMap[conn] = state;
+    }
     g_lock.Unlock();
     if (status != ER_OK) {
         printf("Error while ARDP_Accept.. %s \n", QCC_StatusText(status));
@@ -175,21 +687,40 @@ bool AcceptCb(ArdpHandle* handle, qcc::IPAddress ipAddr, uint16_t ipPort, ArdpCo
 void ConnectCb(ArdpHandle* handle, ArdpConnRecord* conn, bool passive, uint8_t* buf, uint16_t len, QStatus status)
 {
     printf("Looks like I have connected... conn=%p is passive=%s , the message is  %s, status is %s \n", conn, (passive) ? "true" : "false", (char*)buf, QCC_StatusText(status));
+    g_lock.Lock(MUTEX_CONTEXT);
+    ConnState* state = FindConnState(conn);
     if (status == ER_OK) {
-        g_conn = conn;
+        if (state) {
+            state->connected = true;
+            state->connectTime = GetTimestamp();
+        }
     } else {
         //If the connection is not successful, we should not save this anymore and we should clean it up.
+        if (state) {
+            state->failed = true;
+            g_connMap.erase(conn);
+        }
         ARDP_ReleaseConnection(handle, conn);
     }
+    g_lock.Unlock(MUTEX_CONTEXT);
 }
 
 void DisconnectCb(ArdpHandle* handle, ArdpConnRecord* conn, QStatus status)
 {
     printf("Looks like I have disconnected conn = %p..reason = %s \n", conn, QCC_StatusText(status));
     g_lock.Lock(MUTEX_CONTEXT);
-    printf("Clearing up the Recv buffer \n");
-    while (!RecvQueue.empty()) {
-        RecvQueue.pop();
+    ConnState* state = FindConnState(conn);
+    if (state) {
+        printf("Clearing up the Recv buffer of conn %u \n", state->id);
+        state->recvQueue.Clear();
+        state->connected = false;
+        state->disconnectTime = GetTimestamp();
+        g_connMap.erase(conn);
+        if (state->checking) {
+            state->releasePending = true;
+            g_lock.Unlock(MUTEX_CONTEXT);
+            return;
+        }
     }
     ARDP_ReleaseConnection(handle, conn);
     g_lock.Unlock(MUTEX_CONTEXT);
@@ -198,28 +729,57 @@ void DisconnectCb(ArdpHandle* handle, ArdpConnRecord* conn, QStatus status)
 void RecvCb(ArdpHandle* handle, ArdpConnRecord* conn, ArdpRcvBuf* rcv, QStatus status)
 {
     g_lock.Lock(MUTEX_CONTEXT);
-    GetData(rcv);
-    RecvQueue.push(rcv);
+    ConnState* state = FindConnState(conn);
+    if (state) {
+        /* Only the timestamp is read here; RecvClass checks the rest outside the lock */
+        if (!g_fuzz && (rcv->datalen >= PAYLOAD_HEADER_LEN)) {
+            /* Both ends share CLOCK_MONOTONIC only when they run on the same host */
+            uint64_t sent = ((uint64_t)PayloadGetWord(rcv->data, 4) << 32) | PayloadGetWord(rcv->data, 5);
+            uint64_t now = GetTimestampMicros();
+            if (now >= sent) {
+                g_deliveryLatency.Record(now - sent);
+                uint32_t ttl = PayloadGetWord(rcv->data, 2);
+                if (ttl) {
+                    g_ttlTotals.received++;
+                    if (now - sent > (uint64_t)ttl * 1000) {
+                        g_ttlTotals.receivedLate++;
+                    }
+                    g_ttlReceivedAge.Record(now - sent);
+                }
+            }
+        }
+        if (!state->recvQueue.Push(rcv, GetTimestampMicros())) {
+            state->recvOverflow++;
+            ARDP_RecvReady(handle, conn, rcv);
+        }
+    }
     g_lock.Unlock(MUTEX_CONTEXT);
 }
 
 void SendCb(ArdpHandle* handle, ArdpConnRecord* conn, uint8_t* buf, uint32_t len, QStatus status)
 {
-    static uint32_t sender_infinite_ttl_count = 0;
+    ConnState* state = FindConnState(conn);
+    if (!state) {
+        g_ttlInFlight.erase(buf);
+        FreePayload(buf);
+        return;
+    }
 
     uint32_t*data = (uint32_t*)buf;
-    printf("SendCB: sender_infinite_count is %u, length is %u sender_count is %u ttl is %u status is %s \n", htonl(data[0]), htonl(data[1]), htonl(data[3]), htonl(data[2]), QCC_StatusText(status));
+    if (!g_quiet) {
+        printf("SendCB(conn %u): sender_infinite_count is %u, length is %u sender_count is %u ttl is %u status is %s \n", state->id, htonl(data[0]), htonl(data[1]), htonl(data[3]), htonl(data[2]), QCC_StatusText(status));
+    }
 
     //Sender count should match for infinite_ttl
-    if (htonl(data[0]) != sender_infinite_ttl_count) {
-        printf("SendCB: Count not matching. Real count: %u, expected count: %u Alert!. Program FAILED \n", data[0], sender_infinite_ttl_count);
+    if (htonl(data[0]) != state->sendcb_infinite_ttl_count) {
+        printf("SendCB: conn %u Count not matching. Real count: %u, expected count: %u Alert!. Program FAILED \n", state->id, htonl(data[0]), state->sendcb_infinite_ttl_count);
         if (!g_fuzz) {
             assert(0);
             exit(-1);
         }
     }
     if (len != htonl(data[1])) {
-        printf("SendCB: Data length not matching Real length: %u, length from callback: %u . Alert!. Program FAILED \n", htonl(data[1]), len);
+        printf("SendCB: conn %u Data length not matching Real length: %u, length from callback: %u . Alert!. Program FAILED \n", state->id, htonl(data[1]), len);
         if (!g_fuzz) {
             assert(0);
             exit(-1);
@@ -228,78 +788,184 @@ void SendCb(ArdpHandle* handle, ArdpConnRecord* conn, uint8_t* buf, uint32_t len
 
     //If ttl==0, only then increase the sender_infinite_ttl_count
     if (htonl(data[2]) == 0) {
-        sender_infinite_ttl_count++;
+        state->sendcb_infinite_ttl_count++;
     }
+    //A completed send frees window space; let a stalled bulk sender retry
+    state->windowBlocked = false;
+    state->windowEvent.SetEvent();
 
-    printf("SCBUSERDATA %u\n", len);
-    free(buf);
+    if (htonl(data[2]) != 0) {
+        TtlSendDone(buf, status);
+    }
+
+    if (status == ER_OK) {
+        state->sendcb_count++;
+        state->sendcb_bytes += len;
+        uint64_t sent = ((uint64_t)htonl(data[4]) << 32) | htonl(data[5]);
+        g_completionLatency.Record(GetTimestampMicros() - sent);
+    }
+
+    if (!g_quiet) {
+        printf("SCBUSERDATA %u\n", len);
+    }
+    FreePayload(buf);
 }
 
 void SendWindowCb(ArdpHandle* handle, ArdpConnRecord* conn, uint16_t window, QStatus status)
 {
     //QCC_DbgPrintf(("WINDOW RECEIVED-  %u, conn = %p \n", window, conn));
+    ConnState* state = FindConnState(conn);
+    if (state) {
+        state->window = window;
+        if (window > 0) {
+            state->windowBlocked = false;
+            state->windowEvent.SetEvent();
+        }
+    }
 }
+
+#if ARDP_TESTHOOKS
+void ArdpSendToSGHook(ArdpHandle* handle, ArdpConnRecord* conn, TesthookSource source, qcc::ScatterGatherList& msgSG)
+{
+    bool ttl = !g_ttlInFlight.empty();
+    for (std::list<IOVec>::iterator it = msgSG.Begin(); it != msgSG.End(); ++it) {
+        g_wireBytes += it->len;
+        if (ttl) {
+            TtlChargeWire(it->buf, it->len);
+        }
+    }
+    g_wireDatagrams++;
+    if (g_telemetry.IsOpen() && msgSG.Begin() != msgSG.End()) {
+        /* The first chunk is the ARDP header */
+        g_telemetry.OnSend((const uint8_t*)msgSG.Begin()->buf, msgSG.Begin()->len);
+    }
+}
+
+void ArdpSendToHook(ArdpHandle* handle, ArdpConnRecord* conn, TesthookSource source, void* buf, uint32_t len)
+{
+    g_wireBytes += len;
+    g_wireDatagrams++;
+}
+
+void ArdpRecvFromHook(ArdpHandle* handle, ArdpConnRecord* conn, TesthookSource source, void* buf, uint32_t len)
+{
+    g_telemetry.OnRecv((const uint8_t*)buf, len);
+}
+#endif
 class RecvClass : public Thread {
 
   public:
-    RecvClass(char*name, ArdpHandle* handle, qcc::SocketFd sock) : Thread(name) {
+    RecvClass(char*name, ArdpHandle* handle, qcc::SocketFd sock, ConnState* state) : Thread(name) {
         m_handle = handle;
         m_sock = sock;
+        m_state = state;
     }
 
   protected:
     qcc::ThreadReturn STDCALL Run(void* arg) {
+        uint32_t batchMax = (g_releasePolicy == RELEASE_BATCH && g_releaseBatch) ? g_releaseBatch : 1;
 
         while ((!g_interrupt) && (IsRunning())) {
-
-            while (!RecvQueue.empty()) {
-                ArdpRcvBuf*rcv = NULL;
+            /* Sleep until RecvCb hands something over, unless a batch is waiting to go back */
+            uint64_t pushed = 0;
+            ArdpRcvBuf* rcv = m_state->recvQueue.Pop(m_batch.empty() ? 100 : 0, pushed);
+            if (rcv) {
                 g_lock.Lock(MUTEX_CONTEXT);
-                if (RecvQueue.empty()) {
+                if (!m_state->connected) {
+                    //Let Release() settle a connection DisconnectCb left to us
                     g_lock.Unlock(MUTEX_CONTEXT);
-                    break;
+                    Release();
+                    continue;
                 }
-                rcv = RecvQueue.front();
-                RecvQueue.pop();
-                printf("ARDP_RecvReady conn %p, rcv %p, seq %u\n", g_conn, rcv, rcv->seq);
-                QStatus status = ARDP_RecvReady(m_handle, g_conn, rcv);
+                m_state->checking = true;
                 g_lock.Unlock(MUTEX_CONTEXT);
-                if (status != ER_OK) {
-                    QCC_LogError(status, ("Error while ARDP_Recv.. %s \n", QCC_StatusText(status)));
-                    break;
+
+                GetData(m_state, rcv);
+                m_batch.push_back(Held(rcv, pushed));
+                if (g_releasePolicy == RELEASE_DELAYED) {
+                    qcc::Sleep(g_receiver_delay);
+                }
+                if (m_batch.size() < batchMax) {
+                    continue;
                 }
-                qcc::Sleep(g_receiver_delay);
             }
-
+            if (!m_batch.empty()) {
+                Release();
+            }
+        }
+        if (!m_batch.empty()) {
+            Release();
         }
 
         return this;
     }
 
   private:
+    struct Held {
+        ArdpRcvBuf* rcv;
+        uint64_t pushed;
+        Held(ArdpRcvBuf* rcv, uint64_t pushed) : rcv(rcv), pushed(pushed) { }
+    };
+
+    /*
+     * Give every checked message back to ARDP, or, once disconnected, release
+     * the connection if DisconnectCb left that to us.  The buffers of a
+     * released connection go with its record.  Every exit from the batch
+     * comes through here, so checking is never left set.
+     */
+    void Release() {
+        QStatus status = ER_OK;
+        g_lock.Lock(MUTEX_CONTEXT);
+        m_state->checking = false;
+        if (m_state->releasePending) {
+            //Disconnected while we were looking at the buffers
+            m_state->releasePending = false;
+            ARDP_ReleaseConnection(m_handle, m_state->conn);
+        } else if (m_state->connected) {
+            uint64_t now = GetTimestampMicros();
+            for (size_t i = 0; i < m_batch.size() && status == ER_OK; ++i) {
+                ArdpRcvBuf* rcv = m_batch[i].rcv;
+                if (!g_quiet) {
+                    printf("ARDP_RecvReady conn %u %p, rcv %p, seq %u\n", m_state->id, m_state->conn, rcv, rcv->seq);
+                }
+                g_recvHold.Record(now - m_batch[i].pushed);
+                status = ARDP_RecvReady(m_handle, m_state->conn, rcv);
+            }
+        }
+        g_lock.Unlock(MUTEX_CONTEXT);
+        m_batch.clear();
+        g_wakeEvent.SetEvent();
+        if (status != ER_OK) {
+            QCC_LogError(status, ("Error while ARDP_Recv.. %s \n", QCC_StatusText(status)));
+        }
+    }
+
     ArdpHandle* m_handle;
     qcc::SocketFd m_sock;
+    ConnState* m_state;
+    std::vector<Held> m_batch;   /**< Checked, not yet given back */
 
 };
 
 class SendClass : public Thread {
 
   public:
-    SendClass(char*name, ArdpHandle* handle, qcc::SocketFd sock) : Thread(name) {
+    SendClass(char*name, ArdpHandle* handle, qcc::SocketFd sock, ConnState* state) : Thread(name) {
         m_handle = handle;
         m_sock = sock;
+        m_state = state;
     }
 
   protected:
     qcc::ThreadReturn STDCALL Run(void* arg) {
 
         while ((!g_interrupt) && (IsRunning())) {
-            static uint32_t sender_infinite_ttl_count = 0;
-            static uint32_t sender_count = 0;
-            static uint32_t ttl_expired_at_sender = 0;
+            uint32_t& sender_infinite_ttl_count = m_state->sender_infinite_ttl_count;
+            uint32_t& sender_count = m_state->sender_count;
+            uint32_t& ttl_expired_at_sender = m_state->ttl_expired_at_sender;
 
-            //We need atleast 16 bytes. 4 for infinite_ttl_count, 4 for uint32_t length and 4 for TTL, 4 for sender_count;
-            uint32_t length = 16 + qcc::Rand32() % (g_payloadLength);
+            //We need atleast 32 bytes. 4 for infinite_ttl_count, 4 for uint32_t length and 4 for TTL, 4 for sender_count, 8 for the send timestamp, 8 for the body check;
+            uint32_t length = PAYLOAD_HEADER_LEN + qcc::Rand32() % (g_payloadLength);
             uint32_t ttl = 0;
 
             //double a = (double)qcc::Rand8()/255.0;
@@ -317,32 +983,78 @@ class SendClass : public Thread {
                 ttl = 0;
             }
 
-            PAYLOAD = (uint32_t*)malloc(40000 * sizeof(uint32_t));
+            if (g_bulk && !WaitForWindow()) {
+                break;
+            }
+
+            uint32_t* payload = AllocPayload(length);
+            if (!payload) {
+                //pool is dry and we were asked not to wait for it
+                qcc::Sleep(g_sender_delay);
+                continue;
+            }
             //set the infinite ttl count
-            PAYLOAD[0] = ntohl(sender_infinite_ttl_count);
+            payload[0] = ntohl(sender_infinite_ttl_count);
             //set the length
-            PAYLOAD[1] = ntohl(length);
+            payload[1] = ntohl(length);
             //keep the ttl as it is because it is not multi byte.
-            PAYLOAD[2] = ntohl(ttl);
+            payload[2] = ntohl(ttl);
             //set the sender count
-            PAYLOAD[3] = ntohl(sender_count);
+            payload[3] = ntohl(sender_count);
+            //fill the body and say how the receiver can check it
+            payload[6] = ntohl(g_verify);
+            payload[7] = 0;
+            if (g_verify != PAYLOAD_CHECK_NONE) {
+                uint32_t seed = (m_state->id << 24) ^ sender_count;
+                FillPattern((uint8_t*)payload, PAYLOAD_HEADER_LEN, length, seed);
+                if (g_verify == PAYLOAD_CHECK_CRC32C) {
+                    payload[7] = ntohl(Crc32c::Compute((uint8_t*)payload + PAYLOAD_HEADER_LEN, length - PAYLOAD_HEADER_LEN));
+                } else {
+                    payload[7] = ntohl(seed);
+                }
+            }
 
             g_lock.Lock(MUTEX_CONTEXT);
-            QStatus status = ARDP_Send(m_handle, g_conn, (uint8_t*)PAYLOAD, length, ttl);
+            if (!m_state->connected) {
+                g_lock.Unlock(MUTEX_CONTEXT);
+                FreePayload((uint8_t*)payload);
+                break;
+            }
+            //set the send timestamp as late as possible
+            uint64_t now = GetTimestampMicros();
+            payload[4] = ntohl((uint32_t)(now >> 32));
+            payload[5] = ntohl((uint32_t)now);
+            if (ttl) {
+                TtlTrack(m_state, (uint8_t*)payload, sender_count, ttl, length, now);
+            }
+            QStatus status = ARDP_Send(m_handle, m_state->conn, (uint8_t*)payload, length, ttl);
+            if (ttl && (status != ER_OK)) {
+                TtlSendFailed((uint8_t*)payload, status);
+            }
+            if (g_bulk && (status == ER_ARDP_BACKPRESSURE)) {
+                //The message does not fit in what is left of the window; wait for it to open up
+                m_state->windowBlocked = true;
+                m_state->windowEvent.ResetEvent();
+            }
             g_lock.Unlock(MUTEX_CONTEXT);
+            g_wakeEvent.SetEvent();
             if ((status != ER_OK) && (status != ER_ARDP_TTL_EXPIRED)) {
-                if (g_debug) { printf("ARDP_Send Error: sender_count is  %u, sender_infinite_ttl_count is %u, ttl= %u, length is %u status is %s \n", sender_count, sender_infinite_ttl_count, ttl, length, QCC_StatusText(status)); }
-                free(PAYLOAD);
+                if (g_debug) { printf("ARDP_Send Error: conn %u sender_count is  %u, sender_infinite_ttl_count is %u, ttl= %u, length is %u status is %s \n", m_state->id, sender_count, sender_infinite_ttl_count, ttl, length, QCC_StatusText(status)); }
+                FreePayload((uint8_t*)payload);
             } else {
                 if (a < b) {
                     if (g_debug) { printf("Setting ttl as random number %lf < percent %lf \n", a, b); }
                 }
 
-                printf("ARDP_Send: sender_count is  %u, sender_infinite_ttl_count is %u, ttl= %u, length is %u ttl_expired_packets_so_far: %u Status is %s \n", sender_count, sender_infinite_ttl_count, ttl, length, ttl_expired_at_sender, QCC_StatusText(status));
+                if (!g_quiet) {
+                    printf("ARDP_Send(conn %u): sender_count is  %u, sender_infinite_ttl_count is %u, ttl= %u, length is %u ttl_expired_packets_so_far: %u Status is %s \n", m_state->id, sender_count, sender_infinite_ttl_count, ttl, length, ttl_expired_at_sender, QCC_StatusText(status));
+                }
 
                 if (status == ER_ARDP_TTL_EXPIRED) {
                     //just to keep a count of ttl expired packets at the sender
                     ttl_expired_at_sender++;
+                    //ARDP did not take it, so no SendCb will hand it back to the pool
+                    FreePayload((uint8_t*)payload);
                 } else {
                     //packet was sent sucecssfully.
                     sender_count++;
@@ -353,15 +1065,50 @@ class SendClass : public Thread {
                     sender_infinite_ttl_count++;
                 }
             }
-            qcc::Sleep(g_sender_delay);
+            if (!g_bulk || ((status != ER_OK) && (status != ER_ARDP_TTL_EXPIRED) && (status != ER_ARDP_BACKPRESSURE))) {
+                qcc::Sleep(g_sender_delay);
+            }
         }
 
         return this;
     }
 
+    /*
+     * Bulk mode: block while the advertised window is zero or the last send
+     * bounced with ER_ARDP_BACKPRESSURE, until SendWindowCb or SendCb reports
+     * that space has opened up.  Returns false if the connection went away.
+     */
+    bool WaitForWindow() {
+        g_lock.Lock(MUTEX_CONTEXT);
+        if (!m_state->connected) {
+            g_lock.Unlock(MUTEX_CONTEXT);
+            return false;
+        }
+        if ((m_state->window > 0) && !m_state->windowBlocked) {
+            g_lock.Unlock(MUTEX_CONTEXT);
+            return true;
+        }
+        m_state->windowEvent.ResetEvent();
+        g_lock.Unlock(MUTEX_CONTEXT);
+
+        uint64_t start = GetTimestampMicros();
+        bool open = false;
+        while (!open && (!g_interrupt) && (IsRunning())) {
+            qcc::Event::Wait(m_state->windowEvent, 100);
+            g_lock.Lock(MUTEX_CONTEXT);
+            m_state->windowEvent.ResetEvent();
+            open = !m_state->connected || ((m_state->window > 0) && !m_state->windowBlocked);
+            g_lock.Unlock(MUTEX_CONTEXT);
+        }
+        m_state->stalls++;
+        m_state->stalledUs += GetTimestampMicros() - start;
+        return m_state->connected;
+    }
+
   private:
     ArdpHandle* m_handle;
     qcc::SocketFd m_sock;
+    ConnState* m_state;
 
 };
 
@@ -372,25 +1119,109 @@ class ThreadClass : public Thread {
     ThreadClass(char*name, ArdpHandle* handle, qcc::SocketFd sock) : Thread(name) {
         m_handle = handle;
         m_sock = sock;
+        m_runCalls = 0;
+        m_sockWakeups = 0;
+        m_appWakeups = 0;
+        m_timerWakeups = 0;
+    }
+
+    void PrintStats(uint32_t elapsed) {
+        printf("ARDP_Run driver: %s, %llu ARDP_Run calls (%.1f/s)", g_eventDriven ? "event-driven" : "Sleep(1) polling",
+               (unsigned long long)m_runCalls, elapsed ? m_runCalls * 1000.0 / elapsed : 0.0);
+        if (g_eventDriven) {
+            printf(", wakeups: %llu socket, %llu application, %llu timer", (unsigned long long)m_sockWakeups,
+                   (unsigned long long)m_appWakeups, (unsigned long long)m_timerWakeups);
+        }
+        printf("\n");
+#ifndef _WIN32
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) {
+            double user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0;
+            double sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+            printf("CPU: user %.2f s, system %.2f s (%.1f%% of one core)\n", user, sys, elapsed ? (user + sys) * 100000.0 / elapsed : 0.0);
+        }
+#endif
     }
 
   protected:
     qcc::ThreadReturn STDCALL Run(void* arg) {
 
+        if (g_eventDriven) {
+            RunEventDriven();
+            return this;
+        }
+
         while ((!g_interrupt) && (IsRunning())) {
             uint32_t ms;
             g_lock.Lock(MUTEX_CONTEXT);
             ARDP_Run(m_handle, m_sock, true, true,  &ms);
+            if (g_mmsgBatch) {
+                MmsgShim::Instance().Flush(m_sock);
+            }
             g_lock.Unlock(MUTEX_CONTEXT);
+            m_runCalls++;
             qcc::Sleep(1);
         }
 
         return this;
     }
 
+    /*
+     * Only call ARDP_Run when there is something for it to do: the socket is
+     * readable, the timeout it returned last time has expired, or another
+     * thread has just queued work on the handle.
+     */
+    void RunEventDriven() {
+        qcc::Event sockEvent(m_sock, qcc::Event::IO_READ);
+        std::vector<qcc::Event*> checkEvents;
+        std::vector<qcc::Event*> signaledEvents;
+        checkEvents.push_back(&sockEvent);
+        checkEvents.push_back(&g_wakeEvent);
+
+        bool sockRead = true;
+        while ((!g_interrupt) && (IsRunning())) {
+            uint32_t ms = qcc::Event::WAIT_FOREVER;
+            g_lock.Lock(MUTEX_CONTEXT);
+            ARDP_Run(m_handle, m_sock, sockRead, true, &ms);
+            if (g_mmsgBatch) {
+                MmsgShim::Instance().Flush(m_sock);
+            }
+            g_lock.Unlock(MUTEX_CONTEXT);
+            m_runCalls++;
+
+            /* Datagrams left in the batch ring do not make the socket readable */
+            if (g_mmsgBatch && MmsgShim::Instance().Pending(m_sock)) {
+                sockRead = true;
+                m_sockWakeups++;
+                continue;
+            }
+
+            signaledEvents.clear();
+            QStatus status = qcc::Event::Wait(checkEvents, signaledEvents, ms);
+            sockRead = false;
+            if (status == ER_TIMEOUT) {
+                m_timerWakeups++;
+                continue;
+            }
+            for (std::vector<qcc::Event*>::iterator it = signaledEvents.begin(); it != signaledEvents.end(); ++it) {
+                if (*it == &sockEvent) {
+                    sockRead = true;
+                    m_sockWakeups++;
+                } else if (*it == &g_wakeEvent) {
+                    g_wakeEvent.ResetEvent();
+                    m_appWakeups++;
+                }
+            }
+        }
+    }
+
   private:
     ArdpHandle* m_handle;
     qcc::SocketFd m_sock;
+    uint64_t m_runCalls;
+    uint64_t m_sockWakeups;
+    uint64_t m_appWakeups;
+    uint64_t m_timerWakeups;
 
 };
 
@@ -398,6 +1229,7 @@ static void usage() {
     printf("./ardpstress -lp 9955 -fp 9954 -s -sd 50 -c -sleep 60000 \n");
     printf("./ardpstress -lp 9954 -fp 9955 -r -rd 40  -sleep 60000 \n");
     printf("./ardpstress -lp 9954 -fp 9955 -r -rd 40 -la 10.0.0.1 -fa 10.0.0.2 -sleep 60000 \n");
+    printf("./ardpstress -lp 9955 -fp 9954 -s -sd 50 -c -n 200 -q -sleep 60000 \n");
     printf(" -lp #: local port\n");
     printf(" -fp #: foreign port\n");
     printf(" -la #: local address\n");
@@ -406,13 +1238,208 @@ static void usage() {
     printf(" -sd #: sender delay\n");
     printf(" -r: receiver\n");
     printf(" -rd # : receiver delay\n");
+    printf(" -release immediate|batch|delayed :  When the receiver gives checked messages back to ARDP: at once, -rb at a time, or -rd ms after each; default is delayed\n");
+    printf(" -rb # :  Messages per release with -release batch, default is 8\n");
     printf(" -c:  side calling connect\n");
     printf(" -payload #:  Max payload length: default is 135000\n");
     printf(" -ttl #:  ttl, default is 0\n");
     printf(" -percent #: percentage of packets with TTL\n");
+    printf(" -ttlcsv <file> :  Write one line per message sent with a TTL (outcome, age, wire bytes) to <file>\n");
+    printf(" -telemetry <file> :  Write RTT samples, retransmissions and ACKs per interval to <file> as CSV (needs ARDP_TESTHOOKS)\n");
+    printf(" -ti # :  Telemetry interval in ms, default is 1000\n");
     printf(" -sleep # :  program run time\n");
     printf(" -d :  Enable program debug\n");
     printf(" -f :  Use only when running ardpfuzz in conjunction with ardpstress \n");
+    printf(" -n # :  Number of connections to open (side calling connect), default is 1\n");
+    printf(" -q :  Quiet, do not print per-message lines\n");
+    printf(" -e :  Event-driven ARDP_Run loop (socket + ARDP timeout + send wakeup) instead of Sleep(1) polling\n");
+    printf(" -csv <file> :  Write the latency percentiles to <file> as CSV\n");
+    printf(" -json <file> :  Write the latency percentiles and histogram buckets to <file> as JSON\n");
+    printf(" -verify none|pattern|crc :  Sender fills the body with a per-message pattern and the receiver checks it in place, optionally by CRC32C; default is none\n");
+    printf(" -bulk :  Send as fast as the ARDP send window allows instead of every -sd ms\n");
+    printf(" -pool :  Send from a fixed pool of preallocated buffers instead of malloc per message; wait when it runs dry\n");
+    printf(" -poolskip :  Like -pool, but skip the send when the pool runs dry\n");
+    printf(" -poolsize # :  Number of pool buffers, default is %u per connection\n", UDP_SEGMAX);
+    printf(" -mmsg # :  Read and write the socket with recvmmsg/sendmmsg, # datagrams per syscall, 1 to 1024 (Linux); -mmsg 1 is the unbatched baseline\n");
+    printf(" Delivery latency (send_to_recvcb) is only meaningful when both ends run on the same host\n");
+}
+
+static void PrintBulk(uint32_t endTime)
+{
+    uint64_t payload = 0, stalledUs = 0, connectedMs = 0;
+    uint32_t stalls = 0, firstConnect = endTime;
+    for (size_t i = 0; i < g_connStates.size(); ++i) {
+        ConnState* state = g_connStates[i];
+        uint32_t stop = state->disconnectTime ? state->disconnectTime : endTime;
+        payload += state->sendcb_bytes;
+        stalls += state->stalls;
+        stalledUs += state->stalledUs;
+        if (state->connectTime) {
+            connectedMs += stop - state->connectTime;
+            if (state->connectTime < firstConnect) {
+                firstConnect = state->connectTime;
+            }
+        }
+    }
+    double secs = (endTime - firstConnect) / 1000.0;
+    printf("\nBulk: goodput %.3f MB/s (%llu payload bytes acknowledged in %.1f s)\n",
+           secs > 0 ? payload / (1024.0 * 1024.0) / secs : 0.0, (unsigned long long)payload, secs);
+    printf("Bulk: %u window stalls, %.1f ms stalled in total (%.1f%% of connection time)\n",
+           stalls, stalledUs / 1000.0, connectedMs ? stalledUs / 10.0 / connectedMs : 0.0);
+#if ARDP_TESTHOOKS
+    printf("Bulk: %llu bytes in %llu datagrams on the wire (%llu with IPv4/UDP headers), wire/payload ratio %.3f (%.3f)\n",
+           (unsigned long long)g_wireBytes, (unsigned long long)g_wireDatagrams, (unsigned long long)(g_wireBytes + 28 * g_wireDatagrams),
+           payload ? (double)g_wireBytes / payload : 0.0, payload ? (double)(g_wireBytes + 28 * g_wireDatagrams) / payload : 0.0);
+#else
+    printf("Bulk: wire/payload ratio not available, build with ARDP_TESTHOOKS to count bytes on the wire\n");
+#endif
+}
+
+static void PrintReceive()
+{
+    static const char* const policies[] = { "immediate", "batch", "delayed" };
+    uint64_t handed = 0, waits = 0;
+    uint32_t highWater = 0, overflow = 0;
+    for (size_t i = 0; i < g_connStates.size(); ++i) {
+        ConnState* state = g_connStates[i];
+        handed += state->recvQueue.GetPushes();
+        waits += state->recvQueue.GetWaits();
+        overflow += state->recvOverflow;
+        if (state->recvQueue.GetHighWater() > highWater) {
+            highWater = state->recvQueue.GetHighWater();
+        }
+    }
+    printf("\nReceive: release %s", policies[g_releasePolicy]);
+    if (g_releasePolicy == RELEASE_BATCH) {
+        printf(" by %u", g_releaseBatch);
+    } else if (g_releasePolicy == RELEASE_DELAYED) {
+        printf(" by %d ms", g_receiver_delay);
+    }
+    printf(", %llu messages handed over, queue high-water %u of %u, receiver went idle %llu times, %u overflowed\n",
+           (unsigned long long)handed, highWater, UDP_SEGMAX, (unsigned long long)waits, overflow);
+    g_recvHold.PrintSummary();
+}
+
+static void PrintLatency()
+{
+    printf("\nLatency:\n");
+    g_completionLatency.PrintSummary();
+    g_deliveryLatency.PrintSummary();
+
+    if (g_csvFile) {
+        FILE* fp = fopen(g_csvFile, "w");
+        if (fp) {
+            LatencyHistogram::WriteCsvHeader(fp);
+            g_completionLatency.WriteCsvRow(fp);
+            g_deliveryLatency.WriteCsvRow(fp);
+            fclose(fp);
+        } else {
+            printf("Unable to open %s \n", g_csvFile);
+        }
+    }
+    if (g_jsonFile) {
+        FILE* fp = fopen(g_jsonFile, "w");
+        if (fp) {
+            fprintf(fp, "{\"histograms\": [");
+            g_completionLatency.WriteJson(fp);
+            fprintf(fp, ", ");
+            g_deliveryLatency.WriteJson(fp);
+            fprintf(fp, "]}\n");
+            fclose(fp);
+        } else {
+            printf("Unable to open %s \n", g_jsonFile);
+        }
+    }
+}
+
+/*
+ * Start the send/receive workload of every connection that has come up since
+ * the last call.  Called from the main loop so that the ARDP callbacks never
+ * have to create threads.
+ */
+static void StartWorkers(ArdpHandle* handle, qcc::SocketFd sock, bool sender, bool receiver)
+{
+    g_lock.Lock(MUTEX_CONTEXT);
+    for (size_t i = 0; i < g_connStates.size(); ++i) {
+        ConnState* state = g_connStates[i];
+        if (!state->connected || state->sendThread || state->recvThread) {
+            continue;
+        }
+        char name[32];
+        if (sender) {
+            snprintf(name, sizeof(name), "s%u", state->id);
+            state->sendThread = new SendClass(name, handle, sock, state);
+            state->sendThread->Start();
+        }
+        if (receiver) {
+            snprintf(name, sizeof(name), "r%u", state->id);
+            state->recvThread = new RecvClass(name, handle, sock, state);
+            state->recvThread->Start();
+        }
+    }
+    g_lock.Unlock(MUTEX_CONTEXT);
+}
+
+static void StopWorkers()
+{
+    for (size_t i = 0; i < g_connStates.size(); ++i) {
+        ConnState* state = g_connStates[i];
+        if (state->sendThread) {
+            state->sendThread->Stop();
+            state->sendThread->Join();
+            delete state->sendThread;
+            state->sendThread = NULL;
+        }
+        if (state->recvThread) {
+            state->recvThread->Stop();
+            state->recvThread->Join();
+            delete state->recvThread;
+            state->recvThread = NULL;
+        }
+    }
+}
+
+static void PrintThroughput(uint32_t endTime)
+{
+    uint32_t sent = 0, sentOk = 0, recv = 0, lost = 0, expired = 0, corrupt = 0, up = 0, failed = 0;
+    uint64_t sentBytes = 0, recvBytes = 0;
+    uint32_t firstConnect = endTime;
+
+    printf("\n%-6s %-8s %10s %10s %14s %10s %14s %8s %8s %8s %12s %12s\n", "conn", "state", "sent", "sendcb", "sendcb_bytes", "recv", "recv_bytes", "lost", "corrupt", "ttl_exp", "tx_KB/s", "rx_KB/s");
+    for (size_t i = 0; i < g_connStates.size(); ++i) {
+        ConnState* state = g_connStates[i];
+        uint32_t stop = state->disconnectTime ? state->disconnectTime : endTime;
+        uint32_t elapsed = (state->connectTime && stop > state->connectTime) ? stop - state->connectTime : 0;
+        double secs = elapsed / 1000.0;
+        printf("%-6u %-8s %10u %10u %14llu %10u %14llu %8u %8u %8u %12.1f %12.1f\n", state->id,
+               state->failed ? "failed" : (state->connected ? "up" : "down"),
+               state->sender_count, state->sendcb_count, (unsigned long long)state->sendcb_bytes,
+               state->recv_count, (unsigned long long)state->recv_bytes, state->lost, state->corrupt, state->ttl_expired_at_sender,
+               secs > 0 ? state->sendcb_bytes / 1024.0 / secs : 0.0,
+               secs > 0 ? state->recv_bytes / 1024.0 / secs : 0.0);
+        sent += state->sender_count;
+        sentOk += state->sendcb_count;
+        sentBytes += state->sendcb_bytes;
+        recv += state->recv_count;
+        recvBytes += state->recv_bytes;
+        lost += state->lost;
+        corrupt += state->corrupt;
+        expired += state->ttl_expired_at_sender;
+        up += state->connected ? 1 : 0;
+        failed += state->failed ? 1 : 0;
+        if (state->connectTime && state->connectTime < firstConnect) {
+            firstConnect = state->connectTime;
+        }
+    }
+
+    double secs = (endTime - firstConnect) / 1000.0;
+    printf("TOTAL: %u connections (%u up, %u failed) over %.1f s\n", (uint32_t)g_connStates.size(), up, failed, secs);
+    printf("TOTAL: sent %u (%u completed, %llu bytes), received %u (%llu bytes), lost %u, corrupt %u, ttl expired at sender %u\n",
+           sent, sentOk, (unsigned long long)sentBytes, recv, (unsigned long long)recvBytes, lost, corrupt, expired);
+    if (secs > 0) {
+        printf("TOTAL: tx %.1f msgs/s %.1f KB/s, rx %.1f msgs/s %.1f KB/s\n",
+               sentOk / secs, sentBytes / 1024.0 / secs, recv / secs, recvBytes / 1024.0 / secs);
+    }
 }
 
 int main(int argc, char** argv)
@@ -459,6 +1486,32 @@ int main(int argc, char** argv)
         } else if (0 == strcmp("-rd", argv[i])) {
             g_receiver_delay = atoi(argv[i + 1]);
             i++;
+        } else if (0 == strcmp("-release", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else if (0 == strcmp("immediate", argv[i])) {
+                g_releasePolicy = RELEASE_IMMEDIATE;
+            } else if (0 == strcmp("batch", argv[i])) {
+                g_releasePolicy = RELEASE_BATCH;
+            } else if (0 == strcmp("delayed", argv[i])) {
+                g_releasePolicy = RELEASE_DELAYED;
+            } else {
+                printf("option %s takes immediate, batch or delayed\n", argv[i - 1]);
+                usage();
+                exit(1);
+            }
+        } else if (0 == strcmp("-rb", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else {
+                g_releaseBatch = qcc::StringToU32(argv[i], 0, 8);
+            }
         } else if (0 == strcmp("-sleep", argv[i])) {
             ++i;
             if (i == argc) {
@@ -498,6 +1551,108 @@ int main(int argc, char** argv)
             }
         } else if (0 == strcmp("-f", argv[i])) {
             g_fuzz = true;
+        } else if (0 == strcmp("-q", argv[i])) {
+            g_quiet = true;
+        } else if (0 == strcmp("-e", argv[i])) {
+            g_eventDriven = true;
+        } else if (0 == strcmp("-verify", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else if (0 == strcmp("pattern", argv[i])) {
+                g_verify = PAYLOAD_CHECK_PATTERN;
+            } else if (0 == strcmp("crc", argv[i])) {
+                g_verify = PAYLOAD_CHECK_CRC32C;
+            } else if (0 == strcmp("none", argv[i])) {
+                g_verify = PAYLOAD_CHECK_NONE;
+            } else {
+                printf("option %s takes none, pattern or crc\n", argv[i - 1]);
+                usage();
+                exit(1);
+            }
+        } else if (0 == strcmp("-mmsg", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else {
+                //The kernel takes at most UIO_MAXIOV (1024) datagrams per recvmmsg/sendmmsg
+                g_mmsgBatch = qcc::StringToU32(argv[i], 0, 0);
+                g_mmsgBatch = (g_mmsgBatch == 0) ? 1 : (g_mmsgBatch > MmsgShim::MAX_BATCH) ? MmsgShim::MAX_BATCH : g_mmsgBatch;
+            }
+        } else if (0 == strcmp("-ttlcsv", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else {
+                g_ttlCsvFile = argv[i];
+            }
+        } else if (0 == strcmp("-telemetry", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else {
+                g_telemetryFile = argv[i];
+            }
+        } else if (0 == strcmp("-ti", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else {
+                g_telemetryInterval = qcc::StringToU32(argv[i], 0, 1000);
+            }
+        } else if (0 == strcmp("-bulk", argv[i])) {
+            g_bulk = true;
+        } else if (0 == strcmp("-pool", argv[i])) {
+            g_usePool = true;
+        } else if (0 == strcmp("-poolskip", argv[i])) {
+            g_usePool = true;
+            g_poolSkip = true;
+        } else if (0 == strcmp("-poolsize", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else {
+                g_poolCount = qcc::StringToU32(argv[i], 0, 0);
+            }
+        } else if (0 == strcmp("-csv", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else {
+                g_csvFile = argv[i];
+            }
+        } else if (0 == strcmp("-json", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else {
+                g_jsonFile = argv[i];
+            }
+        } else if (0 == strcmp("-n", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                exit(1);
+            } else {
+                g_numConnections = qcc::StringToU32(argv[i], 0, 1);
+            }
         } else {
             printf("Unknown option %s\n", argv[i]);
             exit(0);
@@ -511,6 +1666,41 @@ int main(int argc, char** argv)
 
     signal(SIGINT, SigIntHandler);
 
+    if (g_ttlCsvFile) {
+        g_ttlCsv = fopen(g_ttlCsvFile, "w");
+        if (!g_ttlCsv) {
+            printf("Unable to open %s \n", g_ttlCsvFile);
+            return 1;
+        }
+        fprintf(g_ttlCsv, "conn,count,ttl_ms,length,outcome,age_us,wire_bytes,transmissions\n");
+    }
+
+    if (g_telemetryFile) {
+#if ARDP_TESTHOOKS
+        if (!g_telemetry.Open(g_telemetryFile, g_telemetryInterval)) {
+            printf("Unable to open %s \n", g_telemetryFile);
+            return 1;
+        }
+#else
+        printf("-telemetry needs the ARDP test hooks, build with ARDP_TESTHOOKS; ignored\n");
+#endif
+    }
+
+    if (g_usePool) {
+        /*
+         * ARDP refuses a send unless the whole message fits in the window, and
+         * every message takes at least one of the UDP_SEGMAX segments, so no
+         * more than UDP_SEGMAX buffers per connection can ever be outstanding.
+         */
+        if (g_poolCount == 0) {
+            g_poolCount = UDP_SEGMAX * g_numConnections;
+        }
+        if (!g_pool.Init(PAYLOAD_HEADER_LEN + g_payloadLength, g_poolCount)) {
+            printf("Unable to allocate %u send buffers \n", g_poolCount);
+            return 1;
+        }
+    }
+
 
     //One time activity- Create a socket, set to blocking, bind it to local port, local address
     qcc::SocketFd sock = qcc::INVALID_SOCKET_FD;
@@ -533,6 +1723,11 @@ int main(int argc, char** argv)
         return 0;
     }
 
+    if (g_mmsgBatch && !MmsgShim::Instance().Register(sock, g_mmsgBatch)) {
+        printf("-mmsg is not supported here, using plain socket calls\n");
+        g_mmsgBatch = 0;
+    }
+
     //Populate default values for timers, couters, etc.
     ArdpGlobalConfig ardpConfig;
     ardpConfig.connectTimeout = UDP_CONNECT_TIMEOUT;
@@ -561,18 +1756,33 @@ int main(int argc, char** argv)
     ARDP_SetSendCb(handle, SendCb);
     ARDP_SetSendWindowCb(handle, SendWindowCb);
 
-    ArdpConnRecord* conn;
+#if ARDP_TESTHOOKS
+    ARDP_HookSendToSG(handle, ArdpSendToSGHook);
+    ARDP_HookSendTo(handle, ArdpSendToHook);
+    if (g_telemetry.IsOpen()) {
+        ARDP_HookRecvFrom(handle, ArdpRecvFromHook);
+    }
+#endif
 
     //The side can behave as a server or client. Teach it to behave as a server.
     // This API is only for server side.
     ARDP_StartPassive(handle);
     if (connector) {
-        g_lock.Lock();
-        status = ARDP_Connect(handle, sock, qcc::IPAddress(g_foreign_address), atoi(g_foreign_port), UDP_SEGMAX, UDP_SEGBMAX, &conn, (uint8_t* )g_ajnConnString, strlen(g_ajnConnString) + 1, NULL); \
-        g_lock.Unlock();
-        if (status != ER_OK) {
-            printf("Error while calling ARDP_Connect..  %s \n", QCC_StatusText(status));
-            return 0;
+        for (uint32_t i = 0; i < g_numConnections; ++i) {
+            ArdpConnRecord* conn;
+            g_lock.Lock();
+            status = ARDP_Connect(handle, sock, qcc::IPAddress(g_foreign_address), atoi(g_foreign_port), UDP_SEGMAX, UDP_SEGBMAX, &conn, (uint8_t* )g_ajnConnString, strlen(g_ajnConnString) + 1, NULL);
+            if (status == ER_OK) {
+                ConnState* state = new ConnState(g_connStates.size());
+                state->conn = conn;
+                g_connStates.push_back(state);
+                g_connMap[conn] = state;
+            }
+            g_lock.Unlock();
+            if (status != ER_OK) {
+                printf("Error while calling ARDP_Connect(%u)..  %s \n", i, QCC_StatusText(status));
+                return 0;
+            }
         }
     }
 
@@ -580,19 +1790,10 @@ int main(int argc, char** argv)
     ThreadClass* t1 = new ThreadClass((char*)"t1", handle, sock);
     t1->Start();
 
-    SendClass* s1 = new SendClass((char*)"s1", handle, sock);
-    if (sender) {
-        s1->Start();
-    }
-
-    RecvClass* r1 = new RecvClass((char*)"r1", handle, sock);
-    if (receiver) {
-        r1->Start();
-    }
-
     uint32_t startTime = GetTimestamp();
     uint32_t endTime = GetTimestamp();
     while (!g_interrupt) {
+        StartWorkers(handle, sock, sender, receiver);
         endTime = GetTimestamp();
         if ((endTime - startTime) > g_sleepTime) {
             printf("Time  %u exceeds  %u specified. program exits  \n", (endTime - startTime), g_sleepTime);
@@ -602,17 +1803,43 @@ int main(int argc, char** argv)
         qcc::Sleep(100);
     }
 
+    StopWorkers();
+
     t1->Stop();
     t1->Join();
+    t1->PrintStats(endTime - startTime);
     delete t1;
 
-    s1->Stop();
-    s1->Join();
-    delete s1;
-
-    r1->Stop();
-    r1->Join();
-    delete r1;
+    PrintThroughput(endTime);
+    if (receiver) {
+        PrintReceive();
+    }
+    PrintLatency();
+    if (g_ttlSet) {
+        PrintTtl();
+    }
+    if (g_ttlCsv) {
+        fclose(g_ttlCsv);
+    }
+#if ARDP_TESTHOOKS
+    if (g_telemetry.IsOpen()) {
+        g_telemetry.Close();
+        g_telemetry.PrintSummary();
+    }
+#endif
+    if (g_bulk) {
+        PrintBulk(endTime);
+    }
+    if (g_usePool) {
+        g_pool.PrintStats();
+    }
+    if (g_mmsgBatch) {
+        uint64_t messages = 0;
+        for (size_t i = 0; i < g_connStates.size(); ++i) {
+            messages += g_connStates[i]->sendcb_count + g_connStates[i]->recv_count;
+        }
+        MmsgShim::Instance().PrintStats(sock, messages);
+    }
 
     AllJoynRouterShutdown();
     AllJoynShutdown();
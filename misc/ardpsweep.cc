@@ -0,0 +1,275 @@
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Sweep ArdpGlobalConfig parameters.  For every combination of the given
+ * segmax, segbmax, delayedAckTimeout, fastRetransmitAckCounter and
+ * initialDataTimeout values, run the same fixed duration loopback transfer
+ * as ardplinkemu and print one row of goodput, latency and retransmissions.
+ * Every combination sees the same link and the same seed.
+ */
+
+#include <qcc/Debug.h>
+#include <qcc/Log.h>
+
+#include <stdlib.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include <qcc/String.h>
+#include <qcc/StringUtil.h>
+
+#include <alljoyn/Init.h>
+#include <alljoyn/Status.h>
+
+#include <ArdpProtocol.h>
+
+#include "ArdpLinkEmulator.h"
+#include "ArdpLoopbackTransfer.h"
+#include "ArdpRange.h"
+
+#define QCC_MODULE "ARDP"
+
+using namespace std;
+using namespace qcc;
+using namespace ajn;
+
+static ArdpLoopbackTransfer g_transfer;
+static volatile sig_atomic_t g_interrupt = false;
+
+static void CDECL_CALL SigIntHandler(int sig)
+{
+    g_interrupt = true;
+    g_transfer.Abort();
+}
+
+static void usage() {
+    printf("./ardpsweep -segmax 4,8,16,32 -dat 0:100:25 -time 5000\n");
+    printf("./ardpsweep -segmax 16 -fr 1:4:1 -idt 100:1600:x2 -loss 2 -delay 10 -csv sweep.csv\n");
+    printf("A range is a comma separated list (4,8,16), lo:hi:step (0:100:25) or lo:hi:xN for a geometric series\n");
+    printf(" -segmax range :  Maximum messages in flight, default is 16\n");
+    printf(" -segbmax range :  Maximum message size, default is 65507\n");
+    printf(" -dat range :  delayedAckTimeout in ms, default is 100\n");
+    printf(" -fr range :  fastRetransmitAckCounter, default is 1\n");
+    printf(" -idt range :  initialDataTimeout in ms, default is 1000\n");
+    printf(" -time # :  Duration of each transfer in ms, default is 5000\n");
+    printf(" -repeat # :  Runs per combination, one row each, default is 1\n");
+    printf(" -n # :  Number of concurrent connections, default is 1\n");
+    printf(" -payload # :  Message length, default is 1024\n");
+    printf(" -seed # :  Seed for the emulated link, default is 1\n");
+    printf(" -csv file :  Also write the matrix to a csv file\n");
+    printf(" -direct :  Connect the endpoints directly, no emulated link (no retransmit counts)\n");
+    printf("Link, applied to the data path (see ardplinkemu):\n");
+    printf(" -loss # :  Random loss in percent\n");
+    printf(" -gep # -ger # :  Gilbert-Elliott percent chance of entering/leaving the bad state\n");
+    printf(" -delay # :  One way delay in ms\n");
+    printf(" -jitter # :  Extra uniform delay, 0 to # ms\n");
+    printf(" -reorder # :  Percent of datagrams held back by 10 ms\n");
+    printf(" -rate # :  Bandwidth cap in kbit/s\n");
+}
+
+static const char* NextArg(int argc, char** argv, int& i)
+{
+    ++i;
+    if (i == argc) {
+        printf("option %s requires a parameter\n", argv[i - 1]);
+        usage();
+        exit(1);
+    }
+    return argv[i];
+}
+
+static void ParseRangeOption(int argc, char** argv, int& i, vector<uint32_t>& values, uint32_t min = 0, uint32_t max = 0xFFFFFFFF)
+{
+    const char* arg = NextArg(argc, argv, i);
+    if (!ParseRange(arg, values)) {
+        printf("bad range %s for option %s\n", arg, argv[i - 1]);
+        usage();
+        exit(1);
+    }
+    for (size_t v = 0; v < values.size(); ++v) {
+        if (values[v] < min || values[v] > max) {
+            printf("option %s takes values from %u to %u, not %u\n", argv[i - 1], min, max, values[v]);
+            usage();
+            exit(1);
+        }
+    }
+}
+
+static void PrintHeader(FILE* fp, bool csv)
+{
+    if (csv) {
+        fprintf(fp, "segmax,segbmax,delayed_ack_timeout,fast_retransmit_ack_counter,initial_data_timeout,run,"
+                "goodput_mbps,messages_per_s,p50_us,p99_us,max_us,data_segments,retransmits,retransmit_pct,stalls,send_errors\n");
+    } else {
+        fprintf(fp, "%6s %6s %5s %3s %6s %3s | %10s %10s %9s %9s %9s | %10s %9s %7s %7s %6s\n",
+                "segmax", "segbmx", "dat", "fr", "idt", "run",
+                "MB/s", "msg/s", "p50 us", "p99 us", "max us",
+                "data segs", "retrans", "retr %", "stalls", "errors");
+    }
+}
+
+static void PrintRow(FILE* fp, bool csv, const ArdpGlobalConfig& c, uint32_t run, const ArdpTransferResult& r)
+{
+    double mps = r.seconds > 0.0 ? r.messagesDelivered / r.seconds : 0.0;
+    if (csv) {
+        fprintf(fp, "%u,%u,%u,%u,%u,%u,%.3f,%.0f,%llu,%llu,%llu,%llu,%llu,%.3f,%u,%llu\n",
+                c.segmax, c.segbmax, c.delayedAckTimeout, c.fastRetransmitAckCounter, c.initialDataTimeout, run,
+                r.GoodputMBps(), mps, (unsigned long long)r.latency.GetPercentile(50.0),
+                (unsigned long long)r.latency.GetPercentile(99.0), (unsigned long long)r.latency.GetMax(),
+                (unsigned long long)r.forward.dataSegments, (unsigned long long)r.forward.retransmits,
+                r.RetransmitPercent(), r.stalls, (unsigned long long)r.sendErrors);
+    } else {
+        fprintf(fp, "%6u %6u %5u %3u %6u %3u | %10.3f %10.0f %9llu %9llu %9llu | %10llu %9llu %7.2f %7u %6llu\n",
+                c.segmax, c.segbmax, c.delayedAckTimeout, c.fastRetransmitAckCounter, c.initialDataTimeout, run,
+                r.GoodputMBps(), mps, (unsigned long long)r.latency.GetPercentile(50.0),
+                (unsigned long long)r.latency.GetPercentile(99.0), (unsigned long long)r.latency.GetMax(),
+                (unsigned long long)r.forward.dataSegments, (unsigned long long)r.forward.retransmits,
+                r.RetransmitPercent(), r.stalls, (unsigned long long)r.sendErrors);
+    }
+    fflush(fp);
+}
+
+int main(int argc, char** argv)
+{
+    if (AllJoynInit() != ER_OK) {
+        return 1;
+    }
+    if (AllJoynRouterInit() != ER_OK) {
+        AllJoynShutdown();
+        return 1;
+    }
+
+    ArdpTransferParams params;
+    params.durationMs = 5000;
+    LinkImpairment link;
+    link.reorderDelayUs = 10000;
+    uint32_t repeat = 1;
+    const char* csvFile = NULL;
+
+    vector<uint32_t> segmax(1, params.config.segmax);
+    vector<uint32_t> segbmax(1, params.config.segbmax);
+    vector<uint32_t> dat(1, params.config.delayedAckTimeout);
+    vector<uint32_t> fr(1, params.config.fastRetransmitAckCounter);
+    vector<uint32_t> idt(1, params.config.initialDataTimeout);
+
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp("-h", argv[i])) {
+            usage();
+            exit(0);
+        } else if (0 == strcmp("-segmax", argv[i])) {
+            ParseRangeOption(argc, argv, i, segmax, 1, ARDP_SEGMAX_LIMIT);
+        } else if (0 == strcmp("-segbmax", argv[i])) {
+            ParseRangeOption(argc, argv, i, segbmax, 1, ARDP_SEGBMAX_LIMIT);
+        } else if (0 == strcmp("-dat", argv[i])) {
+            ParseRangeOption(argc, argv, i, dat);
+        } else if (0 == strcmp("-fr", argv[i])) {
+            ParseRangeOption(argc, argv, i, fr);
+        } else if (0 == strcmp("-idt", argv[i])) {
+            ParseRangeOption(argc, argv, i, idt);
+        } else if (0 == strcmp("-time", argv[i])) {
+            params.durationMs = qcc::StringToU32(NextArg(argc, argv, i), 0, 5000);
+        } else if (0 == strcmp("-repeat", argv[i])) {
+            repeat = qcc::StringToU32(NextArg(argc, argv, i), 0, 1);
+        } else if (0 == strcmp("-n", argv[i])) {
+            params.connections = qcc::StringToU32(NextArg(argc, argv, i), 0, 1);
+        } else if (0 == strcmp("-payload", argv[i])) {
+            params.minPayload = params.maxPayload = qcc::StringToU32(NextArg(argc, argv, i), 0, 1024);
+        } else if (0 == strcmp("-seed", argv[i])) {
+            params.seed = qcc::StringToU32(NextArg(argc, argv, i), 0, 1);
+        } else if (0 == strcmp("-csv", argv[i])) {
+            csvFile = NextArg(argc, argv, i);
+        } else if (0 == strcmp("-direct", argv[i])) {
+            params.useEmulator = false;
+        } else if (0 == strcmp("-loss", argv[i])) {
+            link.lossRate = atof(NextArg(argc, argv, i)) / 100.0;
+        } else if (0 == strcmp("-gep", argv[i])) {
+            link.geGoodToBad = atof(NextArg(argc, argv, i)) / 100.0;
+        } else if (0 == strcmp("-ger", argv[i])) {
+            link.geBadToGood = atof(NextArg(argc, argv, i)) / 100.0;
+        } else if (0 == strcmp("-delay", argv[i])) {
+            link.delayUs = (uint32_t)(atof(NextArg(argc, argv, i)) * 1000);
+        } else if (0 == strcmp("-jitter", argv[i])) {
+            link.jitterUs = (uint32_t)(atof(NextArg(argc, argv, i)) * 1000);
+        } else if (0 == strcmp("-reorder", argv[i])) {
+            link.reorderRate = atof(NextArg(argc, argv, i)) / 100.0;
+        } else if (0 == strcmp("-rate", argv[i])) {
+            link.rateKbps = qcc::StringToU32(NextArg(argc, argv, i), 0, 0);
+        } else {
+            printf("Unknown option %s\n", argv[i]);
+            usage();
+            exit(1);
+        }
+    }
+    params.forward = link;
+
+    FILE* csv = NULL;
+    if (csvFile) {
+        csv = fopen(csvFile, "w");
+        if (csv == NULL) {
+            printf("cannot open %s\n", csvFile);
+            exit(1);
+        }
+        PrintHeader(csv, true);
+    }
+
+    signal(SIGINT, SigIntHandler);
+
+    size_t combinations = segmax.size() * segbmax.size() * dat.size() * fr.size() * idt.size();
+    printf("%u combinations x %u runs x %u ms\n", (uint32_t)combinations, repeat, params.durationMs);
+    PrintHeader(stdout, false);
+
+    int failures = 0;
+    for (size_t a = 0; a < segmax.size() && !g_interrupt; ++a) {
+        for (size_t b = 0; b < segbmax.size() && !g_interrupt; ++b) {
+            for (size_t c = 0; c < dat.size() && !g_interrupt; ++c) {
+                for (size_t d = 0; d < fr.size() && !g_interrupt; ++d) {
+                    for (size_t e = 0; e < idt.size() && !g_interrupt; ++e) {
+                        params.config.segmax = (uint16_t)segmax[a];
+                        params.config.segbmax = (uint16_t)segbmax[b];
+                        params.config.delayedAckTimeout = dat[c];
+                        params.config.fastRetransmitAckCounter = fr[d];
+                        params.config.initialDataTimeout = idt[e];
+                        for (uint32_t run = 0; run < repeat && !g_interrupt; ++run) {
+                            ArdpTransferResult result;
+                            QStatus status = g_transfer.Run(params, result);
+                            if (status != ER_OK) {
+                                QCC_LogError(status, ("Transfer failed for segmax %u segbmax %u", segmax[a], segbmax[b]));
+                                failures++;
+                                continue;
+                            }
+                            PrintRow(stdout, false, params.config, run, result);
+                            if (csv) {
+                                PrintRow(csv, true, params.config, run, result);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (csv) {
+        fclose(csv);
+    }
+
+    AllJoynRouterShutdown();
+    AllJoynShutdown();
+    return failures ? 1 : 0;
+}
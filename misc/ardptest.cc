@@ -70,6 +70,9 @@ std::map<ArdpConnRecord*, std::queue<ArdpRcvBuf*> > RecvMapQueue;
 std::map<uint32_t, ArdpConnRecord*> connList;
 static int g_conn = 0;
 static Mutex g_lock;
+static bool g_eventDriven = false;
+/* Set after every command that hands ARDP new work */
+static qcc::Event g_wakeEvent;
 
 static volatile sig_atomic_t g_interrupt = false;
 
@@ -206,6 +209,11 @@ class ThreadClass : public Thread {
   protected:
     qcc::ThreadReturn STDCALL Run(void* arg) {
 
+        if (g_eventDriven) {
+            RunEventDriven();
+            return this;
+        }
+
         while ((!g_interrupt) && (IsRunning())) {
             uint32_t ms;
             g_lock.Lock();
@@ -217,6 +225,37 @@ class ThreadClass : public Thread {
         return this;
     }
 
+    /*
+     * Only call ARDP_Run when the socket is readable, the timeout it returned
+     * has expired, or a command has just queued work on the handle.
+     */
+    void RunEventDriven() {
+        qcc::Event sockEvent(m_sock, qcc::Event::IO_READ);
+        std::vector<qcc::Event*> checkEvents;
+        std::vector<qcc::Event*> signaledEvents;
+        checkEvents.push_back(&sockEvent);
+        checkEvents.push_back(&g_wakeEvent);
+
+        bool sockRead = true;
+        while ((!g_interrupt) && (IsRunning())) {
+            uint32_t ms = qcc::Event::WAIT_FOREVER;
+            g_lock.Lock();
+            ARDP_Run(m_handle, m_sock, sockRead, &ms);
+            g_lock.Unlock();
+
+            signaledEvents.clear();
+            qcc::Event::Wait(checkEvents, signaledEvents, ms);
+            sockRead = false;
+            for (std::vector<qcc::Event*>::iterator it = signaledEvents.begin(); it != signaledEvents.end(); ++it) {
+                if (*it == &sockEvent) {
+                    sockRead = true;
+                } else if (*it == &g_wakeEvent) {
+                    g_wakeEvent.ResetEvent();
+                }
+            }
+        }
+    }
+
   private:
     ArdpHandle* m_handle;
     qcc::SocketFd m_sock;
@@ -262,6 +301,8 @@ int main(int argc, char** argv)
         } else if (0 == strcmp("-fa", argv[i])) {
             g_foreign_address = argv[i + 1];
             i++;
+        } else if (0 == strcmp("-e", argv[i])) {
+            g_eventDriven = true;
         } else {
             printf("Unknown option %s\n", argv[i]);
             exit(0);
@@ -493,6 +534,9 @@ int main(int argc, char** argv)
         }
 
 
+        /* Whatever the command was, let the ARDP thread pick it up now rather than at its next timeout */
+        g_wakeEvent.SetEvent();
+
         if (strcmp(cmd.c_str(), "help") == 0) {
             usage();
         }
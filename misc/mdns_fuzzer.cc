@@ -15,12 +15,31 @@
  *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  ******************************************************************************/
 
+#include <qcc/Event.h>
+#include <qcc/Mutex.h>
 #include <qcc/Socket.h>
 #include <qcc/SocketTypes.h>
+#include <qcc/StringUtil.h>
 #include <qcc/Thread.h>
+#include <qcc/Util.h>
 #include <alljoyn/BusAttachment.h>
 #include <alljoyn/Init.h>
 
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "ArdpRange.h"
+#include "LatencyHistogram.h"
+#include "MdnsPacket.h"
+#include "XorShiftRng.h"
+
 #define QCC_MODULE "MDNS FUZZER TEST PROGRAM"
 
 using namespace std;
@@ -30,37 +49,719 @@ using namespace ajn;
 #define MAXBUFSIZE 65536 // Max UDP Packet size is 64 Kbyte
 
 //The name advertised is "fuzzing.testing.purpose.only.do.not.use.this.name"
-const uint8_t advertise_name_is_at[] = { 0x00, 0x01, 0x80, 0x00, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x04, 0x08, 0x5f, 0x61, 0x6c, 0x6c, 0x6a, 0x6f, 0x79, 0x6e, 0x04, 0x5f, 0x74, 0x63, 0x70, 0x05, 0x6c, 0x6f, 0x63, 0x61, 0x6c, 0x00, 0x00, 0x0c, 0x00, 0x01, 0x00, 0x00, 0x00, 0x78, 0x00, 0x23, 0x20, 0x36, 0x61, 0x66, 0x65, 0x66, 0x63, 0x66, 0x66, 0x35, 0x39, 0x61, 0x66, 0x32, 0x33, 0x66, 0x36, 0x65, 0x63, 0x35, 0x32, 0x61, 0x35, 0x37, 0x30, 0x62, 0x33, 0x35, 0x38, 0x37, 0x66, 0x63, 0x32, 0xc0, 0x0c, 0xc0, 0x2b, 0x00, 0x21, 0x00, 0x01, 0x00, 0x00, 0x00, 0x78, 0x00, 0x29, 0x00, 0x01, 0x00, 0x01, 0x26, 0xe3, 0x20, 0x36, 0x61, 0x66, 0x65, 0x66, 0x63, 0x66, 0x66, 0x35, 0x39, 0x61, 0x66, 0x32, 0x33, 0x66, 0x36, 0x65, 0x63, 0x35, 0x32, 0x61, 0x35, 0x37, 0x30, 0x62, 0x33, 0x35, 0x38, 0x37, 0x66, 0x63, 0x32, 0xc0, 0x1a, 0xc0, 0x2b, 0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x78, 0x00, 0x0a, 0x09, 0x74, 0x78, 0x74, 0x76, 0x65, 0x72, 0x73, 0x3d, 0x30, 0x09, 0x61, 0x64, 0x76, 0x65, 0x72, 0x74, 0x69, 0x73, 0x65, 0xc0, 0x60, 0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x78, 0x00, 0x46, 0x09, 0x74, 0x78, 0x74, 0x76, 0x65, 0x72, 0x73, 0x3d, 0x30, 0x05, 0x74, 0x5f, 0x31, 0x3d, 0x34, 0x35, 0x6e, 0x5f, 0x32, 0x3d, 0x66, 0x75, 0x7a, 0x7a, 0x69, 0x6e, 0x67, 0x2e, 0x74, 0x65, 0x73, 0x74, 0x69, 0x6e, 0x67, 0x2e, 0x70, 0x75, 0x72, 0x70, 0x6f, 0x73, 0x65, 0x2e, 0x6f, 0x6e, 0x6c, 0x79, 0x2e, 0x64, 0x6f, 0x2e, 0x6e, 0x6f, 0x74, 0x2e, 0x75, 0x73, 0x65, 0x2e, 0x74, 0x68, 0x69, 0x73, 0x2e, 0x6e, 0x61, 0x6d, 0x65, 0x0b, 0x73, 0x65, 0x6e, 0x64, 0x65, 0x72, 0x2d, 0x69, 0x6e, 0x66, 0x6f, 0xc0, 0x60, 0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x78, 0x00, 0x2d, 0x09, 0x74, 0x78, 0x74, 0x76, 0x65, 0x72, 0x73, 0x3d, 0x30, 0x04, 0x70, 0x76, 0x3d, 0x32, 0x05, 0x73, 0x69, 0x64, 0x3d, 0x31, 0x0b, 0x75, 0x70, 0x63, 0x76, 0x34, 0x3d, 0x35, 0x37, 0x33, 0x32, 0x36, 0x0b, 0x75, 0x70, 0x63, 0x76, 0x36, 0x3d, 0x33, 0x37, 0x36, 0x31, 0x37, 0xc0, 0x60, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x78, 0x00, 0x04, 0x7f, 0x00, 0x00, 0x01, 0xc0, 0x60, 0x00, 0x1c, 0x00, 0x01, 0x00, 0x00, 0x00, 0x78, 0x00, 0x10, 0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x8a, 0x51, 0xfb, 0xff, 0xfe, 0x6e, 0x95, 0x21 };
-const uint32_t advertise_name_is_at_zone1 = 12;
-const uint32_t advertise_name_is_at_zone2 = 153;
+static const char* const advertise_names[] = { "fuzzing.testing.purpose.only.do.not.use.this.name" };
+static const uint8_t advertise_ipv4[] = { 127, 0, 0, 1 };
+static const uint8_t advertise_ipv6[] = { 0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x8a, 0x51, 0xfb, 0xff, 0xfe, 0x6e, 0x95, 0x21 };
+const MdnsIsAt advertise_name_is_at = {
+    1, "6afefcff59af23f6ec52a570b3587fc2", 9955, TRANSPORT_TCP, advertise_names, ArraySize(advertise_names), 120,
+    advertise_ipv4, advertise_ipv6, { 2, 1, NULL, 57326, 37617 }
+};
 
 //The name to be found is discovery.of.fuzzed.packet.do.not.use.this.name"
-const uint8_t find_name_who_has[] = { 0x00, 0x01, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x08, 0x5f, 0x61, 0x6c, 0x6c, 0x6a, 0x6f, 0x79, 0x6e, 0x04, 0x5f, 0x74, 0x63, 0x70, 0x05, 0x6c, 0x6f, 0x63, 0x61, 0x6c, 0x00, 0x00, 0x0c, 0x80, 0x01, 0x08, 0x5f, 0x61, 0x6c, 0x6c, 0x6a, 0x6f, 0x79, 0x6e, 0x04, 0x5f, 0x75, 0x64, 0x70, 0xc0, 0x1a, 0x00, 0x0c, 0x80, 0x01, 0x06, 0x73, 0x65, 0x61, 0x72, 0x63, 0x68, 0x20, 0x39, 0x32, 0x32, 0x66, 0x37, 0x33, 0x35, 0x35, 0x61, 0x38, 0x32, 0x31, 0x36, 0x37, 0x37, 0x63, 0x30, 0x34, 0x61, 0x64, 0x32, 0x64, 0x36, 0x31, 0x63, 0x64, 0x61, 0x39, 0x39, 0x31, 0x63, 0x37, 0xc0, 0x1a, 0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x78, 0x00, 0x3f, 0x09, 0x74, 0x78, 0x74, 0x76, 0x65, 0x72, 0x73, 0x3d, 0x30, 0x34, 0x6e, 0x5f, 0x31, 0x3d, 0x64, 0x69, 0x73, 0x63, 0x6f, 0x76, 0x65, 0x72, 0x79, 0x2e, 0x6f, 0x66, 0x2e, 0x66, 0x75, 0x7a, 0x7a, 0x65, 0x64, 0x2e, 0x70, 0x61, 0x63, 0x6b, 0x65, 0x74, 0x2e, 0x64, 0x6f, 0x2e, 0x6e, 0x6f, 0x74, 0x2e, 0x75, 0x73, 0x65, 0x2e, 0x74, 0x68, 0x69, 0x73, 0x2e, 0x6e, 0x61, 0x6d, 0x65, 0x2a, 0x0b, 0x73, 0x65, 0x6e, 0x64, 0x65, 0x72, 0x2d, 0x69, 0x6e, 0x66, 0x6f, 0xc0, 0x40, 0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x78, 0x00, 0x30, 0x09, 0x74, 0x78, 0x74, 0x76, 0x65, 0x72, 0x73, 0x3d, 0x30, 0x0e, 0x69, 0x70, 0x76, 0x34, 0x3d, 0x31, 0x32, 0x37, 0x2e, 0x30, 0x2e, 0x30, 0x2e, 0x31, 0x04, 0x70, 0x76, 0x3d, 0x32, 0x05, 0x73, 0x69, 0x64, 0x3d, 0x31, 0x0b, 0x75, 0x70, 0x63, 0x76, 0x34, 0x3d, 0x34, 0x38, 0x39, 0x33, 0x30 };
-const uint32_t find_name_who_has_zone1 = 12;
-const uint32_t find_name_who_has_zone2 = 57;
+static const char* const find_names[] = { "discovery.of.fuzzed.packet.do.not.use.this.name*" };
+const MdnsWhoHas find_name_who_has = {
+    1, "922f7355a821677c04ad2d61cda991c7", find_names, ArraySize(find_names), 120, { 2, 1, "127.0.0.1", 48930, 0 }
+};
 
 
 static bool g_foundName = false;
 
+/*
+ * IS-AT flood: advertiser i sends advertise_name_is_at with its own GUID and
+ * the name FLOOD_NAME_PREFIX followed by i in 8 hex digits.
+ */
+#define FLOOD_NAME_PREFIX "fuzzing.testing.purpose.only.do.not.use.x"
+struct FloodState {
+    Mutex lock;
+    std::vector<uint64_t> sentAt;   /**< By advertiser, 0 until sent */
+    std::vector<uint64_t> foundAt;  /**< By advertiser, 0 until FoundAdvertisedName */
+    uint32_t found;
+    uint32_t repeats;               /**< FoundAdvertisedName for a name already found */
+    FloodState() : found(0), repeats(0) { }
+};
+static FloodState g_flood;
+
 class MyBusListener : public BusListener {
   public:
     void FoundAdvertisedName(const char* name, TransportMask transport, const char* namePrefix)
     {
-        QCC_UNUSED(name);
         QCC_UNUSED(transport);
         QCC_UNUSED(namePrefix);
         g_foundName = true;
+        if (strncmp(name, FLOOD_NAME_PREFIX, sizeof(FLOOD_NAME_PREFIX) - 1) == 0) {
+            uint64_t now = GetTimestampMicros();
+            uint32_t index = strtoul(name + sizeof(FLOOD_NAME_PREFIX) - 1, NULL, 16);
+            g_flood.lock.Lock(MUTEX_CONTEXT);
+            if (index < g_flood.foundAt.size()) {
+                if (g_flood.foundAt[index] == 0) {
+                    g_flood.foundAt[index] = now;
+                    g_flood.found++;
+                } else {
+                    g_flood.repeats++;
+                }
+            }
+            g_flood.lock.Unlock(MUTEX_CONTEXT);
+        }
     }
 };
 static MyBusListener g_busListener;
 
+struct FloodStep {
+    uint32_t rate;
+    uint32_t sent;
+    uint32_t found;
+    double sendSeconds;
+    double ingestSeconds;   /**< First send to last FoundAdvertisedName */
+    LatencyHistogram latency;
+    FloodStep(uint32_t rate) : rate(rate), sent(0), found(0), sendSeconds(0.0), ingestSeconds(0.0), latency("found_latency") { }
+};
+
+/* Sleep, then spin, until the monotonic clock reaches due */
+static void WaitUntil(uint64_t due)
+{
+    uint64_t now = GetTimestampMicros();
+    while (now < due) {
+        if (due - now > 2000) {
+            qcc::Sleep((due - now) / 1000 - 1);
+        }
+        now = GetTimestampMicros();
+    }
+}
+
+/* Send count new advertisers at rate packets/s, then wait up to waitMs for their FoundAdvertisedName */
+static void RunFloodStep(qcc::SocketFd sock, qcc::IPAddress& dest, uint32_t first, uint32_t count, uint32_t waitMs, FloodStep& step)
+{
+    uint8_t buffer[1500];
+    char guid[33];
+    char name[64];
+    const char* names[] = { name };
+    MdnsIsAt isAt = advertise_name_is_at;
+    isAt.guid = guid;
+    isAt.names = names;
+    isAt.numNames = ArraySize(names);
+
+    uint64_t start = GetTimestampMicros();
+    for (uint32_t k = 0; k < count; ++k) {
+        WaitUntil(start + (uint64_t)k * 1000000 / step.rate);
+        uint32_t index = first + k;
+        snprintf(guid, sizeof(guid), "f1%030x", index);
+        snprintf(name, sizeof(name), FLOOD_NAME_PREFIX "%08x", index);
+        size_t len = MdnsBuildIsAt(isAt, buffer, sizeof(buffer));
+
+        g_flood.lock.Lock(MUTEX_CONTEXT);
+        g_flood.sentAt[index] = GetTimestampMicros();
+        g_flood.lock.Unlock(MUTEX_CONTEXT);
+        size_t sent = 0;
+        if (qcc::SendTo(sock, dest, 5353, buffer, len, sent) == ER_OK) {
+            step.sent++;
+        }
+    }
+    uint64_t sendEnd = GetTimestampMicros();
+    step.sendSeconds = (sendEnd - start) / 1000000.0;
+
+    /* Wait for the stragglers, giving up waitMs after the last one sent */
+    while (GetTimestampMicros() - sendEnd < (uint64_t)waitMs * 1000) {
+        g_flood.lock.Lock(MUTEX_CONTEXT);
+        uint32_t found = 0;
+        for (uint32_t k = 0; k < count; ++k) {
+            found += (g_flood.foundAt[first + k] != 0);
+        }
+        g_flood.lock.Unlock(MUTEX_CONTEXT);
+        if (found == count) {
+            break;
+        }
+        qcc::Sleep(10);
+    }
+
+    uint64_t lastFound = start;
+    g_flood.lock.Lock(MUTEX_CONTEXT);
+    for (uint32_t k = 0; k < count; ++k) {
+        uint64_t sentAt = g_flood.sentAt[first + k];
+        uint64_t foundAt = g_flood.foundAt[first + k];
+        if (foundAt) {
+            step.found++;
+            step.latency.Record(foundAt > sentAt ? foundAt - sentAt : 0);
+            lastFound = (foundAt > lastFound) ? foundAt : lastFound;
+        }
+    }
+    g_flood.lock.Unlock(MUTEX_CONTEXT);
+    step.ingestSeconds = (lastFound - start) / 1000000.0;
+}
+
+/*
+ * A step counts as saturated once the router loses discoveries (under 99%
+ * found) or its p99 callback latency is more than four times, and 10 ms
+ * above, that of the slowest rate, which -rate puts first.
+ */
+static void PrintFlood(const std::vector<FloodStep*>& steps)
+{
+    printf("\n%10s %8s %10s %8s %7s %12s %10s %10s %10s %10s\n",
+           "rate", "sent", "sent/s", "found", "found%", "ingest/s", "p50 us", "p90 us", "p99 us", "max us");
+    uint64_t baseP99 = steps.empty() ? 0 : steps[0]->latency.GetPercentile(99.0);
+    const FloodStep* knee = NULL;
+    const FloodStep* lastGood = NULL;
+    for (size_t i = 0; i < steps.size(); ++i) {
+        const FloodStep& s = *steps[i];
+        double foundPct = s.sent ? 100.0 * s.found / s.sent : 0.0;
+        uint64_t p99 = s.latency.GetPercentile(99.0);
+        bool saturated = (foundPct < 99.0) || (p99 > 4 * baseP99 && p99 > baseP99 + 10000);
+        if (saturated && !knee) {
+            knee = &s;
+        } else if (!knee) {
+            lastGood = &s;
+        }
+        printf("%10u %8u %10.1f %8u %6.1f%% %12.1f %10llu %10llu %10llu %10llu%s\n",
+               s.rate, s.sent, s.sendSeconds > 0.0 ? s.sent / s.sendSeconds : 0.0, s.found, foundPct,
+               s.ingestSeconds > 0.0 ? s.found / s.ingestSeconds : 0.0,
+               (unsigned long long)s.latency.GetPercentile(50.0), (unsigned long long)s.latency.GetPercentile(90.0),
+               (unsigned long long)p99, (unsigned long long)s.latency.GetMax(), saturated ? "  saturated" : "");
+    }
+    if (knee) {
+        printf("Discoveries start being dropped or delayed at %u IS-AT/s", knee->rate);
+        if (lastGood) {
+            printf(" (last rate kept up with: %u/s)", lastGood->rate);
+        }
+        printf("\n");
+    } else if (!steps.empty()) {
+        printf("The router kept up with every rate up to %u IS-AT/s\n", steps.back()->rate);
+    }
+    printf("%u repeated FoundAdvertisedName callbacks\n", g_flood.repeats);
+}
+
+/*
+ * WHO-HAS storm: the bus attachment advertises STORM_NAME_PREFIX followed
+ * by 0..N-1 while WHO-HAS queries for each of the prefixes in turn go out
+ * at a fixed rate.  The queries name our unicast socket in their sender
+ * info, so a router answering by unicast answers on it; the IS-AT it
+ * multicasts instead arrive on a second socket joined to the mDNS group.
+ *
+ * IS-AT carry no query id, so a response is taken to answer the oldest
+ * unanswered query of every prefix one of its names matches.  The same
+ * response sent both ways answers once.  A query still unanswered at the
+ * end of a step was suppressed by the router (or lost).
+ */
+#define STORM_NAME_PREFIX "storm.testing.do.not.use.n"
+#define STORM_MAX_PREFIXES 16
+
+struct StormState {
+    Mutex lock;
+    std::vector<qcc::String> prefixes;
+    std::deque<uint64_t> outstanding[STORM_MAX_PREFIXES];  /**< Send times of unanswered queries, by prefix */
+    uint64_t responses;             /**< IS-AT naming one of our names, duplicates included */
+    uint64_t multicastResponses;
+    uint64_t duplicates;            /**< Responses received once by multicast and once by unicast */
+    uint64_t multicastBytes;
+    uint64_t unicastBytes;
+    uint64_t answered;
+    uint64_t lastHash[2];           /**< Last response by unicast [0] and multicast [1] */
+    uint64_t lastAt[2];
+    LatencyHistogram latency;
+
+    StormState() : latency("response_latency") {
+        Reset();
+    }
+
+    void Reset() {
+        responses = multicastResponses = duplicates = multicastBytes = unicastBytes = answered = 0;
+        lastHash[0] = lastHash[1] = lastAt[0] = lastAt[1] = 0;
+        for (size_t p = 0; p < STORM_MAX_PREFIXES; ++p) {
+            outstanding[p].clear();
+        }
+        latency.Reset();
+    }
+};
+static StormState g_storm;
+
+/* A WHO-HAS name ending in '*' is a prefix, any other must match whole */
+static bool StormMatches(const qcc::String& query, const uint8_t* name, size_t len)
+{
+    size_t qlen = query.size();
+    if (qlen && query[qlen - 1] == '*') {
+        return len >= qlen - 1 && memcmp(name, query.data(), qlen - 1) == 0;
+    }
+    return len == qlen && memcmp(name, query.data(), len) == 0;
+}
+
+static void StormResponse(const uint8_t* buf, size_t len, bool multicast, uint64_t now)
+{
+    MdnsFieldMap map;
+    if (len < 12 || !(buf[2] & (MDNS_FLAG_RESPONSE >> 8)) || !MdnsParse(buf, len, map)) {
+        return;
+    }
+    bool ours = false;
+    bool matched[STORM_MAX_PREFIXES] = { false };
+    for (size_t i = 0; i < map.count; ++i) {
+        const MdnsField& f = map.fields[i];
+        const uint8_t* txt = buf + f.offset;
+        if (f.kind != MDNS_FIELD_TXT || f.length < 3 || txt[0] != 'n' || txt[1] != '_') {
+            continue;
+        }
+        const uint8_t* eq = (const uint8_t*)memchr(txt, '=', f.length);
+        if (!eq) {
+            continue;
+        }
+        const uint8_t* name = eq + 1;
+        size_t nameLen = txt + f.length - name;
+        if (nameLen < sizeof(STORM_NAME_PREFIX) - 1 || memcmp(name, STORM_NAME_PREFIX, sizeof(STORM_NAME_PREFIX) - 1) != 0) {
+            continue;
+        }
+        ours = true;
+        for (size_t p = 0; p < g_storm.prefixes.size(); ++p) {
+            matched[p] = matched[p] || StormMatches(g_storm.prefixes[p], name, nameLen);
+        }
+    }
+    if (!ours) {
+        return;
+    }
+
+    /* FNV-1a, to recognise the same response arriving on the other socket */
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ buf[i]) * 1099511628211ULL;
+    }
+    int self = multicast ? 1 : 0;
+
+    g_storm.lock.Lock(MUTEX_CONTEXT);
+    g_storm.responses++;
+    if (multicast) {
+        g_storm.multicastResponses++;
+        g_storm.multicastBytes += len;
+    } else {
+        g_storm.unicastBytes += len;
+    }
+    bool duplicate = g_storm.lastHash[1 - self] == hash && now - g_storm.lastAt[1 - self] < 50000;
+    g_storm.lastHash[self] = hash;
+    g_storm.lastAt[self] = now;
+    if (duplicate) {
+        g_storm.duplicates++;
+        g_storm.lastHash[1 - self] = 0;
+    } else {
+        for (size_t p = 0; p < g_storm.prefixes.size(); ++p) {
+            if (matched[p] && !g_storm.outstanding[p].empty()) {
+                g_storm.latency.Record(now - g_storm.outstanding[p].front());
+                g_storm.outstanding[p].pop_front();
+                g_storm.answered++;
+            }
+        }
+    }
+    g_storm.lock.Unlock(MUTEX_CONTEXT);
+}
+
+/* Reads the unicast and the multicast socket, both non-blocking, until stopped */
+class ResponseCatcher : public qcc::Thread {
+  public:
+    ResponseCatcher(qcc::SocketFd unicast, qcc::SocketFd multicast) :
+        Thread("ResponseCatcher"), m_unicast(unicast), m_multicast(multicast) { }
+
+  protected:
+    qcc::ThreadReturn STDCALL Run(void* arg)
+    {
+        QCC_UNUSED(arg);
+        qcc::Event unicastEvent(m_unicast, qcc::Event::IO_READ);
+        qcc::Event multicastEvent(m_multicast, qcc::Event::IO_READ);
+        std::vector<qcc::Event*> checkEvents;
+        std::vector<qcc::Event*> signaledEvents;
+        checkEvents.push_back(&unicastEvent);
+        checkEvents.push_back(&multicastEvent);
+        while (!IsStopping()) {
+            signaledEvents.clear();
+            qcc::Event::Wait(checkEvents, signaledEvents, 100);
+            Drain(m_unicast, false);
+            Drain(m_multicast, true);
+        }
+        return 0;
+    }
+
+  private:
+    void Drain(qcc::SocketFd sock, bool multicast)
+    {
+        qcc::IPAddress addr;
+        uint16_t port;
+        size_t len;
+        while (qcc::RecvFrom(sock, addr, port, m_buf, sizeof(m_buf), len) == ER_OK) {
+            StormResponse(m_buf, len, multicast, GetTimestampMicros());
+        }
+    }
+
+    qcc::SocketFd m_unicast;
+    qcc::SocketFd m_multicast;
+    uint8_t m_buf[MAXBUFSIZE];
+};
+
+static double CpuSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+struct StormStep {
+    uint32_t rate;
+    uint32_t sent;
+    uint32_t failed;                /**< SendTo would block or failed */
+    double sendSeconds;
+    double cpuSeconds;              /**< Whole process, the bundled router included */
+    uint64_t responses;
+    uint64_t multicastResponses;
+    uint64_t duplicates;
+    uint64_t multicastBytes;
+    uint64_t unicastBytes;
+    uint64_t answered;
+    LatencyHistogram latency;
+    StormStep(uint32_t rate) :
+        rate(rate), sent(0), failed(0), sendSeconds(0.0), cpuSeconds(0.0), responses(0), multicastResponses(0),
+        duplicates(0), multicastBytes(0), unicastBytes(0), answered(0), latency("response_latency") { }
+};
+
+/* Send count WHO-HAS at rate queries/s, cycling through the prefixes, then wait up to waitMs for their answers */
+static void RunStormStep(qcc::SocketFd sock, qcc::IPAddress& dest, uint32_t count, uint32_t waitMs, StormStep& step)
+{
+    uint8_t buffer[1500];
+    const char* names[1];
+    MdnsWhoHas whoHas = { 0, "5707e5707e5707e5707e5707e5707e57", names, 1, 120, { 2, 1, "127.0.0.1", 50001, 0 } };
+    size_t numPrefixes = g_storm.prefixes.size();
+
+    g_storm.lock.Lock(MUTEX_CONTEXT);
+    g_storm.Reset();
+    g_storm.lock.Unlock(MUTEX_CONTEXT);
+
+    double cpuStart = CpuSeconds();
+    uint64_t start = GetTimestampMicros();
+    for (uint32_t k = 0; k < count; ++k) {
+        WaitUntil(start + (uint64_t)k * 1000000 / step.rate);
+        size_t p = k % numPrefixes;
+        names[0] = g_storm.prefixes[p].c_str();
+        whoHas.id = (uint16_t)k;
+        size_t len = MdnsBuildWhoHas(whoHas, buffer, sizeof(buffer));
+
+        g_storm.lock.Lock(MUTEX_CONTEXT);
+        g_storm.outstanding[p].push_back(GetTimestampMicros());
+        g_storm.lock.Unlock(MUTEX_CONTEXT);
+        size_t sent = 0;
+        if (qcc::SendTo(sock, dest, 5353, buffer, len, sent) == ER_OK) {
+            step.sent++;
+        } else {
+            step.failed++;
+            g_storm.lock.Lock(MUTEX_CONTEXT);
+            g_storm.outstanding[p].pop_back();
+            g_storm.lock.Unlock(MUTEX_CONTEXT);
+        }
+    }
+    uint64_t sendEnd = GetTimestampMicros();
+    step.sendSeconds = (sendEnd - start) / 1000000.0;
+
+    /* Wait for the late answers, giving up waitMs after the last query */
+    while (GetTimestampMicros() - sendEnd < (uint64_t)waitMs * 1000) {
+        g_storm.lock.Lock(MUTEX_CONTEXT);
+        size_t unanswered = 0;
+        for (size_t p = 0; p < numPrefixes; ++p) {
+            unanswered += g_storm.outstanding[p].size();
+        }
+        g_storm.lock.Unlock(MUTEX_CONTEXT);
+        if (unanswered == 0) {
+            break;
+        }
+        qcc::Sleep(10);
+    }
+    step.cpuSeconds = CpuSeconds() - cpuStart;
+
+    g_storm.lock.Lock(MUTEX_CONTEXT);
+    step.responses = g_storm.responses;
+    step.multicastResponses = g_storm.multicastResponses;
+    step.duplicates = g_storm.duplicates;
+    step.multicastBytes = g_storm.multicastBytes;
+    step.unicastBytes = g_storm.unicastBytes;
+    step.answered = g_storm.answered;
+    step.latency = g_storm.latency;
+    g_storm.lock.Unlock(MUTEX_CONTEXT);
+}
+
+static void PrintStorm(const std::vector<StormStep*>& steps, double backgroundPerSecond)
+{
+    printf("\n%10s %8s %10s %9s %11s %10s %10s %10s %12s %12s %10s\n",
+           "rate", "sent", "sent/s", "answered%", "suppressed", "resp/query", "p50 us", "p99 us", "mcast B/q", "ucast B/q", "cpu us/q");
+    for (size_t i = 0; i < steps.size(); ++i) {
+        const StormStep& s = *steps[i];
+        double q = s.sent ? (double)s.sent : 1.0;
+        printf("%10u %8u %10.1f %8.1f%% %11llu %10.2f %10llu %10llu %12.1f %12.1f %10.1f\n",
+               s.rate, s.sent, s.sendSeconds > 0.0 ? s.sent / s.sendSeconds : 0.0, 100.0 * s.answered / q,
+               (unsigned long long)(s.sent - s.answered), (s.responses - s.duplicates) / q,
+               (unsigned long long)s.latency.GetPercentile(50.0), (unsigned long long)s.latency.GetPercentile(99.0),
+               s.multicastBytes / q, s.unicastBytes / q, 1e6 * s.cpuSeconds / q);
+        if (s.failed || s.duplicates) {
+            printf("%10s %u queries not sent, %llu responses received both ways\n", "",
+                   s.failed, (unsigned long long)s.duplicates);
+        }
+    }
+    printf("Unsolicited IS-AT for our names before the storm: %.2f/s\n", backgroundPerSecond);
+}
+
+/* Mutate one field of a good packet in place, by what the field holds */
+static void MutateField(XorShiftRng& rng, uint8_t* buf, size_t& len, const MdnsFieldMap& map)
+{
+    const MdnsField& f = map.fields[rng.Below(map.count)];
+    uint8_t* p = buf + f.offset;
+    switch (f.kind) {
+    case MDNS_FIELD_COUNT:
+    case MDNS_FIELD_RDLENGTH:
+        {
+            static const uint16_t values[] = { 0, 1, 0x00ff, 0x7fff, 0xffff };
+            uint16_t cur = MdnsGet16(p);
+            uint32_t pick = rng.Below(3);
+            MdnsPut16(p, (pick == 0) ? cur + 1 : (pick == 1) ? cur - 1 : values[rng.Below(ArraySize(values))]);
+            break;
+        }
+
+    case MDNS_FIELD_LABEL_LENGTH:
+    case MDNS_FIELD_TXT_LENGTH:
+        {
+            //Off by one, the 63 byte label limit, the reserved 01 and 10 prefixes, a pointer prefix
+            static const uint8_t values[] = { 0, 63, 64, 0x80, 0xc0, 0xff };
+            uint32_t pick = rng.Below(3);
+            *p = (pick == 0) ? *p + 1 : (pick == 1) ? *p - 1 : values[rng.Below(ArraySize(values))];
+            break;
+        }
+
+    case MDNS_FIELD_POINTER:
+        {
+            //To itself, to another pointer, into the header, past the end or anywhere
+            uint32_t target = 0;
+            switch (rng.Below(5)) {
+            case 0:
+                target = f.offset;
+                break;
+
+            case 1:
+                {
+                    const MdnsField& other = map.fields[rng.Below(map.count)];
+                    target = other.offset;
+                    break;
+                }
+
+            case 2:
+                target = rng.Below(12);
+                break;
+
+            case 3:
+                target = len + rng.Below(64);
+                break;
+
+            default:
+                target = rng.Below(len);
+                break;
+            }
+            MdnsPut16(p, 0xC000 | (target & 0x3FFF));
+            break;
+        }
+
+    case MDNS_FIELD_TYPE:
+        {
+            static const uint16_t values[] = { MDNS_TYPE_A, MDNS_TYPE_PTR, MDNS_TYPE_TXT, MDNS_TYPE_AAAA, MDNS_TYPE_SRV, 41, 255 };
+            MdnsPut16(p, rng.Below(4) ? values[rng.Below(ArraySize(values))] : rng.Below(65536));
+            break;
+        }
+
+    case MDNS_FIELD_CLASS:
+        {
+            static const uint16_t values[] = { MDNS_CLASS_IN, MDNS_CLASS_QU, 0x00fe, 0x00ff, 0x8000 };
+            MdnsPut16(p, rng.Below(4) ? values[rng.Below(ArraySize(values))] : rng.Below(65536));
+            break;
+        }
+
+    case MDNS_FIELD_TTL:
+        {
+            uint32_t ttl = (rng.Below(3) == 0) ? 0 : rng.Below(2) ? 0xffffffff : rng.Next32();
+            MdnsPut16(p, (uint16_t)(ttl >> 16));
+            MdnsPut16(p + 2, (uint16_t)ttl);
+            break;
+        }
+
+    case MDNS_FIELD_LABEL:
+    case MDNS_FIELD_TXT:
+        {
+            //Characters the name and TXT parsers split on, or anything
+            static const uint8_t values[] = { '=', '.', '*', ',', '_', 0, 0xc0, 0xff };
+            p[rng.Below(f.length)] = rng.Below(2) ? values[rng.Below(ArraySize(values))] : rng.Below(256);
+            break;
+        }
+
+    default:
+        //Id and flags, SRV priority, weight and port, addresses, other rdata
+        p[rng.Below(f.length)] = rng.Below(256);
+        break;
+    }
+}
+
+/*
+ * Fuzz one packet into buf and return its length.  Mostly the good packet
+ * with one to three of its fields mutated or cut short in the middle of a
+ * field; now and then a datagram of random bytes as large as it gets, or
+ * an empty one.
+ */
+static size_t FuzzPacket(XorShiftRng& rng, const uint8_t* good, size_t goodLen, const MdnsFieldMap& map, uint8_t* buf)
+{
+    uint32_t t_rand = rng.Below(10);
+    if (t_rand == 0) {
+        for (size_t i = 0; i < 60000; i += 8) {
+            uint64_t r = rng.Next();
+            memcpy(buf + i, &r, 8);
+        }
+        return 60000;
+    } else if (t_rand == 1) {
+        return 0;
+    }
+
+    memcpy(buf, good, goodLen);
+    size_t len = goodLen;
+    uint32_t mutations = 1 + rng.Below(3);
+    for (uint32_t m = 0; m < mutations; m++) {
+        if (rng.Below(10) == 0) {
+            const MdnsField& f = map.fields[rng.Below(map.count)];
+            len = f.offset + rng.Below(f.length);
+            break;
+        }
+        MutateField(rng, buf, len, map);
+    }
+    return len;
+}
+
+/*
+ * High rate fuzzing: every thread owns a socket and an RNG seeded with the
+ * seed plus its index, fuzzes a batch of packets into its ring and sends
+ * the batch with one sendmmsg().  A run is repeatable per thread from the
+ * seed, though the threads' packets interleave differently every time.
+ */
+class FuzzThread : public qcc::Thread {
+  public:
+    struct Stats {
+        uint64_t packets;
+        uint64_t bytes;
+        uint64_t failed;            /**< Packets the kernel refused */
+        uint64_t syscalls;
+        Stats() : packets(0), bytes(0), failed(0), syscalls(0) { }
+    };
+
+    FuzzThread(const uint8_t* good, size_t goodLen, const MdnsFieldMap& map, uint64_t count, uint32_t batch, uint64_t seed) :
+        Thread("FuzzThread"), m_good(good), m_goodLen(goodLen), m_map(map), m_count(count), m_batch(batch), m_rng(seed),
+        m_ring(batch * MAXBUFSIZE), m_iov(batch), m_msgs(batch) { }
+
+    const Stats& GetStats() const { return m_stats; }
+
+  protected:
+    qcc::ThreadReturn STDCALL Run(void* arg)
+    {
+        QCC_UNUSED(arg);
+        qcc::SocketFd sock;
+        if (qcc::Socket(qcc::QCC_AF_INET, qcc::QCC_SOCK_DGRAM, sock) != ER_OK) {
+            return 0;
+        }
+        qcc::SetMulticastHops(sock, qcc::QCC_AF_INET, 3);
+        qcc::SetMulticastInterface(sock, qcc::QCC_AF_INET, "lo");
+        qcc::Bind(sock, qcc::IPAddress("127.0.0.1"), 0);
+
+        struct sockaddr_in dest;
+        memset(&dest, 0, sizeof(dest));
+        dest.sin_family = AF_INET;
+        dest.sin_port = htons(5353);
+        dest.sin_addr.s_addr = inet_addr("224.0.0.251");
+        for (uint32_t i = 0; i < m_batch; ++i) {
+            m_iov[i].iov_base = &m_ring[i * MAXBUFSIZE];
+            memset(&m_msgs[i], 0, sizeof(m_msgs[i]));
+            m_msgs[i].msg_hdr.msg_name = &dest;
+            m_msgs[i].msg_hdr.msg_namelen = sizeof(dest);
+            m_msgs[i].msg_hdr.msg_iov = &m_iov[i];
+            m_msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        uint64_t left = m_count;
+        while (left && !IsStopping()) {
+            uint32_t n = (left < m_batch) ? (uint32_t)left : m_batch;
+            for (uint32_t i = 0; i < n; ++i) {
+                m_iov[i].iov_len = FuzzPacket(m_rng, m_good, m_goodLen, m_map, &m_ring[i * MAXBUFSIZE]);
+            }
+            uint32_t done = 0;
+            while (done < n) {
+                m_stats.syscalls++;
+                int sent = sendmmsg(sock, &m_msgs[done], n - done, 0);
+                if (sent > 0) {
+                    for (int i = 0; i < sent; ++i) {
+                        m_stats.bytes += m_iov[done + i].iov_len;
+                    }
+                    m_stats.packets += sent;
+                    done += sent;
+                } else if (errno != EINTR) {
+                    //The first packet of the rest was refused, skip it
+                    m_stats.failed++;
+                    done++;
+                }
+            }
+            left -= n;
+        }
+        qcc::Close(sock);
+        return 0;
+    }
+
+  private:
+    const uint8_t* m_good;
+    size_t m_goodLen;
+    const MdnsFieldMap& m_map;
+    uint64_t m_count;
+    uint32_t m_batch;
+    XorShiftRng m_rng;
+    std::vector<uint8_t> m_ring;
+    std::vector<struct iovec> m_iov;
+    std::vector<struct mmsghdr> m_msgs;
+    Stats m_stats;
+};
+
+/* Fuzz count packets from good over numThreads threads and report the rate */
+static void RunFuzzThreads(const char* what, const uint8_t* good, size_t goodLen, const MdnsFieldMap& map,
+                           uint64_t count, uint32_t numThreads, uint32_t batch, uint64_t seed)
+{
+    std::vector<FuzzThread*> threads;
+    for (uint32_t t = 0; t < numThreads; ++t) {
+        uint64_t share = count / numThreads + (t < count % numThreads ? 1 : 0);
+        threads.push_back(new FuzzThread(good, goodLen, map, share, batch, seed + t));
+    }
+    uint64_t start = GetTimestampMicros();
+    for (uint32_t t = 0; t < numThreads; ++t) {
+        threads[t]->Start();
+    }
+    FuzzThread::Stats total;
+    for (uint32_t t = 0; t < numThreads; ++t) {
+        threads[t]->Join();
+        const FuzzThread::Stats& s = threads[t]->GetStats();
+        total.packets += s.packets;
+        total.bytes += s.bytes;
+        total.failed += s.failed;
+        total.syscalls += s.syscalls;
+        delete threads[t];
+    }
+    double seconds = (GetTimestampMicros() - start) / 1000000.0;
+    if (seconds <= 0.0) {
+        seconds = 1e-6;
+    }
+    printf("%s: %llu packets in %.2f s over %u threads: %.0f packets/s, %.1f MB/s, %.1f packets per sendmmsg, %llu refused\n",
+           what, (unsigned long long)total.packets, seconds, numThreads, total.packets / seconds, total.bytes / seconds / 1e6,
+           total.syscalls ? (double)(total.packets + total.failed) / total.syscalls : 0.0, (unsigned long long)total.failed);
+}
+
 int TestAppMain(int argc, char** argv)
 {
     QStatus status = ER_OK;
     size_t sent = 0;
     qcc::IPAddress destinationMulticast("224.0.0.251");
     qcc::SocketFd sock;
-    uint32_t iterationCount = 0;
+    uint64_t iterationCount = 0;
+    uint32_t numThreads = 0;
+    uint32_t batch = 64;
+    uint64_t seed = 1;
+    uint32_t floodCount = 0;
+    uint32_t stormNames = 0;
+    uint32_t stormQueries = 1000;
+    const char* stormPrefixes = STORM_NAME_PREFIX "*";
+    uint32_t waitMs = 5000;
+    std::vector<uint32_t> rates(1, 1000);
 
     for (int i = 1; i < argc; ++i) {
         if (0 == strcmp("-c", argv[i])) {
@@ -69,7 +770,96 @@ int TestAppMain(int argc, char** argv)
                 cout << "option %s requires a parameter" << argv[i - 1] << endl;
                 return 30;
             } else {
-                iterationCount = strtoul(argv[i], NULL, 10);
+                iterationCount = strtoull(argv[i], NULL, 10);
+            }
+        } else if (0 == strcmp("-threads", argv[i])) {
+            //Fuzz from this many threads, each sending batches with sendmmsg
+            ++i;
+            if (i == argc) {
+                cout << "option " << argv[i - 1] << " requires a parameter" << endl;
+                return 30;
+            } else {
+                numThreads = strtoul(argv[i], NULL, 10);
+            }
+        } else if (0 == strcmp("-batch", argv[i])) {
+            //Packets per sendmmsg for -threads
+            ++i;
+            if (i == argc) {
+                cout << "option " << argv[i - 1] << " requires a parameter" << endl;
+                return 30;
+            } else {
+                batch = strtoul(argv[i], NULL, 10);
+                batch = (batch == 0) ? 1 : (batch > 1024) ? 1024 : batch;
+            }
+        } else if (0 == strcmp("-seed", argv[i])) {
+            //Seed of the fuzzer RNG; thread t uses seed + t
+            ++i;
+            if (i == argc) {
+                cout << "option " << argv[i - 1] << " requires a parameter" << endl;
+                return 30;
+            } else {
+                seed = strtoull(argv[i], NULL, 10);
+            }
+        } else if (0 == strcmp("-flood", argv[i])) {
+            //IS-AT ingestion benchmark: this many distinct advertisers per rate
+            ++i;
+            if (i == argc) {
+                cout << "option " << argv[i - 1] << " requires a parameter" << endl;
+                return 30;
+            } else {
+                floodCount = strtoul(argv[i], NULL, 10);
+            }
+        } else if (0 == strcmp("-storm", argv[i])) {
+            //WHO-HAS storm: advertise this many names and query for them at each rate
+            ++i;
+            if (i == argc) {
+                cout << "option " << argv[i - 1] << " requires a parameter" << endl;
+                return 30;
+            } else {
+                stormNames = strtoul(argv[i], NULL, 10);
+            }
+        } else if (0 == strcmp("-prefixes", argv[i])) {
+            //Comma separated names or prefixes ending in '*' the -storm queries cycle through
+            ++i;
+            if (i == argc) {
+                cout << "option " << argv[i - 1] << " requires a parameter" << endl;
+                return 30;
+            } else {
+                stormPrefixes = argv[i];
+            }
+        } else if (0 == strcmp("-queries", argv[i])) {
+            //WHO-HAS queries sent at each rate for -storm
+            ++i;
+            if (i == argc) {
+                cout << "option " << argv[i - 1] << " requires a parameter" << endl;
+                return 30;
+            } else {
+                stormQueries = strtoul(argv[i], NULL, 10);
+            }
+        } else if (0 == strcmp("-rate", argv[i])) {
+            //Packets/s for -flood or -storm: 1000, a list 500,1000,2000 or a range 250:16000:x2
+            ++i;
+            if (i == argc) {
+                cout << "option " << argv[i - 1] << " requires a parameter" << endl;
+                return 30;
+            } else if (!ParseRange(argv[i], rates)) {
+                cout << "option " << argv[i - 1] << " takes a rate, a list or a range of rates" << endl;
+                return 30;
+            }
+            //Slowest first: the steps go up in rate and the flood report compares against the first
+            std::sort(rates.begin(), rates.end());
+            if (rates[0] == 0) {
+                cout << "option " << argv[i - 1] << " takes rates above 0" << endl;
+                return 30;
+            }
+        } else if (0 == strcmp("-wait", argv[i])) {
+            //ms to wait for outstanding discoveries or answers after the last packet of a rate
+            ++i;
+            if (i == argc) {
+                cout << "option " << argv[i - 1] << " requires a parameter" << endl;
+                return 30;
+            } else {
+                waitMs = strtoul(argv[i], NULL, 10);
             }
         }
     }
@@ -80,6 +870,25 @@ int TestAppMain(int argc, char** argv)
         return 31;
     }
 
+    if (stormNames) {
+        qcc::String list(stormPrefixes);
+        size_t pos = 0;
+        while (pos <= list.size()) {
+            size_t comma = list.find_first_of(',', pos);
+            if (comma == qcc::String::npos) {
+                comma = list.size();
+            }
+            if (comma > pos) {
+                g_storm.prefixes.push_back(list.substr(pos, comma - pos));
+            }
+            pos = comma + 1;
+        }
+        if (g_storm.prefixes.empty() || g_storm.prefixes.size() > STORM_MAX_PREFIXES) {
+            cout << "option -prefixes takes 1 to " << STORM_MAX_PREFIXES << " names or prefixes" << endl;
+            return 30;
+        }
+    }
+
     //Set the soskcte to reusable.
     status = qcc::SetReuseAddress(sock, true);
     if (status != ER_OK) {
@@ -132,87 +941,132 @@ int TestAppMain(int argc, char** argv)
         return 39;
     }
 
+    //Build the good packets and map their fields for the fuzzer
+    uint8_t is_at[1500];
+    size_t is_at_len = MdnsBuildIsAt(advertise_name_is_at, is_at, sizeof(is_at));
+    MdnsFieldMap is_at_map;
+    uint8_t who_has[1500];
+    size_t who_has_len = MdnsBuildWhoHas(find_name_who_has, who_has, sizeof(who_has));
+    MdnsFieldMap who_has_map;
+    if (!MdnsParse(is_at, is_at_len, is_at_map) || !MdnsParse(who_has, who_has_len, who_has_map)) {
+        cout << "The good packets do not parse. Exiting.." << endl;
+        return 41;
+    }
+
     //Send the good packet as is
     uint8_t temp_buffer[MAXBUFSIZE];
-    memcpy(temp_buffer, advertise_name_is_at, sizeof(advertise_name_is_at));
-    size_t send_size = sizeof(advertise_name_is_at);
-    status = qcc::SendTo(sock, destinationMulticast, 5353, temp_buffer, send_size, sent);
+    status = qcc::SendTo(sock, destinationMulticast, 5353, is_at, is_at_len, sent);
     qcc::Sleep(5000);
     if (!g_foundName) {
         cout << "The good packet didnt result in FoundAdvertisedName. Exiting.. " << endl;
         return 40;
     }
 
-    //Fuzz the packet
-    for (uint32_t i = 0; i < iterationCount; i++) {
-        uint32_t lower_boundary = 0;
-        uint32_t upper_boundary = 0;
-        uint32_t probablity = 0;
-
-        memcpy(temp_buffer, advertise_name_is_at, sizeof(advertise_name_is_at));
-        size_t send_size = sizeof(advertise_name_is_at);
+    if (floodCount) {
+        g_flood.lock.Lock(MUTEX_CONTEXT);
+        g_flood.sentAt.assign(floodCount * rates.size(), 0);
+        g_flood.foundAt.assign(floodCount * rates.size(), 0);
+        g_flood.lock.Unlock(MUTEX_CONTEXT);
+        std::vector<FloodStep*> steps;
+        for (size_t r = 0; r < rates.size(); ++r) {
+            FloodStep* step = new FloodStep(rates[r]);
+            cout << "Flooding " << floodCount << " IS-AT at " << rates[r] << "/s" << endl;
+            RunFloodStep(sock, destinationMulticast, r * floodCount, floodCount, waitMs, *step);
+            steps.push_back(step);
+        }
+        PrintFlood(steps);
+        for (size_t r = 0; r < steps.size(); ++r) {
+            delete steps[r];
+        }
+        qcc::Close(sock);
+        return 0;
+    }
 
-        uint32_t t_rand = random() % 10;
-        if (t_rand == 0) {
-            lower_boundary = 0; upper_boundary = 60000; probablity = 1; send_size = 60000;
-        } else if (t_rand == 1) {
-            lower_boundary = 0; upper_boundary = 0; probablity = 10; send_size = 0;
-        } else if (t_rand == 2) {
-            lower_boundary = 0; upper_boundary = advertise_name_is_at_zone1; probablity = 2;
-        } else if ((t_rand >= 3) && (t_rand <= 4)) {
-            lower_boundary = advertise_name_is_at_zone1; upper_boundary = advertise_name_is_at_zone2; probablity = (random() % 135 + 1);
-        } else if ((t_rand >= 5) && (t_rand <= 9)) {
-            lower_boundary = advertise_name_is_at_zone2; upper_boundary = send_size; probablity = (random() % 100) + 1;
+    if (stormNames) {
+        //Our own multicast WHO-HAS come back on the group socket as well; StormResponse drops queries
+        qcc::SocketFd msock;
+        status = qcc::Socket(qcc::QCC_AF_INET, qcc::QCC_SOCK_DGRAM, msock);
+        if (status == ER_OK) {
+            qcc::SetReuseAddress(msock, true);
+            qcc::SetReusePort(msock, true);
+            status = qcc::Bind(msock, qcc::IPAddress("0.0.0.0"), 5353);
         }
+        if (status == ER_OK) {
+            status = qcc::JoinMulticastGroup(msock, qcc::QCC_AF_INET, "224.0.0.251", "lo");
+        }
+        if (status != ER_OK) {
+            QCC_LogError(status, ("Multicast socket for IS-AT responses failed"));
+            return 42;
+        }
+        qcc::SetBlocking(msock, false);
+        qcc::SetBlocking(sock, false);
 
-        //Fuzz byte according to probablity
-        for (size_t i = lower_boundary; i < upper_boundary; i++) {
-            if (0 == random() % probablity) {
-                temp_buffer[i] = random() % 255;
+        for (uint32_t n = 0; n < stormNames; ++n) {
+            qcc::String name = STORM_NAME_PREFIX + qcc::U32ToString(n);
+            status = ba.AdvertiseName(name.c_str(), TRANSPORT_ANY);
+            if (status != ER_OK) {
+                cout << "BS AN " << name << " failed. Exiting.." << endl;
+                return 39;
             }
         }
+        qcc::Sleep(3000);
+
+        ResponseCatcher* catcher = new ResponseCatcher(sock, msock);
+        catcher->Start();
 
-        status = qcc::SendTo(sock, destinationMulticast, 5353, temp_buffer, send_size, sent);
+        //What the router multicasts with nobody asking, to tell it apart from the answers
+        g_storm.lock.Lock(MUTEX_CONTEXT);
+        g_storm.Reset();
+        g_storm.lock.Unlock(MUTEX_CONTEXT);
+        qcc::Sleep(2000);
+        g_storm.lock.Lock(MUTEX_CONTEXT);
+        double background = g_storm.responses / 2.0;
+        g_storm.lock.Unlock(MUTEX_CONTEXT);
+
+        std::vector<StormStep*> steps;
+        for (size_t r = 0; r < rates.size(); ++r) {
+            StormStep* step = new StormStep(rates[r]);
+            cout << "Storming " << stormQueries << " WHO-HAS at " << rates[r] << "/s over " << stormNames << " advertised names" << endl;
+            RunStormStep(sock, destinationMulticast, stormQueries, waitMs, *step);
+            steps.push_back(step);
+        }
+        catcher->Stop();
+        catcher->Join();
+        delete catcher;
+
+        PrintStorm(steps, background);
+        for (size_t r = 0; r < steps.size(); ++r) {
+            delete steps[r];
+        }
+        qcc::Close(msock);
+        qcc::Close(sock);
+        return 0;
+    }
+
+    //Fuzz the packet
+    XorShiftRng rng(seed);
+    if (numThreads) {
+        RunFuzzThreads("IS-AT", is_at, is_at_len, is_at_map, iterationCount, numThreads, batch, seed);
+    } else {
+        for (uint64_t i = 0; i < iterationCount; i++) {
+            size_t send_size = FuzzPacket(rng, is_at, is_at_len, is_at_map, temp_buffer);
+            status = qcc::SendTo(sock, destinationMulticast, 5353, temp_buffer, send_size, sent);
+        }
     }
     cout << "PASSED1" << endl;
 
     //Send the good packet as is
-    memset(temp_buffer, '\0', MAXBUFSIZE);
-    memcpy(temp_buffer, find_name_who_has, sizeof(find_name_who_has));
-    send_size = sizeof(find_name_who_has);
-    status = qcc::SendTo(sock, destinationMulticast, 5353, temp_buffer, send_size, sent);
+    status = qcc::SendTo(sock, destinationMulticast, 5353, who_has, who_has_len, sent);
     qcc::Sleep(50);
 
     //Fuzz the packet
-    for (uint32_t i = 0; i < iterationCount; i++) {
-        uint32_t lower_boundary = 0;
-        uint32_t upper_boundary = 0;
-        uint32_t probablity = 0;
-
-        memcpy(temp_buffer, find_name_who_has, sizeof(find_name_who_has));
-        size_t send_size = sizeof(find_name_who_has);
-
-        uint32_t t_rand = random() % 10;
-        if (t_rand == 0) {
-            lower_boundary = 0; upper_boundary = 60000; probablity = 1; send_size = 60000;
-        } else if (t_rand == 1) {
-            lower_boundary = 0; upper_boundary = 0; probablity = 10; send_size = 0;
-        } else if (t_rand == 2) {
-            lower_boundary = 0; upper_boundary = find_name_who_has_zone1; probablity = 2;
-        } else if ((t_rand >= 3) && (t_rand <= 4)) {
-            lower_boundary = find_name_who_has_zone1; upper_boundary = find_name_who_has_zone2; probablity = (random() % 45) + 1;
-        } else if ((t_rand >= 5) && (t_rand <= 9)) {
-            lower_boundary = find_name_who_has_zone2; upper_boundary = send_size; probablity = (random() % 180) + 1;
+    if (numThreads) {
+        RunFuzzThreads("WHO-HAS", who_has, who_has_len, who_has_map, iterationCount, numThreads, batch, seed + numThreads);
+    } else {
+        for (uint64_t i = 0; i < iterationCount; i++) {
+            size_t send_size = FuzzPacket(rng, who_has, who_has_len, who_has_map, temp_buffer);
+            status = qcc::SendTo(sock, destinationMulticast, 5353, temp_buffer, send_size, sent);
         }
-
-        //Fuzz byte according to probablity
-        for (size_t i = lower_boundary; i < upper_boundary; i++) {
-            if (0 == random() % probablity) {
-                temp_buffer[i] = random() % 255;
-            }
-        }
-
-        status = qcc::SendTo(sock, destinationMulticast, 5353, temp_buffer, send_size, sent);
     }
 
     cout << "PASSED2" << endl;
@@ -1,7 +1,8 @@
 /**
  * @file
- * The FuzzedDaemon program listens on a port 9955 for thin client.
- * Once a thin client is connected, it sends out Fuzzed alljoyn messages
+ * The FuzzedDaemon program listens on a port 9955 for thin clients.
+ * Every thin client that connects gets its own stream of fuzzed alljoyn messages,
+ * built by its own RemoteEndpoint, for as long as it stays connected.
  * The thin client is supposed to handle all invalid messages gracefully without crashing
  */
 /******************************************************************************
@@ -21,14 +22,26 @@
  ******************************************************************************/
 
 #include <qcc/Pipe.h>
-#include <qcc/SocketStream.h>
+#include <qcc/Socket.h>
 #include <qcc/ManagedObj.h>
+#include <qcc/StringUtil.h>
+#include <qcc/Thread.h>
+#include <qcc/time.h>
 
 #include <alljoyn/BusAttachment.h>
 #include <alljoyn/Init.h>
 #include <alljoyn/Message.h>
 #include <RemoteEndpoint.h>
 
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
+
 #define QCC_MODULE "FUZZED ROUTING NODE"
 
 using namespace std;
@@ -37,6 +50,11 @@ using namespace ajn;
 const bool falsiness = false;
 static BusAttachment*g_msgBus = NULL;
 
+static uint16_t g_port = 9955;
+static uint32_t g_maxClients = 64;
+static uint32_t g_maxRate = 0;          /* Messages/s over all clients, 0 for no cap */
+static uint32_t g_statsInterval = 5000; /* ms between per client counters, 0 for none */
+
 class TestPipe : public qcc::Pipe {
   public:
     TestPipe() : qcc::Pipe() { }
@@ -209,35 +227,394 @@ static void Fuzz(TestPipe& stream)
     }
 }
 
-int TestAppMain() {
-    QStatus status = ER_FAIL;
-    qcc::SocketFd listenfd;
+/*
+ * One connected thin client: its own pipe and RemoteEndpoint turn messages
+ * into bytes, which are fuzzed and then written to the client's socket.
+ */
+class FuzzClient {
+  public:
+    FuzzClient(qcc::SocketFd fd, const qcc::IPAddress& addr, uint16_t port, uint32_t id) :
+        fd(fd), addr(addr), port(port), id(id), rep(*g_msgBus, falsiness, qcc::String::Empty, &stream),
+        pendingOffset(0), messages(0), bytesSent(0), bytesReceived(0), intervalMessages(0),
+        connectedAt(qcc::GetTimestamp64()), watchingOut(true) { }
+
+    /* Build and fuzz the next message into pending */
+    void NextMessage()
+    {
+        MyMessage msg;
+        MsgArg arg("s", "Hello");
+        msg->Signal("desti.nations", "/foo/bar", "foo.bar", "test", &arg, 1);
+        msg->Deliver(rep);
+
+        //The remote endpoint is associated with a stream. The stream contains the data. Fuzz that data.
+        Fuzz(stream);
+
+        size_t size = stream.AvailBytes();
+        size_t actualBytes = 0;
+        pending.resize(size);
+        if (size) {
+            stream.PullBytes(&pending[0], size, actualBytes);
+        }
+        pending.resize(actualBytes);
+        pendingOffset = 0;
+        messages++;
+        intervalMessages++;
+    }
+
+    bool HasPending() const { return pendingOffset < pending.size(); }
+
+    /* Write as much of pending as the socket takes; ER_WOULDBLOCK if it took less than all */
+    QStatus SendPending()
+    {
+        while (HasPending()) {
+            size_t sent = 0;
+            QStatus status = qcc::Send(fd, &pending[pendingOffset], pending.size() - pendingOffset, sent);
+            if (status != ER_OK) {
+                return status;
+            }
+            pendingOffset += sent;
+            bytesSent += sent;
+        }
+        return ER_OK;
+    }
+
+    /* Read and drop whatever the client sends; false once it has closed */
+    bool Drain()
+    {
+        uint8_t buf[4096];
+        for (;;) {
+            size_t received = 0;
+            QStatus status = qcc::Recv(fd, buf, sizeof(buf), received);
+            if (status == ER_WOULDBLOCK) {
+                return true;
+            }
+            if (status != ER_OK || received == 0) {
+                return false;
+            }
+            bytesReceived += received;
+        }
+    }
+
+    void Print(const char* what, uint64_t now) const
+    {
+        double seconds = (now - connectedAt) / 1000.0;
+        printf("%s client %u %s:%u: %llu messages (%.1f/s), %llu bytes sent, %llu received\n", what, id,
+               addr.ToString().c_str(), port, (unsigned long long)messages, seconds > 0.0 ? messages / seconds : 0.0,
+               (unsigned long long)bytesSent, (unsigned long long)bytesReceived);
+    }
+
+    qcc::SocketFd fd;
+    qcc::IPAddress addr;
+    uint16_t port;
+    uint32_t id;
+    TestPipe stream;
+    RemoteEndpoint rep;
+    std::vector<uint8_t> pending;
+    size_t pendingOffset;
+    uint64_t messages;
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+    uint64_t intervalMessages;
+    uint64_t connectedAt;
+    bool watchingOut;           /* EPOLLOUT is in the client's epoll events */
+};
+
+/* Token bucket for the -rate cap, shared by all clients */
+class RateCap {
+  public:
+    RateCap(uint32_t perSecond) : m_perSecond(perSecond), m_tokens(0.0), m_last(qcc::GetTimestamp64()) { }
+
+    /* Take one message's worth; always true without a cap */
+    bool Take()
+    {
+        if (!m_perSecond) {
+            return true;
+        }
+        Refill();
+        if (m_tokens < 1.0) {
+            return false;
+        }
+        m_tokens -= 1.0;
+        return true;
+    }
+
+    /* Whether a message may go now */
+    bool Ready()
+    {
+        if (!m_perSecond) {
+            return true;
+        }
+        Refill();
+        return m_tokens >= 1.0;
+    }
+
+    /* ms until the next message may go, at least 1 */
+    uint32_t WaitMs()
+    {
+        Refill();
+        double ms = (1.0 - m_tokens) * 1000.0 / m_perSecond;
+        return (ms < 1.0) ? 1 : (uint32_t)ms;
+    }
+
+  private:
+    void Refill()
+    {
+        uint64_t now = qcc::GetTimestamp64();
+        m_tokens += (double)(now - m_last) * m_perSecond / 1000.0;
+        m_last = now;
+        /* Allow a burst of at most a tenth of a second */
+        double burst = (m_perSecond < 10) ? 1.0 : m_perSecond / 10.0;
+        if (m_tokens > burst) {
+            m_tokens = burst;
+        }
+    }
+
+    uint32_t m_perSecond;
+    double m_tokens;
+    uint64_t m_last;
+};
+
+static void PrintStats(const std::map<qcc::SocketFd, FuzzClient*>& clients, uint64_t intervalMs)
+{
+    uint64_t now = qcc::GetTimestamp64();
+    uint64_t total = 0;
+    for (std::map<qcc::SocketFd, FuzzClient*>::const_iterator it = clients.begin(); it != clients.end(); ++it) {
+        FuzzClient* client = it->second;
+        client->Print("   ", now);
+        total += client->intervalMessages;
+        client->intervalMessages = 0;
+    }
+    printf("%u clients, %.1f messages/s over the last %llu ms\n", (uint32_t)clients.size(),
+           intervalMs ? total * 1000.0 / intervalMs : 0.0, (unsigned long long)intervalMs);
+}
 
-    status = qcc::Socket(qcc::QCC_AF_INET, qcc::QCC_SOCK_STREAM, listenfd);
+static QStatus Listen(qcc::SocketFd& listenfd)
+{
+    QStatus status = qcc::Socket(qcc::QCC_AF_INET, qcc::QCC_SOCK_STREAM, listenfd);
     if (ER_OK != status) {
         QCC_LogError(status, ("Unable to create socket"));
-        return 1;
+        return status;
     }
 
+    qcc::SetReuseAddress(listenfd, true);
     qcc::IPAddress all_interfaces_on_this_host("0.0.0.0");
-    status = qcc::Bind(listenfd, all_interfaces_on_this_host, 9955);
+    status = qcc::Bind(listenfd, all_interfaces_on_this_host, g_port);
     if (ER_OK != status) {
-        QCC_LogError(status, ("Unable to bind socket to port 9955"));
-        return 1;
+        QCC_LogError(status, ("Unable to bind socket to port %u", g_port));
+        return status;
     }
 
-    status = qcc::Listen(listenfd, 1);
+    status = qcc::Listen(listenfd, g_maxClients);
     if (ER_OK != status) {
-        QCC_LogError(status, ("Unable to listen on socket bound to port 9955"));
-        return 1;
+        QCC_LogError(status, ("Unable to listen on socket bound to port %u", g_port));
+    }
+    return status;
+}
+
+#if defined(__linux__)
+/* Watch the client for EPOLLOUT too, or for EPOLLIN only */
+static void WatchOut(int epfd, FuzzClient* client, bool out)
+{
+    if (client->watchingOut != out) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = out ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+        ev.data.ptr = client;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, client->fd, &ev);
+        client->watchingOut = out;
     }
+}
 
-    qcc::SocketFd connfd;
-    status = qcc::Accept(listenfd, connfd);
-    if (ER_OK != status) {
-        QCC_LogError(status, ("Unable to accept incoming connection"));
+/*
+ * All clients are served from one thread: the listening socket and every
+ * client socket are non-blocking and in one epoll set.  A writable client
+ * gets its next message once the last one is written completely, as long
+ * as the rate cap allows; whatever it sends is read and dropped.
+ *
+ * While the cap is used up, clients with nothing left to write are taken
+ * off EPOLLOUT, or their level-triggered writability would spin the loop;
+ * they get it back once there are tokens again.
+ */
+static int ServeClients(qcc::SocketFd listenfd)
+{
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        QCC_LogError(ER_OS_ERROR, ("epoll_create1 failed"));
         return 1;
     }
+    qcc::SetBlocking(listenfd, false);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    bool listening = false;
+    uint64_t acceptAfter = 0;   /* No accepting before this, after an Accept error */
+
+    std::map<qcc::SocketFd, FuzzClient*> clients;
+    std::vector<struct epoll_event> events(g_maxClients + 1);
+    RateCap cap(g_maxRate);
+    bool capped = false;
+    uint32_t nextId = 0;
+    uint64_t lastStats = qcc::GetTimestamp64();
+
+    for (;;) {
+        uint64_t now = qcc::GetTimestamp64();
+        if (!listening && clients.size() < g_maxClients && now >= acceptAfter) {
+            ev.events = EPOLLIN;
+            ev.data.ptr = NULL;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+            listening = true;
+        }
+
+        bool exhausted = !cap.Ready();
+        if (exhausted != capped) {
+            capped = exhausted;
+            for (std::map<qcc::SocketFd, FuzzClient*>::iterator it = clients.begin(); it != clients.end(); ++it) {
+                WatchOut(epfd, it->second, !capped || it->second->HasPending());
+            }
+        }
+
+        int n = epoll_wait(epfd, &events[0], (int)events.size(), capped ? (int)cap.WaitMs() : 100);
+        for (int i = 0; i < n; ++i) {
+            FuzzClient* client = (FuzzClient*)events[i].data.ptr;
+            if (!client) {
+                for (;;) {
+                    if (clients.size() >= g_maxClients) {
+                        /* Leave the rest in the backlog until a client goes away */
+                        epoll_ctl(epfd, EPOLL_CTL_DEL, listenfd, NULL);
+                        listening = false;
+                        break;
+                    }
+                    qcc::SocketFd connfd;
+                    qcc::IPAddress addr;
+                    uint16_t port = 0;
+                    QStatus status = qcc::Accept(listenfd, addr, port, connfd);
+                    if (status == ER_WOULDBLOCK) {
+                        break;
+                    }
+                    if (status != ER_OK) {
+                        /* Out of descriptors, say; the listening socket stays readable, so back off */
+                        QCC_LogError(status, ("Unable to accept incoming connection"));
+                        epoll_ctl(epfd, EPOLL_CTL_DEL, listenfd, NULL);
+                        listening = false;
+                        acceptAfter = qcc::GetTimestamp64() + 100;
+                        break;
+                    }
+                    qcc::SetBlocking(connfd, false);
+                    client = new FuzzClient(connfd, addr, port, nextId++);
+                    client->watchingOut = !capped;
+                    clients[connfd] = client;
+                    ev.events = capped ? EPOLLIN : (EPOLLIN | EPOLLOUT);
+                    ev.data.ptr = client;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &ev);
+                    client->Print("Connected", qcc::GetTimestamp64());
+                }
+                continue;
+            }
+
+            bool alive = !(events[i].events & (EPOLLERR | EPOLLHUP));
+            if (alive && (events[i].events & EPOLLIN)) {
+                alive = client->Drain();
+            }
+            if (alive && (events[i].events & EPOLLOUT)) {
+                if (!client->HasPending() && cap.Take()) {
+                    client->NextMessage();
+                }
+                QStatus status = client->SendPending();
+                alive = (status == ER_OK || status == ER_WOULDBLOCK);
+                if (alive && capped && !client->HasPending()) {
+                    WatchOut(epfd, client, false);
+                }
+            }
+            if (!alive) {
+                client->Print("Disconnected", qcc::GetTimestamp64());
+                epoll_ctl(epfd, EPOLL_CTL_DEL, client->fd, NULL);
+                qcc::Close(client->fd);
+                clients.erase(client->fd);
+                delete client;
+            }
+        }
+
+        now = qcc::GetTimestamp64();
+        if (g_statsInterval && now - lastStats >= g_statsInterval) {
+            PrintStats(clients, now - lastStats);
+            lastStats = now;
+        }
+    }
+}
+#else
+/* Without epoll the clients are served one after the other */
+static int ServeClients(qcc::SocketFd listenfd)
+{
+    RateCap cap(g_maxRate);
+    uint32_t nextId = 0;
+    for (;;) {
+        qcc::SocketFd connfd;
+        qcc::IPAddress addr;
+        uint16_t port = 0;
+        QStatus status = qcc::Accept(listenfd, addr, port, connfd);
+        if (ER_OK != status) {
+            QCC_LogError(status, ("Unable to accept incoming connection"));
+            return 1;
+        }
+        qcc::SetBlocking(connfd, true);
+        FuzzClient* client = new FuzzClient(connfd, addr, port, nextId++);
+        client->Print("Connected", qcc::GetTimestamp64());
+        do {
+            while (!cap.Take()) {
+                qcc::Sleep(cap.WaitMs());
+            }
+            client->NextMessage();
+            status = client->SendPending();
+        } while (status == ER_OK);
+        client->Print("Disconnected", qcc::GetTimestamp64());
+        qcc::Close(connfd);
+        delete client;
+    }
+}
+#endif
+
+static void usage(void)
+{
+    printf("Usage: FuzzedDaemon [-p <port>] [-max <clients>] [-rate <msgs/s>] [-stats <ms>]\n\n");
+    printf("Options:\n");
+    printf("   -h              = Print this help message\n");
+    printf("   -p <port>       = Port to listen on for thin clients (default 9955)\n");
+    printf("   -max <clients>  = Thin clients served at the same time (default 64)\n");
+    printf("   -rate <msgs/s>  = Cap on the messages/s sent to all clients together (default no cap)\n");
+    printf("   -stats <ms>     = Interval of the per client counters, 0 for none (default 5000)\n");
+}
+
+int TestAppMain(int argc, char** argv) {
+    QStatus status = ER_FAIL;
+    qcc::SocketFd listenfd;
+
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp("-h", argv[i]) || 0 == strcmp("-?", argv[i])) {
+            usage();
+            return 0;
+        } else if (0 == strcmp("-p", argv[i]) || 0 == strcmp("-max", argv[i]) ||
+                   0 == strcmp("-rate", argv[i]) || 0 == strcmp("-stats", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                return 1;
+            }
+            uint32_t value = qcc::StringToU32(argv[i], 0);
+            if (0 == strcmp("-p", argv[i - 1])) {
+                g_port = (uint16_t)value;
+            } else if (0 == strcmp("-max", argv[i - 1])) {
+                g_maxClients = value ? value : 1;
+            } else if (0 == strcmp("-rate", argv[i - 1])) {
+                g_maxRate = value;
+            } else {
+                g_statsInterval = value;
+            }
+        } else {
+            printf("Unknown option %s\n", argv[i]);
+            usage();
+            return 1;
+        }
+    }
 
     g_msgBus = new BusAttachment("FuzzedDaemon");
     status = g_msgBus->Start();
@@ -251,47 +628,14 @@ int TestAppMain() {
         return 1;
     }
 
-    //create a sock stream out of connfd
-    qcc::SocketStream* socketStream = new qcc::SocketStream(connfd);
-
-    //Create a RemoteEndpoint using a pipe
-    TestPipe stream;
-    TestPipe* pStream = &stream;
-    RemoteEndpoint rep(*g_msgBus, falsiness, qcc::String::Empty, pStream);
-    uint8_t* buf = NULL;
-    size_t actualBytes = 0;
-
-    for (;;) {
-        //Construct alljoyn message and send to thin client.
-        MyMessage msg;
-        MsgArg arg("s", "Hello");
-        //status = msg->MethodCall("desti.nations", "/foo/bar", "foo.bar", "test", &arg, 1);
-        status = msg->Signal("desti.nations", "/foo/bar", "foo.bar", "test", &arg, 1);
-        status = msg->Deliver(rep);
-
-        //The remote endpoint is associated with a stream. The stream contains the data. Fuzz that data.
-        Fuzz(stream);
-
-        // The stream should now be pushed to the socket stream so that it goes to the other side.
-        // So, pullbytes from pipe and push it into socket stream.
-        size_t size = pStream->AvailBytes();
-        buf = new uint8_t[size];
-        status = pStream->PullBytes(buf, size, actualBytes);
-
-        //push buf into socketstream
-        actualBytes = 0;
-        status = socketStream->PushBytes(buf, size, actualBytes);
-        if (status != ER_OK) {
-            delete socketStream;
-            status = qcc::Accept(listenfd, connfd);
-            socketStream = new qcc::SocketStream(connfd);
-        }
-
-        delete [] buf;
+    status = Listen(listenfd);
+    if (ER_OK != status) {
+        return 1;
     }
+    return ServeClients(listenfd);
 }
 
-int CDECL_CALL main()
+int CDECL_CALL main(int argc, char** argv)
 {
     QStatus status = AllJoynInit();
     if (ER_OK != status) {
@@ -305,7 +649,7 @@ int CDECL_CALL main()
     }
 #endif
 
-    int ret = TestAppMain();
+    int ret = TestAppMain(argc, argv);
 
 #ifdef ROUTER
     AllJoynRouterShutdown();
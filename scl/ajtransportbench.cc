@@ -0,0 +1,737 @@
+/**
+ * @file
+ * Runs the same workload over TCP, UDP and LOCAL sessions and prints one
+ * comparable table.
+ *
+ * The service side (-s) advertises over TCP and UDP and counts what it
+ * receives.  The client joins it once per transport and sends a fixed,
+ * seeded mix of signals and method calls with a fixed mix of payload
+ * sizes, so every transport carries exactly the same messages.  A LOCAL
+ * session cannot reach another process's bundled router, so for LOCAL the
+ * client hosts the same service object on a second bus attachment of its
+ * own and joins that.
+ */
+
+/******************************************************************************
+ * Copyright AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+#include <qcc/platform.h>
+#include <qcc/Debug.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <vector>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include <qcc/Event.h>
+#include <qcc/Mutex.h>
+#include <qcc/String.h>
+#include <qcc/StringUtil.h>
+#include <qcc/Thread.h>
+#include <qcc/Util.h>
+#include <qcc/time.h>
+
+#include <alljoyn/BusAttachment.h>
+#include <alljoyn/BusObject.h>
+#include <alljoyn/DBusStd.h>
+#include <alljoyn/AllJoynStd.h>
+#include <alljoyn/Init.h>
+#include <alljoyn/version.h>
+
+#include <alljoyn/Status.h>
+
+#include "../misc/LatencyHistogram.h"
+#include "../misc/XorShiftRng.h"
+
+#define QCC_MODULE "ALLJOYN"
+
+using namespace std;
+using namespace qcc;
+using namespace ajn;
+
+namespace org {
+namespace alljoyn {
+namespace transport_bench {
+const char* WellKnownName = "org.alljoyn.transport_bench";
+const char* InterfaceName = "org.alljoyn.transport_bench.Interface";
+const char* ObjectPath = "/org/alljoyn/transport_bench";
+const SessionPort Port = 570;
+}
+}
+}
+
+/* Payload sizes of the workload and how often each is picked, in percent */
+struct SizeMix {
+    uint32_t length;
+    uint32_t percent;
+};
+static const SizeMix g_sizeMix[] = {
+    { 64, 50 },
+    { 1024, 30 },
+    { 16384, 15 },
+    { 65536, 5 }
+};
+
+static BusAttachment* g_msgBus = NULL;
+static String g_wellKnownName = ::org::alljoyn::transport_bench::WellKnownName;
+static volatile sig_atomic_t g_interrupt = false;
+
+static uint32_t g_messages = 10000;
+static uint32_t g_callPercent = 50;
+static uint32_t g_seed = 1;
+static uint32_t g_drainTimeout = 10000;
+static uint32_t g_callTimeout = 30000;
+
+static Mutex g_foundLock;
+static TransportMask g_foundTransports = 0;
+static Event g_foundEvent;
+
+static void CDECL_CALL SigIntHandler(int sig)
+{
+    QCC_UNUSED(sig);
+    g_interrupt = true;
+}
+
+static double CpuSeconds()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#else
+    return 0.0;
+#endif
+}
+
+static const char* TransportName(TransportMask transport)
+{
+    switch (transport) {
+    case TRANSPORT_TCP:
+        return "TCP";
+
+    case TRANSPORT_UDP:
+        return "UDP";
+
+    case TRANSPORT_LOCAL:
+        return "LOCAL";
+
+    default:
+        return "?";
+    }
+}
+
+static QStatus CreateInterface(BusAttachment& bus, const InterfaceDescription*& intf)
+{
+    InterfaceDescription* newIntf = NULL;
+    QStatus status = bus.CreateInterface(::org::alljoyn::transport_bench::InterfaceName, newIntf);
+    if (status != ER_OK) {
+        return status;
+    }
+    /* Data and Call carry the send time in microseconds, a sequence number and the payload */
+    newIntf->AddSignal("Data", "tuay", "sent,seq,payload", 0);
+    newIntf->AddMethod("Call", "tuay", "t", "sent,seq,payload,sent", 0);
+    newIntf->AddMethod("Start", NULL, NULL, NULL, 0);
+    newIntf->AddMethod("Report", NULL, "ttttt", "signals,bytes,p50,p99,cpuUs", 0);
+    newIntf->Activate();
+    intf = newIntf;
+    return ER_OK;
+}
+
+/*
+ * The receiving end.  Counts the Data signals and their one-way latency,
+ * answers Call at once, and hands the counters and its own CPU time since
+ * Start back from Report.  The signal latency compares timestamps of two
+ * processes and is only meaningful when both run on the same host.
+ */
+class BenchServiceObject : public BusObject {
+
+  public:
+    BenchServiceObject(BusAttachment& bus, const InterfaceDescription& intf) :
+        BusObject(::org::alljoyn::transport_bench::ObjectPath),
+        m_signals(0), m_bytes(0), m_cpuStart(CpuSeconds()), m_signalLatency("signal_one_way")
+    {
+        AddInterface(intf);
+        const MethodEntry methodEntries[] = {
+            { intf.GetMember("Call"), static_cast<MessageReceiver::MethodHandler>(&BenchServiceObject::Call) },
+            { intf.GetMember("Start"), static_cast<MessageReceiver::MethodHandler>(&BenchServiceObject::Start) },
+            { intf.GetMember("Report"), static_cast<MessageReceiver::MethodHandler>(&BenchServiceObject::Report) }
+        };
+        QStatus status = AddMethodHandlers(methodEntries, ArraySize(methodEntries));
+        if (status != ER_OK) {
+            QCC_LogError(status, ("Failed to register method handlers for BenchServiceObject."));
+        }
+        status = bus.RegisterSignalHandler(this, static_cast<MessageReceiver::SignalHandler>(&BenchServiceObject::Data),
+                                           intf.GetMember("Data"), NULL);
+        if (status != ER_OK) {
+            QCC_LogError(status, ("Failed to register signal handler for Data."));
+        }
+    }
+
+    void Data(const InterfaceDescription::Member* member, const char* sourcePath, Message& msg)
+    {
+        QCC_UNUSED(member);
+        QCC_UNUSED(sourcePath);
+        uint64_t now = GetTimestampMicros();
+        uint64_t sent = msg->GetArg(0)->v_uint64;
+        m_lock.Lock(MUTEX_CONTEXT);
+        m_signals++;
+        m_bytes += msg->GetArg(2)->v_scalarArray.numElements;
+        m_signalLatency.Record(now > sent ? now - sent : 0);
+        m_lock.Unlock(MUTEX_CONTEXT);
+    }
+
+    void Call(const InterfaceDescription::Member* member, Message& msg)
+    {
+        QCC_UNUSED(member);
+        MsgArg reply("t", msg->GetArg(0)->v_uint64);
+        QStatus status = MethodReply(msg, &reply, 1);
+        if (status != ER_OK) {
+            QCC_LogError(status, ("Call: Error sending reply."));
+        }
+    }
+
+    void Start(const InterfaceDescription::Member* member, Message& msg)
+    {
+        QCC_UNUSED(member);
+        m_lock.Lock(MUTEX_CONTEXT);
+        m_signals = 0;
+        m_bytes = 0;
+        m_signalLatency.Reset();
+        m_cpuStart = CpuSeconds();
+        m_lock.Unlock(MUTEX_CONTEXT);
+        MethodReply(msg);
+    }
+
+    void Report(const InterfaceDescription::Member* member, Message& msg)
+    {
+        QCC_UNUSED(member);
+        MsgArg args[5];
+        m_lock.Lock(MUTEX_CONTEXT);
+        args[0].Set("t", m_signals);
+        args[1].Set("t", m_bytes);
+        args[2].Set("t", m_signalLatency.GetPercentile(50.0));
+        args[3].Set("t", m_signalLatency.GetPercentile(99.0));
+        args[4].Set("t", (uint64_t)((CpuSeconds() - m_cpuStart) * 1e6));
+        m_lock.Unlock(MUTEX_CONTEXT);
+        QStatus status = MethodReply(msg, args, ArraySize(args));
+        if (status != ER_OK) {
+            QCC_LogError(status, ("Report: Error sending reply."));
+        }
+    }
+
+  private:
+    Mutex m_lock;
+    uint64_t m_signals;
+    uint64_t m_bytes;
+    double m_cpuStart;
+    LatencyHistogram m_signalLatency;
+};
+
+class BenchServiceListener : public SessionPortListener {
+
+  public:
+    bool AcceptSessionJoiner(SessionPort sessionPort, const char* joiner, const SessionOpts& opts)
+    {
+        QCC_UNUSED(sessionPort);
+        printf("Session joined by %s over %s\n", joiner, TransportName(opts.transports));
+        return true;
+    }
+};
+
+/* The client only needs a bus object to emit Data from */
+class BenchSenderObject : public BusObject {
+
+  public:
+    BenchSenderObject(const InterfaceDescription& intf) : BusObject("/org/alljoyn/transport_bench/sender")
+    {
+        AddInterface(intf);
+        m_data = intf.GetMember("Data");
+    }
+
+    QStatus SendData(const char* dest, SessionId sessionId, MsgArg* args, size_t numArgs)
+    {
+        return Signal(dest, sessionId, *m_data, args, numArgs);
+    }
+
+  private:
+    const InterfaceDescription::Member* m_data;
+};
+
+class BenchBusListener : public BusListener {
+
+  public:
+    void FoundAdvertisedName(const char* name, TransportMask transport, const char* namePrefix)
+    {
+        QCC_UNUSED(namePrefix);
+        if (0 == strcmp(name, g_wellKnownName.c_str())) {
+            g_foundLock.Lock(MUTEX_CONTEXT);
+            g_foundTransports |= transport;
+            g_foundLock.Unlock(MUTEX_CONTEXT);
+            g_foundEvent.SetEvent();
+        }
+    }
+};
+
+static BenchBusListener g_busListener;
+
+struct BenchResult {
+    TransportMask transport;
+    QStatus status;
+    uint32_t sent;
+    uint32_t signalsSent;
+    uint64_t signalsReceived;
+    uint64_t bytes;
+    double seconds;
+    double clientCpuSeconds;
+    uint64_t serviceCpuUs;
+    bool serviceInProcess;
+    uint64_t signalP50;
+    uint64_t signalP99;
+    LatencyHistogram callLatency;
+
+    BenchResult(TransportMask transport) :
+        transport(transport), status(ER_OK), sent(0), signalsSent(0), signalsReceived(0), bytes(0), seconds(0.0),
+        clientCpuSeconds(0.0), serviceCpuUs(0), serviceInProcess(false), signalP50(0), signalP99(0),
+        callLatency("call_rtt") { }
+};
+
+static QStatus GetReport(ProxyBusObject& remoteObj, BenchResult& result)
+{
+    Message reply(*g_msgBus);
+    QStatus status = remoteObj.MethodCall(::org::alljoyn::transport_bench::InterfaceName, "Report", NULL, 0, reply, g_callTimeout);
+    if (status == ER_OK) {
+        result.signalsReceived = reply->GetArg(0)->v_uint64;
+        result.signalP50 = reply->GetArg(2)->v_uint64;
+        result.signalP99 = reply->GetArg(3)->v_uint64;
+        result.serviceCpuUs = reply->GetArg(4)->v_uint64;
+    }
+    return status;
+}
+
+/* Run the workload once over a session to host and fill in result */
+static void RunWorkload(const char* host, BenchSenderObject& sender, const InterfaceDescription& intf, BenchResult& result)
+{
+    SessionOpts opts(SessionOpts::TRAFFIC_MESSAGES, false, SessionOpts::PROXIMITY_ANY, result.transport);
+    SessionId sessionId;
+    result.status = g_msgBus->JoinSession(host, ::org::alljoyn::transport_bench::Port, NULL, sessionId, opts);
+    if (result.status != ER_OK) {
+        QCC_LogError(result.status, ("JoinSession over %s failed", TransportName(result.transport)));
+        return;
+    }
+
+    ProxyBusObject remoteObj(*g_msgBus, host, ::org::alljoyn::transport_bench::ObjectPath, sessionId);
+    remoteObj.AddInterface(intf);
+    const InterfaceDescription::Member* call = intf.GetMember("Call");
+
+    Message reply(*g_msgBus);
+    result.status = remoteObj.MethodCall(::org::alljoyn::transport_bench::InterfaceName, "Start", NULL, 0, reply, g_callTimeout);
+    if (result.status != ER_OK) {
+        QCC_LogError(result.status, ("Start over %s failed", TransportName(result.transport)));
+        g_msgBus->LeaveSession(sessionId);
+        return;
+    }
+
+    uint32_t maxLength = 0;
+    for (size_t i = 0; i < ArraySize(g_sizeMix); ++i) {
+        maxLength = (g_sizeMix[i].length > maxLength) ? g_sizeMix[i].length : maxLength;
+    }
+    std::vector<uint8_t> payload(maxLength, 0xA5);
+
+    /* Same seed for every transport, so every transport sends the same sequence */
+    XorShiftRng rng(g_seed);
+    uint64_t start = GetTimestampMicros();
+    double cpuStart = CpuSeconds();
+    for (uint32_t i = 0; i < g_messages && !g_interrupt; ++i) {
+        uint32_t pick = rng.Below(100);
+        uint32_t length = g_sizeMix[0].length;
+        for (size_t s = 0, acc = 0; s < ArraySize(g_sizeMix); ++s) {
+            acc += g_sizeMix[s].percent;
+            if (pick < acc) {
+                length = g_sizeMix[s].length;
+                break;
+            }
+        }
+        bool isCall = rng.Below(100) < g_callPercent;
+
+        MsgArg args[3];
+        uint64_t sent = GetTimestampMicros();
+        args[0].Set("t", sent);
+        args[1].Set("u", i);
+        args[2].Set("ay", length, &payload[0]);
+        if (isCall) {
+            result.status = remoteObj.MethodCall(*call, args, ArraySize(args), reply, g_callTimeout);
+            if (result.status != ER_OK) {
+                QCC_LogError(result.status, ("Call %u over %s failed", i, TransportName(result.transport)));
+                break;
+            }
+            result.callLatency.Record(GetTimestampMicros() - sent);
+        } else {
+            result.status = sender.SendData(host, sessionId, args, ArraySize(args));
+            if (result.status != ER_OK) {
+                QCC_LogError(result.status, ("Signal %u over %s failed", i, TransportName(result.transport)));
+                break;
+            }
+            result.signalsSent++;
+        }
+        result.sent++;
+        result.bytes += length;
+    }
+
+    /* Signals are not acknowledged; the run ends when the service has them all */
+    uint64_t drainStart = GetTimestampMicros();
+    QStatus status = ER_OK;
+    do {
+        status = GetReport(remoteObj, result);
+        if (status != ER_OK || result.signalsReceived >= result.signalsSent) {
+            break;
+        }
+        qcc::Sleep(10);
+    } while (!g_interrupt && (GetTimestampMicros() - drainStart) < (uint64_t)g_drainTimeout * 1000);
+    result.seconds = (GetTimestampMicros() - start) / 1000000.0;
+    result.clientCpuSeconds = CpuSeconds() - cpuStart;
+    if (result.status == ER_OK) {
+        result.status = status;
+    }
+
+    g_msgBus->LeaveSession(sessionId);
+}
+
+static void PrintTable(const std::vector<BenchResult*>& results)
+{
+    printf("\n%-6s %8s %10s %8s %10s %10s %10s %10s %12s %12s %s\n",
+           "", "msgs", "msgs/s", "MB/s", "call p50", "call p99", "sig p50", "sig p99", "cpu us/msg", "svc us/msg", "signals lost");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = *results[i];
+        if (r.status != ER_OK && r.sent == 0) {
+            printf("%-6s not run: %s\n", TransportName(r.transport), QCC_StatusText(r.status));
+            continue;
+        }
+        double secs = r.seconds > 0.0 ? r.seconds : 1e-9;
+        char svc[32];
+        if (r.serviceInProcess) {
+            snprintf(svc, sizeof(svc), "in process");
+        } else {
+            snprintf(svc, sizeof(svc), "%.1f", r.sent ? (double)r.serviceCpuUs / r.sent : 0.0);
+        }
+        printf("%-6s %8u %10.1f %8.2f %10llu %10llu %10llu %10llu %12.1f %12s %llu%s\n",
+               TransportName(r.transport), r.sent, r.sent / secs, r.bytes / secs / 1e6,
+               (unsigned long long)r.callLatency.GetPercentile(50.0), (unsigned long long)r.callLatency.GetPercentile(99.0),
+               (unsigned long long)r.signalP50, (unsigned long long)r.signalP99,
+               r.sent ? r.clientCpuSeconds * 1e6 / r.sent : 0.0, svc,
+               (unsigned long long)(r.signalsSent > r.signalsReceived ? r.signalsSent - r.signalsReceived : 0),
+               r.status == ER_OK ? "" : " (aborted)");
+    }
+    printf("Latencies in us.  Calls are round trips; signals are one way and only meaningful on one host.\n");
+    printf("CPU is per message sent, for the client process and the service process (bundled router included).\n");
+}
+
+static void usage(void)
+{
+    printf("Usage: ajtransportbench -s [-n <well-known name>]\n");
+    printf("       ajtransportbench [-t] [-u] [-l] [-n <well-known name>] [-m #] [-calls #] [-seed #]\n\n");
+    printf("Options:\n");
+    printf("   -s            = Service side: advertise over TCP and UDP and count what arrives\n");
+    printf("   -t            = Run the workload over TCP\n");
+    printf("   -u            = Run the workload over UDP\n");
+    printf("   -l            = Run the workload over LOCAL (to a service object in this process)\n");
+    printf("                   Without -t, -u or -l all three are run\n");
+    printf("   -n <name>     = Well-known name of the service, default is %s\n", ::org::alljoyn::transport_bench::WellKnownName);
+    printf("   -m #          = Messages per transport, default is 10000\n");
+    printf("   -calls #      = Percentage of messages sent as method calls, the rest are signals; default is 50\n");
+    printf("   -seed #       = Seed of the message mix, default is 1\n");
+    printf("   -drain #      = ms to wait for the service to receive every signal, default is 10000\n");
+    printf("   Payload sizes: 64 (50%%), 1024 (30%%), 16384 (15%%), 65536 (5%%) bytes\n");
+}
+
+static QStatus StartBus(BusAttachment& bus)
+{
+    QStatus status = bus.Start();
+    if (status != ER_OK) {
+        QCC_LogError(status, ("BusAttachment::Start failed"));
+        return status;
+    }
+    status = bus.Connect();
+    if (status != ER_OK) {
+        QCC_LogError(status, ("BusAttachment::Connect failed"));
+    }
+    return status;
+}
+
+static void StopService(BusAttachment& bus, BenchServiceObject* object)
+{
+    if (object) {
+        bus.UnregisterAllHandlers(object);
+        bus.UnregisterBusObject(*object);
+        delete object;
+    }
+    bus.Stop();
+    bus.Join();
+}
+
+static QStatus HostService(BusAttachment& bus, BenchServiceObject*& object, BenchServiceListener& listener)
+{
+    const InterfaceDescription* intf = NULL;
+    QStatus status = CreateInterface(bus, intf);
+    if (status != ER_OK) {
+        QCC_LogError(status, ("Cannot create interface on bus attachment."));
+        return status;
+    }
+    object = new BenchServiceObject(bus, *intf);
+    status = bus.RegisterBusObject(*object);
+    if (status != ER_OK) {
+        QCC_LogError(status, ("RegisterBusObject failed"));
+        return status;
+    }
+    SessionOpts opts(SessionOpts::TRAFFIC_MESSAGES, false, SessionOpts::PROXIMITY_ANY, TRANSPORT_ANY | TRANSPORT_UDP);
+    SessionPort port = ::org::alljoyn::transport_bench::Port;
+    status = bus.BindSessionPort(port, opts, listener);
+    if (status != ER_OK) {
+        QCC_LogError(status, ("BindSessionPort failed"));
+    }
+    return status;
+}
+
+int TestAppMain(int argc, char** argv)
+{
+    QStatus status = ER_OK;
+    bool service = false;
+    TransportMask transports = 0;
+
+    printf("AllJoyn Library version: %s\n", ajn::GetVersion());
+    printf("AllJoyn Library build info: %s\n", ajn::GetBuildInfo());
+
+    signal(SIGINT, SigIntHandler);
+
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp("-h", argv[i]) || 0 == strcmp("-?", argv[i])) {
+            usage();
+            return 0;
+        } else if (0 == strcmp("-s", argv[i])) {
+            service = true;
+        } else if (0 == strcmp("-t", argv[i])) {
+            transports |= TRANSPORT_TCP;
+        } else if (0 == strcmp("-u", argv[i])) {
+            transports |= TRANSPORT_UDP;
+        } else if (0 == strcmp("-l", argv[i])) {
+            transports |= TRANSPORT_LOCAL;
+        } else if (0 == strcmp("-n", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                return 1;
+            } else {
+                g_wellKnownName = argv[i];
+            }
+        } else if (0 == strcmp("-m", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                return 1;
+            } else {
+                g_messages = StringToU32(argv[i], 0, 10000);
+            }
+        } else if (0 == strcmp("-calls", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                return 1;
+            } else {
+                g_callPercent = StringToU32(argv[i], 0, 50);
+                if (g_callPercent > 100) {
+                    g_callPercent = 100;
+                }
+            }
+        } else if (0 == strcmp("-seed", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                return 1;
+            } else {
+                g_seed = StringToU32(argv[i], 0, 1);
+            }
+        } else if (0 == strcmp("-drain", argv[i])) {
+            ++i;
+            if (i == argc) {
+                printf("option %s requires a parameter\n", argv[i - 1]);
+                usage();
+                return 1;
+            } else {
+                g_drainTimeout = StringToU32(argv[i], 0, 10000);
+            }
+        } else {
+            printf("Unknown option %s\n", argv[i]);
+            usage();
+            return 1;
+        }
+    }
+    if (service && transports) {
+        printf("Don't set a transport for the service; it advertises over TCP and UDP.\n");
+        usage();
+        return 1;
+    }
+    if (!transports) {
+        transports = TRANSPORT_TCP | TRANSPORT_UDP | TRANSPORT_LOCAL;
+    }
+
+    g_msgBus = new BusAttachment("ajtransportbench", true);
+    status = StartBus(*g_msgBus);
+    if (status != ER_OK) {
+        return 1;
+    }
+
+    if (service) {
+        BenchServiceObject* object = NULL;
+        BenchServiceListener listener;
+        status = HostService(*g_msgBus, object, listener);
+        if (status == ER_OK) {
+            status = g_msgBus->RequestName(g_wellKnownName.c_str(), DBUS_NAME_FLAG_REPLACE_EXISTING | DBUS_NAME_FLAG_DO_NOT_QUEUE);
+            if (status != ER_OK) {
+                QCC_LogError(status, ("RequestName(%s) failed", g_wellKnownName.c_str()));
+            }
+        }
+        if (status == ER_OK) {
+            status = g_msgBus->AdvertiseName(g_wellKnownName.c_str(), TRANSPORT_TCP | TRANSPORT_UDP);
+            if (status != ER_OK) {
+                QCC_LogError(status, ("AdvertiseName(%s) failed", g_wellKnownName.c_str()));
+            }
+        }
+        if (status == ER_OK) {
+            printf("Service %s ready, Ctrl-C to exit\n", g_wellKnownName.c_str());
+            while (!g_interrupt) {
+                qcc::Sleep(100);
+            }
+        }
+        StopService(*g_msgBus, object);
+        delete g_msgBus;
+        return (status == ER_OK) ? 0 : 1;
+    }
+
+    const InterfaceDescription* intf = NULL;
+    status = CreateInterface(*g_msgBus, intf);
+    if (status != ER_OK) {
+        QCC_LogError(status, ("Cannot create interface on bus attachment."));
+        return 1;
+    }
+    BenchSenderObject sender(*intf);
+    g_msgBus->RegisterBusObject(sender);
+    g_msgBus->RegisterBusListener(g_busListener);
+
+    /* The in-process service for LOCAL, on its own attachment to the same router */
+    BusAttachment* localBus = NULL;
+    BenchServiceObject* localObject = NULL;
+    BenchServiceListener localListener;
+    if (transports & TRANSPORT_LOCAL) {
+        localBus = new BusAttachment("ajtransportbench_local", true);
+        status = StartBus(*localBus);
+        if (status == ER_OK) {
+            status = HostService(*localBus, localObject, localListener);
+        }
+        if (status != ER_OK) {
+            return 1;
+        }
+    }
+
+    if (transports & (TRANSPORT_TCP | TRANSPORT_UDP)) {
+        status = g_msgBus->FindAdvertisedNameByTransport(g_wellKnownName.c_str(), transports & (TRANSPORT_TCP | TRANSPORT_UDP));
+        if (status != ER_OK) {
+            QCC_LogError(status, ("FindAdvertisedName failed"));
+            return 1;
+        }
+    }
+
+    std::vector<BenchResult*> results;
+    static const TransportMask order[] = { TRANSPORT_TCP, TRANSPORT_UDP, TRANSPORT_LOCAL };
+    for (size_t i = 0; i < ArraySize(order) && !g_interrupt; ++i) {
+        if (!(transports & order[i])) {
+            continue;
+        }
+        BenchResult* result = new BenchResult(order[i]);
+        results.push_back(result);
+        qcc::String host;
+        if (order[i] == TRANSPORT_LOCAL) {
+            host = localBus->GetUniqueName();
+            result->serviceInProcess = true;
+        } else {
+            /* Wait for the service to show up over this transport */
+            uint64_t waitStart = GetTimestampMicros();
+            bool found = false;
+            while (!g_interrupt && (GetTimestampMicros() - waitStart) < 30000000) {
+                g_foundLock.Lock(MUTEX_CONTEXT);
+                found = (g_foundTransports & order[i]) != 0;
+                g_foundEvent.ResetEvent();
+                g_foundLock.Unlock(MUTEX_CONTEXT);
+                if (found) {
+                    break;
+                }
+                Event::Wait(g_foundEvent, 1000);
+            }
+            if (!found) {
+                result->status = ER_TIMEOUT;
+                printf("%s not found over %s\n", g_wellKnownName.c_str(), TransportName(order[i]));
+                continue;
+            }
+            host = g_wellKnownName;
+        }
+        printf("Running %u messages over %s\n", g_messages, TransportName(order[i]));
+        RunWorkload(host.c_str(), sender, *intf, *result);
+    }
+
+    PrintTable(results);
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        delete results[i];
+    }
+    if (localBus) {
+        StopService(*localBus, localObject);
+        delete localBus;
+    }
+    g_msgBus->UnregisterBusObject(sender);
+    g_msgBus->Stop();
+    g_msgBus->Join();
+    delete g_msgBus;
+    return 0;
+}
+
+/** Main entry point */
+int CDECL_CALL main(int argc, char** argv)
+{
+    QStatus status = AllJoynInit();
+    if (ER_OK != status) {
+        return 1;
+    }
+#ifdef ROUTER
+    status = AllJoynRouterInit();
+    if (ER_OK != status) {
+        AllJoynShutdown();
+        return 1;
+    }
+#endif
+
+    int ret = TestAppMain(argc, argv);
+
+#ifdef ROUTER
+    AllJoynRouterShutdown();
+#endif
+    AllJoynShutdown();
+
+    return ret;
+}